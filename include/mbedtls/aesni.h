@@ -79,6 +79,42 @@ void mbedtls_aesni_gcm_mult( unsigned char c[16],
                      const unsigned char a[16],
                      const unsigned char b[16] );
 
+/**
+ * \brief          Precompute the powers of H used by
+ *                 mbedtls_aesni_gcm_crypt_blocks()
+ *
+ * \param hpow     Result: H^4, H^3, H^2 and H
+ * \param h        Hash subkey H (as per the GCM spec)
+ */
+void mbedtls_aesni_gcm_powers( unsigned char hpow[64],
+                               const unsigned char h[16] );
+
+/**
+ * \brief          AES-GCM en(de)cryption of whole 64-byte chunks: four
+ *                 counter blocks are encrypted in parallel and the
+ *                 four ciphertext blocks are hashed with one reduction
+ *
+ * \param ctx      AES context holding the encryption round keys
+ * \param hpow     Powers of H from mbedtls_aesni_gcm_powers()
+ * \param mode     MBEDTLS_AES_ENCRYPT or MBEDTLS_AES_DECRYPT
+ * \param length   Length of the input, a multiple of 64
+ * \param y        Counter block, updated to the last one used
+ * \param buf      GHASH value, updated
+ * \param input    Input data
+ * \param output   Output data (may be the same as input)
+ *
+ * \note           Both CPU features (MBEDTLS_AESNI_AES and
+ *                 MBEDTLS_AESNI_CLMUL) must be supported.
+ */
+void mbedtls_aesni_gcm_crypt_blocks( const mbedtls_aes_context *ctx,
+                             const unsigned char hpow[64],
+                             int mode,
+                             size_t length,
+                             unsigned char y[16],
+                             unsigned char buf[16],
+                             const unsigned char *input,
+                             unsigned char *output );
+
 /**
  * \brief           Compute decryption round keys from encryption round keys
  *
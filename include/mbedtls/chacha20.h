@@ -0,0 +1,141 @@
+/**
+ * \file chacha20.h
+ *
+ * \brief ChaCha20 stream cipher (RFC 7539)
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+#ifndef MBEDTLS_CHACHA20_H
+#define MBEDTLS_CHACHA20_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA               -0x0051  /**< Invalid input parameter(s). */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          ChaCha20 context structure
+ */
+typedef struct
+{
+    uint32_t state[16];             /*!< state before the rounds        */
+    unsigned char keystream[64];    /*!< keystream of the current block */
+    size_t keystream_used;          /*!< bytes of keystream already used */
+}
+mbedtls_chacha20_context;
+
+/**
+ * \brief          Initialize ChaCha20 context
+ *
+ * \param ctx      ChaCha20 context to be initialized
+ */
+void mbedtls_chacha20_init( mbedtls_chacha20_context *ctx );
+
+/**
+ * \brief          Clear ChaCha20 context
+ *
+ * \param ctx      ChaCha20 context to be cleared
+ */
+void mbedtls_chacha20_free( mbedtls_chacha20_context *ctx );
+
+/**
+ * \brief          ChaCha20 key schedule
+ *
+ * \param ctx      ChaCha20 context
+ * \param key      256-bit key
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA if ctx or key is NULL
+ */
+int mbedtls_chacha20_setkey( mbedtls_chacha20_context *ctx,
+                             const unsigned char key[32] );
+
+/**
+ * \brief          Set the nonce and initial block counter. Must be
+ *                 called after mbedtls_chacha20_setkey() and before the
+ *                 first call to mbedtls_chacha20_update().
+ *
+ * \param ctx      ChaCha20 context
+ * \param nonce    96-bit nonce
+ * \param counter  initial value of the 32-bit block counter
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA if ctx or nonce is NULL
+ */
+int mbedtls_chacha20_starts( mbedtls_chacha20_context *ctx,
+                             const unsigned char nonce[12],
+                             uint32_t counter );
+
+/**
+ * \brief          ChaCha20 encryption / decryption (the operation is its
+ *                 own inverse). Can be called repeatedly: the keystream
+ *                 continues where the previous call stopped.
+ *
+ * \note           Runs of 256 bytes or more are handled by a kernel that
+ *                 produces several blocks at once, using SSE2, AVX2 or
+ *                 NEON when the target supports it.
+ *
+ * \param ctx      ChaCha20 context
+ * \param length   length of the input data
+ * \param input    buffer holding the input data
+ * \param output   buffer for the output data (may be the same as input)
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA on NULL buffers
+ */
+int mbedtls_chacha20_update( mbedtls_chacha20_context *ctx,
+                             size_t length,
+                             const unsigned char *input,
+                             unsigned char *output );
+
+/**
+ * \brief          ChaCha20 encryption / decryption in one call
+ *
+ * \param key      256-bit key
+ * \param nonce    96-bit nonce
+ * \param counter  initial value of the 32-bit block counter
+ * \param length   length of the input data
+ * \param input    buffer holding the input data
+ * \param output   buffer for the output data (may be the same as input)
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA on NULL buffers
+ */
+int mbedtls_chacha20_crypt( const unsigned char key[32],
+                            const unsigned char nonce[12],
+                            uint32_t counter,
+                            size_t length,
+                            const unsigned char *input,
+                            unsigned char *output );
+
+/**
+ * \brief          Checkup routine
+ *
+ * \return         0 if successful, or 1 if the test failed
+ */
+int mbedtls_chacha20_self_test( int verbose );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* chacha20.h */
@@ -0,0 +1,200 @@
+/**
+ * \file chachapoly.h
+ *
+ * \brief ChaCha20-Poly1305 AEAD construction (RFC 7539)
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+#ifndef MBEDTLS_CHACHAPOLY_H
+#define MBEDTLS_CHACHAPOLY_H
+
+#include "chacha20.h"
+#include "poly1305.h"
+
+#include <stdint.h>
+
+#define MBEDTLS_CHACHAPOLY_ENCRYPT     1
+#define MBEDTLS_CHACHAPOLY_DECRYPT     0
+
+#define MBEDTLS_ERR_CHACHAPOLY_BAD_STATE                  -0x0054  /**< The requested operation is not permitted in the current state. */
+#define MBEDTLS_ERR_CHACHAPOLY_AUTH_FAILED                -0x0056  /**< Authenticated decryption failed: data was not authentic. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          ChaCha20-Poly1305 context structure
+ */
+typedef struct
+{
+    mbedtls_chacha20_context chacha20_ctx;  /*!< cipher context         */
+    mbedtls_poly1305_context poly1305_ctx;  /*!< MAC context            */
+    uint64_t aad_len;                       /*!< additional data length */
+    uint64_t ciphertext_len;                /*!< ciphertext length      */
+    int state;                              /*!< operation in progress  */
+    int mode;                               /*!< encrypt or decrypt     */
+}
+mbedtls_chachapoly_context;
+
+/**
+ * \brief          Initialize ChaCha20-Poly1305 context
+ *
+ * \param ctx      ChaCha20-Poly1305 context to be initialized
+ */
+void mbedtls_chachapoly_init( mbedtls_chachapoly_context *ctx );
+
+/**
+ * \brief          Clear ChaCha20-Poly1305 context
+ *
+ * \param ctx      ChaCha20-Poly1305 context to be cleared
+ */
+void mbedtls_chachapoly_free( mbedtls_chachapoly_context *ctx );
+
+/**
+ * \brief          Set the 256-bit key
+ *
+ * \param ctx      ChaCha20-Poly1305 context
+ * \param key      256-bit key
+ *
+ * \return         0 if successful, or MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA
+ */
+int mbedtls_chachapoly_setkey( mbedtls_chachapoly_context *ctx,
+                               const unsigned char key[32] );
+
+/**
+ * \brief          Start a message. Derives the Poly1305 key from the
+ *                 first ChaCha20 block for this nonce.
+ *
+ * \warning        A nonce must never be used twice with the same key.
+ *
+ * \param ctx      ChaCha20-Poly1305 context
+ * \param nonce    96-bit nonce
+ * \param mode     MBEDTLS_CHACHAPOLY_ENCRYPT or MBEDTLS_CHACHAPOLY_DECRYPT
+ *
+ * \return         0 if successful, or a ChaCha20 or Poly1305 error code
+ */
+int mbedtls_chachapoly_starts( mbedtls_chachapoly_context *ctx,
+                               const unsigned char nonce[12],
+                               int mode );
+
+/**
+ * \brief          Feed additional data. Can be called repeatedly, but
+ *                 only before the first call to mbedtls_chachapoly_update().
+ *
+ * \param ctx      ChaCha20-Poly1305 context
+ * \param aad      buffer holding the additional data
+ * \param aad_len  length of the additional data
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHAPOLY_BAD_STATE if called out of order
+ */
+int mbedtls_chachapoly_update_aad( mbedtls_chachapoly_context *ctx,
+                                   const unsigned char *aad,
+                                   size_t aad_len );
+
+/**
+ * \brief          Encrypt or decrypt data. Can be called repeatedly.
+ *
+ * \param ctx      ChaCha20-Poly1305 context
+ * \param length   length of the input data
+ * \param input    buffer holding the input data
+ * \param output   buffer for the output data (may be the same as input)
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHAPOLY_BAD_STATE if called out of order
+ */
+int mbedtls_chachapoly_update( mbedtls_chachapoly_context *ctx,
+                               size_t length,
+                               const unsigned char *input,
+                               unsigned char *output );
+
+/**
+ * \brief          Finish the message and output the 128-bit tag
+ *
+ * \param ctx      ChaCha20-Poly1305 context
+ * \param mac      buffer for the tag
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHAPOLY_BAD_STATE if called out of order
+ */
+int mbedtls_chachapoly_finish( mbedtls_chachapoly_context *ctx,
+                               unsigned char mac[16] );
+
+/**
+ * \brief          Encrypt a whole message and compute its tag
+ *
+ * \param ctx      ChaCha20-Poly1305 context, with the key set
+ * \param length   length of the input data
+ * \param nonce    96-bit nonce
+ * \param aad      buffer holding the additional data
+ * \param aad_len  length of the additional data
+ * \param input    buffer holding the plaintext
+ * \param output   buffer for the ciphertext (may be the same as input)
+ * \param tag      buffer for the 128-bit tag
+ *
+ * \return         0 if successful, or a ChaCha20, Poly1305 or
+ *                 ChaCha20-Poly1305 error code
+ */
+int mbedtls_chachapoly_encrypt_and_tag( mbedtls_chachapoly_context *ctx,
+                                        size_t length,
+                                        const unsigned char nonce[12],
+                                        const unsigned char *aad,
+                                        size_t aad_len,
+                                        const unsigned char *input,
+                                        unsigned char *output,
+                                        unsigned char tag[16] );
+
+/**
+ * \brief          Decrypt a whole message and check its tag
+ *
+ * \param ctx      ChaCha20-Poly1305 context, with the key set
+ * \param length   length of the input data
+ * \param nonce    96-bit nonce
+ * \param aad      buffer holding the additional data
+ * \param aad_len  length of the additional data
+ * \param tag      buffer holding the 128-bit tag
+ * \param input    buffer holding the ciphertext
+ * \param output   buffer for the plaintext (may be the same as input)
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_CHACHAPOLY_AUTH_FAILED if the tag does not
+ *                 match (the output is then wiped), or a ChaCha20,
+ *                 Poly1305 or ChaCha20-Poly1305 error code
+ */
+int mbedtls_chachapoly_auth_decrypt( mbedtls_chachapoly_context *ctx,
+                                     size_t length,
+                                     const unsigned char nonce[12],
+                                     const unsigned char *aad,
+                                     size_t aad_len,
+                                     const unsigned char tag[16],
+                                     const unsigned char *input,
+                                     unsigned char *output );
+
+/**
+ * \brief          Checkup routine
+ *
+ * \return         0 if successful, or 1 if the test failed
+ */
+int mbedtls_chachapoly_self_test( int verbose );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* chachapoly.h */
@@ -65,10 +65,16 @@
 #error "MBEDTLS_HAVE_TIME_DATE without MBEDTLS_HAVE_TIME does not make sense"
 #endif
 
-#if defined(MBEDTLS_AESNI_C) && !defined(MBEDTLS_HAVE_ASM)
+#if defined(MBEDTLS_AESNI_C) && \
+    ( !defined(MBEDTLS_HAVE_ASM) || !defined(MBEDTLS_CPU_C) )
 #error "MBEDTLS_AESNI_C defined, but not all prerequisites"
 #endif
 
+#if defined(MBEDTLS_CHACHAPOLY_C) &&        \
+    ( !defined(MBEDTLS_CHACHA20_C) || !defined(MBEDTLS_POLY1305_C) )
+#error "MBEDTLS_CHACHAPOLY_C defined, but not all prerequisites"
+#endif
+
 #if defined(MBEDTLS_CTR_DRBG_C) && !defined(MBEDTLS_AES_C)
 #error "MBEDTLS_CTR_DRBG_C defined, but not all prerequisites"
 #endif
@@ -208,6 +214,17 @@
 #error "MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS defined, but not all prerequisites"
 #endif
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS) &&                    \
+    !defined(MBEDTLS_TLS_MILAGRO_CS)
+#error "MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC) &&                    \
+    ( !defined(MBEDTLS_TLS_MILAGRO_CS) || !defined(MBEDTLS_SSL_SRV_C) ||    \
+      !defined(MBEDTLS_THREADING_PTHREAD) )
+#error "MBEDTLS_TLS_MILAGRO_CS_ASYNC defined, but not all prerequisites"
+#endif
+
 #if defined(MBEDTLS_KEY_EXCHANGE_MILAGRO_CS_ENABLED) &&                    \
     ( !defined(MBEDTLS_TLS_MILAGRO_CS) || !defined(MBEDTLS_AES_C) ||            \
       !defined(MBEDTLS_GCM_C) || !defined(MBEDTLS_SHA256_C) )
@@ -225,7 +242,8 @@
 #error "MBEDTLS_MEMORY_BUFFER_ALLOC_C defined, but not all prerequisites"
 #endif
 
-#if defined(MBEDTLS_PADLOCK_C) && !defined(MBEDTLS_HAVE_ASM)
+#if defined(MBEDTLS_PADLOCK_C) && \
+    ( !defined(MBEDTLS_HAVE_ASM) || !defined(MBEDTLS_CPU_C) )
 #error "MBEDTLS_PADLOCK_C defined, but not all prerequisites"
 #endif
 
@@ -487,6 +505,44 @@
 #error "MBEDTLS_SSL_TICKET_C defined, but not all prerequisites"
 #endif
 
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS) &&                               \
+    ( !defined(MBEDTLS_SSL_TICKET_C) || !defined(__GNUC__) )
+#error "MBEDTLS_SSL_TICKET_LOCKLESS defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_KEYS) && MBEDTLS_SSL_TICKET_KEYS < 2
+#error "MBEDTLS_SSL_TICKET_KEYS must be at least 2"
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST) &&                          \
+    ( !defined(MBEDTLS_SHA256_C) || !defined(MBEDTLS_X509_CRT_PARSE_C) )
+#error "MBEDTLS_SSL_SESSION_CERT_DIGEST defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_SSL_CACHE_SHM_C) && defined(_WIN32)
+#error "MBEDTLS_SSL_CACHE_SHM_C defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_SSL_CACHE_SHM_SESSION_LEN) && MBEDTLS_SSL_CACHE_SHM_SESSION_LEN > 65535
+#error "MBEDTLS_SSL_CACHE_SHM_SESSION_LEN too large"
+#endif
+
+#if defined(MBEDTLS_SSL_KEYSHARE_C) && !defined(MBEDTLS_ECDH_C)
+#error "MBEDTLS_SSL_KEYSHARE_C defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING) && !defined(MBEDTLS_TIMING_C)
+#error "MBEDTLS_SSL_HANDSHAKE_TIMING defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS) && defined(MBEDTLS_ZLIB_SUPPORT)
+#error "MBEDTLS_SSL_VARIABLE_BUFFERS cannot be used with MBEDTLS_ZLIB_SUPPORT"
+#endif
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH) && defined(MBEDTLS_ZLIB_SUPPORT)
+#error "MBEDTLS_SSL_WRITE_BATCH cannot be used with MBEDTLS_ZLIB_SUPPORT"
+#endif
+
 #if defined(MBEDTLS_SSL_CBC_RECORD_SPLITTING) && \
     !defined(MBEDTLS_SSL_PROTO_SSL3) && !defined(MBEDTLS_SSL_PROTO_TLS1)
 #error "MBEDTLS_SSL_CBC_RECORD_SPLITTING defined, but not all prerequisites"
@@ -34,7 +34,7 @@
 
 #include <stddef.h>
 
-#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C)
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
 #define MBEDTLS_CIPHER_MODE_AEAD
 #endif
 
@@ -74,6 +74,7 @@ typedef enum {
     MBEDTLS_CIPHER_ID_CAMELLIA,
     MBEDTLS_CIPHER_ID_BLOWFISH,
     MBEDTLS_CIPHER_ID_ARC4,
+    MBEDTLS_CIPHER_ID_CHACHA20,
 } mbedtls_cipher_id_t;
 
 typedef enum {
@@ -126,6 +127,7 @@ typedef enum {
     MBEDTLS_CIPHER_CAMELLIA_128_CCM,
     MBEDTLS_CIPHER_CAMELLIA_192_CCM,
     MBEDTLS_CIPHER_CAMELLIA_256_CCM,
+    MBEDTLS_CIPHER_CHACHA20_POLY1305,
 } mbedtls_cipher_type_t;
 
 typedef enum {
@@ -138,6 +140,7 @@ typedef enum {
     MBEDTLS_MODE_GCM,
     MBEDTLS_MODE_STREAM,
     MBEDTLS_MODE_CCM,
+    MBEDTLS_MODE_CHACHAPOLY,
 } mbedtls_cipher_mode_t;
 
 typedef enum {
@@ -496,10 +499,10 @@ int mbedtls_cipher_set_iv( mbedtls_cipher_context_t *ctx,
  */
 int mbedtls_cipher_reset( mbedtls_cipher_context_t *ctx );
 
-#if defined(MBEDTLS_GCM_C)
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
 /**
  * \brief               Add additional data (for AEAD ciphers).
- *                      Currently only supported with GCM.
+ *                      Currently only supported with GCM and ChaCha20-Poly1305.
  *                      Must be called exactly once, after mbedtls_cipher_reset().
  *
  * \param ctx           generic cipher context
@@ -510,7 +513,7 @@ int mbedtls_cipher_reset( mbedtls_cipher_context_t *ctx );
  */
 int mbedtls_cipher_update_ad( mbedtls_cipher_context_t *ctx,
                       const unsigned char *ad, size_t ad_len );
-#endif /* MBEDTLS_GCM_C */
+#endif /* MBEDTLS_GCM_C || MBEDTLS_CHACHAPOLY_C */
 
 /**
  * \brief               Generic cipher update function. Encrypts/decrypts
@@ -564,10 +567,11 @@ int mbedtls_cipher_update( mbedtls_cipher_context_t *ctx, const unsigned char *i
 int mbedtls_cipher_finish( mbedtls_cipher_context_t *ctx,
                    unsigned char *output, size_t *olen );
 
-#if defined(MBEDTLS_GCM_C)
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
 /**
  * \brief               Write tag for AEAD ciphers.
- *                      Currently only supported with GCM.
+ *                      Currently only supported with GCM and ChaCha20-Poly1305
+ *                      (whose tag is always 16 bytes).
  *                      Must be called after mbedtls_cipher_finish().
  *
  * \param ctx           Generic cipher context
@@ -581,7 +585,8 @@ int mbedtls_cipher_write_tag( mbedtls_cipher_context_t *ctx,
 
 /**
  * \brief               Check tag for AEAD ciphers.
- *                      Currently only supported with GCM.
+ *                      Currently only supported with GCM and ChaCha20-Poly1305
+ *                      (whose tag is always 16 bytes).
  *                      Must be called after mbedtls_cipher_finish().
  *
  * \param ctx           Generic cipher context
@@ -592,7 +597,7 @@ int mbedtls_cipher_write_tag( mbedtls_cipher_context_t *ctx,
  */
 int mbedtls_cipher_check_tag( mbedtls_cipher_context_t *ctx,
                       const unsigned char *tag, size_t tag_len );
-#endif /* MBEDTLS_GCM_C */
+#endif /* MBEDTLS_GCM_C || MBEDTLS_CHACHAPOLY_C */
 
 /**
  * \brief               Generic all-in-one encryption/decryption
@@ -828,6 +828,37 @@
  */
 //#define MBEDTLS_TLS_MILAGRO_CS_ENABLE_PIN
 
+/**
+ * \def MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS
+ *
+ * Store the per-handshake parameters of MILAGRO_CS inside
+ * mbedtls_milagro_cs_context, in arrays sized from the curve, instead of
+ * allocating each of them on the heap for every handshake. Together with
+ * mbedtls_ssl_milagro_cs_set_reusable(), a context serves any number of
+ * handshakes without allocating.
+ *
+ * This makes mbedtls_milagro_cs_context about 600 bytes larger.
+ *
+ * Requires: MBEDTLS_TLS_MILAGRO_CS
+ *
+ * Uncomment this macro to store the MILAGRO_CS parameters inline
+ */
+//#define MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS
+
+/**
+ * \def MBEDTLS_TLS_MILAGRO_CS_ASYNC
+ *
+ * Enable the MILAGRO_CS worker pool: a server can hand the authentication
+ * of the client (the pairings of MPIN_SERVER) to background threads, and
+ * mbedtls_ssl_handshake() returns MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS until
+ * the result is available instead of blocking the calling thread.
+ *
+ * Requires: MBEDTLS_TLS_MILAGRO_CS, MBEDTLS_SSL_SRV_C, MBEDTLS_THREADING_PTHREAD
+ *
+ * Uncomment this macro to enable the MILAGRO_CS worker pool
+ */
+//#define MBEDTLS_TLS_MILAGRO_CS_ASYNC
+
 /**
  * \def MBEDTLS_NO_DEFAULT_ENTROPY_SOURCES
  *
@@ -1264,6 +1295,38 @@
  */
 //#define MBEDTLS_SSL_SESSION_TICKETS
 
+/**
+ * \def MBEDTLS_SSL_SESSION_CERT_DIGEST
+ *
+ * Serialize sessions with a SHA-256 digest of the peer certificate instead
+ * of the certificate itself, see mbedtls_ssl_session_save(). This makes
+ * session tickets and cache entries several times smaller when clients
+ * authenticate with certificates, but sessions resumed from them have no
+ * peer_cert, only its digest in peer_cert_digest.
+ *
+ * Requires: MBEDTLS_SHA256_C, MBEDTLS_X509_CRT_PARSE_C
+ *
+ * Uncomment this macro to keep only peer certificate digests in sessions
+ */
+//#define MBEDTLS_SSL_SESSION_CERT_DIGEST
+
+/**
+ * \def MBEDTLS_SSL_TICKET_LOCKLESS
+ *
+ * Write and parse session tickets without taking the mutex of the ticket
+ * context, which is then only taken to rotate the keys. The keys are
+ * published with sequence numbers, and each ticket operation sets up its
+ * own cipher context. This removes the contention of servers resuming
+ * many sessions on many threads, at the cost of a key setup per ticket.
+ *
+ * Uses the __atomic builtins of GCC and Clang.
+ *
+ * Requires: MBEDTLS_SSL_TICKET_C
+ *
+ * Uncomment this macro to write and parse tickets without locking
+ */
+//#define MBEDTLS_SSL_TICKET_LOCKLESS
+
 /**
  * \def MBEDTLS_SSL_EXPORT_KEYS
  *
@@ -1274,6 +1337,90 @@
  */
 //#define MBEDTLS_SSL_EXPORT_KEYS
 
+/**
+ * \def MBEDTLS_SSL_HANDSHAKE_TIMING
+ *
+ * Enable the handshake timing callback, see mbedtls_ssl_conf_timing_cb().
+ * It reports the time spent in each handshake step and in the expensive
+ * crypto operations of the handshake (pairings, point multiplications,
+ * RSA private key operations and X.509 chain verification).
+ *
+ * Requires: MBEDTLS_TIMING_C
+ *
+ * Comment this macro to disable the handshake timing callback
+ */
+//#define MBEDTLS_SSL_HANDSHAKE_TIMING
+
+/**
+ * \def MBEDTLS_SSL_VARIABLE_BUFFERS
+ *
+ * Allocate the record I/O buffers of each connection at a small idle size
+ * (MBEDTLS_SSL_IDLE_BUFFER_LEN) and grow them to MBEDTLS_SSL_BUFFER_LEN only
+ * while a handshake is running or when a large record is read or written.
+ * Buffers are shrunk back to the idle size when the handshake completes and
+ * after MBEDTLS_SSL_BUFFER_SHRINK_RECORDS consecutive small records, which
+ * saves about 30 KB per mostly idle connection at the cost of an occasional
+ * reallocation. Use mbedtls_ssl_get_buffer_bytes() to watch the effect.
+ *
+ * Only applies to TLS: DTLS contexts always use full-size buffers.
+ *
+ * With a CBC ciphersuite the input buffer stays at full size once the
+ * handshake is over, as the constant-time padding check reads up to 256
+ * bytes past the end of short records: such connections only save the
+ * output half, about 15 KB.
+ *
+ * Requires: !MBEDTLS_ZLIB_SUPPORT
+ *
+ * Uncomment this macro to enable variable-size record buffers
+ */
+//#define MBEDTLS_SSL_VARIABLE_BUFFERS
+
+/**
+ * \def MBEDTLS_SSL_BUFFER_POOL
+ *
+ * Enable a pool of record buffers shared by the contexts of a
+ * configuration, see mbedtls_ssl_conf_buffer_pool(). TLS contexts using it
+ * give their buffers back to the pool while they are idle and take them
+ * again when a record is received or sent.
+ *
+ * Uncomment this macro to enable the record buffer pool
+ */
+//#define MBEDTLS_SSL_BUFFER_POOL
+
+/**
+ * \def MBEDTLS_SSL_WRITE_BATCH
+ *
+ * Let a single mbedtls_ssl_write() or mbedtls_ssl_writev() call on a TLS
+ * connection encrypt several consecutive records into a staging area and
+ * send them all with one flush, instead of one record and one f_send call
+ * per MBEDTLS_SSL_MAX_CONTENT_LEN bytes. The staging area holds
+ * MBEDTLS_SSL_WRITE_BATCH_RECORDS records by default, see
+ * mbedtls_ssl_conf_write_batch(); it is allocated on the first large write.
+ *
+ * Requires: !MBEDTLS_ZLIB_SUPPORT
+ *
+ * Uncomment this macro to enable batched writes
+ */
+//#define MBEDTLS_SSL_WRITE_BATCH
+
+/**
+ * \def MBEDTLS_SSL_READ_AHEAD
+ *
+ * Let TLS connections read ahead: instead of asking f_recv for exactly the
+ * bytes of the record header, then of the record body, read as much as fits
+ * in a per-context staging area of MBEDTLS_SSL_READ_AHEAD_LEN bytes (see
+ * mbedtls_ssl_conf_read_ahead()) and take the following records from it.
+ * This saves one or more recv() calls per record when the peer sends
+ * several records at once.
+ *
+ * Applications waiting for the socket to be readable before calling
+ * mbedtls_ssl_read() must call mbedtls_ssl_check_pending() first, as the
+ * data they wait for may already have been read.
+ *
+ * Uncomment this macro to enable read-ahead
+ */
+//#define MBEDTLS_SSL_READ_AHEAD
+
 /**
  * \def MBEDTLS_SSL_SERVER_NAME_INDICATION
  *
@@ -1425,8 +1572,9 @@
  *
  * Module:  library/aesni.c
  * Caller:  library/aes.c
+ *          library/gcm.c
  *
- * Requires: MBEDTLS_HAVE_ASM
+ * Requires: MBEDTLS_HAVE_ASM, MBEDTLS_CPU_C
  *
  * This modules adds support for the AES-NI instructions on x86-64
  */
@@ -1676,6 +1824,43 @@
  */
 //#define MBEDTLS_CERTS_C
 
+/**
+ * \def MBEDTLS_CHACHA20_C
+ *
+ * Enable the ChaCha20 stream cipher.
+ *
+ * Module:  library/chacha20.c
+ * Caller:  library/chachapoly.c
+ *
+ * Uses SSE2 and, where the CPU supports it, AVX2 code on x86 and NEON code
+ * on little-endian ARM to process several blocks at once.
+ */
+//#define MBEDTLS_CHACHA20_C
+
+/**
+ * \def MBEDTLS_CHACHAPOLY_C
+ *
+ * Enable the ChaCha20-Poly1305 AEAD construction.
+ *
+ * Module:  library/chachapoly.c
+ * Caller:  library/cipher_wrap.c
+ *
+ * Requires: MBEDTLS_CHACHA20_C, MBEDTLS_POLY1305_C
+ *
+ * This module enables the following ciphersuites (if other requisites are
+ * enabled as well):
+ *      MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_ECDHE_PSK_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_DHE_PSK_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_RSA_PSK_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_PSK_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_MILAGRO_CS_WITH_CHACHA20_POLY1305_SHA256
+ *      MBEDTLS_TLS_MILAGRO_P2P_WITH_CHACHA20_POLY1305_SHA256
+ */
+//#define MBEDTLS_CHACHAPOLY_C
+
 /**
  * \def MBEDTLS_CIPHER_C
  *
@@ -1688,6 +1873,25 @@
  */
 #define MBEDTLS_CIPHER_C
 
+/**
+ * \def MBEDTLS_CPU_C
+ *
+ * Enable the run-time selection of the accelerated implementations.
+ *
+ * Module:  library/cpu.c
+ * Caller:  library/aes.c
+ *          library/aesni.c
+ *          library/chacha20.c
+ *          library/gcm.c
+ *          library/sha256.c
+ *          library/sha512.c
+ *
+ * This module probes the CPU once and picks the best implementation built
+ * in for each primitive. Without it, the vectorized kernels are left out
+ * and only the portable C code is used.
+ */
+#define MBEDTLS_CPU_C
+
 /**
  * \def MBEDTLS_CTR_DRBG_C
  *
@@ -2006,7 +2210,7 @@
  * Module:  library/padlock.c
  * Caller:  library/aes.c
  *
- * Requires: MBEDTLS_HAVE_ASM
+ * Requires: MBEDTLS_HAVE_ASM, MBEDTLS_CPU_C
  *
  * This modules adds support for the VIA PadLock on x86.
 // */
@@ -2155,6 +2359,16 @@
  */
 #define MBEDTLS_PLATFORM_C
 
+/**
+ * \def MBEDTLS_POLY1305_C
+ *
+ * Enable the Poly1305 one-time authenticator.
+ *
+ * Module:  library/poly1305.c
+ * Caller:  library/chachapoly.c
+ */
+//#define MBEDTLS_POLY1305_C
+
 /**
  * \def MBEDTLS_RIPEMD160_C
  *
@@ -2244,6 +2458,21 @@
  */
 #define MBEDTLS_SSL_CACHE_C
 
+/**
+ * \def MBEDTLS_SSL_CACHE_SHM_C
+ *
+ * Enable an SSL session cache kept in memory shared by the worker
+ * processes a server forks, so that any worker can resume the sessions
+ * established by the others, see mbedtls_ssl_cache_shm_setup().
+ *
+ * Module:  library/ssl_cache_shm.c
+ * Caller:
+ *
+ * Requires: a POSIX platform with mmap() and process-shared pthread
+ *           mutexes; link with -lpthread
+ */
+//#define MBEDTLS_SSL_CACHE_SHM_C
+
 /**
  * \def MBEDTLS_SSL_COOKIE_C
  *
@@ -2254,6 +2483,19 @@
  */
 //#define MBEDTLS_SSL_COOKIE_C
 
+/**
+ * \def MBEDTLS_SSL_KEYSHARE_C
+ *
+ * Enable a pool of precomputed ephemeral ECDH key pairs for the ECDHE key
+ * exchanges, see mbedtls_ssl_conf_keyshare_cb().
+ *
+ * Module:  library/ssl_keyshare.c
+ * Caller:
+ *
+ * Requires: MBEDTLS_ECDH_C
+ */
+//#define MBEDTLS_SSL_KEYSHARE_C
+
 /**
  * \def MBEDTLS_SSL_TICKET_C
  *
@@ -2533,12 +2775,26 @@
 /* SSL Cache options */
 //#define MBEDTLS_SSL_CACHE_DEFAULT_TIMEOUT       86400 /**< 1 day  */
 //#define MBEDTLS_SSL_CACHE_DEFAULT_MAX_ENTRIES      50 /**< Maximum entries in cache */
+//#define MBEDTLS_SSL_CACHE_SHARDS                   16 /**< Independently locked parts of the cache */
+//#define MBEDTLS_SSL_CACHE_SHM_WAYS                  8 /**< Slots a session ID can be stored in, with MBEDTLS_SSL_CACHE_SHM_C */
+//#define MBEDTLS_SSL_CACHE_SHM_LOCKS                64 /**< Locks shared by the sets of slots, with MBEDTLS_SSL_CACHE_SHM_C */
+//#define MBEDTLS_SSL_CACHE_SHM_SESSION_LEN        2048 /**< Largest serialized session stored, with MBEDTLS_SSL_CACHE_SHM_C */
+
+/* MILAGRO_CS options */
+//#define MBEDTLS_MILAGRO_CS_HID_CACHE_DEFAULT_MAX_ENTRIES  1024 /**< Maximum identities in the server's HID cache */
+//#define MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_THREADS          64 /**< Maximum threads of a MILAGRO_CS worker pool */
+//#define MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH            64 /**< Maximum clients authenticated together by a worker */
 
 /* SSL options */
 //#define MBEDTLS_SSL_MAX_CONTENT_LEN             16384 /**< Maxium fragment length in bytes, determines the size of each of the two internal I/O buffers */
 //#define MBEDTLS_SSL_DEFAULT_TICKET_LIFETIME     86400 /**< Lifetime of session tickets (if enabled) */
+//#define MBEDTLS_SSL_TICKET_KEYS                     2 /**< Ticket keys accepted at the same time, with MBEDTLS_SSL_TICKET_C */
 //#define MBEDTLS_PSK_MAX_LEN               32 /**< Max size of TLS pre-shared keys, in bytes (default 256 bits) */
 //#define MBEDTLS_SSL_COOKIE_TIMEOUT        60 /**< Default expiration delay of DTLS cookies, in seconds if HAVE_TIME, or in number of cookies issued */
+//#define MBEDTLS_SSL_IDLE_BUFFER_LEN     1024 /**< Size of each record buffer of an idle connection, with MBEDTLS_SSL_VARIABLE_BUFFERS */
+//#define MBEDTLS_SSL_BUFFER_SHRINK_RECORDS  8 /**< Consecutive small records before shrinking the buffers, with MBEDTLS_SSL_VARIABLE_BUFFERS */
+//#define MBEDTLS_SSL_WRITE_BATCH_RECORDS    4 /**< Default records sent per write call, with MBEDTLS_SSL_WRITE_BATCH */
+//#define MBEDTLS_SSL_READ_AHEAD_LEN     16384 /**< Default size of the read-ahead area, with MBEDTLS_SSL_READ_AHEAD */
 
 /**
  * Complete list of ciphersuites to use, in order of preference.
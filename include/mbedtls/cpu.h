@@ -0,0 +1,191 @@
+/**
+ * \file cpu.h
+ *
+ * \brief Run-time selection of the accelerated symmetric primitives
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+#ifndef MBEDTLS_CPU_H
+#define MBEDTLS_CPU_H
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#define MBEDTLS_ERR_CPU_FEATURE_UNAVAILABLE               -0x0059  /**< The implementation is not available on this CPU or build. */
+
+/*
+ * Instruction sets the vectorized code can be built for. The kernels using
+ * them are compiled whenever the compiler allows it and MBEDTLS_CPU_C is
+ * there to pick them, and only run if the CPU turns out to support them.
+ */
+#if defined(MBEDTLS_CPU_C)
+
+#if defined(__GNUC__) && defined(__SSE2__) &&                     \
+    ( defined(__x86_64__) || defined(__i386__) )
+#define MBEDTLS_HAVE_SSE2_INTRIN
+#endif
+
+#if defined(MBEDTLS_HAVE_SSE2_INTRIN) && defined(MBEDTLS_HAVE_ASM) && \
+    defined(__x86_64__) && ( defined(__clang__) || __GNUC__ >= 5 )
+#define MBEDTLS_HAVE_AVX2_INTRIN
+#endif
+
+#if defined(MBEDTLS_HAVE_AVX2_INTRIN)
+#define MBEDTLS_HAVE_SHANI_INTRIN
+#endif
+
+#if defined(__GNUC__) && ( defined(__ARM_NEON) || defined(__ARM_NEON__) ) && \
+    !defined(__ARMEB__) && !defined(__AARCH64EB__)
+#define MBEDTLS_HAVE_NEON_INTRIN
+#endif
+
+/* Without +crypto in the target, GCC has the intrinsics per function */
+#if defined(MBEDTLS_HAVE_NEON_INTRIN) && defined(__aarch64__) &&     \
+    ( defined(__ARM_FEATURE_CRYPTO) ||                                \
+      ( defined(__linux__) && !defined(__clang__) && __GNUC__ >= 6 ) )
+#define MBEDTLS_HAVE_ARMV8_CRYPTO_INTRIN
+#endif
+
+#endif /* MBEDTLS_CPU_C */
+
+/*
+ * CPU features, as returned by mbedtls_cpu_features()
+ */
+#define MBEDTLS_CPU_SSE2            0x00000001u
+#define MBEDTLS_CPU_SSSE3           0x00000002u
+#define MBEDTLS_CPU_AESNI           0x00000004u
+#define MBEDTLS_CPU_PCLMUL          0x00000008u
+#define MBEDTLS_CPU_AVX2            0x00000010u
+#define MBEDTLS_CPU_SHANI           0x00000020u
+#define MBEDTLS_CPU_PADLOCK_ACE     0x00000040u
+#define MBEDTLS_CPU_NEON            0x00000080u
+#define MBEDTLS_CPU_ARMV8_SHA2      0x00000100u
+#define MBEDTLS_CPU_SSE41           0x00000200u
+
+/**
+ * \brief          Primitives with more than one implementation
+ */
+typedef enum
+{
+    MBEDTLS_CPU_AES = 0,            /*!< AES block function             */
+    MBEDTLS_CPU_GHASH,              /*!< GCM multiplication in GF(2^128) */
+    MBEDTLS_CPU_CHACHA20,           /*!< ChaCha20 keystream             */
+    MBEDTLS_CPU_SHA256,             /*!< SHA-256 compression function   */
+    MBEDTLS_CPU_SHA512,             /*!< SHA-512 compression function   */
+    MBEDTLS_CPU_SHA256_MULTI,       /*!< SHA-256 of several messages    */
+    MBEDTLS_CPU_PRIMITIVES          /*!< Number of primitives           */
+}
+mbedtls_cpu_primitive_t;
+
+/**
+ * \brief          Implementations of the primitives
+ */
+typedef enum
+{
+    MBEDTLS_CPU_IMPL_GENERIC = 0,   /*!< Portable C                     */
+    MBEDTLS_CPU_IMPL_PADLOCK,       /*!< VIA PadLock ACE                */
+    MBEDTLS_CPU_IMPL_AESNI,         /*!< AES-NI                         */
+    MBEDTLS_CPU_IMPL_PCLMUL,        /*!< PCLMULQDQ                      */
+    MBEDTLS_CPU_IMPL_SSE2,          /*!< SSE2                           */
+    MBEDTLS_CPU_IMPL_AVX2,          /*!< AVX2                           */
+    MBEDTLS_CPU_IMPL_NEON,          /*!< ARM NEON                       */
+    MBEDTLS_CPU_IMPL_SHANI,         /*!< x86 SHA extensions             */
+    MBEDTLS_CPU_IMPL_ARMV8,         /*!< ARMv8 cryptography extensions  */
+    MBEDTLS_CPU_IMPLS               /*!< Number of implementations      */
+}
+mbedtls_cpu_impl_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Detect the CPU features and select the best available
+ *                 implementation of each primitive.
+ *
+ * \note           This is done automatically the first time a primitive
+ *                 is used. Calling it again has no effect.
+ *
+ * \note           With MBEDTLS_THREADING_PTHREAD, the first use may happen
+ *                 in several threads at once. Otherwise, call this
+ *                 function before starting the threads that use the
+ *                 library.
+ */
+void mbedtls_cpu_init( void );
+
+/**
+ * \brief          Features of the CPU the library is running on
+ *
+ * \return         The MBEDTLS_CPU_XXX flags of the detected features
+ */
+unsigned int mbedtls_cpu_features( void );
+
+/**
+ * \brief          Implementation selected for a primitive
+ *
+ * \param prim     The primitive
+ *
+ * \return         The implementation in use, MBEDTLS_CPU_IMPL_GENERIC
+ *                 for an unknown primitive
+ */
+mbedtls_cpu_impl_t mbedtls_cpu_impl( mbedtls_cpu_primitive_t prim );
+
+/**
+ * \brief          Force the implementation of a primitive, for testing
+ *                 and benchmarking.
+ *
+ * \warning        Only contexts set up afterwards are guaranteed to use it,
+ *                 as some implementations prepare keys or tables their own
+ *                 way. This is not thread-safe: call it before setting up
+ *                 any context.
+ *
+ * \param prim     The primitive
+ * \param impl     The implementation to use
+ *
+ * \return         0 if successful, or MBEDTLS_ERR_CPU_FEATURE_UNAVAILABLE
+ *                 if impl is not built for prim or not supported by the CPU
+ */
+int mbedtls_cpu_set_impl( mbedtls_cpu_primitive_t prim,
+                          mbedtls_cpu_impl_t impl );
+
+/**
+ * \brief          Name of a primitive, e.g. "AES"
+ *
+ * \param prim     The primitive
+ *
+ * \return         The name, or NULL for an unknown primitive
+ */
+const char *mbedtls_cpu_primitive_name( mbedtls_cpu_primitive_t prim );
+
+/**
+ * \brief          Name of an implementation, e.g. "AES-NI"
+ *
+ * \param impl     The implementation
+ *
+ * \return         The name, or NULL for an unknown implementation
+ */
+const char *mbedtls_cpu_impl_name( mbedtls_cpu_impl_t impl );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* cpu.h */
@@ -66,6 +66,10 @@
  * PBKDF2    1  0x007C-0x007C
  * HMAC_DRBG 4  0x0003-0x0009
  * CCM       2                  0x000D-0x000F
+ * CHACHA20  1                  0x0051-0x0051
+ * CHACHAPOLY 2  0x0054-0x0056
+ * POLY1305  1                  0x0057-0x0057
+ * CPU       1                  0x0059-0x0059
  *
  * High-level module nr (3 bits - 0x0...-0x7...)
  * Name      ID  Nr of Errors
@@ -80,7 +84,7 @@
  * MD        5   4
  * CIPHER    6   6
  * SSL       6   17 (Started from top)
- * SSL       7   31
+ * SSL       7   32
  *
  * Module dependent error code (5 bits 0x.00.-0x.F8.)
  */
@@ -50,6 +50,10 @@ typedef struct {
     unsigned char y[16];        /*!< Y working value */
     unsigned char buf[16];      /*!< buf working value */
     int mode;                   /*!< Encrypt or Decrypt */
+#if defined(MBEDTLS_AESNI_C)
+    unsigned char HP[64];       /*!< Powers of H for the AES-NI bulk path */
+    int aesni;                  /*!< Use the AES-NI bulk path */
+#endif
 }
 mbedtls_gcm_context;
 
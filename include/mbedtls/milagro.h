@@ -38,6 +38,14 @@
 #include "wcc.h"
 #include "mbedtls/entropy.h"
 
+#if defined(MBEDTLS_THREADING_C)
+#include "mbedtls/threading.h"
+#endif
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC) || defined(MBEDTLS_THREADING_PTHREAD)
+#include <pthread.h>
+#endif
+
 #define mbedtls_calloc    calloc
 #define mbedtls_free       free
 
@@ -47,11 +55,44 @@
 #define hashDoneOFF                          0   /* parameter needed by Milagro_p2p */
 #define hashDoneON                           1   /* parameter needed by Milagro_p2p */
 
+#if !defined(MBEDTLS_MILAGRO_CS_HID_CACHE_DEFAULT_MAX_ENTRIES)
+#define MBEDTLS_MILAGRO_CS_HID_CACHE_DEFAULT_MAX_ENTRIES  1024 /* maximum identities in the server's HID cache */
+#endif
+
+#if !defined(MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_THREADS)
+#define MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_THREADS        64   /* maximum threads of a worker pool */
+#endif
+
+#if !defined(MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH)
+#define MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH          64   /* maximum clients authenticated together */
+#endif
+
+#if !defined(MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PAIRS)
+#define MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PAIRS             16   /* precomputed pairs kept per identity */
+#endif
+
+#if !defined(MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PEERS)
+#define MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PEERS             16   /* peers the client precomputes for */
+#endif
+
+#define MBEDTLS_MILAGRO_P2P_MAX_IDENTITY_LEN              256  /* same as the max of the identity octets */
+
+#define MBEDTLS_MILAGRO_CS_ASYNC_IDLE                     0    /* no authentication submitted */
+#define MBEDTLS_MILAGRO_CS_ASYNC_QUEUED                   1    /* waiting for a worker */
+#define MBEDTLS_MILAGRO_CS_ASYNC_RUNNING                  2    /* being computed by a worker */
+#define MBEDTLS_MILAGRO_CS_ASYNC_DONE                     3    /* result available in async_ret */
+
 
 
 /* defined below */
 typedef struct mbedtls_milagro_cs_context mbedtls_milagro_cs_context;
+typedef struct mbedtls_milagro_cs_hid_cache_context mbedtls_milagro_cs_hid_cache_context;
+typedef struct mbedtls_milagro_cs_hid_cache_entry mbedtls_milagro_cs_hid_cache_entry;
+typedef struct mbedtls_milagro_cs_worker_pool mbedtls_milagro_cs_worker_pool;
+typedef struct mbedtls_milagro_cs_context_pool mbedtls_milagro_cs_context_pool;
 typedef struct mbedtls_milagro_p2p_context mbedtls_milagro_p2p_context;
+typedef struct mbedtls_milagro_p2p_context_pool mbedtls_milagro_p2p_context_pool;
+typedef struct mbedtls_milagro_p2p_precomp_context mbedtls_milagro_p2p_precomp_context;
 
 
 
@@ -71,6 +112,35 @@ void mbedtls_free_octet(octet *to_be_freed);
 
 // Milagro Client-to-Server
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS)
+/**
+ * \brief           Storage of the per-handshake parameters of a milagro_cs
+ *                  context, sized from the curve so that a handshake does
+ *                  no heap allocation
+ */
+typedef struct
+{
+#if defined(MBEDTLS_SSL_CLI_C)
+    char X[PGS];
+#endif
+#if defined(MBEDTLS_SSL_SRV_C)
+    char HID[2*PFS+1];
+    char HTID[2*PFS+1];
+    char hash_client_id[PGS];
+#endif
+    char param_rand[PGS];
+    char W[2*PFS+1];
+    char R[2*PFS+1];
+    char U[2*PFS+1];
+    char UT[2*PFS+1];
+    char Y[PGS];
+    char V[2*PFS+1];
+    char H[PGS];
+    char Key[PAS];
+}
+mbedtls_milagro_cs_buffers;
+#endif
+
 /**
  * \brief           Struct inside handshake for MILAGRO_CS
  *
@@ -89,10 +159,19 @@ struct mbedtls_milagro_cs_context
     octet G2;                 /*!< Parameter for the computation of the key                           */
     octet time_permits;       /*!< Time Permits in case is required, otherwise is NULL                */
     int pin;                  /*!< 4 digit pin, is 0 if not required                                  */
+    int precomputed;          /*!< 1 if G1/G2 hold MPIN_PRECOMPUTE(secret, hash_client_id) and the
+                                    context is kept across handshakes, 0 otherwise                    */
 #endif
 #if defined(MBEDTLS_SSL_SRV_C)
     octet HID;                 /*!< Parameter owned only by the server (case no time permits)          */
     octet HTID;                /*!< Parameter owned only by the server (case with time permits)        */
+    mbedtls_milagro_cs_hid_cache_context *hid_cache; /*!< Cache of HID/HTID, NULL if not used          */
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    mbedtls_milagro_cs_worker_pool *worker_pool; /*!< Pool authenticating the client, NULL if inline   */
+    int async_state;           /*!< MBEDTLS_MILAGRO_CS_ASYNC_xxx, protected by the pool's mutex        */
+    int async_ret;             /*!< Result of the authentication once async_state is DONE              */
+    mbedtls_milagro_cs_context *async_next; /*!< Next context in the pool's queue                      */
+#endif
 #endif
     octet param_rand;         /*!< Random number internally generated by the server and client        */
     octet W;                  /*!< Public parameter sent to the client for the key computation        */
@@ -111,9 +190,170 @@ struct mbedtls_milagro_cs_context
     csprng RNG;               /*!< Random Number Generator                                            */
     int date;                 /*!< date to use in case of Time Permits, otherwise is set to 0         */
     unsign32 timevalue;            /*!< time value to use in case of Time Permits, otherwise is set to 0   */
+    int reusable;             /*!< 1 if the context is kept by the caller across handshakes and only
+                                    reset at the end of each of them, 0 if it is freed                */
+    mbedtls_milagro_cs_context_pool *pool;  /*!< Pool the context is lent by, NULL if owned by the caller */
+    mbedtls_milagro_cs_context *pool_next;  /*!< Next free context of the pool                        */
+#if defined(MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS)
+    mbedtls_milagro_cs_buffers buffers; /*!< Storage of the per-handshake octets                      */
+#endif
 };
 
 
+#if defined(MBEDTLS_SSL_SRV_C)
+/**
+ * \brief           Entry of the server's cache of hashed identity points
+ */
+struct mbedtls_milagro_cs_hid_cache_entry
+{
+    int date;                 /*!< date HTID has been computed for, 0 without time permits            */
+    int id_len;               /*!< length of the hash of the client's identity                        */
+    char id[PGS];             /*!< hash of the client's identity, key of the entry                    */
+    int hid_len;              /*!< length of hid                                                      */
+    char hid[2*PFS+1];        /*!< hash of the client's identity mapped to the curve                  */
+    int htid_len;             /*!< length of htid                                                     */
+    char htid[2*PFS+1];       /*!< hid plus the time permit point for date                            */
+    mbedtls_milagro_cs_hid_cache_entry *prev;   /*!< more recently used entry                         */
+    mbedtls_milagro_cs_hid_cache_entry *next;   /*!< less recently used entry                         */
+    mbedtls_milagro_cs_hid_cache_entry *chain;  /*!< next entry in the same bucket                    */
+};
+
+/**
+ * \brief           Bounded LRU cache of the points HID/HTID computed by the
+ *                  server from the hash of the client's identity, shared by
+ *                  all the server's milagro_cs contexts
+ */
+struct mbedtls_milagro_cs_hid_cache_context
+{
+    mbedtls_milagro_cs_hid_cache_entry *entries;  /*!< storage for max_entries entries                */
+    mbedtls_milagro_cs_hid_cache_entry **buckets; /*!< index of the entries by identity               */
+    mbedtls_milagro_cs_hid_cache_entry *head;     /*!< most recently used entry                       */
+    mbedtls_milagro_cs_hid_cache_entry *tail;     /*!< least recently used entry                      */
+    int used;                 /*!< number of entries in use                                           */
+    int max_entries;          /*!< maximum entries                                                    */
+    unsigned long hits;       /*!< lookups answered from the cache                                    */
+    unsigned long misses;     /*!< lookups that had to map the identity to the curve                  */
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_threading_mutex_t mutex;    /*!< mutex                                                    */
+#endif
+};
+
+/**
+ * \brief           Initialize a HID cache context
+ *
+ * \param cache     HID cache context
+ */
+void mbedtls_milagro_cs_hid_cache_init( mbedtls_milagro_cs_hid_cache_context *cache );
+
+/**
+ * \brief           Set the maximum number of cached identities, flushing
+ *                  the cache (Default: MBEDTLS_MILAGRO_CS_HID_CACHE_DEFAULT_MAX_ENTRIES)
+ *
+ * \param cache     HID cache context
+ * \param max       maximum entries, 0 disables the cache
+ */
+void mbedtls_milagro_cs_hid_cache_set_max_entries( mbedtls_milagro_cs_hid_cache_context *cache, int max );
+
+/**
+ * \brief           Get HID and HTID for the hash of a client's identity,
+ *                  computing and caching them on a miss
+ *                  (Thread-safe if MBEDTLS_THREADING_C is enabled)
+ *
+ * \param cache            HID cache context
+ * \param date             date of the time permit, 0 if not used
+ * \param hash_client_id   hash of the client's identity
+ * \param HID              output, at least 2*PFS+1 bytes
+ * \param HTID             output, at least 2*PFS+1 bytes
+ *
+ * \return          0 if successful, MBEDTLS_ERR_THREADING_MUTEX_ERROR otherwise
+ */
+int mbedtls_milagro_cs_hid_cache_get( mbedtls_milagro_cs_hid_cache_context *cache, int date,
+                                      octet *hash_client_id, octet *HID, octet *HTID );
+
+/**
+ * \brief           Read the hit/miss counters of the cache
+ *
+ * \param cache     HID cache context
+ * \param hits      number of lookups answered from the cache
+ * \param misses    number of lookups that computed the points
+ */
+void mbedtls_milagro_cs_hid_cache_stats( mbedtls_milagro_cs_hid_cache_context *cache,
+                                         unsigned long *hits, unsigned long *misses );
+
+/**
+ * \brief           Free the entries of a HID cache context
+ *
+ * \param cache     HID cache context
+ */
+void mbedtls_milagro_cs_hid_cache_free( mbedtls_milagro_cs_hid_cache_context *cache );
+#endif /* MBEDTLS_SSL_SRV_C */
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+/**
+ * \brief           Pool of threads running the server's authentication of
+ *                  the clients, shared by the milagro_cs contexts of many
+ *                  connections
+ */
+struct mbedtls_milagro_cs_worker_pool
+{
+    pthread_t threads[MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_THREADS]; /*!< workers                      */
+    int nb_threads;           /*!< number of workers running                                          */
+    int shutdown;             /*!< set when the workers have to exit                                  */
+    int max_batch;            /*!< maximum contexts authenticated together by a worker                */
+    unsigned int window_ms;   /*!< time a worker waits for a batch to fill up                         */
+    int queued;               /*!< number of queued contexts                                          */
+    mbedtls_milagro_cs_context *head;  /*!< first queued context                                       */
+    mbedtls_milagro_cs_context *tail;  /*!< last queued context                                        */
+    pthread_mutex_t mutex;    /*!< protects the queue and the async fields of the contexts             */
+    pthread_cond_t work;      /*!< signalled when a context is queued or on shutdown                  */
+    pthread_cond_t done;      /*!< broadcast when a worker finishes a context                         */
+};
+
+/**
+ * \brief           Initialize a worker pool
+ *
+ * \param pool      worker pool
+ */
+void mbedtls_milagro_cs_worker_pool_init( mbedtls_milagro_cs_worker_pool *pool );
+
+/**
+ * \brief           Start the threads of a worker pool
+ *
+ * \param pool         worker pool, initialized
+ * \param nb_threads   number of threads, 1 to MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_THREADS
+ *
+ * \return          0 if successful, MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA,
+ *                  MBEDTLS_ERR_THREADING_MUTEX_ERROR or
+ *                  MBEDTLS_ERR_SSL_ALLOC_FAILED if a thread could not be created
+ */
+int mbedtls_milagro_cs_worker_pool_setup( mbedtls_milagro_cs_worker_pool *pool, int nb_threads );
+
+/**
+ * \brief           Let the workers authenticate the queued clients in
+ *                  batches (see mbedtls_milagro_cs_authenticate_clients()):
+ *                  a worker which finds a client queued waits up to
+ *                  window_ms for max_batch clients before starting
+ *                  (Default: 1 client, no window)
+ *
+ * \note            Must be called before mbedtls_milagro_cs_worker_pool_setup()
+ *
+ * \param pool         worker pool, initialized
+ * \param max_batch    maximum clients per batch, up to
+ *                     MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH
+ * \param window_ms    maximum time spent waiting for a batch to fill up
+ */
+void mbedtls_milagro_cs_worker_pool_set_batch( mbedtls_milagro_cs_worker_pool *pool,
+                                               int max_batch, unsigned int window_ms );
+
+/**
+ * \brief           Stop the threads of a worker pool, after they have
+ *                  processed the contexts still queued
+ *
+ * \param pool      worker pool
+ */
+void mbedtls_milagro_cs_worker_pool_free( mbedtls_milagro_cs_worker_pool *pool );
+#endif /* MBEDTLS_TLS_MILAGRO_CS_ASYNC */
+
 /**
  * \brief           Initialize an milagro_cs struct
  *
@@ -148,6 +388,57 @@ int mbedtls_ssl_milagro_cs_setup_RNG( mbedtls_milagro_cs_context *milagro_cs, mb
  */
 void mbedtls_ssl_milagro_cs_set_secret( mbedtls_milagro_cs_context *milagro_cs, char* secret, int len_secret);
 
+/**
+ * \brief           Keep the context across handshakes: at the end of each
+ *                  handshake only the per-handshake parameters are released
+ *                  (see mbedtls_milagro_cs_reset()), and the caller has to
+ *                  call mbedtls_milagro_cs_free() when done with it
+ *
+ * \note            Combined with MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS, a
+ *                  reused context makes no heap allocation per handshake
+ *
+ * \param milagro_cs      milagro_cs struct
+ * \param reusable        1 to keep the context, 0 to free it with the
+ *                        handshake (default)
+ *
+ */
+void mbedtls_ssl_milagro_cs_set_reusable( mbedtls_milagro_cs_context *milagro_cs, int reusable );
+
+#if defined(MBEDTLS_SSL_SRV_C)
+/**
+ * \brief           Make the server consult a HID cache before mapping the
+ *                  client's identity to the curve
+ *
+ * \note            No copy of the cache is made, it can be shared by the
+ *                  milagro_cs contexts of many connections
+ *
+ * \param milagro_cs      milagro_cs struct of the server
+ * \param cache           HID cache to use, NULL to disable
+ *
+ */
+void mbedtls_ssl_milagro_cs_set_hid_cache( mbedtls_milagro_cs_context *milagro_cs,
+                                           mbedtls_milagro_cs_hid_cache_context *cache );
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+/**
+ * \brief           Make the server authenticate the client in a worker pool:
+ *                  mbedtls_ssl_handshake() returns
+ *                  MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS until the pairings
+ *                  have been computed
+ *
+ * \note            No copy of the pool is made, it can be shared by the
+ *                  milagro_cs contexts of many connections and must outlive
+ *                  them
+ *
+ * \param milagro_cs      milagro_cs struct of the server
+ * \param pool            worker pool to use, NULL to authenticate inline
+ *
+ */
+void mbedtls_ssl_milagro_cs_set_worker_pool( mbedtls_milagro_cs_context *milagro_cs,
+                                             mbedtls_milagro_cs_worker_pool *pool );
+#endif
+#endif
+
 #if defined(MBEDTLS_SSL_CLI_C)
 /**
  * \brief           Set up the secret provided by the DTAs
@@ -172,6 +463,23 @@ void mbedtls_ssl_milagro_cs_set_client_identity(mbedtls_milagro_cs_context *mila
 void mbedtls_ssl_milagro_cs_set_timepermit( mbedtls_milagro_cs_context *milagro_cs, char* timepermit, int len_timepermit);
 
 
+#if defined(MBEDTLS_SSL_CLI_C)
+/**
+ * \brief           Precompute the pairings G1 and G2 used by the client for
+ *                  the computation of the key
+ *
+ * \note            Must be called after mbedtls_ssl_milagro_cs_set_secret()
+ *                  and mbedtls_ssl_milagro_cs_set_client_identity().
+ *                  Once precomputed, the context is long-lived, as after
+ *                  mbedtls_ssl_milagro_cs_set_reusable().
+ *
+ * \param milagro_cs      milagro_cs struct of the client
+ *
+ * \return           0 if successful, a negative error code otherwise
+ */
+int mbedtls_ssl_milagro_cs_precompute( mbedtls_milagro_cs_context *milagro_cs );
+#endif
+
 /**
  * \brief          Alloc memory for the parameters used by the milagro_cs, inc
  *                 case of the client it computes also the public parameters to
@@ -222,6 +530,51 @@ int mbedtls_milagro_cs_read_client_parameters( mbedtls_milagro_cs_context *milag
  */
 int mbedtls_milagro_cs_authenticate_client( mbedtls_milagro_cs_context *milagro_cs );
 
+/**
+ * \brief           Authenticate the clients of several contexts together:
+ *                  the date is taken once and the identity of a client
+ *                  reconnecting several times is mapped to the curve once
+ *
+ * \note            Each client is still verified on its own, so the
+ *                  results tell which clients failed
+ *
+ * \param milagro_cs      array of n milagro_cs structs of the server, with
+ *                        the parameters of the clients read
+ * \param n               number of contexts
+ * \param results         output, the result of mbedtls_milagro_cs_authenticate_client()
+ *                        for each context
+ *
+ * \return           0 if all the clients are authenticated,
+ *                   MBEDTLS_ERR_MILAGRO_CS_AUTHENTICATION_FAILED otherwise
+ */
+int mbedtls_milagro_cs_authenticate_clients( mbedtls_milagro_cs_context **milagro_cs, int n, int *results );
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+/**
+ * \brief           Queue the authentication of the client in the worker
+ *                  pool of the context
+ *
+ * \note            Until the result has been collected with
+ *                  mbedtls_milagro_cs_authenticate_client_poll(), the
+ *                  parameters read from the client must not be touched
+ *
+ * \param milagro_cs      milagro_cs struct of the server, with a worker pool
+ *
+ * \return          0 if queued, MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA otherwise
+ */
+int mbedtls_milagro_cs_authenticate_client_async( mbedtls_milagro_cs_context *milagro_cs );
+
+/**
+ * \brief           Collect the result of a queued authentication
+ *
+ * \param milagro_cs      milagro_cs struct of the server
+ *
+ * \return          MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS if not computed yet,
+ *                  otherwise the result of mbedtls_milagro_cs_authenticate_client()
+ */
+int mbedtls_milagro_cs_authenticate_client_poll( mbedtls_milagro_cs_context *milagro_cs );
+#endif
+
 #endif
 
 /**
@@ -256,6 +609,17 @@ int mbedtls_milagro_cs_write_exchange_parameter( int client_or_server, mbedtls_m
 int mbedtls_milagro_cs_read_public_parameter( int client_or_server, mbedtls_milagro_cs_context *milagro_cs,
                                        const unsigned char *buf, size_t len  );
 
+/**
+ * \brief           Release the parameters of the last handshake, keeping
+ *                  the secret, the identity, the time permit, the RNG and
+ *                  the precomputed values so that the context can be used
+ *                  for another handshake
+ *
+ * \param milagro_cs      milagro_cs context to be reset
+ *
+ */
+void mbedtls_milagro_cs_reset( mbedtls_milagro_cs_context *milagro_cs );
+
 /**
  * \brief           Free the context milagro_cs
  *
@@ -264,6 +628,83 @@ int mbedtls_milagro_cs_read_public_parameter( int client_or_server, mbedtls_mila
  */
 void mbedtls_milagro_cs_free( mbedtls_milagro_cs_context *milagro_cs);
 
+/**
+ * \brief           Pool of per-handshake milagro_cs contexts sharing the
+ *                  long-lived material (secret, identity, time permit,
+ *                  precomputed pairings, HID cache, worker pool) of a model
+ *                  context, see mbedtls_ssl_conf_milagro_cs()
+ */
+struct mbedtls_milagro_cs_context_pool
+{
+    const mbedtls_milagro_cs_context *model; /*!< long-lived material, owned by the caller          */
+    mbedtls_entropy_context *entropy;  /*!< seeds the RNG of each context of the pool                 */
+    mbedtls_milagro_cs_context *free_list; /*!< contexts waiting for a handshake                      */
+    int nb_contexts;          /*!< contexts allocated by the pool                                     */
+    int nb_free;              /*!< contexts in free_list                                              */
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_threading_mutex_t mutex;    /*!< protects free_list                                       */
+#endif
+};
+
+/**
+ * \brief           Initialize a milagro_cs context pool
+ *
+ * \param pool      context pool
+ */
+void mbedtls_milagro_cs_context_pool_init( mbedtls_milagro_cs_context_pool *pool );
+
+/**
+ * \brief           Set the material the contexts of the pool are made from
+ *
+ * \note            No copy of the model is made, it must have been set up
+ *                  with the mbedtls_ssl_milagro_cs_set_xxx() functions (and
+ *                  precomputed on the client side) and must outlive the pool.
+ *                  Its RNG is not used, each context gets its own.
+ *
+ * \param pool      context pool, initialized
+ * \param model     milagro_cs context holding the long-lived material
+ * \param entropy   entropy used to seed the RNG of each new context
+ *
+ * \return          0 if successful, MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA
+ *                  if the model has no secret
+ */
+int mbedtls_milagro_cs_context_pool_setup( mbedtls_milagro_cs_context_pool *pool,
+                                           const mbedtls_milagro_cs_context *model,
+                                           mbedtls_entropy_context *entropy );
+
+/**
+ * \brief           Take a context from the pool for one handshake,
+ *                  allocating a new one if none is free
+ *                  (Thread-safe if MBEDTLS_THREADING_C is enabled)
+ *
+ * \param pool         context pool, set up
+ * \param milagro_cs   output, the context, to be given back with
+ *                     mbedtls_milagro_cs_context_pool_put()
+ *
+ * \return          0 if successful, MBEDTLS_ERR_THREADING_MUTEX_ERROR or
+ *                  MBEDTLS_ERR_ENTROPY_SOURCE_FAILED otherwise
+ */
+int mbedtls_milagro_cs_context_pool_get( mbedtls_milagro_cs_context_pool *pool,
+                                         mbedtls_milagro_cs_context **milagro_cs );
+
+/**
+ * \brief           Reset a context taken from a pool and give it back
+ *                  (Thread-safe if MBEDTLS_THREADING_C is enabled)
+ *
+ * \param milagro_cs   context returned by mbedtls_milagro_cs_context_pool_get()
+ */
+void mbedtls_milagro_cs_context_pool_put( mbedtls_milagro_cs_context *milagro_cs );
+
+/**
+ * \brief           Free the contexts of a pool
+ *
+ * \note            All the contexts taken from the pool must have been
+ *                  given back, i.e. the handshakes using it be over
+ *
+ * \param pool      context pool
+ */
+void mbedtls_milagro_cs_context_pool_free( mbedtls_milagro_cs_context_pool *pool );
+
 
 
 // Milagro Peer-to-Peer
@@ -295,6 +736,9 @@ struct mbedtls_milagro_p2p_context
     octet client_PIB;          /*!< Client's private parameter                                        */
     octet shared_secret;       /*!< Shared secret computed by at the two sides                        */
     csprng RNG;                /*!< Random Number Generator                                           */
+    mbedtls_milagro_p2p_precomp_context *precomp; /*!< Precomputed ephemeral pairs, NULL if not used  */
+    mbedtls_milagro_p2p_context_pool *pool;  /*!< Pool the context is lent by, NULL if owned by the caller */
+    mbedtls_milagro_p2p_context *pool_next;  /*!< Next free context of the pool                       */
 };
 
 
@@ -330,6 +774,35 @@ void mbedtls_ssl_milagro_p2p_set_key(int client_or_server, mbedtls_milagro_p2p_c
 int mbedtls_milagro_p2p_compute_public_param( mbedtls_milagro_p2p_context *milagro_p2p);
 
 
+/**
+ * \brief                 Make the client's side computation of the ephemeral
+ *                        parameters W, W.H(server_identity), Y and
+ *                        Y.H(client_identity), once the server's identity
+ *                        has been read
+ *
+ * \param milagro_p2p     milagro_p2p struct which contains the parameters
+ *
+ * \return                0 if successful, error otherwise
+ */
+int mbedtls_milagro_p2p_compute_client_param( mbedtls_milagro_p2p_context *milagro_p2p);
+
+
+/**
+ * \brief                 Take the ephemeral pairs of the handshakes from a
+ *                        store of precomputed pairs
+ *
+ * \note                  No copy of the store is made, it can be shared by
+ *                        the milagro_p2p contexts of many connections
+ *
+ * \param milagro_p2p     milagro_p2p struct
+ * \param precomp         store of precomputed pairs, NULL to compute them
+ *                        during the handshake
+ *
+ */
+void mbedtls_ssl_milagro_p2p_set_precomp( mbedtls_milagro_p2p_context *milagro_p2p,
+                                          mbedtls_milagro_p2p_precomp_context *precomp );
+
+
 /**
  * \brief                Set up the random number generator for the milagro_p2p struct
  *
@@ -407,6 +880,240 @@ int mbedtls_milagro_p2p_read_public_parameters( int client_or_server, mbedtls_mi
 void mbedtls_milagro_p2p_free( mbedtls_milagro_p2p_context *milagro_p2p);
 
 
+/**
+ * \brief           Release the parameters of the last handshake, keeping
+ *                  the own identity, the key and the RNG so that the context
+ *                  can be used for another handshake
+ *
+ * \param milagro_p2p      milagro_p2p context to be reset
+ *
+ */
+void mbedtls_milagro_p2p_reset( mbedtls_milagro_p2p_context *milagro_p2p);
+
+
+/**
+ * \brief           Ephemeral scalar with its multiple of a hashed identity
+ */
+typedef struct
+{
+    char scalar[PGS];         /*!< random scalar                                                      */
+    char point[4*PFS];        /*!< scalar.H(id), in G1 (2*PFS+1 bytes) or in G2 (4*PFS bytes)          */
+    int point_len;            /*!< length of point                                                    */
+}
+mbedtls_milagro_p2p_precomp_pair;
+
+/**
+ * \brief           Hashed identity and the pairs precomputed for it
+ */
+typedef struct
+{
+    int id_len;               /*!< length of the identity, 0 if the slot is free                      */
+    char id[MBEDTLS_MILAGRO_P2P_MAX_IDENTITY_LEN]; /*!< identity                                     */
+    char hash[HASH_BYTES];    /*!< WCC_HASH_ID(id)                                                    */
+    int g2;                   /*!< 1 if the multiples are in G2, 0 if in G1                           */
+    mbedtls_milagro_p2p_precomp_pair *pairs; /*!< ready pairs                                         */
+    int nb_pairs;             /*!< number of ready pairs                                              */
+    unsigned long last_use;   /*!< time of the last lookup, for the eviction of peers                 */
+}
+mbedtls_milagro_p2p_precomp_identity;
+
+/**
+ * \brief           Store of ephemeral pairs computed ahead of the
+ *                  MILAGRO_P2P handshakes, shared by the contexts of one
+ *                  side: the server keeps X.H(server_identity), the client
+ *                  keeps Y.H(client_identity) and W.H(server_identity) for
+ *                  the servers it has talked to
+ */
+struct mbedtls_milagro_p2p_precomp_context
+{
+    int endpoint;             /*!< MBEDTLS_SSL_IS_CLIENT or MBEDTLS_SSL_IS_SERVER                     */
+    int max_pairs;            /*!< pairs kept per identity                                            */
+    int low_water;            /*!< a refill is requested below this number of pairs                   */
+    mbedtls_milagro_p2p_precomp_identity own; /*!< own identity                                      */
+    mbedtls_milagro_p2p_precomp_identity *peers; /*!< servers' identities (client only)               */
+    int max_peers;            /*!< number of slots in peers                                           */
+    unsigned long clock;      /*!< lookup counter                                                     */
+    unsigned long hits;       /*!< pairs taken from the store                                         */
+    unsigned long misses;     /*!< pairs computed during the handshake                                */
+    csprng RNG;               /*!< generates the scalars                                              */
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_threading_mutex_t mutex;    /*!< protects everything above                                */
+#endif
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_t thread;         /*!< background refill thread                                           */
+    int running;              /*!< 1 if thread has been started                                       */
+    int shutdown;             /*!< set when the thread has to exit                                    */
+    int wakeup;               /*!< set when a refill is requested                                     */
+    pthread_mutex_t wake_mutex; /*!< protects running, shutdown and wakeup                            */
+    pthread_cond_t wake;      /*!< signalled when wakeup or shutdown is set                           */
+#endif
+};
+
+/**
+ * \brief           Initialize a store of precomputed pairs
+ *
+ * \param precomp   store of precomputed pairs
+ */
+void mbedtls_milagro_p2p_precomp_init( mbedtls_milagro_p2p_precomp_context *precomp );
+
+/**
+ * \brief           Set up a store of precomputed pairs for one side
+ *
+ * \param precomp            store of precomputed pairs, initialized
+ * \param client_or_server   MBEDTLS_SSL_IS_CLIENT or MBEDTLS_SSL_IS_SERVER
+ * \param identity           own identity, as given to
+ *                           mbedtls_ssl_milagro_p2p_set_identity()
+ * \param entropy            entropy used to seed the generation of the scalars
+ * \param max_pairs          pairs kept per identity, 1 to
+ *                           MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PAIRS
+ *
+ * \return          0 if successful, MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA or
+ *                  MBEDTLS_ERR_ENTROPY_SOURCE_FAILED otherwise
+ */
+int mbedtls_milagro_p2p_precomp_setup( mbedtls_milagro_p2p_precomp_context *precomp,
+                                       int client_or_server, const char *identity,
+                                       mbedtls_entropy_context *entropy, int max_pairs );
+
+/**
+ * \brief           Let the client precompute for a server before the
+ *                  first handshake with it (servers are otherwise added
+ *                  when a handshake finds no pair for them)
+ *
+ * \param precomp   store of precomputed pairs of a client
+ * \param identity  identity of the server
+ *
+ * \return          0 if successful, MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA or
+ *                  MBEDTLS_ERR_THREADING_MUTEX_ERROR otherwise
+ */
+int mbedtls_milagro_p2p_precomp_add_peer( mbedtls_milagro_p2p_precomp_context *precomp,
+                                          const char *identity );
+
+/**
+ * \brief           Compute pairs until every identity of the store has
+ *                  max_pairs of them (Thread-safe if MBEDTLS_THREADING_C is
+ *                  enabled, the point multiplications are made outside of
+ *                  the lock)
+ *
+ * \note            Meant to be called off the handshake path, from an idle
+ *                  loop or from mbedtls_milagro_p2p_precomp_start()
+ *
+ * \param precomp   store of precomputed pairs
+ *
+ * \return          0 if successful, MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED
+ *                  or MBEDTLS_ERR_THREADING_MUTEX_ERROR otherwise
+ */
+int mbedtls_milagro_p2p_precomp_refill( mbedtls_milagro_p2p_precomp_context *precomp );
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+/**
+ * \brief           Start a thread refilling the store whenever an identity
+ *                  falls below half of max_pairs
+ *
+ * \param precomp   store of precomputed pairs, set up
+ *
+ * \return          0 if successful, MBEDTLS_ERR_SSL_ALLOC_FAILED if the
+ *                  thread could not be created
+ */
+int mbedtls_milagro_p2p_precomp_start( mbedtls_milagro_p2p_precomp_context *precomp );
+#endif
+
+/**
+ * \brief           Read the hit/miss counters of the store
+ *
+ * \param precomp   store of precomputed pairs
+ * \param hits      number of pairs taken from the store
+ * \param misses    number of pairs computed during a handshake
+ */
+void mbedtls_milagro_p2p_precomp_stats( mbedtls_milagro_p2p_precomp_context *precomp,
+                                        unsigned long *hits, unsigned long *misses );
+
+/**
+ * \brief           Stop the refill thread and free a store of precomputed
+ *                  pairs
+ *
+ * \param precomp   store of precomputed pairs
+ */
+void mbedtls_milagro_p2p_precomp_free( mbedtls_milagro_p2p_precomp_context *precomp );
+
+/**
+ * \brief           Pool of per-handshake milagro_p2p contexts sharing the
+ *                  key, the identity and the store of precomputed pairs of
+ *                  a model context, see
+ *                  mbedtls_ssl_conf_milagro_p2p()
+ */
+struct mbedtls_milagro_p2p_context_pool
+{
+    const mbedtls_milagro_p2p_context *model; /*!< long-lived material, owned by the caller         */
+    mbedtls_entropy_context *entropy;  /*!< seeds the RNG of each context of the pool                 */
+    mbedtls_milagro_p2p_context *free_list; /*!< contexts waiting for a handshake                     */
+    int nb_contexts;          /*!< contexts allocated by the pool                                     */
+    int nb_free;              /*!< contexts in free_list                                              */
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_threading_mutex_t mutex;    /*!< protects free_list                                       */
+#endif
+};
+
+/**
+ * \brief           Initialize a milagro_p2p context pool
+ *
+ * \param pool      context pool
+ */
+void mbedtls_milagro_p2p_context_pool_init( mbedtls_milagro_p2p_context_pool *pool );
+
+/**
+ * \brief           Set the material the contexts of the pool are made from
+ *
+ * \note            No copy of the model is made, it must have been set up
+ *                  with mbedtls_ssl_milagro_p2p_set_key() and
+ *                  mbedtls_ssl_milagro_p2p_set_identity() for the same side
+ *                  and must outlive the pool. Its RNG is not used, each
+ *                  context gets its own.
+ *
+ * \param pool      context pool, initialized
+ * \param model     milagro_p2p context holding the long-lived material
+ * \param entropy   entropy used to seed the RNG of each new context
+ *
+ * \return          0 if successful, MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA
+ *                  if the model has no key
+ */
+int mbedtls_milagro_p2p_context_pool_setup( mbedtls_milagro_p2p_context_pool *pool,
+                                            const mbedtls_milagro_p2p_context *model,
+                                            mbedtls_entropy_context *entropy );
+
+/**
+ * \brief           Take a context from the pool for one handshake,
+ *                  allocating a new one if none is free
+ *                  (Thread-safe if MBEDTLS_THREADING_C is enabled)
+ *
+ * \param pool          context pool, set up
+ * \param milagro_p2p   output, the context, to be given back with
+ *                      mbedtls_milagro_p2p_context_pool_put()
+ *
+ * \return          0 if successful, MBEDTLS_ERR_THREADING_MUTEX_ERROR or
+ *                  MBEDTLS_ERR_ENTROPY_SOURCE_FAILED otherwise
+ */
+int mbedtls_milagro_p2p_context_pool_get( mbedtls_milagro_p2p_context_pool *pool,
+                                          mbedtls_milagro_p2p_context **milagro_p2p );
+
+/**
+ * \brief           Reset a context taken from a pool and give it back
+ *                  (Thread-safe if MBEDTLS_THREADING_C is enabled)
+ *
+ * \param milagro_p2p   context returned by mbedtls_milagro_p2p_context_pool_get()
+ */
+void mbedtls_milagro_p2p_context_pool_put( mbedtls_milagro_p2p_context *milagro_p2p );
+
+/**
+ * \brief           Free the contexts of a pool
+ *
+ * \note            All the contexts taken from the pool must have been
+ *                  given back, i.e. the handshakes using it be over
+ *
+ * \param pool      context pool
+ */
+void mbedtls_milagro_p2p_context_pool_free( mbedtls_milagro_p2p_context_pool *pool );
+
+
 #endif /* milagro_h */
 
 
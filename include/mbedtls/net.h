@@ -187,6 +187,22 @@ int mbedtls_net_recv( void *ctx, unsigned char *buf, size_t len );
  */
 int mbedtls_net_send( void *ctx, const unsigned char *buf, size_t len );
 
+/**
+ * \brief          Write at most the total length of the fragments, with a
+ *                 single gather write where the platform has one. If no
+ *                 error occurs, the actual amount written is returned.
+ *                 Suitable for \c mbedtls_ssl_set_bio_vec().
+ *
+ * \param ctx      Socket
+ * \param iov      The fragments to write, in order
+ * \param iovcnt   The number of fragments
+ *
+ * \return         the number of bytes sent,
+ *                 or a non-zero error code; with a non-blocking socket,
+ *                 MBEDTLS_ERR_SSL_WANT_WRITE indicates write() would block.
+ */
+int mbedtls_net_send_vec( void *ctx, const mbedtls_ssl_iovec *iov, int iovcnt );
+
 /**
  * \brief          Read at most 'len' characters, blocking for at most
  *                 'timeout' seconds. If no error occurs, the actual amount
@@ -0,0 +1,129 @@
+/**
+ * \file poly1305.h
+ *
+ * \brief Poly1305 one-time authenticator (RFC 7539)
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+#ifndef MBEDTLS_POLY1305_H
+#define MBEDTLS_POLY1305_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA               -0x0057  /**< Invalid input parameter(s). */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Poly1305 context structure
+ */
+typedef struct
+{
+    uint32_t r[5];                  /*!< clamped r, in 26-bit limbs     */
+    uint32_t s[4];                  /*!< s, added to the final value    */
+    uint32_t acc[5];                /*!< accumulator, in 26-bit limbs   */
+    unsigned char queue[16];        /*!< partial block of input         */
+    size_t queue_len;               /*!< bytes in queue                 */
+}
+mbedtls_poly1305_context;
+
+/**
+ * \brief          Initialize Poly1305 context
+ *
+ * \param ctx      Poly1305 context to be initialized
+ */
+void mbedtls_poly1305_init( mbedtls_poly1305_context *ctx );
+
+/**
+ * \brief          Clear Poly1305 context
+ *
+ * \param ctx      Poly1305 context to be cleared
+ */
+void mbedtls_poly1305_free( mbedtls_poly1305_context *ctx );
+
+/**
+ * \brief          Start a MAC computation
+ *
+ * \warning        A key must never be used for more than one message.
+ *
+ * \param ctx      Poly1305 context
+ * \param key      256-bit one-time key (r followed by s)
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA if ctx or key is NULL
+ */
+int mbedtls_poly1305_starts( mbedtls_poly1305_context *ctx,
+                             const unsigned char key[32] );
+
+/**
+ * \brief          Feed data to the MAC computation
+ *
+ * \param ctx      Poly1305 context
+ * \param input    buffer holding the data
+ * \param ilen     length of the data
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA on NULL buffers
+ */
+int mbedtls_poly1305_update( mbedtls_poly1305_context *ctx,
+                             const unsigned char *input,
+                             size_t ilen );
+
+/**
+ * \brief          Output the MAC
+ *
+ * \param ctx      Poly1305 context
+ * \param mac      buffer for the 16-byte MAC
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA if ctx or mac is NULL
+ */
+int mbedtls_poly1305_finish( mbedtls_poly1305_context *ctx,
+                             unsigned char mac[16] );
+
+/**
+ * \brief          Output = Poly1305( key, input buffer )
+ *
+ * \param key      256-bit one-time key
+ * \param input    buffer holding the data
+ * \param ilen     length of the data
+ * \param mac      buffer for the 16-byte MAC
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA on NULL buffers
+ */
+int mbedtls_poly1305_mac( const unsigned char key[32],
+                          const unsigned char *input,
+                          size_t ilen,
+                          unsigned char mac[16] );
+
+/**
+ * \brief          Checkup routine
+ *
+ * \return         0 if successful, or 1 if the test failed
+ */
+int mbedtls_poly1305_self_test( int verbose );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* poly1305.h */
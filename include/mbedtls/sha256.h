@@ -32,6 +32,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Number of messages mbedtls_sha256_multi() hashes side by side at most
+ */
+#define MBEDTLS_SHA256_MULTI_LANES  8
+
 #if !defined(MBEDTLS_SHA256_ALT)
 // Regular implementation
 //
@@ -127,6 +132,38 @@ extern "C" {
 void mbedtls_sha256( const unsigned char *input, size_t ilen,
            unsigned char output[32], int is224 );
 
+/**
+ * \brief          output[i] = SHA-256( input[i] ) for n independent
+ *                 buffers, hashed side by side in SIMD lanes when the CPU
+ *                 allows it
+ *
+ * \param n        number of buffers
+ * \param input    buffers holding the data
+ * \param ilen     lengths of the input data
+ * \param output   SHA-224/256 checksum results
+ * \param is224    0 = use SHA256, 1 = use SHA224
+ */
+void mbedtls_sha256_multi( size_t n, const unsigned char * const input[],
+                           const size_t ilen[], unsigned char * const output[],
+                           int is224 );
+
+/**
+ * \brief          output[i] = HMAC-SHA-256( key, input[i] ) for n
+ *                 independent buffers, hashed side by side in SIMD lanes
+ *                 when the CPU allows it
+ *
+ * \param key      HMAC secret key
+ * \param keylen   length of the HMAC key
+ * \param n        number of buffers
+ * \param input    buffers holding the data
+ * \param ilen     lengths of the input data
+ * \param output   HMAC-SHA-256 results
+ */
+void mbedtls_sha256_hmac_multi( const unsigned char *key, size_t keylen,
+                                size_t n, const unsigned char * const input[],
+                                const size_t ilen[],
+                                unsigned char * const output[] );
+
 /**
  * \brief          Checkup routine
  *
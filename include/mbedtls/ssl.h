@@ -56,6 +56,10 @@
 #include "zlib.h"
 #endif
 
+#if defined(MBEDTLS_SSL_BUFFER_POOL) && defined(MBEDTLS_THREADING_C)
+#include "threading.h"
+#endif
+
 #if defined(MBEDTLS_HAVE_TIME)
 #include <time.h>
 #endif
@@ -112,6 +116,7 @@
 #define MBEDTLS_ERR_SSL_TIMEOUT                           -0x6800  /**< The operation timed out. */
 #define MBEDTLS_ERR_SSL_CLIENT_RECONNECT                  -0x6780  /**< The client initiated a reconnect from the same port. */
 #define MBEDTLS_ERR_SSL_UNEXPECTED_RECORD                 -0x6700  /**< Record header looks valid but is not expected. */
+#define MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS                -0x7000  /**< A cryptographic operation is in progress, try again later. */
 /*
  * MILAGRO_CS errors
  */
@@ -206,6 +211,15 @@
 #define MBEDTLS_SSL_PRESET_DEFAULT              0
 #define MBEDTLS_SSL_PRESET_SUITEB               2
 
+/*
+ * Events reported to the handshake timing callback
+ */
+#define MBEDTLS_SSL_TIMING_STEP                 0   /**< one call of mbedtls_ssl_handshake_step() */
+#define MBEDTLS_SSL_TIMING_PAIRING              1   /**< Milagro key computation (pairings) */
+#define MBEDTLS_SSL_TIMING_ECP_MUL              2   /**< ECDH key generation or shared secret, ECDSA signature */
+#define MBEDTLS_SSL_TIMING_RSA_PRIVATE          3   /**< RSA decryption or signature */
+#define MBEDTLS_SSL_TIMING_X509_VERIFY          4   /**< verification of the peer's certificate chain */
+
 /*
  * Default range for DTLS retransmission timer value, in milliseconds.
  * RFC 6347 4.2.4.1 says from 1 second to 60 seconds.
@@ -240,6 +254,41 @@
 #define MBEDTLS_SSL_MAX_CONTENT_LEN         16384   /**< Size of the input / output buffer */
 #endif
 
+/*
+ * With MBEDTLS_SSL_VARIABLE_BUFFERS, size of each of the two I/O buffers
+ * of an idle connection, and number of consecutive records that fit in it
+ * before buffers that were grown are shrunk back to it.
+ */
+#if !defined(MBEDTLS_SSL_IDLE_BUFFER_LEN)
+#define MBEDTLS_SSL_IDLE_BUFFER_LEN         1024
+#endif
+
+#if !defined(MBEDTLS_SSL_BUFFER_SHRINK_RECORDS)
+#define MBEDTLS_SSL_BUFFER_SHRINK_RECORDS   8
+#endif
+
+/*
+ * With MBEDTLS_SSL_WRITE_BATCH, default number of records a single write
+ * call may encrypt and send at once (1 disables batching)
+ */
+#if !defined(MBEDTLS_SSL_WRITE_BATCH_RECORDS)
+#define MBEDTLS_SSL_WRITE_BATCH_RECORDS     4
+#endif
+
+/*
+ * Upper bound on the records per write call, so that the staging area and
+ * the length a write call returns stay well within an int
+ */
+#define MBEDTLS_SSL_WRITE_BATCH_MAX         64
+
+/*
+ * With MBEDTLS_SSL_READ_AHEAD, default size of the area the incoming bytes
+ * are read ahead into (0 disables read-ahead)
+ */
+#if !defined(MBEDTLS_SSL_READ_AHEAD_LEN)
+#define MBEDTLS_SSL_READ_AHEAD_LEN          16384
+#endif
+
 /* \} name SECTION: Module settings */
 
 /*
@@ -494,8 +543,45 @@ struct mbedtls_ssl_session
 #if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
     int encrypt_then_mac;       /*!< flag for EtM activation                */
 #endif
+
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    unsigned char peer_cert_digest[32]; /*!< SHA-256 of the peer cert    */
+    size_t peer_cert_digest_len;        /*!< 32 if restored from a
+                                             digest instead of peer_cert */
+#endif
 };
 
+/**
+ * \brief          One fragment of a scatter-gather buffer list, as used by
+ *                 mbedtls_ssl_writev() and the vectored send callback
+ */
+typedef struct
+{
+    const unsigned char *base;  /*!< start of the fragment                  */
+    size_t len;                 /*!< length of the fragment in bytes        */
+}
+mbedtls_ssl_iovec;
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+/**
+ * \brief          Pool of record buffers (of MBEDTLS_SSL_BUFFER_LEN bytes)
+ *                 lent to the idle-capable SSL contexts of a configuration,
+ *                 see mbedtls_ssl_conf_buffer_pool()
+ */
+typedef struct
+{
+    unsigned char *free_list;   /*!< buffers waiting for a context          */
+    size_t max_free;            /*!< buffers kept in free_list, 0 for all   */
+    size_t nb_free;             /*!< buffers in free_list                   */
+    size_t nb_in_use;           /*!< buffers lent to contexts               */
+    size_t peak_in_use;         /*!< highest nb_in_use seen                 */
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_threading_mutex_t mutex;    /*!< protects the fields above      */
+#endif
+}
+mbedtls_ssl_buffer_pool;
+#endif /* MBEDTLS_SSL_BUFFER_POOL */
+
 /**
  * SSL/TLS configuration to be shared between mbedtls_ssl_context structures.
  */
@@ -567,6 +653,20 @@ struct mbedtls_ssl_config
     void *p_export_keys;            /*!< context for key export callback    */
 #endif
 
+#if defined(MBEDTLS_ECDH_C)
+    /** Callback to take a precomputed ephemeral ECDH key pair              */
+    int (*f_keyshare)( void *, mbedtls_ecp_group_id,
+                       mbedtls_mpi *, mbedtls_ecp_point * );
+    void *p_keyshare;               /*!< context for the keyshare callback  */
+#endif
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    /** Callback to report the time spent in a handshake step or operation  */
+    void (*f_timing)( void *, const mbedtls_ssl_context *, int, int,
+                      unsigned long, unsigned long );
+    void *p_timing;                 /*!< context for the timing callback    */
+#endif
+
 #if defined(MBEDTLS_X509_CRT_PARSE_C)
     const mbedtls_x509_crt_profile *cert_profile; /*!< verification profile */
     mbedtls_ssl_key_cert *key_cert; /*!< own certificate/key pair(s)        */
@@ -598,6 +698,19 @@ struct mbedtls_ssl_config
     const char **alpn_list;         /*!< ordered list of protocols          */
 #endif
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS)
+    mbedtls_milagro_cs_context_pool *milagro_cs_pool;   /*!< per-handshake
+                                         milagro_cs contexts                */
+#endif
+#if defined(MBEDTLS_TLS_MILAGRO_P2P)
+    mbedtls_milagro_p2p_context_pool *milagro_p2p_pool; /*!< per-handshake
+                                         milagro_p2p contexts               */
+#endif
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    mbedtls_ssl_buffer_pool *buf_pool;  /*!< record buffers of the contexts */
+#endif
+
     /*
      * Numerical settings (int then char)
      */
@@ -621,6 +734,14 @@ struct mbedtls_ssl_config
     unsigned int badmac_limit;      /*!< limit of records with a bad MAC    */
 #endif
 
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    unsigned int write_batch;       /*!< max. records per write call        */
+#endif
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    size_t read_ahead;              /*!< size of the read-ahead area        */
+#endif
+
 #if defined(MBEDTLS_DHM_C) && defined(MBEDTLS_SSL_CLI_C)
     unsigned int dhm_min_bitlen;    /*!< min. bit length of the DHM prime   */
 #endif
@@ -700,6 +821,7 @@ struct mbedtls_ssl_context
     int (*f_send)(void *, const unsigned char *, size_t);
     int (*f_recv)(void *, unsigned char *, size_t);
     int (*f_recv_timeout)(void *, unsigned char *, size_t, uint32_t);
+    int (*f_send_vec)(void *, const mbedtls_ssl_iovec *, int);
     void *p_bio;                /*!< context for I/O operations   */
 
     /*
@@ -759,6 +881,30 @@ struct mbedtls_ssl_context
     int nb_zero;                /*!< # of 0-length encrypted messages */
     int record_read;            /*!< record is already present        */
 
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    size_t in_buf_len;          /*!< current size of in_buf           */
+    size_t out_buf_len;         /*!< current size of out_buf          */
+    unsigned int small_records; /*!< consecutive records that fit in
+                                     idle-size buffers                */
+#endif
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    unsigned char in_ctr_idle[8];   /*!< in_ctr while in_buf is back in
+                                         the buffer pool              */
+    unsigned char out_ctr_idle[8];  /*!< out_ctr while out_buf is back
+                                         in the buffer pool           */
+    size_t in_msg_idle;         /*!< offset of in_msg in in_buf, idem */
+    size_t out_msg_idle;        /*!< offset of out_msg in out_buf     */
+    unsigned char in_hdr_idle[5];   /*!< header bytes received while
+                                         in_buf is back in the pool   */
+    size_t in_hdr_idle_len;     /*!< number of bytes in in_hdr_idle   */
+#endif
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    unsigned char *in_ahead;    /*!< bytes read ahead of the record   */
+    size_t in_ahead_len;        /*!< size of in_ahead                 */
+    size_t in_ahead_start;      /*!< first unused byte in in_ahead    */
+    size_t in_ahead_end;        /*!< end of the bytes in in_ahead     */
+#endif
+
     /*
      * Record layer (outgoing data)
      */
@@ -772,6 +918,12 @@ struct mbedtls_ssl_context
     int out_msgtype;            /*!< record header: message type      */
     size_t out_msglen;          /*!< record header: message length    */
     size_t out_left;            /*!< amount of data not yet written   */
+    size_t out_taglen;          /*!< trailing MAC or tag in out_msg   */
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    unsigned char *out_batch;   /*!< staging area for batched records */
+    size_t out_batch_len;       /*!< size of out_batch in bytes       */
+    unsigned int out_batched;   /*!< records staged in out_batch      */
+#endif
 
 #if defined(MBEDTLS_ZLIB_SUPPORT)
     unsigned char *compress_buf;        /*!<  zlib data buffer        */
@@ -925,6 +1077,44 @@ void mbedtls_ssl_set_milagro_cs(mbedtls_ssl_handshake_params * handshake, mbedtl
      */
 void mbedtls_ssl_set_milagro_p2p(mbedtls_ssl_handshake_params * handshake, mbedtls_milagro_p2p_context * milagro_p2p);
 #endif
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS)
+/**
+ * \brief          Set the pool the milagro_cs context of each handshake is
+ *                 taken from, so that one configuration serves any number of
+ *                 concurrent connections: the context is taken when the
+ *                 handshake starts and given back to the pool when it ends
+ *
+ * \note           No copy of the pool is made, it must outlive the SSL
+ *                 contexts using this configuration. A context set with
+ *                 mbedtls_ssl_set_milagro_cs() takes precedence.
+ *
+ * \param conf     SSL configuration
+ * \param pool     context pool, set up with
+ *                 mbedtls_milagro_cs_context_pool_setup(), or NULL
+ */
+void mbedtls_ssl_conf_milagro_cs( mbedtls_ssl_config *conf,
+                                  mbedtls_milagro_cs_context_pool *pool );
+#endif
+
+#if defined(MBEDTLS_TLS_MILAGRO_P2P)
+/**
+ * \brief          Set the pool the milagro_p2p context of each handshake is
+ *                 taken from, so that one configuration serves any number of
+ *                 concurrent connections: the context is taken when the
+ *                 handshake starts and given back to the pool when it ends
+ *
+ * \note           No copy of the pool is made, it must outlive the SSL
+ *                 contexts using this configuration. A context set with
+ *                 mbedtls_ssl_set_milagro_p2p() takes precedence.
+ *
+ * \param conf     SSL configuration
+ * \param pool     context pool, set up with
+ *                 mbedtls_milagro_p2p_context_pool_setup(), or NULL
+ */
+void mbedtls_ssl_conf_milagro_p2p( mbedtls_ssl_config *conf,
+                                   mbedtls_milagro_p2p_context_pool *pool );
+#endif
     
 /**
  * \brief          Reset an already initialized SSL context for re-use
@@ -1064,6 +1254,28 @@ void mbedtls_ssl_set_bio( mbedtls_ssl_context *ssl,
         int (*f_recv)(void *, unsigned char *, size_t),
         int (*f_recv_timeout)(void *, unsigned char *, size_t, uint32_t) );
 
+/**
+ * \brief          Set a vectored write callback, used instead of the
+ *                 \c f_send callback of \c mbedtls_ssl_set_bio() to send
+ *                 records. (Default: NULL, only use \c f_send.)
+ *
+ * \param ssl      SSL context
+ * \param f_send_vec vectored write callback, called with \c p_bio from
+ *                 \c mbedtls_ssl_set_bio(), the list of fragments and
+ *                 their count. Each record is described by up to three
+ *                 fragments: header and explicit IV, ciphertext, then the
+ *                 trailing tag or MAC if any. Returns the number of bytes
+ *                 written, MBEDTLS_ERR_SSL_WANT_WRITE or another negative
+ *                 error code, like \c f_send.
+ *
+ * \note           The fragments of a record lie next to each other in the
+ *                 output buffer, so the callback may send less than all of
+ *                 them; the remaining bytes are offered again on the next
+ *                 call. \c mbedtls_net_send_vec() is a suitable callback.
+ */
+void mbedtls_ssl_set_bio_vec( mbedtls_ssl_context *ssl,
+        int (*f_send_vec)(void *, const mbedtls_ssl_iovec *, int) );
+
 /**
  * \brief          Set the timeout period for mbedtls_ssl_read()
  *                 (Default: no timeout.)
@@ -1222,6 +1434,205 @@ void mbedtls_ssl_conf_export_keys_cb( mbedtls_ssl_config *conf,
         void *p_export_keys );
 #endif /* MBEDTLS_SSL_EXPORT_KEYS */
 
+#if defined(MBEDTLS_ECDH_C)
+/**
+ * \brief           Callback type: take an ephemeral ECDH key pair
+ *
+ * \note            This describes what a callback implementation should do.
+ *                  This callback should move a fresh key pair of the curve,
+ *                  generated in advance, into d and Q. A pair must never be
+ *                  handed out twice.
+ *
+ * \param p_keyshare Context for the callback
+ * \param grp_id    Curve of the pair
+ * \param d         Private value to be set
+ * \param Q         Public value to be set
+ *
+ * \return          0 if a pair was set, or
+ *                  any other value if the handshake has to generate its
+ *                  own pair.
+ */
+typedef int mbedtls_ssl_keyshare_t( void *p_keyshare,
+                                    mbedtls_ecp_group_id grp_id,
+                                    mbedtls_mpi *d,
+                                    mbedtls_ecp_point *Q );
+
+/**
+ * \brief           Configure the callback giving precomputed ephemeral
+ *                  ECDH key pairs to the ECDHE key exchanges (server) and
+ *                  to the ECDH(E) ClientKeyExchange (client).
+ *                  (Default: none, the pair is generated in the handshake.)
+ *
+ * \note            See \c mbedtls_ssl_keyshare_get() for an implementation
+ *                  keeping a pool filled in the background.
+ *
+ * \param conf      SSL configuration context
+ * \param f_keyshare Callback taking a key pair
+ * \param p_keyshare Context for the callback
+ */
+void mbedtls_ssl_conf_keyshare_cb( mbedtls_ssl_config *conf,
+        mbedtls_ssl_keyshare_t *f_keyshare,
+        void *p_keyshare );
+#endif /* MBEDTLS_ECDH_C */
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+/**
+ * \brief           Callback type: report the time spent in a handshake
+ *                  step or in an expensive operation of the handshake
+ *
+ * \note            The times come from mbedtls_timing_monotonic_us(), in
+ *                  microseconds. They wrap around, only end - start is
+ *                  meaningful.
+ *
+ * \note            A step that returns MBEDTLS_ERR_SSL_WANT_READ or
+ *                  MBEDTLS_ERR_SSL_WANT_WRITE is reported too, so a state
+ *                  can be reported several times in a handshake. The
+ *                  operations are reported before the step they belong to.
+ *
+ * \param p_timing  Context for the callback
+ * \param ssl       SSL context doing the handshake
+ * \param event     MBEDTLS_SSL_TIMING_STEP, MBEDTLS_SSL_TIMING_PAIRING,
+ *                  MBEDTLS_SSL_TIMING_ECP_MUL, MBEDTLS_SSL_TIMING_RSA_PRIVATE
+ *                  or MBEDTLS_SSL_TIMING_X509_VERIFY
+ * \param state     Handshake state (mbedtls_ssl_states) the step or the
+ *                  operation was run in
+ * \param start     Time at the start of the step or operation
+ * \param end       Time at its end
+ */
+typedef void mbedtls_ssl_timing_t( void *p_timing,
+                                   const mbedtls_ssl_context *ssl,
+                                   int event, int state,
+                                   unsigned long start,
+                                   unsigned long end );
+
+/**
+ * \brief           Configure the handshake timing callback.
+ *                  (Default: none.)
+ *
+ * \note            See \c mbedtls_ssl_timing_t. Without a callback, the
+ *                  cost is a test per step and per operation.
+ *
+ * \param conf      SSL configuration context
+ * \param f_timing  Callback reporting the times
+ * \param p_timing  Context for the callback
+ */
+void mbedtls_ssl_conf_timing_cb( mbedtls_ssl_config *conf,
+        mbedtls_ssl_timing_t *f_timing,
+        void *p_timing );
+#endif /* MBEDTLS_SSL_HANDSHAKE_TIMING */
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+/**
+ * \brief           Initialize a buffer pool
+ *
+ * \param pool      buffer pool
+ */
+void mbedtls_ssl_buffer_pool_init( mbedtls_ssl_buffer_pool *pool );
+
+/**
+ * \brief           Set the number of free buffers the pool keeps for later
+ *                  use, the ones given back above it are freed.
+ *                  (Default: 0, keep them all.)
+ *
+ * \param pool      buffer pool
+ * \param max_free  maximum number of free buffers
+ */
+void mbedtls_ssl_buffer_pool_set_max_free( mbedtls_ssl_buffer_pool *pool,
+                                           size_t max_free );
+
+/**
+ * \brief           Get the memory footprint of the pool
+ *                  (Thread-safe if MBEDTLS_THREADING_C is enabled)
+ *
+ * \param pool      buffer pool
+ * \param in_use    bytes of the buffers currently lent to contexts
+ * \param idle      bytes of the free buffers kept by the pool
+ * \param peak      highest value of in_use so far
+ *
+ * \return          0 if successful, or MBEDTLS_ERR_THREADING_MUTEX_ERROR
+ */
+int mbedtls_ssl_buffer_pool_stats( mbedtls_ssl_buffer_pool *pool,
+                                   size_t *in_use, size_t *idle,
+                                   size_t *peak );
+
+/**
+ * \brief           Free the buffers kept by a pool
+ *
+ * \note            All the contexts using the pool must have been freed
+ *
+ * \param pool      buffer pool
+ */
+void mbedtls_ssl_buffer_pool_free( mbedtls_ssl_buffer_pool *pool );
+
+/**
+ * \brief           Set the pool the record buffers of the contexts using
+ *                  this configuration are taken from. A TLS context gives
+ *                  its input buffer back while no record is pending and its
+ *                  output buffer once everything is sent, and takes them
+ *                  again only when data has to be moved, so that idle
+ *                  connections hold no buffer at all.
+ *
+ * \note            No copy of the pool is made, it must outlive the SSL
+ *                  contexts using this configuration, and be set before
+ *                  mbedtls_ssl_setup() is called on them.
+ *
+ * \note            The pool can be shared by several threads when
+ *                  MBEDTLS_THREADING_C is enabled, but one pool (and one
+ *                  configuration) per worker thread avoids the locking.
+ *
+ * \param conf      SSL configuration
+ * \param pool      buffer pool, initialized, or NULL
+ */
+void mbedtls_ssl_conf_buffer_pool( mbedtls_ssl_config *conf,
+                                   mbedtls_ssl_buffer_pool *pool );
+#endif /* MBEDTLS_SSL_BUFFER_POOL */
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+/**
+ * \brief          Set the maximum number of records a single call to
+ *                 mbedtls_ssl_write() or mbedtls_ssl_writev() may encrypt
+ *                 and send at once. (TLS only, no effect on DTLS.)
+ *                 (Default: MBEDTLS_SSL_WRITE_BATCH_RECORDS)
+ *
+ * \param conf     SSL configuration
+ * \param records  Maximum number of records per call, 0 or 1 to send a
+ *                 single record as without batching; values above
+ *                 MBEDTLS_SSL_WRITE_BATCH_MAX are lowered to it
+ *
+ * \note           Each context keeps a staging area of up to \c records
+ *                 times MBEDTLS_SSL_BUFFER_LEN bytes, allocated when a write
+ *                 first spans several records. The records are sent with a
+ *                 single f_send call where the BIO accepts it, and a write
+ *                 call may then return up to \c records times the maximum
+ *                 fragment length.
+ */
+void mbedtls_ssl_conf_write_batch( mbedtls_ssl_config *conf,
+                                   unsigned int records );
+#endif /* MBEDTLS_SSL_WRITE_BATCH */
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+/**
+ * \brief          Set the size of the area the incoming bytes of each
+ *                 context are read ahead into, so that several records can
+ *                 be received with a single f_recv call.
+ *                 (TLS only, no effect on DTLS.)
+ *                 (Default: MBEDTLS_SSL_READ_AHEAD_LEN)
+ *
+ * \param conf     SSL configuration
+ * \param len      Size of the read-ahead area in bytes, 0 to ask f_recv
+ *                 for the bytes of the current record only
+ *
+ * \note           The area is allocated on the first read. Records that
+ *                 are at least as large are received directly into the
+ *                 input buffer once the bytes read ahead are used up.
+ *
+ * \note           With read-ahead, the socket may have no more data while
+ *                 records are waiting in the context: use
+ *                 \c mbedtls_ssl_check_pending() before waiting for it.
+ */
+void mbedtls_ssl_conf_read_ahead( mbedtls_ssl_config *conf, size_t len );
+#endif /* MBEDTLS_SSL_READ_AHEAD */
+
 /**
  * \brief          Callback type: generate a cookie
  *
@@ -2120,6 +2531,23 @@ void mbedtls_ssl_conf_renegotiation_period( mbedtls_ssl_config *conf,
  */
 size_t mbedtls_ssl_get_bytes_avail( const mbedtls_ssl_context *ssl );
 
+/**
+ * \brief          Check if data was received from the underlying transport
+ *                 but not processed yet, so that calling mbedtls_ssl_read()
+ *                 may make progress without waiting for the transport.
+ *
+ * \param ssl      SSL context
+ *
+ * \return         0 if nothing is pending, 1 otherwise
+ *
+ * \note           This is different from mbedtls_ssl_get_bytes_avail(): the
+ *                 pending data may be the rest of a handshake record, the
+ *                 next records of a datagram, bytes read ahead with
+ *                 MBEDTLS_SSL_READ_AHEAD, or a record that turns out to
+ *                 carry no application data.
+ */
+int mbedtls_ssl_check_pending( const mbedtls_ssl_context *ssl );
+
 /**
  * \brief          Return the result of the certificate verification
  *
@@ -2183,6 +2611,20 @@ int mbedtls_ssl_get_record_expansion( const mbedtls_ssl_context *ssl );
 size_t mbedtls_ssl_get_max_frag_len( const mbedtls_ssl_context *ssl );
 #endif /* MBEDTLS_SSL_MAX_FRAGMENT_LENGTH */
 
+/**
+ * \brief          Return the number of bytes currently allocated for the
+ *                 record I/O buffers of this context
+ *
+ * \note           Without MBEDTLS_SSL_VARIABLE_BUFFERS this is always twice
+ *                 MBEDTLS_SSL_BUFFER_LEN (plus the compression buffer if
+ *                 any) once the context is set up.
+ *
+ * \param ssl      SSL context
+ *
+ * \return         Live size of the input and output buffers, in bytes
+ */
+size_t mbedtls_ssl_get_buffer_bytes( const mbedtls_ssl_context *ssl );
+
 #if defined(MBEDTLS_X509_CRT_PARSE_C)
 /**
  * \brief          Return the peer certificate from the current connection
@@ -2221,6 +2663,51 @@ const mbedtls_x509_crt *mbedtls_ssl_get_peer_cert( const mbedtls_ssl_context *ss
 int mbedtls_ssl_get_session( const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session );
 #endif /* MBEDTLS_SSL_CLI_C */
 
+/**
+ * \brief          Serialize a session in a compact, versioned format
+ *                 holding only the negotiated parameters, as used by the
+ *                 session cache and ticket modules.
+ *
+ * \note           The peer certificate is stored as DER, or only as its
+ *                 SHA-256 digest if MBEDTLS_SSL_SESSION_CERT_DIGEST is
+ *                 defined.
+ *
+ * \param session  session to serialize
+ * \param buf      buffer to write to, may be NULL if buf_len is 0
+ * \param buf_len  size of buf
+ * \param olen     bytes written, or bytes needed if buf is too small
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL if buf is too small
+ */
+int mbedtls_ssl_session_save( const mbedtls_ssl_session *session,
+                              unsigned char *buf, size_t buf_len,
+                              size_t *olen );
+
+/**
+ * \brief          Restore a session serialized by mbedtls_ssl_session_save()
+ *
+ * \note           A session saved with only the peer certificate digest
+ *                 is restored with peer_cert set to NULL and the digest
+ *                 in peer_cert_digest.
+ *
+ * \param session  initialized session to fill, which must be freed by
+ *                 the caller with mbedtls_ssl_session_free() even if the
+ *                 function fails
+ * \param buf      serialized session
+ * \param len      length of buf
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_SSL_BAD_INPUT_DATA if buf is malformed or
+ *                 of another format version,
+ *                 MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE if it holds a peer
+ *                 certificate digest this build can't restore,
+ *                 MBEDTLS_ERR_SSL_ALLOC_FAILED on memory allocation error,
+ *                 or an X509 error code if the peer certificate is invalid
+ */
+int mbedtls_ssl_session_load( mbedtls_ssl_session *session,
+                              const unsigned char *buf, size_t len );
+
 /**
  * \brief          Perform the SSL handshake
  *
@@ -2228,15 +2715,22 @@ int mbedtls_ssl_get_session( const mbedtls_ssl_context *ssl, mbedtls_ssl_session
  *
  * \return         0 if successful, or
  *                 MBEDTLS_ERR_SSL_WANT_READ or MBEDTLS_ERR_SSL_WANT_WRITE, or
+ *                 MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS, or
  *                 MBEDTLS_ERR_SSL_HELLO_VERIFY_REQUIRED (see below), or
  *                 a specific SSL error code.
  *
  * \note           If this function returns something other than 0 or
- *                 MBEDTLS_ERR_SSL_WANT_READ/WRITE, then the ssl context
+ *                 MBEDTLS_ERR_SSL_WANT_READ/WRITE or
+ *                 MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS, then the ssl context
  *                 becomes unusable, and you should either free it or call
  *                 \c mbedtls_ssl_session_reset() on it before re-using it for
  *                 a new connection; the current connection must be closed.
  *
+ * \note           MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS is returned by a server
+ *                 which handed the MILAGRO_CS authentication of the client
+ *                 to a worker pool (see MBEDTLS_TLS_MILAGRO_CS_ASYNC): call
+ *                 this function again later, as with WANT_READ/WRITE.
+ *
  * \note           If DTLS is in use, then you may choose to handle
  *                 MBEDTLS_ERR_SSL_HELLO_VERIFY_REQUIRED specially for logging
  *                 purposes, as it is an expected return value rather than an
@@ -2321,6 +2815,39 @@ int mbedtls_ssl_renegotiate( mbedtls_ssl_context *ssl );
  */
 int mbedtls_ssl_read( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len );
 
+/**
+ * \brief          Read application data without copying it: lend the
+ *                 decrypted content of the current record, in place in the
+ *                 input buffer of the context
+ *
+ * \param ssl      SSL context
+ * \param buf      set to the start of the data on success
+ *
+ * \return         the number of bytes available at *buf, or
+ *                 the same values as \c mbedtls_ssl_read() otherwise
+ *
+ * \note           The data stays valid until it is given back with
+ *                 \c mbedtls_ssl_read_release(), which must happen before
+ *                 the next call to \c mbedtls_ssl_read() or this function.
+ *                 Calling this function again before that returns the
+ *                 remaining data of the same record.
+ */
+int mbedtls_ssl_read_inplace( mbedtls_ssl_context *ssl,
+                              const unsigned char **buf );
+
+/**
+ * \brief          Give back the first bytes of the data lent by
+ *                 \c mbedtls_ssl_read_inplace(), marking them as read
+ *
+ * \param ssl      SSL context
+ * \param len      number of bytes consumed, at most the value returned by
+ *                 \c mbedtls_ssl_read_inplace()
+ *
+ * \return         0 if successful, or MBEDTLS_ERR_SSL_BAD_INPUT_DATA if no
+ *                 data is lent or len is too large
+ */
+int mbedtls_ssl_read_release( mbedtls_ssl_context *ssl, size_t len );
+
 /**
  * \brief          Try to write exactly 'len' application data bytes
  *
@@ -2358,6 +2885,34 @@ int mbedtls_ssl_read( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len )
  */
 int mbedtls_ssl_write( mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len );
 
+/**
+ * \brief          Write application data gathered from several buffers
+ *
+ *                 Same as \c mbedtls_ssl_write() on the concatenation of
+ *                 the fragments, without copying them to the output buffer
+ *                 first when the ciphersuite allows it: GCM records are
+ *                 encrypted straight from the fragments, as are CCM records
+ *                 whose payload lies in a single fragment. Other records are
+ *                 gathered into the output buffer and encrypted in place.
+ *
+ * \param ssl      SSL context
+ * \param iov      list of fragments holding the data
+ * \param iovcnt   number of fragments in \c iov
+ *
+ * \return         the number of bytes actually written (may be less than
+ *                 the total length of the fragments), or
+ *                 MBEDTLS_ERR_SSL_WANT_WRITE or MBEDTLS_ERR_SSL_WANT_READ,
+ *                 or another negative error code.
+ *
+ * \note           The partial write, WANT_READ/WRITE and maximum fragment
+ *                 length notes of \c mbedtls_ssl_write() apply, with the
+ *                 fragment list in place of \c buf and \c len: after a
+ *                 partial write, call again with the fragments advanced
+ *                 by the return value.
+ */
+int mbedtls_ssl_writev( mbedtls_ssl_context *ssl,
+                        const mbedtls_ssl_iovec *iov, int iovcnt );
+
 /**
  * \brief           Send an alert message
  *
@@ -45,6 +45,10 @@
 #define MBEDTLS_SSL_CACHE_DEFAULT_MAX_ENTRIES      50   /*!< Maximum entries in cache */
 #endif
 
+#if !defined(MBEDTLS_SSL_CACHE_SHARDS)
+#define MBEDTLS_SSL_CACHE_SHARDS                   16   /*!< Independently locked parts of the cache */
+#endif
+
 /* \} name SECTION: Module settings */
 
 #ifdef __cplusplus
@@ -55,30 +59,58 @@ typedef struct mbedtls_ssl_cache_context mbedtls_ssl_cache_context;
 typedef struct mbedtls_ssl_cache_entry mbedtls_ssl_cache_entry;
 
 /**
- * \brief   This structure is used for storing cache entries
+ * \brief   This structure is used for storing cache entries, each holding
+ *          a session serialized by mbedtls_ssl_session_save()
  */
 struct mbedtls_ssl_cache_entry
 {
 #if defined(MBEDTLS_HAVE_TIME)
     time_t timestamp;           /*!< entry timestamp    */
 #endif
-    mbedtls_ssl_session session;        /*!< entry session      */
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-    mbedtls_x509_buf peer_cert;         /*!< entry peer_cert    */
-#endif
-    mbedtls_ssl_cache_entry *next;      /*!< chain pointer      */
+    unsigned char id[32];               /*!< session identifier */
+    size_t id_len;                      /*!< session id length  */
+    unsigned char *session;             /*!< serialized session */
+    size_t session_len;                 /*!< length of session  */
+    mbedtls_ssl_cache_entry *prev;      /*!< older entry        */
+    mbedtls_ssl_cache_entry *next;      /*!< newer entry        */
+    mbedtls_ssl_cache_entry *chain;     /*!< next in bucket     */
 };
 
+/**
+ * \brief   Part of the cache holding the sessions whose ID hashes to it,
+ *          with its own lock
+ */
+typedef struct
+{
+    mbedtls_ssl_cache_entry **buckets;  /*!< index by session ID    */
+    size_t nb_buckets;                  /*!< power of two, or 0     */
+    mbedtls_ssl_cache_entry *oldest;    /*!< first to expire        */
+    mbedtls_ssl_cache_entry *newest;    /*!< last to expire         */
+    int count;                          /*!< entries in the shard   */
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_threading_mutex_t mutex;    /*!< mutex                  */
+#endif
+}
+mbedtls_ssl_cache_shard;
+
 /**
  * \brief Cache context
+ *
+ * Sessions are spread over MBEDTLS_SSL_CACHE_SHARDS shards by a hash of
+ * their ID. Each shard indexes its entries in a hash table and keeps them
+ * in expiry order, so lookups and insertions take constant time and only
+ * contend with the connections of the same shard. The number of entries
+ * of the whole cache is kept under its own lock, always taken after the
+ * one of a shard.
  */
 struct mbedtls_ssl_cache_context
 {
-    mbedtls_ssl_cache_entry *chain;     /*!< start of the chain     */
+    mbedtls_ssl_cache_shard shards[MBEDTLS_SSL_CACHE_SHARDS]; /*!< shards */
     int timeout;                /*!< cache entry timeout    */
     int max_entries;            /*!< maximum entries        */
+    int count;                  /*!< entries in all shards  */
 #if defined(MBEDTLS_THREADING_C)
-    mbedtls_threading_mutex_t mutex;    /*!< mutex                  */
+    mbedtls_threading_mutex_t count_mutex; /*!< mutex for count */
 #endif
 };
 
@@ -124,6 +156,10 @@ void mbedtls_ssl_cache_set_timeout( mbedtls_ssl_cache_context *cache, int timeou
  * \brief          Set the maximum number of cache entries
  *                 (Default: MBEDTLS_SSL_CACHE_DEFAULT_MAX_ENTRIES (50))
  *
+ * \note           Once the cache is full, a new session replaces the
+ *                 oldest entry of its shard. If that shard is empty, the
+ *                 new session isn't cached.
+ *
  * \param cache    SSL cache context
  * \param max      cache entry maximum
  */
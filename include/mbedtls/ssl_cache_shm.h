@@ -0,0 +1,150 @@
+/**
+ * \file ssl_cache_shm.h
+ *
+ * \brief SSL session cache in memory shared by forked processes
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+#ifndef MBEDTLS_SSL_CACHE_SHM_H
+#define MBEDTLS_SSL_CACHE_SHM_H
+
+#include "ssl.h"
+
+#include <stdint.h>
+
+/**
+ * \name SECTION: Module settings
+ *
+ * The configuration options you can set for this module are in this section.
+ * Either change them in config.h or define them on the compiler command line.
+ * \{
+ */
+
+#if !defined(MBEDTLS_SSL_CACHE_SHM_WAYS)
+#define MBEDTLS_SSL_CACHE_SHM_WAYS                 8   /*!< Slots a session ID can be stored in */
+#endif
+
+#if !defined(MBEDTLS_SSL_CACHE_SHM_LOCKS)
+#define MBEDTLS_SSL_CACHE_SHM_LOCKS               64   /*!< Locks shared by the sets of slots   */
+#endif
+
+#if !defined(MBEDTLS_SSL_CACHE_SHM_SESSION_LEN)
+#define MBEDTLS_SSL_CACHE_SHM_SESSION_LEN       2048   /*!< Largest serialized session stored   */
+#endif
+
+/* \} name SECTION: Module settings */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mbedtls_ssl_cache_shm_region mbedtls_ssl_cache_shm_region;
+
+/**
+ * \brief   Shared session cache context
+ *
+ * The sessions are kept serialized in fixed-size slots of a region
+ * mapped with MAP_SHARED, set up once by the parent process before it
+ * forks its workers. A session ID hashes to a set of
+ * MBEDTLS_SSL_CACHE_SHM_WAYS slots, and the sets are protected by
+ * MBEDTLS_SSL_CACHE_SHM_LOCKS process-shared mutexes. A full set
+ * replaces its oldest session.
+ */
+typedef struct
+{
+    mbedtls_ssl_cache_shm_region *region;   /*!< shared mapping, or NULL  */
+    size_t region_len;                      /*!< size of the mapping      */
+}
+mbedtls_ssl_cache_shm_context;
+
+/**
+ * \brief          Initialize a shared SSL cache context
+ *
+ * \param cache    shared SSL cache context
+ */
+void mbedtls_ssl_cache_shm_init( mbedtls_ssl_cache_shm_context *cache );
+
+/**
+ * \brief          Map the shared region of the cache. Must be called
+ *                 before the worker processes are forked.
+ *
+ * \param cache    shared SSL cache context
+ * \param max_entries  number of sessions the region holds, rounded up
+ *                 to a multiple of MBEDTLS_SSL_CACHE_SHM_WAYS
+ * \param timeout  session timeout in seconds, 0 for none (ignored
+ *                 without MBEDTLS_HAVE_TIME)
+ *
+ * \return         0 if successful,
+ *                 MBEDTLS_ERR_SSL_BAD_INPUT_DATA if max_entries < 1,
+ *                 MBEDTLS_ERR_SSL_ALLOC_FAILED if the region can't be
+ *                 mapped or its locks can't be set up
+ */
+int mbedtls_ssl_cache_shm_setup( mbedtls_ssl_cache_shm_context *cache,
+                                 int max_entries, int timeout );
+
+/**
+ * \brief          Cache get callback implementation
+ *                 (Safe to call from any of the processes sharing the cache)
+ *
+ * \param data     shared SSL cache context
+ * \param session  session to retrieve entry for
+ */
+int mbedtls_ssl_cache_shm_get( void *data, mbedtls_ssl_session *session );
+
+/**
+ * \brief          Cache set callback implementation
+ *                 (Safe to call from any of the processes sharing the cache)
+ *
+ * \note           Sessions that take more than
+ *                 MBEDTLS_SSL_CACHE_SHM_SESSION_LEN bytes once serialized
+ *                 by mbedtls_ssl_session_save() are not stored. Those
+ *                 with a peer certificate take about 100 bytes more than
+ *                 the certificate, or about 130 bytes in total with
+ *                 MBEDTLS_SSL_SESSION_CERT_DIGEST.
+ *
+ * \param data     shared SSL cache context
+ * \param session  session to store entry for
+ */
+int mbedtls_ssl_cache_shm_set( void *data, const mbedtls_ssl_session *session );
+
+/**
+ * \brief          Read the counters of the cache, summed over all the
+ *                 processes sharing it
+ *
+ * \param cache    shared SSL cache context
+ * \param hits     sessions found by mbedtls_ssl_cache_shm_get()
+ * \param misses   lookups that found no session
+ * \param evictions  live sessions replaced by mbedtls_ssl_cache_shm_set()
+ */
+void mbedtls_ssl_cache_shm_stats( const mbedtls_ssl_cache_shm_context *cache,
+                                  unsigned long *hits, unsigned long *misses,
+                                  unsigned long *evictions );
+
+/**
+ * \brief          Unmap the shared region from this process. The
+ *                 region goes away with the last process mapping it.
+ *
+ * \param cache    shared SSL cache context
+ */
+void mbedtls_ssl_cache_shm_free( mbedtls_ssl_cache_shm_context *cache );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ssl_cache_shm.h */
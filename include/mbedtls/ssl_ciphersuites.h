@@ -233,6 +233,17 @@ extern "C" {
 
 #define MBEDTLS_TLS_MILAGRO_CS_WITH_AES_128_GCM_SHA256   0xC0B1  /**< TLS 1.2, experimental */
 #define MBEDTLS_TLS_MILAGRO_P2P_WITH_AES_128_GCM_SHA256  0xC0B2  /**< TLS 1.2, experimental */
+#define MBEDTLS_TLS_MILAGRO_CS_WITH_CHACHA20_POLY1305_SHA256  0xC0B3  /**< TLS 1.2, experimental */
+#define MBEDTLS_TLS_MILAGRO_P2P_WITH_CHACHA20_POLY1305_SHA256 0xC0B4  /**< TLS 1.2, experimental */
+
+/* RFC 7905 */
+#define MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256     0xCCA8 /**< TLS 1.2 */
+#define MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256   0xCCA9 /**< TLS 1.2 */
+#define MBEDTLS_TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256       0xCCAA /**< TLS 1.2 */
+#define MBEDTLS_TLS_PSK_WITH_CHACHA20_POLY1305_SHA256           0xCCAB /**< TLS 1.2 */
+#define MBEDTLS_TLS_ECDHE_PSK_WITH_CHACHA20_POLY1305_SHA256     0xCCAC /**< TLS 1.2 */
+#define MBEDTLS_TLS_DHE_PSK_WITH_CHACHA20_POLY1305_SHA256       0xCCAD /**< TLS 1.2 */
+#define MBEDTLS_TLS_RSA_PSK_WITH_CHACHA20_POLY1305_SHA256       0xCCAE /**< TLS 1.2 */
 
 /* Reminder: update mbedtls_ssl_premaster_secret when adding a new key exchange.
  * Reminder: update MBEDTLS_KEY_EXCHANGE__xxx below
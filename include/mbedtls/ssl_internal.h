@@ -50,6 +50,10 @@ defined(MBEDTLS_TLS_MILAGRO_P2P)
 #include "milagro.h"
 #endif
 
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+#include "timing.h"
+#endif
+
 #if ( defined(__ARMCC_VERSION) || defined(_MSC_VER) ) && \
     !defined(inline) && !defined(__cplusplus)
 #define inline __inline
@@ -150,6 +154,32 @@ defined(MBEDTLS_TLS_MILAGRO_P2P)
                         + MBEDTLS_SSL_PADDING_ADD                   \
                         )
 
+/*
+ * Current size of the input / output buffers of a context, which is only
+ * smaller than MBEDTLS_SSL_BUFFER_LEN with variable-size buffers.
+ */
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+#define MBEDTLS_SSL_IN_BUFFER_LEN( ssl )    ( (ssl)->in_buf_len )
+#define MBEDTLS_SSL_OUT_BUFFER_LEN( ssl )   ( (ssl)->out_buf_len )
+
+/* An idle buffer must at least hold an alert with full record expansion */
+#if MBEDTLS_SSL_IDLE_BUFFER_LEN < \
+    MBEDTLS_SSL_BUFFER_LEN - MBEDTLS_SSL_MAX_CONTENT_LEN + 16
+#error "MBEDTLS_SSL_IDLE_BUFFER_LEN too small for the enabled ciphersuites"
+#endif
+#if MBEDTLS_SSL_IDLE_BUFFER_LEN > MBEDTLS_SSL_BUFFER_LEN
+#error "MBEDTLS_SSL_IDLE_BUFFER_LEN larger than MBEDTLS_SSL_BUFFER_LEN"
+#endif
+#else
+#define MBEDTLS_SSL_IN_BUFFER_LEN( ssl )    MBEDTLS_SSL_BUFFER_LEN
+#define MBEDTLS_SSL_OUT_BUFFER_LEN( ssl )   MBEDTLS_SSL_BUFFER_LEN
+#endif
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH) && \
+    MBEDTLS_SSL_WRITE_BATCH_RECORDS > MBEDTLS_SSL_WRITE_BATCH_MAX
+#error "MBEDTLS_SSL_WRITE_BATCH_RECORDS larger than MBEDTLS_SSL_WRITE_BATCH_MAX"
+#endif
+
 /*
  * TLS extension flags (for extensions with outgoing ServerHello content
  * that need it (e.g. for RENEGOTIATION_INFO the server already knows because
@@ -158,6 +188,7 @@ defined(MBEDTLS_TLS_MILAGRO_P2P)
 #define MBEDTLS_TLS_EXT_SUPPORTED_POINT_FORMATS_PRESENT (1 << 0)
 #define MBEDTLS_TLS_EXT_ECJPAKE_KKPP_OK                 (1 << 1)
 #define MBEDTLS_TLS_EXT_MILAGRO_CS_OK                         (1 << 2)
+#define MBEDTLS_TLS_EXT_MILAGRO_CS_PENDING                    (1 << 3)
 
 #ifdef __cplusplus
 extern "C" {
@@ -274,6 +305,9 @@ struct mbedtls_ssl_handshake_params
 #if defined(MBEDTLS_TLS_MILAGRO_P2P)
     mbedtls_milagro_p2p_context *milagro_p2p;
 #endif /* MBEDTLS_TLS_MILAGRO_P2P */
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    unsigned long timing_start;         /*!< start of the timed operation */
+#endif
     
 };
 
@@ -369,6 +403,13 @@ int mbedtls_ssl_send_fatal_handshake_failure( mbedtls_ssl_context *ssl );
 void mbedtls_ssl_reset_checksum( mbedtls_ssl_context *ssl );
 int mbedtls_ssl_derive_keys( mbedtls_ssl_context *ssl );
 
+#if defined(MBEDTLS_SSL_PROTO_TLS1_2) && defined(MBEDTLS_SHA256_C)
+int mbedtls_ssl_tls_prf_sha256( const unsigned char *secret, size_t slen,
+                                const char *label,
+                                const unsigned char *random, size_t rlen,
+                                unsigned char *dstbuf, size_t dlen );
+#endif
+
 int mbedtls_ssl_read_record( mbedtls_ssl_context *ssl );
 int mbedtls_ssl_fetch_input( mbedtls_ssl_context *ssl, size_t nb_want );
 
@@ -403,6 +444,34 @@ int mbedtls_ssl_milagro_p2p_derive_premaster(int client_or_server,
 int mbedtls_ssl_psk_derive_premaster( mbedtls_ssl_context *ssl, mbedtls_key_exchange_type_t key_ex );
 #endif
 
+#if defined(MBEDTLS_ECDH_C)
+int mbedtls_ssl_ecdh_gen_public( mbedtls_ssl_context *ssl );
+#endif
+
+/*
+ * Time an expensive operation of the handshake for the timing callback:
+ * MBEDTLS_SSL_TIMING_BEGIN( ssl ) before it and
+ * MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_XXX ) after it.
+ */
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+void mbedtls_ssl_timing_report( mbedtls_ssl_context *ssl, int event );
+
+#define MBEDTLS_SSL_TIMING_BEGIN( ssl )                                     \
+    do {                                                                    \
+        if( (ssl)->conf->f_timing != NULL )                                 \
+            (ssl)->handshake->timing_start = mbedtls_timing_monotonic_us(); \
+    } while( 0 )
+
+#define MBEDTLS_SSL_TIMING_END( ssl, event )                                \
+    do {                                                                    \
+        if( (ssl)->conf->f_timing != NULL )                                 \
+            mbedtls_ssl_timing_report( (ssl), (event) );                    \
+    } while( 0 )
+#else
+#define MBEDTLS_SSL_TIMING_BEGIN( ssl )         do { } while( 0 )
+#define MBEDTLS_SSL_TIMING_END( ssl, event )    do { } while( 0 )
+#endif /* MBEDTLS_SSL_HANDSHAKE_TIMING */
+
 #if defined(MBEDTLS_PK_C)
 unsigned char mbedtls_ssl_sig_from_pk( mbedtls_pk_context *pk );
 mbedtls_pk_type_t mbedtls_ssl_pk_alg_from_sig( unsigned char sig );
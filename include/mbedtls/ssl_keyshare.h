@@ -0,0 +1,225 @@
+/**
+ * \file ssl_keyshare.h
+ *
+ * \brief Pool of precomputed ephemeral ECDH key pairs
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+#ifndef MBEDTLS_SSL_KEYSHARE_H
+#define MBEDTLS_SSL_KEYSHARE_H
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+
+#include "ssl.h"
+
+#if defined(MBEDTLS_THREADING_C)
+#include "threading.h"
+#endif
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+#include <pthread.h>
+#endif
+
+/**
+ * \name SECTION: Module settings
+ *
+ * The configuration options you can set for this module are in this section.
+ * Either change them in config.h or define them on the compiler command line.
+ * \{
+ */
+
+#if !defined(MBEDTLS_SSL_KEYSHARE_MAX_CURVES)
+#define MBEDTLS_SSL_KEYSHARE_MAX_CURVES          4   /*!< Maximum curves in a pool */
+#endif
+
+#if !defined(MBEDTLS_SSL_KEYSHARE_MAX_THREADS)
+#define MBEDTLS_SSL_KEYSHARE_MAX_THREADS         4   /*!< Maximum refill threads   */
+#endif
+
+/* \} name SECTION: Module settings */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief   Ready key pairs of one curve
+ */
+typedef struct
+{
+    mbedtls_ecp_group_id grp_id;    /*!< curve of the pairs                 */
+    mbedtls_mpi *d;                 /*!< private values                     */
+    mbedtls_ecp_point *Q;           /*!< public values                      */
+    int nb_pairs;                   /*!< number of ready pairs              */
+    unsigned long hits;             /*!< pairs taken by a handshake         */
+    unsigned long misses;           /*!< handshakes that found no pair      */
+    unsigned long generated;        /*!< pairs added to the pool            */
+}
+mbedtls_ssl_keyshare_curve;
+
+/**
+ * \brief   Keyshare pool context
+ */
+typedef struct
+{
+    mbedtls_ssl_keyshare_curve curves[MBEDTLS_SSL_KEYSHARE_MAX_CURVES];
+    int nb_curves;                  /*!< number of curves in use            */
+    int max_pairs;                  /*!< pairs kept per curve               */
+    int low_water;                  /*!< refill is requested below this     */
+
+    /** Callback for getting (pseudo-)random numbers                        */
+    int  (*f_rng)(void *, unsigned char *, size_t);
+    void *p_rng;                    /*!< context for the RNG function       */
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_threading_mutex_t mutex;
+#endif
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_t threads[MBEDTLS_SSL_KEYSHARE_MAX_THREADS]; /*!< refill threads */
+    int nb_threads;                 /*!< number of started threads          */
+    int shutdown;                   /*!< set when the threads have to exit  */
+    unsigned long wakeup;           /*!< incremented on refill requests     */
+    pthread_mutex_t wake_mutex;     /*!< protects nb_threads, shutdown and
+                                         wakeup                             */
+    pthread_cond_t wake;            /*!< signalled on wakeup or shutdown    */
+#endif
+}
+mbedtls_ssl_keyshare_pool;
+
+/**
+ * \brief           Initialize a keyshare pool.
+ *                  (Just make it ready for mbedtls_ssl_keyshare_setup()
+ *                  or mbedtls_ssl_keyshare_free().)
+ *
+ * \param pool      Pool to be initialized
+ */
+void mbedtls_ssl_keyshare_init( mbedtls_ssl_keyshare_pool *pool );
+
+/**
+ * \brief           Prepare a pool to be actually used
+ *
+ * \param pool      Pool to be set up
+ * \param curves    Curves to keep pairs for, terminated by
+ *                  MBEDTLS_ECP_DP_NONE (at most
+ *                  MBEDTLS_SSL_KEYSHARE_MAX_CURVES of them)
+ * \param max_pairs Number of pairs kept per curve
+ * \param f_rng     RNG callback function, it must be thread-safe if
+ *                  refill threads are started
+ * \param p_rng     RNG callback context
+ *
+ * \note            The pool starts empty: fill it with
+ *                  mbedtls_ssl_keyshare_refill() or start refill threads
+ *                  with mbedtls_ssl_keyshare_start().
+ *
+ * \return          0 if successful,
+ *                  or a specific MBEDTLS_ERR_XXX error code
+ */
+int mbedtls_ssl_keyshare_setup( mbedtls_ssl_keyshare_pool *pool,
+                                const mbedtls_ecp_group_id *curves,
+                                int max_pairs,
+                                int (*f_rng)(void *, unsigned char *, size_t),
+                                void *p_rng );
+
+/**
+ * \brief           Set the number of pairs of a curve under which a refill
+ *                  is requested (Default: half of max_pairs)
+ *
+ * \param pool      Keyshare pool
+ * \param low_water Low-water mark, between 1 and max_pairs
+ */
+void mbedtls_ssl_keyshare_set_low_water( mbedtls_ssl_keyshare_pool *pool,
+                                         int low_water );
+
+/**
+ * \brief           Implementation of the keyshare callback: move a ready
+ *                  pair of the curve into d and Q
+ *
+ * \note            See \c mbedtls_ssl_keyshare_t for description
+ */
+mbedtls_ssl_keyshare_t mbedtls_ssl_keyshare_get;
+
+/**
+ * \brief           Fill every curve of the pool up to max_pairs
+ *
+ * \param pool      Keyshare pool
+ *
+ * \note            The key generation is made without holding the lock of
+ *                  the pool, so handshakes can take pairs meanwhile.
+ *
+ * \return          0 if successful,
+ *                  or a specific MBEDTLS_ERR_XXX error code
+ */
+int mbedtls_ssl_keyshare_refill( mbedtls_ssl_keyshare_pool *pool );
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+/**
+ * \brief           Start threads that refill the pool when a curve goes
+ *                  under the low-water mark
+ *
+ * \param pool      Keyshare pool
+ * \param nb_threads Number of threads, at most
+ *                  MBEDTLS_SSL_KEYSHARE_MAX_THREADS
+ *
+ * \return          0 if successful,
+ *                  or a specific MBEDTLS_ERR_XXX error code
+ */
+int mbedtls_ssl_keyshare_start( mbedtls_ssl_keyshare_pool *pool, int nb_threads );
+#endif
+
+/**
+ * \brief           Get the metrics of a curve of the pool
+ *
+ * \param pool      Keyshare pool
+ * \param grp_id    Curve
+ * \param available Number of ready pairs
+ * \param hits      Pairs taken by a handshake
+ * \param misses    Handshakes that had to generate their pair
+ * \param generated Pairs added to the pool
+ *
+ * \return          0 if successful,
+ *                  MBEDTLS_ERR_ECP_FEATURE_UNAVAILABLE if the curve is not
+ *                  in the pool, or a specific MBEDTLS_ERR_XXX error code
+ */
+int mbedtls_ssl_keyshare_stats( mbedtls_ssl_keyshare_pool *pool,
+                                mbedtls_ecp_group_id grp_id,
+                                int *available,
+                                unsigned long *hits,
+                                unsigned long *misses,
+                                unsigned long *generated );
+
+/**
+ * \brief           Stop the refill threads, free a pool's content and
+ *                  zeroize it.
+ *
+ * \param pool      Pool to be cleaned up
+ */
+void mbedtls_ssl_keyshare_free( mbedtls_ssl_keyshare_pool *pool );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MBEDTLS_SSL_KEYSHARE_C */
+
+#endif /* ssl_keyshare.h */
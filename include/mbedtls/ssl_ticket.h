@@ -36,6 +36,20 @@
 #include "threading.h"
 #endif
 
+/**
+ * \name SECTION: Module settings
+ *
+ * The configuration options you can set for this module are in this section.
+ * Either change them in config.h or define them on the compiler command line.
+ * \{
+ */
+
+#if !defined(MBEDTLS_SSL_TICKET_KEYS)
+#define MBEDTLS_SSL_TICKET_KEYS                     2   /*!< Keys accepted at the same time */
+#endif
+
+/* \} name SECTION: Module settings */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -47,17 +61,32 @@ typedef struct
 {
     unsigned char name[4];          /*!< random key identifier              */
     uint32_t generation_time;       /*!< key generation timestamp (seconds) */
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    unsigned char key[32];          /*!< key, set up for each ticket        */
+    unsigned int seq;               /*!< odd while the key is replaced      */
+#else
     mbedtls_cipher_context_t ctx;   /*!< context for auth enc/decryption    */
+#endif
 }
 mbedtls_ssl_ticket_key;
 
 /**
  * \brief   Context for session ticket handling functions
+ *
+ * The keys form a ring: tickets are written with the active key, and
+ * rotating replaces the oldest key with a new one that becomes active.
+ *
+ * With MBEDTLS_SSL_TICKET_LOCKLESS, the mutex is only taken to rotate
+ * the keys: tickets are written and parsed with a copy of the key, read
+ * under its sequence number, and a cipher context of their own.
  */
 typedef struct
 {
-    mbedtls_ssl_ticket_key keys[2]; /*!< ticket protection keys             */
+    mbedtls_ssl_ticket_key keys[MBEDTLS_SSL_TICKET_KEYS]; /*!< ticket protection keys */
     unsigned char active;           /*!< index of the currently active key  */
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    const mbedtls_cipher_info_t *cipher_info; /*!< cipher of the keys       */
+#endif
 
     uint32_t ticket_lifetime;       /*!< lifetime of tickets in seconds     */
 
@@ -95,9 +124,19 @@ void mbedtls_ssl_ticket_init( mbedtls_ssl_ticket_context *ctx );
  *                  least as strong as the the strongest ciphersuite
  *                  supported. Usually that means a 256-bit key.
  *
- * \note            The lifetime of the keys is twice the lifetime of tickets.
- *                  It is recommended to pick a reasonnable lifetime so as not
- *                  to negate the benefits of forward secrecy.
+ * \note            A new key is made every lifetime / (MBEDTLS_SSL_TICKET_KEYS
+ *                  - 1) seconds, so the lifetime of the keys is
+ *                  MBEDTLS_SSL_TICKET_KEYS / (MBEDTLS_SSL_TICKET_KEYS - 1)
+ *                  times the lifetime of tickets: twice with the default
+ *                  two keys. More keys rotate faster for the same ticket
+ *                  lifetime. It is recommended to pick a reasonnable
+ *                  lifetime so as not to negate the benefits of forward
+ *                  secrecy.
+ *
+ * \note            With MBEDTLS_SSL_TICKET_LOCKLESS, f_rng is called
+ *                  without holding the context's mutex, and must be
+ *                  thread-safe by itself (as mbedtls_ctr_drbg_random() is
+ *                  with MBEDTLS_THREADING_C).
  *
  * \return          0 if successful,
  *                  or a specific MBEDTLS_ERR_XXX error code
@@ -76,6 +76,14 @@ unsigned long mbedtls_timing_hardclock( void );
  */
 unsigned long mbedtls_timing_get_timer( struct mbedtls_timing_hr_time *val, int reset );
 
+/**
+ * \brief          Return a monotonic time in microseconds
+ *
+ * \note           The origin is arbitrary and the value wraps around: only
+ *                 differences between two values are meaningful.
+ */
+unsigned long mbedtls_timing_monotonic_us( void );
+
 /**
  * \brief          Setup an alarm clock
  *
@@ -33,6 +33,7 @@
 #if defined(MBEDTLS_AESNI_C)
 
 #include "mbedtls/aesni.h"
+#include "mbedtls/cpu.h"
 
 #include <string.h>
 
@@ -47,20 +48,10 @@
  */
 int mbedtls_aesni_has_support( unsigned int what )
 {
-    static int done = 0;
-    static unsigned int c = 0;
+    unsigned int features = mbedtls_cpu_features();
 
-    if( ! done )
-    {
-        asm( "movl  $1, %%eax   \n\t"
-             "cpuid             \n\t"
-             : "=c" (c)
-             :
-             : "eax", "ebx", "edx" );
-        done = 1;
-    }
-
-    return( ( c & what ) != 0 );
+    return( ( ( what & MBEDTLS_AESNI_AES ) && ( features & MBEDTLS_CPU_AESNI ) ) ||
+            ( ( what & MBEDTLS_AESNI_CLMUL ) && ( features & MBEDTLS_CPU_PCLMUL ) ) );
 }
 
 /*
@@ -86,8 +77,15 @@ int mbedtls_aesni_has_support( unsigned int what )
 #define xmm0_xmm2   "0xD0"
 #define xmm0_xmm3   "0xD8"
 #define xmm0_xmm4   "0xE0"
+#define xmm0_xmm5   "0xE8"
+#define xmm0_xmm6   "0xF0"
+#define xmm0_xmm7   "0xF8"
 #define xmm1_xmm0   "0xC1"
 #define xmm1_xmm2   "0xD1"
+#define xmm4_xmm0   "0xC4"
+#define xmm4_xmm1   "0xCC"
+#define xmm4_xmm2   "0xD4"
+#define xmm4_xmm3   "0xDC"
 
 /*
  * AES-NI AES-ECB block en(de)cryption
@@ -134,6 +132,73 @@ int mbedtls_aesni_crypt_ecb( mbedtls_aes_context *ctx,
     return( 0 );
 }
 
+/*
+ * Shift the carry-less product xmm2:xmm1 one bit to the left and reduce
+ * it modulo the GCM polynomial, leaving the result in xmm0.
+ * Clobbers xmm1 to xmm5.
+ */
+#define GCM_SHIFT_REDUCE                                                      \
+    /*                                                                        \
+     * Now shift the result one bit to the left,                              \
+     * taking advantage of [CLMUL-WP] eq 27 (p. 20)                           \
+     */                                                                       \
+    "movdqa %%xmm1, %%xmm3             \n\t" /* r1:r0 */                      \
+    "movdqa %%xmm2, %%xmm4             \n\t" /* r3:r2 */                      \
+    "psllq $1, %%xmm1                  \n\t" /* r1<<1:r0<<1 */                \
+    "psllq $1, %%xmm2                  \n\t" /* r3<<1:r2<<1 */                \
+    "psrlq $63, %%xmm3                 \n\t" /* r1>>63:r0>>63 */              \
+    "psrlq $63, %%xmm4                 \n\t" /* r3>>63:r2>>63 */              \
+    "movdqa %%xmm3, %%xmm5             \n\t" /* r1>>63:r0>>63 */              \
+    "pslldq $8, %%xmm3                 \n\t" /* r0>>63:0 */                   \
+    "pslldq $8, %%xmm4                 \n\t" /* r2>>63:0 */                   \
+    "psrldq $8, %%xmm5                 \n\t" /* 0:r1>>63 */                   \
+    "por %%xmm3, %%xmm1                \n\t" /* r1<<1|r0>>63:r0<<1 */         \
+    "por %%xmm4, %%xmm2                \n\t" /* r3<<1|r2>>62:r2<<1 */         \
+    "por %%xmm5, %%xmm2                \n\t" /* r3<<1|r2>>62:r2<<1|r1>>63 */  \
+                                                                              \
+    /*                                                                        \
+     * Now reduce modulo the GCM polynomial x^128 + x^7 + x^2 + x + 1         \
+     * using [CLMUL-WP] algorithm 5 (p. 20).                                  \
+     * Currently xmm2:xmm1 holds x3:x2:x1:x0 (already shifted).               \
+     */                                                                       \
+    /* Step 2 (1) */                                                          \
+    "movdqa %%xmm1, %%xmm3             \n\t" /* x1:x0 */                      \
+    "movdqa %%xmm1, %%xmm4             \n\t" /* same */                       \
+    "movdqa %%xmm1, %%xmm5             \n\t" /* same */                       \
+    "psllq $63, %%xmm3                 \n\t" /* x1<<63:x0<<63 = stuff:a */    \
+    "psllq $62, %%xmm4                 \n\t" /* x1<<62:x0<<62 = stuff:b */    \
+    "psllq $57, %%xmm5                 \n\t" /* x1<<57:x0<<57 = stuff:c */    \
+                                                                              \
+    /* Step 2 (2) */                                                          \
+    "pxor %%xmm4, %%xmm3               \n\t" /* stuff:a+b */                  \
+    "pxor %%xmm5, %%xmm3               \n\t" /* stuff:a+b+c */                \
+    "pslldq $8, %%xmm3                 \n\t" /* a+b+c:0 */                    \
+    "pxor %%xmm3, %%xmm1               \n\t" /* x1+a+b+c:x0 = d:x0 */         \
+                                                                              \
+    /* Steps 3 and 4 */                                                       \
+    "movdqa %%xmm1,%%xmm0              \n\t" /* d:x0 */                       \
+    "movdqa %%xmm1,%%xmm4              \n\t" /* same */                       \
+    "movdqa %%xmm1,%%xmm5              \n\t" /* same */                       \
+    "psrlq $1, %%xmm0                  \n\t" /* e1:x0>>1 = e1:e0' */          \
+    "psrlq $2, %%xmm4                  \n\t" /* f1:x0>>2 = f1:f0' */          \
+    "psrlq $7, %%xmm5                  \n\t" /* g1:x0>>7 = g1:g0' */          \
+    "pxor %%xmm4, %%xmm0               \n\t" /* e1+f1:e0'+f0' */              \
+    "pxor %%xmm5, %%xmm0               \n\t" /* e1+f1+g1:e0'+f0'+g0' */       \
+    /* e0'+f0'+g0' is almost e0+f0+g0, except for some missing */             \
+    /* bits carried from d. Now get those bits back in. */                    \
+    "movdqa %%xmm1,%%xmm3              \n\t" /* d:x0 */                       \
+    "movdqa %%xmm1,%%xmm4              \n\t" /* same */                       \
+    "movdqa %%xmm1,%%xmm5              \n\t" /* same */                       \
+    "psllq $63, %%xmm3                 \n\t" /* d<<63:stuff */                \
+    "psllq $62, %%xmm4                 \n\t" /* d<<62:stuff */                \
+    "psllq $57, %%xmm5                 \n\t" /* d<<57:stuff */                \
+    "pxor %%xmm4, %%xmm3               \n\t" /* d<<63+d<<62:stuff */          \
+    "pxor %%xmm5, %%xmm3               \n\t" /* missing bits of d:stuff */    \
+    "psrldq $8, %%xmm3                 \n\t" /* 0:missing bits of d */        \
+    "pxor %%xmm3, %%xmm0               \n\t" /* e1+f1+g1:e0+f0+g0 */          \
+    "pxor %%xmm1, %%xmm0               \n\t" /* h1:h0 */                      \
+    "pxor %%xmm2, %%xmm0               \n\t" /* x3+h1:x2+h0 */
+
 /*
  * GCM multiplication: c = a times b in GF(2^128)
  * Based on [CLMUL-WP] algorithms 1 (with equation 27) and 5.
@@ -173,66 +238,7 @@ void mbedtls_aesni_gcm_mult( unsigned char c[16],
          "pxor %%xmm4, %%xmm2               \n\t" // d1:d0+e1+f1
          "pxor %%xmm3, %%xmm1               \n\t" // c1+e0+f1:c0
 
-         /*
-          * Now shift the result one bit to the left,
-          * taking advantage of [CLMUL-WP] eq 27 (p. 20)
-          */
-         "movdqa %%xmm1, %%xmm3             \n\t" // r1:r0
-         "movdqa %%xmm2, %%xmm4             \n\t" // r3:r2
-         "psllq $1, %%xmm1                  \n\t" // r1<<1:r0<<1
-         "psllq $1, %%xmm2                  \n\t" // r3<<1:r2<<1
-         "psrlq $63, %%xmm3                 \n\t" // r1>>63:r0>>63
-         "psrlq $63, %%xmm4                 \n\t" // r3>>63:r2>>63
-         "movdqa %%xmm3, %%xmm5             \n\t" // r1>>63:r0>>63
-         "pslldq $8, %%xmm3                 \n\t" // r0>>63:0
-         "pslldq $8, %%xmm4                 \n\t" // r2>>63:0
-         "psrldq $8, %%xmm5                 \n\t" // 0:r1>>63
-         "por %%xmm3, %%xmm1                \n\t" // r1<<1|r0>>63:r0<<1
-         "por %%xmm4, %%xmm2                \n\t" // r3<<1|r2>>62:r2<<1
-         "por %%xmm5, %%xmm2                \n\t" // r3<<1|r2>>62:r2<<1|r1>>63
-
-         /*
-          * Now reduce modulo the GCM polynomial x^128 + x^7 + x^2 + x + 1
-          * using [CLMUL-WP] algorithm 5 (p. 20).
-          * Currently xmm2:xmm1 holds x3:x2:x1:x0 (already shifted).
-          */
-         /* Step 2 (1) */
-         "movdqa %%xmm1, %%xmm3             \n\t" // x1:x0
-         "movdqa %%xmm1, %%xmm4             \n\t" // same
-         "movdqa %%xmm1, %%xmm5             \n\t" // same
-         "psllq $63, %%xmm3                 \n\t" // x1<<63:x0<<63 = stuff:a
-         "psllq $62, %%xmm4                 \n\t" // x1<<62:x0<<62 = stuff:b
-         "psllq $57, %%xmm5                 \n\t" // x1<<57:x0<<57 = stuff:c
-
-         /* Step 2 (2) */
-         "pxor %%xmm4, %%xmm3               \n\t" // stuff:a+b
-         "pxor %%xmm5, %%xmm3               \n\t" // stuff:a+b+c
-         "pslldq $8, %%xmm3                 \n\t" // a+b+c:0
-         "pxor %%xmm3, %%xmm1               \n\t" // x1+a+b+c:x0 = d:x0
-
-         /* Steps 3 and 4 */
-         "movdqa %%xmm1,%%xmm0              \n\t" // d:x0
-         "movdqa %%xmm1,%%xmm4              \n\t" // same
-         "movdqa %%xmm1,%%xmm5              \n\t" // same
-         "psrlq $1, %%xmm0                  \n\t" // e1:x0>>1 = e1:e0'
-         "psrlq $2, %%xmm4                  \n\t" // f1:x0>>2 = f1:f0'
-         "psrlq $7, %%xmm5                  \n\t" // g1:x0>>7 = g1:g0'
-         "pxor %%xmm4, %%xmm0               \n\t" // e1+f1:e0'+f0'
-         "pxor %%xmm5, %%xmm0               \n\t" // e1+f1+g1:e0'+f0'+g0'
-         // e0'+f0'+g0' is almost e0+f0+g0, ex\tcept for some missing
-         // bits carried from d. Now get those\t bits back in.
-         "movdqa %%xmm1,%%xmm3              \n\t" // d:x0
-         "movdqa %%xmm1,%%xmm4              \n\t" // same
-         "movdqa %%xmm1,%%xmm5              \n\t" // same
-         "psllq $63, %%xmm3                 \n\t" // d<<63:stuff
-         "psllq $62, %%xmm4                 \n\t" // d<<62:stuff
-         "psllq $57, %%xmm5                 \n\t" // d<<57:stuff
-         "pxor %%xmm4, %%xmm3               \n\t" // d<<63+d<<62:stuff
-         "pxor %%xmm5, %%xmm3               \n\t" // missing bits of d:stuff
-         "psrldq $8, %%xmm3                 \n\t" // 0:missing bits of d
-         "pxor %%xmm3, %%xmm0               \n\t" // e1+f1+g1:e0+f0+g0
-         "pxor %%xmm1, %%xmm0               \n\t" // h1:h0
-         "pxor %%xmm2, %%xmm0               \n\t" // x3+h1:x2+h0
+         GCM_SHIFT_REDUCE
 
          "movdqu %%xmm0, (%2)               \n\t" // done
          :
@@ -246,6 +252,210 @@ void mbedtls_aesni_gcm_mult( unsigned char c[16],
     return;
 }
 
+/*
+ * Byte-reversal mask for pshufb, and the increment of a byte-reversed
+ * counter block
+ */
+static const unsigned char aesni_bswap_mask[16] =
+    { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+static const unsigned char aesni_ctr_one[16] = { 1 };
+
+/*
+ * Precompute H^4, H^3, H^2 and H in the byte order used by the registers
+ */
+void mbedtls_aesni_gcm_powers( unsigned char hpow[64],
+                               const unsigned char h[16] )
+{
+    unsigned char hk[16];
+    size_t i, k;
+
+    memcpy( hk, h, 16 );
+
+    for( k = 4; k > 0; k-- )
+    {
+        for( i = 0; i < 16; i++ )
+            hpow[16 * ( k - 1 ) + i] = hk[15 - i];
+
+        mbedtls_aesni_gcm_mult( hk, hk, h );
+    }
+}
+
+/*
+ * Multiply-accumulate the block at offset OFF of c with the power of H
+ * at the same offset of hpow: xmm7:xmm6:xmm5 += c * H^k (unreduced)
+ */
+#define GCM_GHASH_ACCUMULATE( OFF )                                     \
+    "movdqu " OFF "(%2), %%xmm0         \n\t" /* next block */          \
+    "pshufb %%xmm3, %%xmm0              \n\t"                           \
+    "movdqu " OFF "(%1), %%xmm1         \n\t" /* H^k */                 \
+    "movdqa %%xmm1, %%xmm2              \n\t"                           \
+    PCLMULQDQ xmm0_xmm2 ",0x00          \n\t" /* low halves */          \
+    "pxor %%xmm2, %%xmm5                \n\t"                           \
+    "movdqa %%xmm1, %%xmm2              \n\t"                           \
+    PCLMULQDQ xmm0_xmm2 ",0x11          \n\t" /* high halves */         \
+    "pxor %%xmm2, %%xmm6                \n\t"                           \
+    "movdqa %%xmm1, %%xmm2              \n\t"                           \
+    PCLMULQDQ xmm0_xmm2 ",0x10          \n\t" /* middle terms */        \
+    "pxor %%xmm2, %%xmm7                \n\t"                           \
+    PCLMULQDQ xmm0_xmm1 ",0x01          \n\t"                           \
+    "pxor %%xmm1, %%xmm7                \n\t"
+
+/*
+ * GHASH four blocks with a single reduction, following [CLMUL-WP]
+ * section 4 (aggregated reduction):
+ *      buf = ( buf + c0 ) * H^4 + c1 * H^3 + c2 * H^2 + c3 * H
+ */
+static void aesni_gcm_ghash4( unsigned char buf[16],
+                              const unsigned char hpow[64],
+                              const unsigned char c[64] )
+{
+    asm( "movdqu (%3), %%xmm3               \n\t" // byte-reversal mask
+         "movdqu (%0), %%xmm4               \n\t" // current hash
+         "pshufb %%xmm3, %%xmm4             \n\t"
+         "movdqu (%2), %%xmm0               \n\t" // first block
+         "pshufb %%xmm3, %%xmm0             \n\t"
+         "pxor %%xmm4, %%xmm0               \n\t" // hash + first block
+         "movdqu (%1), %%xmm1               \n\t" // H^4
+         "movdqa %%xmm1, %%xmm5             \n\t"
+         "movdqa %%xmm1, %%xmm6             \n\t"
+         "movdqa %%xmm1, %%xmm7             \n\t"
+         PCLMULQDQ xmm0_xmm5 ",0x00         \n\t" // low halves
+         PCLMULQDQ xmm0_xmm6 ",0x11         \n\t" // high halves
+         PCLMULQDQ xmm0_xmm7 ",0x10         \n\t" // middle terms
+         PCLMULQDQ xmm0_xmm1 ",0x01         \n\t"
+         "pxor %%xmm1, %%xmm7               \n\t"
+
+         GCM_GHASH_ACCUMULATE( "16" )
+         GCM_GHASH_ACCUMULATE( "32" )
+         GCM_GHASH_ACCUMULATE( "48" )
+
+         /* Fold the middle terms into xmm2:xmm1 */
+         "movdqa %%xmm7, %%xmm4             \n\t" // m1:m0
+         "psrldq $8, %%xmm7                 \n\t" // 0:m1
+         "pslldq $8, %%xmm4                 \n\t" // m0:0
+         "pxor %%xmm7, %%xmm6               \n\t"
+         "pxor %%xmm4, %%xmm5               \n\t"
+         "movdqa %%xmm5, %%xmm1             \n\t"
+         "movdqa %%xmm6, %%xmm2             \n\t"
+
+         GCM_SHIFT_REDUCE
+
+         "movdqu (%3), %%xmm6               \n\t" // byte-reversal mask
+         "pshufb %%xmm6, %%xmm0             \n\t"
+         "movdqu %%xmm0, (%0)               \n\t" // new hash
+         :
+         : "r" (buf), "r" (hpow), "r" (c), "r" (aesni_bswap_mask)
+         : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3",
+                           "xmm4", "xmm5", "xmm6", "xmm7" );
+}
+
+/*
+ * CTR encryption of four blocks in parallel, so that the latency of each
+ * aesenc is hidden behind the three others:
+ *      output[i] = input[i] + E( ++y ), i = 0..3
+ * with the 32-bit counter in the last four bytes of y
+ */
+static void aesni_gcm_ctr4( const mbedtls_aes_context *ctx,
+                            unsigned char y[16],
+                            const unsigned char input[64],
+                            unsigned char output[64] )
+{
+    int nr = ctx->nr;
+    const uint32_t *rk = ctx->rk;
+
+    asm volatile( "movdqu (%4), %%xmm6      \n\t" // byte-reversal mask
+                  "movdqu (%5), %%xmm7      \n\t" // counter increment
+                  "movdqu (%6), %%xmm5      \n\t" // counter block
+                  "pshufb %%xmm6, %%xmm5    \n\t" // counter in low dword
+                  "paddd %%xmm7, %%xmm5     \n\t"
+                  "movdqa %%xmm5, %%xmm0    \n\t"
+                  "pshufb %%xmm6, %%xmm0    \n\t" // block 0
+                  "paddd %%xmm7, %%xmm5     \n\t"
+                  "movdqa %%xmm5, %%xmm1    \n\t"
+                  "pshufb %%xmm6, %%xmm1    \n\t" // block 1
+                  "paddd %%xmm7, %%xmm5     \n\t"
+                  "movdqa %%xmm5, %%xmm2    \n\t"
+                  "pshufb %%xmm6, %%xmm2    \n\t" // block 2
+                  "paddd %%xmm7, %%xmm5     \n\t"
+                  "movdqa %%xmm5, %%xmm3    \n\t"
+                  "pshufb %%xmm6, %%xmm3    \n\t" // block 3
+                  "movdqu %%xmm3, (%6)      \n\t" // last counter used
+
+                  "movdqu (%1), %%xmm4      \n\t" // round key 0
+                  "pxor %%xmm4, %%xmm0      \n\t" // round 0
+                  "pxor %%xmm4, %%xmm1      \n\t"
+                  "pxor %%xmm4, %%xmm2      \n\t"
+                  "pxor %%xmm4, %%xmm3      \n\t"
+                  "addq $16, %1             \n\t" // point to next round key
+                  "subl $1, %0              \n\t" // normal rounds = nr - 1
+
+                  "1:                       \n\t"
+                  "movdqu (%1), %%xmm4      \n\t" // load round key
+                  AESENC xmm4_xmm0         "\n\t" // do round
+                  AESENC xmm4_xmm1         "\n\t"
+                  AESENC xmm4_xmm2         "\n\t"
+                  AESENC xmm4_xmm3         "\n\t"
+                  "addq $16, %1             \n\t" // point to next round key
+                  "subl $1, %0              \n\t" // loop
+                  "jnz 1b                   \n\t"
+                  "movdqu (%1), %%xmm4      \n\t" // load round key
+                  AESENCLAST xmm4_xmm0     "\n\t" // last round
+                  AESENCLAST xmm4_xmm1     "\n\t"
+                  AESENCLAST xmm4_xmm2     "\n\t"
+                  AESENCLAST xmm4_xmm3     "\n\t"
+
+                  "movdqu   (%2), %%xmm4    \n\t" // xor with input
+                  "pxor %%xmm4, %%xmm0      \n\t"
+                  "movdqu %%xmm0,   (%3)    \n\t" // and export output
+                  "movdqu 16(%2), %%xmm4    \n\t"
+                  "pxor %%xmm4, %%xmm1      \n\t"
+                  "movdqu %%xmm1, 16(%3)    \n\t"
+                  "movdqu 32(%2), %%xmm4    \n\t"
+                  "pxor %%xmm4, %%xmm2      \n\t"
+                  "movdqu %%xmm2, 32(%3)    \n\t"
+                  "movdqu 48(%2), %%xmm4    \n\t"
+                  "pxor %%xmm4, %%xmm3      \n\t"
+                  "movdqu %%xmm3, 48(%3)    \n\t"
+                  : "+r" (nr), "+r" (rk)
+                  : "r" (input), "r" (output), "r" (aesni_bswap_mask),
+                    "r" (aesni_ctr_one), "r" (y)
+                  : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3",
+                                    "xmm4", "xmm5", "xmm6", "xmm7" );
+}
+
+/*
+ * AES-GCM en(de)cryption of whole 64-byte chunks
+ */
+void mbedtls_aesni_gcm_crypt_blocks( const mbedtls_aes_context *ctx,
+                             const unsigned char hpow[64],
+                             int mode,
+                             size_t length,
+                             unsigned char y[16],
+                             unsigned char buf[16],
+                             const unsigned char *input,
+                             unsigned char *output )
+{
+    /*
+     * The ciphertext is hashed before it is decrypted, so that the output
+     * may overwrite the input, or after it is encrypted. Either way,
+     * hashing one chunk is independent from encrypting the counter blocks
+     * of the next one, and the out-of-order core overlaps them.
+     */
+    for( ; length >= 64; length -= 64 )
+    {
+        if( mode == MBEDTLS_AES_DECRYPT )
+            aesni_gcm_ghash4( buf, hpow, input );
+
+        aesni_gcm_ctr4( ctx, y, input, output );
+
+        if( mode == MBEDTLS_AES_ENCRYPT )
+            aesni_gcm_ghash4( buf, hpow, output );
+
+        input  += 64;
+        output += 64;
+    }
+}
+
 /*
  * Compute decryption round keys from encryption round keys
  */
@@ -0,0 +1,767 @@
+/*
+ *  ChaCha20 stream cipher (RFC 7539)
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+
+/*
+ * https://tools.ietf.org/html/rfc7539
+ *
+ * Besides the one-block function, runs of blocks go through kernels that
+ * keep word i of 4 (SSE2, NEON) or 8 (AVX2) consecutive blocks in one
+ * vector register, so a quarter round is done on all the blocks at once,
+ * and transpose the result back into block order before the XOR.
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_CHACHA20_C)
+
+#include "mbedtls/chacha20.h"
+#include "mbedtls/cpu.h"
+
+#include <string.h>
+
+#if defined(MBEDTLS_SELF_TEST)
+#if defined(MBEDTLS_PLATFORM_C)
+#include "mbedtls/platform.h"
+#else
+#include <stdio.h>
+#define mbedtls_printf printf
+#endif /* MBEDTLS_PLATFORM_C */
+#endif /* MBEDTLS_SELF_TEST */
+
+#if defined(MBEDTLS_HAVE_SSE2_INTRIN)
+#define CHACHA20_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(MBEDTLS_HAVE_AVX2_INTRIN)
+#define CHACHA20_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(MBEDTLS_HAVE_NEON_INTRIN)
+#define CHACHA20_NEON
+#include <arm_neon.h>
+#endif
+
+/* Implementation that should never be optimized out by the compiler */
+static void mbedtls_zeroize( void *v, size_t n ) {
+    volatile unsigned char *p = v; while( n-- ) *p++ = 0;
+}
+
+/*
+ * 32-bit integer manipulation macros (little endian)
+ */
+#ifndef GET_UINT32_LE
+#define GET_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ]       )             \
+        | ( (uint32_t) (b)[(i) + 1] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 2] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 3] << 24 );            \
+}
+#endif
+
+#ifndef PUT_UINT32_LE
+#define PUT_UINT32_LE(n,b,i)                                    \
+{                                                               \
+    (b)[(i)    ] = (unsigned char) ( ( (n)       ) & 0xFF );    \
+    (b)[(i) + 1] = (unsigned char) ( ( (n) >>  8 ) & 0xFF );    \
+    (b)[(i) + 2] = (unsigned char) ( ( (n) >> 16 ) & 0xFF );    \
+    (b)[(i) + 3] = (unsigned char) ( ( (n) >> 24 ) & 0xFF );    \
+}
+#endif
+
+#define ROTL32(x,n) ( ( (x) << (n) ) | ( (x) >> ( 32 - (n) ) ) )
+
+#define QUARTERROUND(x,a,b,c,d)                                 \
+{                                                               \
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = ROTL32( x[d], 16 );      \
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = ROTL32( x[b], 12 );      \
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = ROTL32( x[d],  8 );      \
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = ROTL32( x[b],  7 );      \
+}
+
+/*
+ * Ten double rounds on the 16 words of x, whatever a word is: QR is the
+ * quarter round on x[a], x[b], x[c], x[d]
+ */
+#define CHACHA20_ROUNDS(QR,x)                                   \
+{                                                               \
+    int r_;                                                     \
+    for( r_ = 0; r_ < 10; r_++ )                                \
+    {                                                           \
+        QR( x, 0, 4,  8, 12 );                                  \
+        QR( x, 1, 5,  9, 13 );                                  \
+        QR( x, 2, 6, 10, 14 );                                  \
+        QR( x, 3, 7, 11, 15 );                                  \
+        QR( x, 0, 5, 10, 15 );                                  \
+        QR( x, 1, 6, 11, 12 );                                  \
+        QR( x, 2, 7,  8, 13 );                                  \
+        QR( x, 3, 4,  9, 14 );                                  \
+    }                                                           \
+}
+
+/*
+ * Compute the keystream block for the current state
+ */
+static void chacha20_block( const uint32_t state[16],
+                            unsigned char keystream[64] )
+{
+    uint32_t x[16];
+    int i;
+
+    memcpy( x, state, sizeof( x ) );
+
+    CHACHA20_ROUNDS( QUARTERROUND, x );
+
+    for( i = 0; i < 16; i++ )
+    {
+        x[i] += state[i];
+        PUT_UINT32_LE( x[i], keystream, 4 * i );
+    }
+
+    mbedtls_zeroize( x, sizeof( x ) );
+}
+
+#if defined(CHACHA20_SSE2)
+#define SSE2_ROTL(v,n)                                          \
+    _mm_or_si128( _mm_slli_epi32( v, n ), _mm_srli_epi32( v, 32 - n ) )
+
+#define SSE2_QUARTERROUND(x,a,b,c,d)                            \
+{                                                               \
+    x[a] = _mm_add_epi32( x[a], x[b] );                         \
+    x[d] = SSE2_ROTL( _mm_xor_si128( x[d], x[a] ), 16 );        \
+    x[c] = _mm_add_epi32( x[c], x[d] );                         \
+    x[b] = SSE2_ROTL( _mm_xor_si128( x[b], x[c] ), 12 );        \
+    x[a] = _mm_add_epi32( x[a], x[b] );                         \
+    x[d] = SSE2_ROTL( _mm_xor_si128( x[d], x[a] ),  8 );        \
+    x[c] = _mm_add_epi32( x[c], x[d] );                         \
+    x[b] = SSE2_ROTL( _mm_xor_si128( x[b], x[c] ),  7 );        \
+}
+
+/*
+ * Encrypt 4 blocks (256 bytes) and advance the block counter
+ */
+static void chacha20_sse2_blocks( uint32_t state[16],
+                                  const unsigned char *input,
+                                  unsigned char *output )
+{
+    __m128i x[16], s[16];
+    int i;
+
+    for( i = 0; i < 16; i++ )
+        s[i] = _mm_set1_epi32( (int) state[i] );
+    s[12] = _mm_add_epi32( s[12], _mm_set_epi32( 3, 2, 1, 0 ) );
+    memcpy( x, s, sizeof( x ) );
+
+    CHACHA20_ROUNDS( SSE2_QUARTERROUND, x );
+
+    /* Words 4g to 4g + 3 of the 4 blocks are a 4x4 transpose away */
+    for( i = 0; i < 16; i += 4 )
+    {
+        __m128i t0, t1, t2, t3;
+        __m128i a = _mm_add_epi32( x[i    ], s[i    ] );
+        __m128i b = _mm_add_epi32( x[i + 1], s[i + 1] );
+        __m128i c = _mm_add_epi32( x[i + 2], s[i + 2] );
+        __m128i d = _mm_add_epi32( x[i + 3], s[i + 3] );
+
+        t0 = _mm_unpacklo_epi32( a, b );
+        t1 = _mm_unpacklo_epi32( c, d );
+        t2 = _mm_unpackhi_epi32( a, b );
+        t3 = _mm_unpackhi_epi32( c, d );
+
+        a = _mm_unpacklo_epi64( t0, t1 );
+        b = _mm_unpackhi_epi64( t0, t1 );
+        c = _mm_unpacklo_epi64( t2, t3 );
+        d = _mm_unpackhi_epi64( t2, t3 );
+
+        _mm_storeu_si128( (__m128i *)( output +   0 + 4 * i ), _mm_xor_si128( a,
+                _mm_loadu_si128( (const __m128i *)( input +   0 + 4 * i ) ) ) );
+        _mm_storeu_si128( (__m128i *)( output +  64 + 4 * i ), _mm_xor_si128( b,
+                _mm_loadu_si128( (const __m128i *)( input +  64 + 4 * i ) ) ) );
+        _mm_storeu_si128( (__m128i *)( output + 128 + 4 * i ), _mm_xor_si128( c,
+                _mm_loadu_si128( (const __m128i *)( input + 128 + 4 * i ) ) ) );
+        _mm_storeu_si128( (__m128i *)( output + 192 + 4 * i ), _mm_xor_si128( d,
+                _mm_loadu_si128( (const __m128i *)( input + 192 + 4 * i ) ) ) );
+    }
+
+    state[12] += 4;
+}
+#endif /* CHACHA20_SSE2 */
+
+#if defined(CHACHA20_AVX2)
+#define AVX2_ROTL(v,n)                                                      \
+    _mm256_or_si256( _mm256_slli_epi32( v, n ), _mm256_srli_epi32( v, 32 - n ) )
+
+#define AVX2_QUARTERROUND(x,a,b,c,d)                                        \
+{                                                                           \
+    x[a] = _mm256_add_epi32( x[a], x[b] );                                  \
+    x[d] = _mm256_shuffle_epi8( _mm256_xor_si256( x[d], x[a] ), rot16 );    \
+    x[c] = _mm256_add_epi32( x[c], x[d] );                                  \
+    x[b] = AVX2_ROTL( _mm256_xor_si256( x[b], x[c] ), 12 );                 \
+    x[a] = _mm256_add_epi32( x[a], x[b] );                                  \
+    x[d] = _mm256_shuffle_epi8( _mm256_xor_si256( x[d], x[a] ), rot8 );     \
+    x[c] = _mm256_add_epi32( x[c], x[d] );                                  \
+    x[b] = AVX2_ROTL( _mm256_xor_si256( x[b], x[c] ),  7 );                 \
+}
+
+/*
+ * Encrypt 8 blocks (512 bytes) and advance the block counter
+ */
+__attribute__((target("avx2")))
+static void chacha20_avx2_blocks( uint32_t state[16],
+                                  const unsigned char *input,
+                                  unsigned char *output )
+{
+    __m256i x[16], s[16], y[16];
+    const __m256i rot16 = _mm256_set_epi8( 13, 12, 15, 14,  9,  8, 11, 10,
+                                            5,  4,  7,  6,  1,  0,  3,  2,
+                                           13, 12, 15, 14,  9,  8, 11, 10,
+                                            5,  4,  7,  6,  1,  0,  3,  2 );
+    const __m256i rot8  = _mm256_set_epi8( 14, 13, 12, 15, 10,  9,  8, 11,
+                                            6,  5,  4,  7,  2,  1,  0,  3,
+                                           14, 13, 12, 15, 10,  9,  8, 11,
+                                            6,  5,  4,  7,  2,  1,  0,  3 );
+    int i;
+
+    for( i = 0; i < 16; i++ )
+        s[i] = _mm256_set1_epi32( (int) state[i] );
+    s[12] = _mm256_add_epi32( s[12], _mm256_set_epi32( 7, 6, 5, 4, 3, 2, 1, 0 ) );
+    memcpy( x, s, sizeof( x ) );
+
+    CHACHA20_ROUNDS( AVX2_QUARTERROUND, x );
+
+    /*
+     * A 4x4 transpose in each 128-bit lane leaves words 4g to 4g + 3 of
+     * blocks j and j + 4 in y[4g + j]
+     */
+    for( i = 0; i < 16; i += 4 )
+    {
+        __m256i t0, t1, t2, t3;
+        __m256i a = _mm256_add_epi32( x[i    ], s[i    ] );
+        __m256i b = _mm256_add_epi32( x[i + 1], s[i + 1] );
+        __m256i c = _mm256_add_epi32( x[i + 2], s[i + 2] );
+        __m256i d = _mm256_add_epi32( x[i + 3], s[i + 3] );
+
+        t0 = _mm256_unpacklo_epi32( a, b );
+        t1 = _mm256_unpacklo_epi32( c, d );
+        t2 = _mm256_unpackhi_epi32( a, b );
+        t3 = _mm256_unpackhi_epi32( c, d );
+
+        y[i    ] = _mm256_unpacklo_epi64( t0, t1 );
+        y[i + 1] = _mm256_unpackhi_epi64( t0, t1 );
+        y[i + 2] = _mm256_unpacklo_epi64( t2, t3 );
+        y[i + 3] = _mm256_unpackhi_epi64( t2, t3 );
+    }
+
+    /* Then pair up the lanes of two word groups into 32-byte stores */
+    for( i = 0; i < 8; i++ )
+    {
+        int j = i & 3;
+        int g = ( i >> 2 ) * 8;
+        __m256i lo = _mm256_permute2x128_si256( y[g + j], y[g + 4 + j], 0x20 );
+        __m256i hi = _mm256_permute2x128_si256( y[g + j], y[g + 4 + j], 0x31 );
+        size_t off = 64 * j + 4 * g;
+
+        _mm256_storeu_si256( (__m256i *)( output + off ), _mm256_xor_si256( lo,
+                _mm256_loadu_si256( (const __m256i *)( input + off ) ) ) );
+        _mm256_storeu_si256( (__m256i *)( output + off + 256 ), _mm256_xor_si256( hi,
+                _mm256_loadu_si256( (const __m256i *)( input + off + 256 ) ) ) );
+    }
+
+    state[12] += 8;
+}
+#endif /* CHACHA20_AVX2 */
+
+#if defined(CHACHA20_NEON)
+#define NEON_ROTL(v,n)                                          \
+    vsriq_n_u32( vshlq_n_u32( v, n ), v, 32 - n )
+
+#define NEON_ROTL16(v)                                          \
+    vreinterpretq_u32_u16( vrev32q_u16( vreinterpretq_u16_u32( v ) ) )
+
+#define NEON_QUARTERROUND(x,a,b,c,d)                            \
+{                                                               \
+    x[a] = vaddq_u32( x[a], x[b] );                             \
+    x[d] = NEON_ROTL16( veorq_u32( x[d], x[a] ) );              \
+    x[c] = vaddq_u32( x[c], x[d] );                             \
+    x[b] = veorq_u32( x[b], x[c] );                             \
+    x[b] = NEON_ROTL( x[b], 12 );                               \
+    x[a] = vaddq_u32( x[a], x[b] );                             \
+    x[d] = veorq_u32( x[d], x[a] );                             \
+    x[d] = NEON_ROTL( x[d],  8 );                               \
+    x[c] = vaddq_u32( x[c], x[d] );                             \
+    x[b] = veorq_u32( x[b], x[c] );                             \
+    x[b] = NEON_ROTL( x[b],  7 );                               \
+}
+
+#define NEON_XOR_STORE(v,off)                                   \
+    vst1q_u8( output + (off), veorq_u8( vreinterpretq_u8_u32( v ),   \
+                                        vld1q_u8( input + (off) ) ) )
+
+/*
+ * Encrypt 4 blocks (256 bytes) and advance the block counter
+ */
+static void chacha20_neon_blocks( uint32_t state[16],
+                                  const unsigned char *input,
+                                  unsigned char *output )
+{
+    static const uint32_t lanes[4] = { 0, 1, 2, 3 };
+    uint32x4_t x[16], s[16];
+    int i;
+
+    for( i = 0; i < 16; i++ )
+        s[i] = vdupq_n_u32( state[i] );
+    s[12] = vaddq_u32( s[12], vld1q_u32( lanes ) );
+    memcpy( x, s, sizeof( x ) );
+
+    CHACHA20_ROUNDS( NEON_QUARTERROUND, x );
+
+    /* Words 4g to 4g + 3 of the 4 blocks are a 4x4 transpose away */
+    for( i = 0; i < 16; i += 4 )
+    {
+        uint32x4x2_t ab = vtrnq_u32( vaddq_u32( x[i    ], s[i    ] ),
+                                     vaddq_u32( x[i + 1], s[i + 1] ) );
+        uint32x4x2_t cd = vtrnq_u32( vaddq_u32( x[i + 2], s[i + 2] ),
+                                     vaddq_u32( x[i + 3], s[i + 3] ) );
+
+        NEON_XOR_STORE( vcombine_u32( vget_low_u32( ab.val[0] ),
+                                      vget_low_u32( cd.val[0] ) ),   0 + 4 * i );
+        NEON_XOR_STORE( vcombine_u32( vget_low_u32( ab.val[1] ),
+                                      vget_low_u32( cd.val[1] ) ),  64 + 4 * i );
+        NEON_XOR_STORE( vcombine_u32( vget_high_u32( ab.val[0] ),
+                                      vget_high_u32( cd.val[0] ) ), 128 + 4 * i );
+        NEON_XOR_STORE( vcombine_u32( vget_high_u32( ab.val[1] ),
+                                      vget_high_u32( cd.val[1] ) ), 192 + 4 * i );
+    }
+
+    state[12] += 4;
+}
+#endif /* CHACHA20_NEON */
+
+void mbedtls_chacha20_init( mbedtls_chacha20_context *ctx )
+{
+    memset( ctx, 0, sizeof( mbedtls_chacha20_context ) );
+
+    /* No keystream left until the first block is computed */
+    ctx->keystream_used = 64;
+}
+
+void mbedtls_chacha20_free( mbedtls_chacha20_context *ctx )
+{
+    if( ctx == NULL )
+        return;
+
+    mbedtls_zeroize( ctx, sizeof( mbedtls_chacha20_context ) );
+}
+
+int mbedtls_chacha20_setkey( mbedtls_chacha20_context *ctx,
+                             const unsigned char key[32] )
+{
+    int i;
+
+    if( ctx == NULL || key == NULL )
+        return( MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA );
+
+    /* "expand 32-byte k" */
+    ctx->state[0] = 0x61707865;
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+
+    for( i = 0; i < 8; i++ )
+        GET_UINT32_LE( ctx->state[4 + i], key, 4 * i );
+
+    return( 0 );
+}
+
+int mbedtls_chacha20_starts( mbedtls_chacha20_context *ctx,
+                             const unsigned char nonce[12],
+                             uint32_t counter )
+{
+    if( ctx == NULL || nonce == NULL )
+        return( MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA );
+
+    ctx->state[12] = counter;
+    GET_UINT32_LE( ctx->state[13], nonce, 0 );
+    GET_UINT32_LE( ctx->state[14], nonce, 4 );
+    GET_UINT32_LE( ctx->state[15], nonce, 8 );
+
+    mbedtls_zeroize( ctx->keystream, sizeof( ctx->keystream ) );
+    ctx->keystream_used = 64;
+
+    return( 0 );
+}
+
+int mbedtls_chacha20_update( mbedtls_chacha20_context *ctx,
+                             size_t length,
+                             const unsigned char *input,
+                             unsigned char *output )
+{
+    size_t i;
+#if defined(MBEDTLS_CPU_C)
+    mbedtls_cpu_impl_t impl;
+#endif
+
+    if( ctx == NULL || ( length != 0 && ( input == NULL || output == NULL ) ) )
+        return( MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA );
+
+    /* Use up the keystream left by the previous call */
+    while( length > 0 && ctx->keystream_used < 64 )
+    {
+        *output++ = *input++ ^ ctx->keystream[ctx->keystream_used++];
+        length--;
+    }
+
+#if defined(MBEDTLS_CPU_C)
+    impl = mbedtls_cpu_impl( MBEDTLS_CPU_CHACHA20 );
+#endif
+
+#if defined(CHACHA20_AVX2)
+    while( impl == MBEDTLS_CPU_IMPL_AVX2 && length >= 512 )
+    {
+        chacha20_avx2_blocks( ctx->state, input, output );
+        input  += 512;
+        output += 512;
+        length -= 512;
+    }
+#endif
+
+    /* The AVX2 path leaves up to 511 bytes to the SSE2 kernel */
+#if defined(CHACHA20_SSE2) || defined(CHACHA20_NEON)
+    while( impl != MBEDTLS_CPU_IMPL_GENERIC && length >= 256 )
+    {
+#if defined(CHACHA20_SSE2)
+        chacha20_sse2_blocks( ctx->state, input, output );
+#else
+        chacha20_neon_blocks( ctx->state, input, output );
+#endif
+        input  += 256;
+        output += 256;
+        length -= 256;
+    }
+#endif
+
+    while( length > 0 )
+    {
+        size_t use_len = ( length < 64 ) ? length : 64;
+
+        chacha20_block( ctx->state, ctx->keystream );
+        ctx->state[12]++;
+
+        for( i = 0; i < use_len; i++ )
+            output[i] = input[i] ^ ctx->keystream[i];
+
+        ctx->keystream_used = use_len;
+        input  += use_len;
+        output += use_len;
+        length -= use_len;
+    }
+
+    return( 0 );
+}
+
+int mbedtls_chacha20_crypt( const unsigned char key[32],
+                            const unsigned char nonce[12],
+                            uint32_t counter,
+                            size_t length,
+                            const unsigned char *input,
+                            unsigned char *output )
+{
+    mbedtls_chacha20_context ctx;
+    int ret;
+
+    mbedtls_chacha20_init( &ctx );
+
+    if( ( ret = mbedtls_chacha20_setkey( &ctx, key ) ) != 0 )
+        goto cleanup;
+
+    if( ( ret = mbedtls_chacha20_starts( &ctx, nonce, counter ) ) != 0 )
+        goto cleanup;
+
+    ret = mbedtls_chacha20_update( &ctx, length, input, output );
+
+cleanup:
+    mbedtls_chacha20_free( &ctx );
+    return( ret );
+}
+
+#if defined(MBEDTLS_SELF_TEST)
+/*
+ * Test vectors from RFC 7539, A.1 #1, 2.4.2 and A.2 #2
+ */
+#define CHACHA20_TESTS  3
+
+static const unsigned char test_keys[CHACHA20_TESTS][32] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+      0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+      0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }
+};
+
+static const unsigned char test_nonces[CHACHA20_TESTS][12] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a,
+      0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x02 }
+};
+
+static const uint32_t test_counters[CHACHA20_TESTS] =
+    { 0, 1, 1 };
+
+static const size_t test_lengths[CHACHA20_TESTS] =
+    { 64, 114, 375 };
+
+static const unsigned char test_input[CHACHA20_TESTS][375] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x4c, 0x61, 0x64, 0x69, 0x65, 0x73, 0x20, 0x61,
+      0x6e, 0x64, 0x20, 0x47, 0x65, 0x6e, 0x74, 0x6c,
+      0x65, 0x6d, 0x65, 0x6e, 0x20, 0x6f, 0x66, 0x20,
+      0x74, 0x68, 0x65, 0x20, 0x63, 0x6c, 0x61, 0x73,
+      0x73, 0x20, 0x6f, 0x66, 0x20, 0x27, 0x39, 0x39,
+      0x3a, 0x20, 0x49, 0x66, 0x20, 0x49, 0x20, 0x63,
+      0x6f, 0x75, 0x6c, 0x64, 0x20, 0x6f, 0x66, 0x66,
+      0x65, 0x72, 0x20, 0x79, 0x6f, 0x75, 0x20, 0x6f,
+      0x6e, 0x6c, 0x79, 0x20, 0x6f, 0x6e, 0x65, 0x20,
+      0x74, 0x69, 0x70, 0x20, 0x66, 0x6f, 0x72, 0x20,
+      0x74, 0x68, 0x65, 0x20, 0x66, 0x75, 0x74, 0x75,
+      0x72, 0x65, 0x2c, 0x20, 0x73, 0x75, 0x6e, 0x73,
+      0x63, 0x72, 0x65, 0x65, 0x6e, 0x20, 0x77, 0x6f,
+      0x75, 0x6c, 0x64, 0x20, 0x62, 0x65, 0x20, 0x69,
+      0x74, 0x2e },
+    { 0x41, 0x6e, 0x79, 0x20, 0x73, 0x75, 0x62, 0x6d,
+      0x69, 0x73, 0x73, 0x69, 0x6f, 0x6e, 0x20, 0x74,
+      0x6f, 0x20, 0x74, 0x68, 0x65, 0x20, 0x49, 0x45,
+      0x54, 0x46, 0x20, 0x69, 0x6e, 0x74, 0x65, 0x6e,
+      0x64, 0x65, 0x64, 0x20, 0x62, 0x79, 0x20, 0x74,
+      0x68, 0x65, 0x20, 0x43, 0x6f, 0x6e, 0x74, 0x72,
+      0x69, 0x62, 0x75, 0x74, 0x6f, 0x72, 0x20, 0x66,
+      0x6f, 0x72, 0x20, 0x70, 0x75, 0x62, 0x6c, 0x69,
+      0x63, 0x61, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x61,
+      0x73, 0x20, 0x61, 0x6c, 0x6c, 0x20, 0x6f, 0x72,
+      0x20, 0x70, 0x61, 0x72, 0x74, 0x20, 0x6f, 0x66,
+      0x20, 0x61, 0x6e, 0x20, 0x49, 0x45, 0x54, 0x46,
+      0x20, 0x49, 0x6e, 0x74, 0x65, 0x72, 0x6e, 0x65,
+      0x74, 0x2d, 0x44, 0x72, 0x61, 0x66, 0x74, 0x20,
+      0x6f, 0x72, 0x20, 0x52, 0x46, 0x43, 0x20, 0x61,
+      0x6e, 0x64, 0x20, 0x61, 0x6e, 0x79, 0x20, 0x73,
+      0x74, 0x61, 0x74, 0x65, 0x6d, 0x65, 0x6e, 0x74,
+      0x20, 0x6d, 0x61, 0x64, 0x65, 0x20, 0x77, 0x69,
+      0x74, 0x68, 0x69, 0x6e, 0x20, 0x74, 0x68, 0x65,
+      0x20, 0x63, 0x6f, 0x6e, 0x74, 0x65, 0x78, 0x74,
+      0x20, 0x6f, 0x66, 0x20, 0x61, 0x6e, 0x20, 0x49,
+      0x45, 0x54, 0x46, 0x20, 0x61, 0x63, 0x74, 0x69,
+      0x76, 0x69, 0x74, 0x79, 0x20, 0x69, 0x73, 0x20,
+      0x63, 0x6f, 0x6e, 0x73, 0x69, 0x64, 0x65, 0x72,
+      0x65, 0x64, 0x20, 0x61, 0x6e, 0x20, 0x22, 0x49,
+      0x45, 0x54, 0x46, 0x20, 0x43, 0x6f, 0x6e, 0x74,
+      0x72, 0x69, 0x62, 0x75, 0x74, 0x69, 0x6f, 0x6e,
+      0x22, 0x2e, 0x20, 0x53, 0x75, 0x63, 0x68, 0x20,
+      0x73, 0x74, 0x61, 0x74, 0x65, 0x6d, 0x65, 0x6e,
+      0x74, 0x73, 0x20, 0x69, 0x6e, 0x63, 0x6c, 0x75,
+      0x64, 0x65, 0x20, 0x6f, 0x72, 0x61, 0x6c, 0x20,
+      0x73, 0x74, 0x61, 0x74, 0x65, 0x6d, 0x65, 0x6e,
+      0x74, 0x73, 0x20, 0x69, 0x6e, 0x20, 0x49, 0x45,
+      0x54, 0x46, 0x20, 0x73, 0x65, 0x73, 0x73, 0x69,
+      0x6f, 0x6e, 0x73, 0x2c, 0x20, 0x61, 0x73, 0x20,
+      0x77, 0x65, 0x6c, 0x6c, 0x20, 0x61, 0x73, 0x20,
+      0x77, 0x72, 0x69, 0x74, 0x74, 0x65, 0x6e, 0x20,
+      0x61, 0x6e, 0x64, 0x20, 0x65, 0x6c, 0x65, 0x63,
+      0x74, 0x72, 0x6f, 0x6e, 0x69, 0x63, 0x20, 0x63,
+      0x6f, 0x6d, 0x6d, 0x75, 0x6e, 0x69, 0x63, 0x61,
+      0x74, 0x69, 0x6f, 0x6e, 0x73, 0x20, 0x6d, 0x61,
+      0x64, 0x65, 0x20, 0x61, 0x74, 0x20, 0x61, 0x6e,
+      0x79, 0x20, 0x74, 0x69, 0x6d, 0x65, 0x20, 0x6f,
+      0x72, 0x20, 0x70, 0x6c, 0x61, 0x63, 0x65, 0x2c,
+      0x20, 0x77, 0x68, 0x69, 0x63, 0x68, 0x20, 0x61,
+      0x72, 0x65, 0x20, 0x61, 0x64, 0x64, 0x72, 0x65,
+      0x73, 0x73, 0x65, 0x64, 0x20, 0x74, 0x6f }
+};
+
+static const unsigned char test_output[CHACHA20_TESTS][375] =
+{
+    { 0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90,
+      0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+      0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a,
+      0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+      0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d,
+      0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+      0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c,
+      0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86 },
+    { 0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80,
+      0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+      0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2,
+      0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+      0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab,
+      0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+      0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab,
+      0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+      0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61,
+      0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+      0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06,
+      0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+      0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6,
+      0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+      0x87, 0x4d },
+    { 0xa3, 0xfb, 0xf0, 0x7d, 0xf3, 0xfa, 0x2f, 0xde,
+      0x4f, 0x37, 0x6c, 0xa2, 0x3e, 0x82, 0x73, 0x70,
+      0x41, 0x60, 0x5d, 0x9f, 0x4f, 0x4f, 0x57, 0xbd,
+      0x8c, 0xff, 0x2c, 0x1d, 0x4b, 0x79, 0x55, 0xec,
+      0x2a, 0x97, 0x94, 0x8b, 0xd3, 0x72, 0x29, 0x15,
+      0xc8, 0xf3, 0xd3, 0x37, 0xf7, 0xd3, 0x70, 0x05,
+      0x0e, 0x9e, 0x96, 0xd6, 0x47, 0xb7, 0xc3, 0x9f,
+      0x56, 0xe0, 0x31, 0xca, 0x5e, 0xb6, 0x25, 0x0d,
+      0x40, 0x42, 0xe0, 0x27, 0x85, 0xec, 0xec, 0xfa,
+      0x4b, 0x4b, 0xb5, 0xe8, 0xea, 0xd0, 0x44, 0x0e,
+      0x20, 0xb6, 0xe8, 0xdb, 0x09, 0xd8, 0x81, 0xa7,
+      0xc6, 0x13, 0x2f, 0x42, 0x0e, 0x52, 0x79, 0x50,
+      0x42, 0xbd, 0xfa, 0x77, 0x73, 0xd8, 0xa9, 0x05,
+      0x14, 0x47, 0xb3, 0x29, 0x1c, 0xe1, 0x41, 0x1c,
+      0x68, 0x04, 0x65, 0x55, 0x2a, 0xa6, 0xc4, 0x05,
+      0xb7, 0x76, 0x4d, 0x5e, 0x87, 0xbe, 0xa8, 0x5a,
+      0xd0, 0x0f, 0x84, 0x49, 0xed, 0x8f, 0x72, 0xd0,
+      0xd6, 0x62, 0xab, 0x05, 0x26, 0x91, 0xca, 0x66,
+      0x42, 0x4b, 0xc8, 0x6d, 0x2d, 0xf8, 0x0e, 0xa4,
+      0x1f, 0x43, 0xab, 0xf9, 0x37, 0xd3, 0x25, 0x9d,
+      0xc4, 0xb2, 0xd0, 0xdf, 0xb4, 0x8a, 0x6c, 0x91,
+      0x39, 0xdd, 0xd7, 0xf7, 0x69, 0x66, 0xe9, 0x28,
+      0xe6, 0x35, 0x55, 0x3b, 0xa7, 0x6c, 0x5c, 0x87,
+      0x9d, 0x7b, 0x35, 0xd4, 0x9e, 0xb2, 0xe6, 0x2b,
+      0x08, 0x71, 0xcd, 0xac, 0x63, 0x89, 0x39, 0xe2,
+      0x5e, 0x8a, 0x1e, 0x0e, 0xf9, 0xd5, 0x28, 0x0f,
+      0xa8, 0xca, 0x32, 0x8b, 0x35, 0x1c, 0x3c, 0x76,
+      0x59, 0x89, 0xcb, 0xcf, 0x3d, 0xaa, 0x8b, 0x6c,
+      0xcc, 0x3a, 0xaf, 0x9f, 0x39, 0x79, 0xc9, 0x2b,
+      0x37, 0x20, 0xfc, 0x88, 0xdc, 0x95, 0xed, 0x84,
+      0xa1, 0xbe, 0x05, 0x9c, 0x64, 0x99, 0xb9, 0xfd,
+      0xa2, 0x36, 0xe7, 0xe8, 0x18, 0xb0, 0x4b, 0x0b,
+      0xc3, 0x9c, 0x1e, 0x87, 0x6b, 0x19, 0x3b, 0xfe,
+      0x55, 0x69, 0x75, 0x3f, 0x88, 0x12, 0x8c, 0xc0,
+      0x8a, 0xaa, 0x9b, 0x63, 0xd1, 0xa1, 0x6f, 0x80,
+      0xef, 0x25, 0x54, 0xd7, 0x18, 0x9c, 0x41, 0x1f,
+      0x58, 0x69, 0xca, 0x52, 0xc5, 0xb8, 0x3f, 0xa3,
+      0x6f, 0xf2, 0x16, 0xb9, 0xc1, 0xd3, 0x00, 0x62,
+      0xbe, 0xbc, 0xfd, 0x2d, 0xc5, 0xbc, 0xe0, 0x91,
+      0x19, 0x34, 0xfd, 0xa7, 0x9a, 0x86, 0xf6, 0xe6,
+      0x98, 0xce, 0xd7, 0x59, 0xc3, 0xff, 0x9b, 0x64,
+      0x77, 0x33, 0x8f, 0x3d, 0xa4, 0xf9, 0xcd, 0x85,
+      0x14, 0xea, 0x99, 0x82, 0xcc, 0xaf, 0xb3, 0x41,
+      0xb2, 0x38, 0x4d, 0xd9, 0x02, 0xf3, 0xd1, 0xab,
+      0x7a, 0xc6, 0x1d, 0xd2, 0x9c, 0x6f, 0x21, 0xba,
+      0x5b, 0x86, 0x2f, 0x37, 0x30, 0xe3, 0x7c, 0xfd,
+      0xc4, 0xfd, 0x80, 0x6c, 0x22, 0xf2, 0x21 }
+};
+
+int mbedtls_chacha20_self_test( int verbose )
+{
+    mbedtls_chacha20_context ctx;
+    unsigned char output[1024 + 3];
+    unsigned char check[sizeof( output )];
+    size_t off;
+    int i;
+
+    for( i = 0; i < CHACHA20_TESTS; i++ )
+    {
+        if( verbose != 0 )
+            mbedtls_printf( "  ChaCha20 test #%d: ", i + 1 );
+
+        if( mbedtls_chacha20_crypt( test_keys[i], test_nonces[i],
+                                    test_counters[i], test_lengths[i],
+                                    test_input[i], output ) != 0 ||
+            memcmp( output, test_output[i], test_lengths[i] ) != 0 )
+        {
+            if( verbose != 0 )
+                mbedtls_printf( "failed\n" );
+
+            return( 1 );
+        }
+
+        if( verbose != 0 )
+            mbedtls_printf( "passed\n" );
+    }
+
+    /*
+     * The multi-block kernels must agree with the one-block function,
+     * fed 63 bytes at a time so it also goes through the leftover
+     * keystream
+     */
+    if( verbose != 0 )
+        mbedtls_printf( "  ChaCha20 test #%d: ", CHACHA20_TESTS + 1 );
+
+    memset( output, 0, sizeof( output ) );
+    memset( check, 0, sizeof( check ) );
+
+    mbedtls_chacha20_init( &ctx );
+    mbedtls_chacha20_setkey( &ctx, test_keys[2] );
+    mbedtls_chacha20_starts( &ctx, test_nonces[2], 0xFFFFFFF9 );
+
+    for( off = 0; off < sizeof( check ); off += 63 )
+    {
+        size_t len = sizeof( check ) - off < 63 ? sizeof( check ) - off : 63;
+
+        mbedtls_chacha20_update( &ctx, len, check + off, check + off );
+    }
+
+    mbedtls_chacha20_free( &ctx );
+
+    if( mbedtls_chacha20_crypt( test_keys[2], test_nonces[2], 0xFFFFFFF9,
+                                sizeof( output ), output, output ) != 0 ||
+        memcmp( output, check, sizeof( output ) ) != 0 )
+    {
+        if( verbose != 0 )
+            mbedtls_printf( "failed\n" );
+
+        return( 1 );
+    }
+
+    if( verbose != 0 )
+        mbedtls_printf( "passed\n\n" );
+
+    return( 0 );
+}
+
+#endif /* MBEDTLS_SELF_TEST */
+
+#endif /* MBEDTLS_CHACHA20_C */
@@ -0,0 +1,462 @@
+/*
+ *  ChaCha20-Poly1305 AEAD construction (RFC 7539)
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+
+/*
+ * https://tools.ietf.org/html/rfc7539#section-2.8
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_CHACHAPOLY_C)
+
+#include "mbedtls/chachapoly.h"
+
+#include <string.h>
+
+#if defined(MBEDTLS_SELF_TEST)
+#if defined(MBEDTLS_PLATFORM_C)
+#include "mbedtls/platform.h"
+#else
+#include <stdio.h>
+#define mbedtls_printf printf
+#endif /* MBEDTLS_PLATFORM_C */
+#endif /* MBEDTLS_SELF_TEST */
+
+#define CHACHAPOLY_STATE_INIT       0
+#define CHACHAPOLY_STATE_AAD        1
+#define CHACHAPOLY_STATE_CIPHERTEXT 2   /* Encrypting or decrypting */
+
+/* Implementation that should never be optimized out by the compiler */
+static void mbedtls_zeroize( void *v, size_t n ) {
+    volatile unsigned char *p = v; while( n-- ) *p++ = 0;
+}
+
+/*
+ * The additional data and the ciphertext are each zero-padded to a
+ * multiple of 16 bytes in the MAC input
+ */
+static int chachapoly_pad_mac( mbedtls_chachapoly_context *ctx, uint64_t len )
+{
+    unsigned char zeroes[15];
+    size_t partial = (size_t)( len % 16 );
+
+    if( partial == 0 )
+        return( 0 );
+
+    memset( zeroes, 0, sizeof( zeroes ) );
+
+    return( mbedtls_poly1305_update( &ctx->poly1305_ctx, zeroes, 16 - partial ) );
+}
+
+void mbedtls_chachapoly_init( mbedtls_chachapoly_context *ctx )
+{
+    mbedtls_chacha20_init( &ctx->chacha20_ctx );
+    mbedtls_poly1305_init( &ctx->poly1305_ctx );
+    ctx->aad_len        = 0;
+    ctx->ciphertext_len = 0;
+    ctx->state          = CHACHAPOLY_STATE_INIT;
+    ctx->mode           = MBEDTLS_CHACHAPOLY_ENCRYPT;
+}
+
+void mbedtls_chachapoly_free( mbedtls_chachapoly_context *ctx )
+{
+    if( ctx == NULL )
+        return;
+
+    mbedtls_chacha20_free( &ctx->chacha20_ctx );
+    mbedtls_poly1305_free( &ctx->poly1305_ctx );
+    mbedtls_zeroize( ctx, sizeof( mbedtls_chachapoly_context ) );
+}
+
+int mbedtls_chachapoly_setkey( mbedtls_chachapoly_context *ctx,
+                               const unsigned char key[32] )
+{
+    if( ctx == NULL )
+        return( MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA );
+
+    return( mbedtls_chacha20_setkey( &ctx->chacha20_ctx, key ) );
+}
+
+int mbedtls_chachapoly_starts( mbedtls_chachapoly_context *ctx,
+                               const unsigned char nonce[12],
+                               int mode )
+{
+    int ret;
+    unsigned char poly1305_key[64];
+
+    if( ctx == NULL )
+        return( MBEDTLS_ERR_CHACHA20_BAD_INPUT_DATA );
+
+    /* Block 0 gives the one-time Poly1305 key, the data starts at 1 */
+    if( ( ret = mbedtls_chacha20_starts( &ctx->chacha20_ctx, nonce, 0 ) ) != 0 )
+        goto cleanup;
+
+    memset( poly1305_key, 0, sizeof( poly1305_key ) );
+    if( ( ret = mbedtls_chacha20_update( &ctx->chacha20_ctx, sizeof( poly1305_key ),
+                                         poly1305_key, poly1305_key ) ) != 0 )
+        goto cleanup;
+
+    if( ( ret = mbedtls_poly1305_starts( &ctx->poly1305_ctx, poly1305_key ) ) != 0 )
+        goto cleanup;
+
+    ctx->aad_len        = 0;
+    ctx->ciphertext_len = 0;
+    ctx->state          = CHACHAPOLY_STATE_AAD;
+    ctx->mode           = mode;
+
+cleanup:
+    mbedtls_zeroize( poly1305_key, sizeof( poly1305_key ) );
+    return( ret );
+}
+
+int mbedtls_chachapoly_update_aad( mbedtls_chachapoly_context *ctx,
+                                   const unsigned char *aad,
+                                   size_t aad_len )
+{
+    if( ctx == NULL )
+        return( MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA );
+
+    if( ctx->state != CHACHAPOLY_STATE_AAD )
+        return( MBEDTLS_ERR_CHACHAPOLY_BAD_STATE );
+
+    ctx->aad_len += aad_len;
+
+    return( mbedtls_poly1305_update( &ctx->poly1305_ctx, aad, aad_len ) );
+}
+
+int mbedtls_chachapoly_update( mbedtls_chachapoly_context *ctx,
+                               size_t length,
+                               const unsigned char *input,
+                               unsigned char *output )
+{
+    int ret;
+
+    if( ctx == NULL )
+        return( MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA );
+
+    if( ctx->state != CHACHAPOLY_STATE_AAD &&
+        ctx->state != CHACHAPOLY_STATE_CIPHERTEXT )
+        return( MBEDTLS_ERR_CHACHAPOLY_BAD_STATE );
+
+    if( ctx->state == CHACHAPOLY_STATE_AAD )
+    {
+        ctx->state = CHACHAPOLY_STATE_CIPHERTEXT;
+
+        if( ( ret = chachapoly_pad_mac( ctx, ctx->aad_len ) ) != 0 )
+            return( ret );
+    }
+
+    ctx->ciphertext_len += length;
+
+    /* The MAC is always over the ciphertext */
+    if( ctx->mode == MBEDTLS_CHACHAPOLY_ENCRYPT )
+    {
+        if( ( ret = mbedtls_chacha20_update( &ctx->chacha20_ctx, length,
+                                             input, output ) ) != 0 )
+            return( ret );
+
+        ret = mbedtls_poly1305_update( &ctx->poly1305_ctx, output, length );
+    }
+    else
+    {
+        if( ( ret = mbedtls_poly1305_update( &ctx->poly1305_ctx, input,
+                                             length ) ) != 0 )
+            return( ret );
+
+        ret = mbedtls_chacha20_update( &ctx->chacha20_ctx, length,
+                                       input, output );
+    }
+
+    return( ret );
+}
+
+int mbedtls_chachapoly_finish( mbedtls_chachapoly_context *ctx,
+                               unsigned char mac[16] )
+{
+    int ret;
+    unsigned char len_block[16];
+    int i;
+
+    if( ctx == NULL || mac == NULL )
+        return( MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA );
+
+    if( ctx->state == CHACHAPOLY_STATE_INIT )
+        return( MBEDTLS_ERR_CHACHAPOLY_BAD_STATE );
+
+    if( ctx->state == CHACHAPOLY_STATE_AAD )
+    {
+        if( ( ret = chachapoly_pad_mac( ctx, ctx->aad_len ) ) != 0 )
+            return( ret );
+    }
+    else if( ( ret = chachapoly_pad_mac( ctx, ctx->ciphertext_len ) ) != 0 )
+        return( ret );
+
+    ctx->state = CHACHAPOLY_STATE_INIT;
+
+    /* Both lengths as 64-bit little endian */
+    for( i = 0; i < 8; i++ )
+    {
+        len_block[i    ] = (unsigned char)( ctx->aad_len        >> ( 8 * i ) );
+        len_block[i + 8] = (unsigned char)( ctx->ciphertext_len >> ( 8 * i ) );
+    }
+
+    if( ( ret = mbedtls_poly1305_update( &ctx->poly1305_ctx, len_block,
+                                         sizeof( len_block ) ) ) != 0 )
+        return( ret );
+
+    return( mbedtls_poly1305_finish( &ctx->poly1305_ctx, mac ) );
+}
+
+static int chachapoly_crypt_and_tag( mbedtls_chachapoly_context *ctx,
+                                     int mode,
+                                     size_t length,
+                                     const unsigned char nonce[12],
+                                     const unsigned char *aad,
+                                     size_t aad_len,
+                                     const unsigned char *input,
+                                     unsigned char *output,
+                                     unsigned char tag[16] )
+{
+    int ret;
+
+    if( ( ret = mbedtls_chachapoly_starts( ctx, nonce, mode ) ) != 0 )
+        return( ret );
+
+    if( ( ret = mbedtls_chachapoly_update_aad( ctx, aad, aad_len ) ) != 0 )
+        return( ret );
+
+    if( ( ret = mbedtls_chachapoly_update( ctx, length, input, output ) ) != 0 )
+        return( ret );
+
+    return( mbedtls_chachapoly_finish( ctx, tag ) );
+}
+
+int mbedtls_chachapoly_encrypt_and_tag( mbedtls_chachapoly_context *ctx,
+                                        size_t length,
+                                        const unsigned char nonce[12],
+                                        const unsigned char *aad,
+                                        size_t aad_len,
+                                        const unsigned char *input,
+                                        unsigned char *output,
+                                        unsigned char tag[16] )
+{
+    return( chachapoly_crypt_and_tag( ctx, MBEDTLS_CHACHAPOLY_ENCRYPT,
+                                      length, nonce, aad, aad_len,
+                                      input, output, tag ) );
+}
+
+int mbedtls_chachapoly_auth_decrypt( mbedtls_chachapoly_context *ctx,
+                                     size_t length,
+                                     const unsigned char nonce[12],
+                                     const unsigned char *aad,
+                                     size_t aad_len,
+                                     const unsigned char tag[16],
+                                     const unsigned char *input,
+                                     unsigned char *output )
+{
+    int ret;
+    unsigned char check_tag[16];
+    size_t i;
+    int diff;
+
+    if( tag == NULL )
+        return( MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA );
+
+    if( ( ret = chachapoly_crypt_and_tag( ctx, MBEDTLS_CHACHAPOLY_DECRYPT,
+                                          length, nonce, aad, aad_len,
+                                          input, output, check_tag ) ) != 0 )
+        return( ret );
+
+    /* Check tag in "constant-time" */
+    for( diff = 0, i = 0; i < sizeof( check_tag ); i++ )
+        diff |= tag[i] ^ check_tag[i];
+
+    if( diff != 0 )
+    {
+        mbedtls_zeroize( output, length );
+        return( MBEDTLS_ERR_CHACHAPOLY_AUTH_FAILED );
+    }
+
+    return( 0 );
+}
+
+#if defined(MBEDTLS_SELF_TEST)
+/*
+ * Test vector from RFC 7539, 2.8.2
+ */
+static const unsigned char test_key[32] =
+{
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+    0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+    0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f
+};
+
+static const unsigned char test_nonce[12] =
+{
+    0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43,
+    0x44, 0x45, 0x46, 0x47
+};
+
+static const unsigned char test_aad[12] =
+{
+    0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7
+};
+
+static const unsigned char test_input[114] =
+{
+    0x4c, 0x61, 0x64, 0x69, 0x65, 0x73, 0x20, 0x61,
+    0x6e, 0x64, 0x20, 0x47, 0x65, 0x6e, 0x74, 0x6c,
+    0x65, 0x6d, 0x65, 0x6e, 0x20, 0x6f, 0x66, 0x20,
+    0x74, 0x68, 0x65, 0x20, 0x63, 0x6c, 0x61, 0x73,
+    0x73, 0x20, 0x6f, 0x66, 0x20, 0x27, 0x39, 0x39,
+    0x3a, 0x20, 0x49, 0x66, 0x20, 0x49, 0x20, 0x63,
+    0x6f, 0x75, 0x6c, 0x64, 0x20, 0x6f, 0x66, 0x66,
+    0x65, 0x72, 0x20, 0x79, 0x6f, 0x75, 0x20, 0x6f,
+    0x6e, 0x6c, 0x79, 0x20, 0x6f, 0x6e, 0x65, 0x20,
+    0x74, 0x69, 0x70, 0x20, 0x66, 0x6f, 0x72, 0x20,
+    0x74, 0x68, 0x65, 0x20, 0x66, 0x75, 0x74, 0x75,
+    0x72, 0x65, 0x2c, 0x20, 0x73, 0x75, 0x6e, 0x73,
+    0x63, 0x72, 0x65, 0x65, 0x6e, 0x20, 0x77, 0x6f,
+    0x75, 0x6c, 0x64, 0x20, 0x62, 0x65, 0x20, 0x69,
+    0x74, 0x2e
+};
+
+static const unsigned char test_output[114] =
+{
+    0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb,
+    0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+    0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe,
+    0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+    0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12,
+    0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+    0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29,
+    0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+    0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c,
+    0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+    0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94,
+    0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+    0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d,
+    0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+    0x61, 0x16
+};
+
+static const unsigned char test_mac[16] =
+{
+    0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a,
+    0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91
+};
+
+int mbedtls_chachapoly_self_test( int verbose )
+{
+    mbedtls_chachapoly_context ctx;
+    unsigned char output[114];
+    unsigned char mac[16];
+    size_t off;
+    int ret;
+
+    mbedtls_chachapoly_init( &ctx );
+
+    if( verbose != 0 )
+        mbedtls_printf( "  ChaCha20-Poly1305 test #1 (enc): " );
+
+    ret = mbedtls_chachapoly_setkey( &ctx, test_key );
+    if( ret == 0 )
+        ret = mbedtls_chachapoly_encrypt_and_tag( &ctx, sizeof( test_input ),
+                                                  test_nonce, test_aad,
+                                                  sizeof( test_aad ),
+                                                  test_input, output, mac );
+    if( ret != 0 ||
+        memcmp( output, test_output, sizeof( test_output ) ) != 0 ||
+        memcmp( mac, test_mac, sizeof( test_mac ) ) != 0 )
+        goto fail;
+
+    if( verbose != 0 )
+        mbedtls_printf( "passed\n  ChaCha20-Poly1305 test #1 (dec): " );
+
+    if( mbedtls_chachapoly_auth_decrypt( &ctx, sizeof( test_output ),
+                                         test_nonce, test_aad,
+                                         sizeof( test_aad ), test_mac,
+                                         test_output, output ) != 0 ||
+        memcmp( output, test_input, sizeof( test_input ) ) != 0 )
+        goto fail;
+
+    /* A modified tag must be refused */
+    memcpy( mac, test_mac, sizeof( mac ) );
+    mac[15] ^= 0x01;
+
+    if( mbedtls_chachapoly_auth_decrypt( &ctx, sizeof( test_output ),
+                                         test_nonce, test_aad,
+                                         sizeof( test_aad ), mac,
+                                         test_output, output ) !=
+        MBEDTLS_ERR_CHACHAPOLY_AUTH_FAILED )
+        goto fail;
+
+    if( verbose != 0 )
+        mbedtls_printf( "passed\n  ChaCha20-Poly1305 test #1 (split): " );
+
+    /* Same again, with the input split into odd pieces */
+    if( mbedtls_chachapoly_starts( &ctx, test_nonce,
+                                   MBEDTLS_CHACHAPOLY_ENCRYPT ) != 0 ||
+        mbedtls_chachapoly_update_aad( &ctx, test_aad, 5 ) != 0 ||
+        mbedtls_chachapoly_update_aad( &ctx, test_aad + 5,
+                                       sizeof( test_aad ) - 5 ) != 0 )
+        goto fail;
+
+    for( off = 0; off < sizeof( test_input ); off += 17 )
+    {
+        size_t len = sizeof( test_input ) - off < 17 ?
+                     sizeof( test_input ) - off : 17;
+
+        if( mbedtls_chachapoly_update( &ctx, len, test_input + off,
+                                       output + off ) != 0 )
+            goto fail;
+    }
+
+    if( mbedtls_chachapoly_finish( &ctx, mac ) != 0 ||
+        memcmp( output, test_output, sizeof( test_output ) ) != 0 ||
+        memcmp( mac, test_mac, sizeof( test_mac ) ) != 0 )
+        goto fail;
+
+    mbedtls_chachapoly_free( &ctx );
+
+    if( verbose != 0 )
+        mbedtls_printf( "passed\n\n" );
+
+    return( 0 );
+
+fail:
+    mbedtls_chachapoly_free( &ctx );
+
+    if( verbose != 0 )
+        mbedtls_printf( "failed\n" );
+
+    return( 1 );
+}
+
+#endif /* MBEDTLS_SELF_TEST */
+
+#endif /* MBEDTLS_CHACHAPOLY_C */
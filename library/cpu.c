@@ -0,0 +1,376 @@
+/*
+ *  Run-time selection of the accelerated symmetric primitives
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+
+/*
+ * Each primitive has a list of the implementations built into the library,
+ * best first, with the CPU features they need. The first one the CPU
+ * supports is selected the first time the primitive is used, and the
+ * modules then look the selection up rather than probing the CPU
+ * themselves.
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_CPU_C)
+
+#include "mbedtls/cpu.h"
+
+#include <stddef.h>
+
+#if defined(MBEDTLS_AESNI_C)
+#include "mbedtls/aesni.h"
+#endif
+
+#if defined(MBEDTLS_PADLOCK_C)
+#include "mbedtls/padlock.h"
+#endif
+
+#if defined(MBEDTLS_HAVE_ARMV8_CRYPTO_INTRIN) && !defined(__ARM_FEATURE_CRYPTO)
+#include <sys/auxv.h>
+#endif
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+#include <pthread.h>
+#endif
+
+#ifndef asm
+#define asm __asm
+#endif
+
+#if defined(MBEDTLS_HAVE_ASM) && defined(__GNUC__) &&             \
+    ( defined(__x86_64__) || defined(__i386__) )
+#define CPU_X86_CPUID
+#endif
+
+typedef struct
+{
+    mbedtls_cpu_impl_t impl;        /* implementation                   */
+    unsigned int features;          /* CPU features it needs            */
+}
+cpu_candidate;
+
+static const cpu_candidate cpu_aes[] =
+{
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    { MBEDTLS_CPU_IMPL_AESNI,   MBEDTLS_CPU_AESNI },
+#endif
+#if defined(MBEDTLS_PADLOCK_C) && defined(MBEDTLS_HAVE_X86)
+    { MBEDTLS_CPU_IMPL_PADLOCK, MBEDTLS_CPU_PADLOCK_ACE },
+#endif
+    { MBEDTLS_CPU_IMPL_GENERIC, 0 }
+};
+
+static const cpu_candidate cpu_ghash[] =
+{
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    { MBEDTLS_CPU_IMPL_PCLMUL,  MBEDTLS_CPU_PCLMUL },
+#endif
+    { MBEDTLS_CPU_IMPL_GENERIC, 0 }
+};
+
+static const cpu_candidate cpu_chacha20[] =
+{
+#if defined(MBEDTLS_CHACHA20_C) && defined(MBEDTLS_HAVE_AVX2_INTRIN)
+    { MBEDTLS_CPU_IMPL_AVX2,    MBEDTLS_CPU_AVX2 },
+#endif
+#if defined(MBEDTLS_CHACHA20_C) && defined(MBEDTLS_HAVE_SSE2_INTRIN)
+    { MBEDTLS_CPU_IMPL_SSE2,    MBEDTLS_CPU_SSE2 },
+#endif
+#if defined(MBEDTLS_CHACHA20_C) && defined(MBEDTLS_HAVE_NEON_INTRIN)
+    { MBEDTLS_CPU_IMPL_NEON,    MBEDTLS_CPU_NEON },
+#endif
+    { MBEDTLS_CPU_IMPL_GENERIC, 0 }
+};
+
+static const cpu_candidate cpu_sha256[] =
+{
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_HAVE_SHANI_INTRIN)
+    { MBEDTLS_CPU_IMPL_SHANI,   MBEDTLS_CPU_SHANI | MBEDTLS_CPU_SSSE3 |
+                                MBEDTLS_CPU_SSE41 },
+#endif
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_HAVE_ARMV8_CRYPTO_INTRIN)
+    { MBEDTLS_CPU_IMPL_ARMV8,   MBEDTLS_CPU_ARMV8_SHA2 },
+#endif
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_HAVE_AVX2_INTRIN)
+    { MBEDTLS_CPU_IMPL_AVX2,    MBEDTLS_CPU_AVX2 },
+#endif
+    { MBEDTLS_CPU_IMPL_GENERIC, 0 }
+};
+
+static const cpu_candidate cpu_sha512[] =
+{
+#if defined(MBEDTLS_SHA512_C) && defined(MBEDTLS_HAVE_AVX2_INTRIN)
+    { MBEDTLS_CPU_IMPL_AVX2,    MBEDTLS_CPU_AVX2 },
+#endif
+    { MBEDTLS_CPU_IMPL_GENERIC, 0 }
+};
+
+/*
+ * Hashing in SIMD lanes does not beat running the messages one after the
+ * other through the SHA-256 instructions
+ */
+static const cpu_candidate cpu_sha256_multi[] =
+{
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_HAVE_SHANI_INTRIN)
+    { MBEDTLS_CPU_IMPL_SHANI,   MBEDTLS_CPU_SHANI | MBEDTLS_CPU_SSSE3 |
+                                MBEDTLS_CPU_SSE41 },
+#endif
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_HAVE_ARMV8_CRYPTO_INTRIN)
+    { MBEDTLS_CPU_IMPL_ARMV8,   MBEDTLS_CPU_ARMV8_SHA2 },
+#endif
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_HAVE_AVX2_INTRIN)
+    { MBEDTLS_CPU_IMPL_AVX2,    MBEDTLS_CPU_AVX2 },
+#endif
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_HAVE_SSE2_INTRIN)
+    { MBEDTLS_CPU_IMPL_SSE2,    MBEDTLS_CPU_SSE2 },
+#endif
+    { MBEDTLS_CPU_IMPL_GENERIC, 0 }
+};
+
+static const cpu_candidate * const cpu_candidates[MBEDTLS_CPU_PRIMITIVES] =
+{
+    cpu_aes,
+    cpu_ghash,
+    cpu_chacha20,
+    cpu_sha256,
+    cpu_sha512,
+    cpu_sha256_multi,
+};
+
+static const char * const cpu_primitive_names[MBEDTLS_CPU_PRIMITIVES] =
+{
+    "AES",
+    "GHASH",
+    "ChaCha20",
+    "SHA-256",
+    "SHA-512",
+    "SHA-256-multi",
+};
+
+static const char * const cpu_impl_names[MBEDTLS_CPU_IMPLS] =
+{
+    "generic",
+    "PadLock",
+    "AES-NI",
+    "PCLMULQDQ",
+    "SSE2",
+    "AVX2",
+    "NEON",
+    "SHA-NI",
+    "ARMv8",
+};
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+#else
+static int cpu_done = 0;
+#endif
+static unsigned int cpu_feat = 0;
+static mbedtls_cpu_impl_t cpu_selected[MBEDTLS_CPU_PRIMITIVES];
+
+#if defined(CPU_X86_CPUID)
+static void cpu_cpuid( unsigned int leaf, unsigned int regs[4] )
+{
+#if defined(__x86_64__)
+    asm volatile( "cpuid"
+                  : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                  : "a" (leaf), "c" (0) );
+#else
+    /* ebx may hold the GOT pointer */
+    asm volatile( "movl  %%ebx, %1     \n\t"
+                  "cpuid               \n\t"
+                  "xchgl %%ebx, %1     \n\t"
+                  : "=a" (regs[0]), "=&r" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                  : "a" (leaf), "c" (0) );
+#endif
+}
+
+/*
+ * Leaf 1 ecx: PCLMULQDQ (1), SSSE3 (9), SSE4.1 (19), AES-NI (25),
+ *             OSXSAVE (27), AVX (28)
+ * Leaf 1 edx: SSE2 (26)
+ * Leaf 7 ebx: AVX2 (5), SHA (29)
+ */
+static unsigned int cpu_x86_features( void )
+{
+    unsigned int regs[4], max, xcr0, features = 0;
+
+    cpu_cpuid( 0, regs );
+    max = regs[0];
+    if( max < 1 )
+        return( 0 );
+
+    cpu_cpuid( 1, regs );
+
+    if( regs[3] & ( 1u << 26 ) )
+        features |= MBEDTLS_CPU_SSE2;
+    if( regs[2] & ( 1u << 9 ) )
+        features |= MBEDTLS_CPU_SSSE3;
+    if( regs[2] & ( 1u << 19 ) )
+        features |= MBEDTLS_CPU_SSE41;
+    if( regs[2] & ( 1u << 25 ) )
+        features |= MBEDTLS_CPU_AESNI;
+    if( regs[2] & ( 1u << 1 ) )
+        features |= MBEDTLS_CPU_PCLMUL;
+
+    /* AVX2 also needs the OS to save the YMM registers (XCR0 bits 1-2) */
+    xcr0 = 0;
+    if( ( regs[2] & ( 3u << 27 ) ) == ( 3u << 27 ) )
+    {
+        /* xgetbv, emitted as bytes for old assemblers */
+        asm volatile( ".byte 0x0F,0x01,0xD0" : "=a" (xcr0) : "c" (0) : "edx" );
+    }
+
+    if( max >= 7 )
+    {
+        cpu_cpuid( 7, regs );
+
+        if( ( regs[1] & ( 1u << 5 ) ) && ( xcr0 & 0x06 ) == 0x06 )
+            features |= MBEDTLS_CPU_AVX2;
+        if( regs[1] & ( 1u << 29 ) )
+            features |= MBEDTLS_CPU_SHANI;
+    }
+
+    return( features );
+}
+#endif /* CPU_X86_CPUID */
+
+static void cpu_detect( void )
+{
+    unsigned int features = 0;
+    const cpu_candidate *c;
+    int i;
+
+#if defined(CPU_X86_CPUID)
+    features |= cpu_x86_features();
+#endif
+
+    /* Instruction sets the compiler may use anyway must be there */
+#if defined(MBEDTLS_HAVE_SSE2_INTRIN)
+    features |= MBEDTLS_CPU_SSE2;
+#endif
+#if defined(MBEDTLS_HAVE_NEON_INTRIN)
+    features |= MBEDTLS_CPU_NEON;
+#endif
+
+#if defined(__ARM_FEATURE_CRYPTO)
+    features |= MBEDTLS_CPU_ARMV8_SHA2;
+#elif defined(MBEDTLS_HAVE_ARMV8_CRYPTO_INTRIN)
+    /* HWCAP_SHA2 */
+    if( getauxval( AT_HWCAP ) & ( 1ul << 6 ) )
+        features |= MBEDTLS_CPU_ARMV8_SHA2;
+#endif
+
+#if defined(MBEDTLS_PADLOCK_C) && defined(MBEDTLS_HAVE_X86)
+    if( mbedtls_padlock_has_support( MBEDTLS_PADLOCK_ACE ) )
+        features |= MBEDTLS_CPU_PADLOCK_ACE;
+#endif
+
+    cpu_feat = features;
+
+    for( i = 0; i < MBEDTLS_CPU_PRIMITIVES; i++ )
+    {
+        /* The generic implementation ends each list and needs nothing */
+        for( c = cpu_candidates[i]; ( c->features & features ) != c->features; c++ )
+            ;
+
+        cpu_selected[i] = c->impl;
+    }
+}
+
+/*
+ * Without pthread_once(), the selection is only published safely to the
+ * threads started after the first call
+ */
+void mbedtls_cpu_init( void )
+{
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    (void) pthread_once( &cpu_once, cpu_detect );
+#else
+    if( cpu_done )
+        return;
+
+    cpu_detect();
+    cpu_done = 1;
+#endif
+}
+
+unsigned int mbedtls_cpu_features( void )
+{
+    mbedtls_cpu_init();
+
+    return( cpu_feat );
+}
+
+mbedtls_cpu_impl_t mbedtls_cpu_impl( mbedtls_cpu_primitive_t prim )
+{
+    mbedtls_cpu_init();
+
+    if( (unsigned int) prim >= MBEDTLS_CPU_PRIMITIVES )
+        return( MBEDTLS_CPU_IMPL_GENERIC );
+
+    return( cpu_selected[prim] );
+}
+
+int mbedtls_cpu_set_impl( mbedtls_cpu_primitive_t prim,
+                          mbedtls_cpu_impl_t impl )
+{
+    const cpu_candidate *c;
+
+    mbedtls_cpu_init();
+
+    if( (unsigned int) prim >= MBEDTLS_CPU_PRIMITIVES )
+        return( MBEDTLS_ERR_CPU_FEATURE_UNAVAILABLE );
+
+    for( c = cpu_candidates[prim]; ; c++ )
+    {
+        if( c->impl == impl && ( c->features & cpu_feat ) == c->features )
+        {
+            cpu_selected[prim] = impl;
+            return( 0 );
+        }
+
+        if( c->impl == MBEDTLS_CPU_IMPL_GENERIC )
+            return( MBEDTLS_ERR_CPU_FEATURE_UNAVAILABLE );
+    }
+}
+
+const char *mbedtls_cpu_primitive_name( mbedtls_cpu_primitive_t prim )
+{
+    if( (unsigned int) prim >= MBEDTLS_CPU_PRIMITIVES )
+        return( NULL );
+
+    return( cpu_primitive_names[prim] );
+}
+
+const char *mbedtls_cpu_impl_name( mbedtls_cpu_impl_t impl )
+{
+    if( (unsigned int) impl >= MBEDTLS_CPU_IMPLS )
+        return( NULL );
+
+    return( cpu_impl_names[impl] );
+}
+
+#endif /* MBEDTLS_CPU_C */
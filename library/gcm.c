@@ -38,6 +38,7 @@
 #if defined(MBEDTLS_GCM_C)
 
 #include "mbedtls/gcm.h"
+#include "mbedtls/cpu.h"
 
 #include <string.h>
 
@@ -124,9 +125,13 @@ static int gcm_gen_table( mbedtls_gcm_context *ctx )
     ctx->HH[8] = vh;
 
 #if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
-    /* With CLMUL support, we need only h, not the rest of the table */
-    if( mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) )
+    /* With CLMUL support, we need only h and its powers for the bulk
+     * path, not the rest of the table */
+    if( mbedtls_cpu_impl( MBEDTLS_CPU_GHASH ) == MBEDTLS_CPU_IMPL_PCLMUL )
+    {
+        mbedtls_aesni_gcm_powers( ctx->HP, h );
         return( 0 );
+    }
 #endif
 
     /* 0 corresponds to 0 in GF(2^128) */
@@ -187,6 +192,12 @@ int mbedtls_gcm_setkey( mbedtls_gcm_context *ctx,
     if( ( ret = gcm_gen_table( ctx ) ) != 0 )
         return( ret );
 
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    ctx->aesni = ( cipher == MBEDTLS_CIPHER_ID_AES &&
+                   mbedtls_cpu_impl( MBEDTLS_CPU_AES ) == MBEDTLS_CPU_IMPL_AESNI &&
+                   mbedtls_cpu_impl( MBEDTLS_CPU_GHASH ) == MBEDTLS_CPU_IMPL_PCLMUL );
+#endif
+
     return( 0 );
 }
 
@@ -215,7 +226,7 @@ static void gcm_mult( mbedtls_gcm_context *ctx, const unsigned char x[16],
     uint64_t zh, zl;
 
 #if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
-    if( mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) ) {
+    if( mbedtls_cpu_impl( MBEDTLS_CPU_GHASH ) == MBEDTLS_CPU_IMPL_PCLMUL ) {
         unsigned char h[16];
 
         PUT_UINT32_BE( ctx->HH[8] >> 32, h,  0 );
@@ -370,6 +381,24 @@ int mbedtls_gcm_update( mbedtls_gcm_context *ctx,
     ctx->len += length;
 
     p = input;
+
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    /* Bulk path for whole 64-byte chunks, the rest goes through the loop.
+     * MBEDTLS_GCM_ENCRYPT and MBEDTLS_GCM_DECRYPT match the AES modes. */
+    if( ctx->aesni && length >= 64 )
+    {
+        use_len = length & ~(size_t) 63;
+
+        mbedtls_aesni_gcm_crypt_blocks( ctx->cipher_ctx.cipher_ctx, ctx->HP,
+                                        ctx->mode, use_len, ctx->y, ctx->buf,
+                                        p, out_p );
+
+        length -= use_len;
+        p += use_len;
+        out_p += use_len;
+    }
+#endif
+
     while( length > 0 )
     {
         use_len = ( length < 16 ) ? length : 16;
@@ -32,6 +32,10 @@
 
 #include <limits.h>
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+#include <time.h>
+#endif
+
 #define mbedtls_calloc    calloc
 #define mbedtls_free       free
 
@@ -67,6 +71,41 @@ void mbedtls_free_octet(octet *to_be_freed)
 
 #if defined(MBEDTLS_TLS_MILAGRO_CS)
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS)
+#define MILAGRO_CS_BUF( milagro_cs, name )  ( (milagro_cs)->buffers.name )
+#else
+#define MILAGRO_CS_BUF( milagro_cs, name )  NULL
+#endif
+
+/*
+ * Give a per-handshake octet its storage: the buffer inside the context
+ * with MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS, the heap otherwise
+ */
+static void milagro_cs_octet_setup( octet *o, char *inline_buf, int size )
+{
+#if defined(MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS)
+    o->val = inline_buf;
+    memset( o->val, 0, size );
+#else
+    (void) inline_buf;
+    if( o->val == NULL )
+        o->val = mbedtls_alloc_or_die(size);
+#endif
+    o->max = size;
+}
+
+static void milagro_cs_octet_release( octet *o )
+{
+#if defined(MBEDTLS_TLS_MILAGRO_CS_INLINE_BUFFERS)
+    if( o->val != NULL )
+        memset( o->val, 0, o->max );
+    o->val = NULL;
+    o->len = 0;
+#else
+    mbedtls_free_octet(o);
+#endif
+}
+
 void mbedtls_ssl_milagro_cs_init( mbedtls_milagro_cs_context * milagro_cs)
 {
     memset(milagro_cs,0,sizeof(*milagro_cs));
@@ -126,34 +165,72 @@ void mbedtls_ssl_milagro_cs_set_secret(mbedtls_milagro_cs_context *milagro_cs, c
     milagro_cs->secret.len = len_secret;
 }
 
+void mbedtls_ssl_milagro_cs_set_reusable( mbedtls_milagro_cs_context *milagro_cs, int reusable )
+{
+    milagro_cs->reusable = reusable;
+}
+
+
+#if defined(MBEDTLS_SSL_CLI_C)
+int mbedtls_ssl_milagro_cs_precompute( mbedtls_milagro_cs_context *milagro_cs )
+{
+    if( milagro_cs->secret.val == NULL || milagro_cs->hash_client_id.val == NULL )
+    {
+        return( MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA );
+    }
+
+    if( milagro_cs->G1.val == NULL )
+    {
+        milagro_cs->G1.val = mbedtls_alloc_or_die(12*PFS);
+        milagro_cs->G1.max = 12*PFS;
+    }
+    if( milagro_cs->G2.val == NULL )
+    {
+        milagro_cs->G2.val = mbedtls_alloc_or_die(12*PFS);
+        milagro_cs->G2.max = 12*PFS;
+    }
+
+    milagro_cs->precomputed = 0;
+    if( MPIN_PRECOMPUTE(&milagro_cs->secret, &milagro_cs->hash_client_id,
+                        &milagro_cs->G1, &milagro_cs->G2) != 0 )
+    {
+        return( MBEDTLS_ERR_MILAGRO_CS_KEY_COMPUTATOIN_FAILED );
+    }
+    milagro_cs->precomputed = 1;
+    milagro_cs->reusable = 1;
+
+    return 0;
+}
+#endif /* MBEDTLS_SSL_CLI_C */
 
         
 int mbedtls_ssl_milagro_cs_alloc_memory(int client_or_server, mbedtls_milagro_cs_context *milagro_cs)
 {
     // Set memory of parameters to be fit
-    milagro_cs->Y.val = mbedtls_alloc_or_die(PGS);
-    milagro_cs->V.val = mbedtls_alloc_or_die(2*PFS+1);
-    milagro_cs->UT.val = mbedtls_alloc_or_die(2*PFS+1);
-    milagro_cs->U.val = mbedtls_alloc_or_die(2*PFS+1);
-    milagro_cs->W.val = mbedtls_alloc_or_die(2*PFS+1);
-    milagro_cs->R.val = mbedtls_alloc_or_die(2*PFS+1);
-    milagro_cs->param_rand.val = mbedtls_alloc_or_die(PGS);
-    milagro_cs->H.val = mbedtls_alloc_or_die(PGS);
-    milagro_cs->H.max = PGS;
-    milagro_cs->Key.val = mbedtls_alloc_or_die(PAS);
-    milagro_cs->Key.max = PAS;
+    milagro_cs_octet_setup(&milagro_cs->Y, MILAGRO_CS_BUF(milagro_cs, Y), PGS);
+    milagro_cs_octet_setup(&milagro_cs->V, MILAGRO_CS_BUF(milagro_cs, V), 2*PFS+1);
+    milagro_cs_octet_setup(&milagro_cs->UT, MILAGRO_CS_BUF(milagro_cs, UT), 2*PFS+1);
+    milagro_cs_octet_setup(&milagro_cs->U, MILAGRO_CS_BUF(milagro_cs, U), 2*PFS+1);
+    milagro_cs_octet_setup(&milagro_cs->W, MILAGRO_CS_BUF(milagro_cs, W), 2*PFS+1);
+    milagro_cs_octet_setup(&milagro_cs->R, MILAGRO_CS_BUF(milagro_cs, R), 2*PFS+1);
+    milagro_cs_octet_setup(&milagro_cs->param_rand, MILAGRO_CS_BUF(milagro_cs, param_rand), PGS);
+    milagro_cs_octet_setup(&milagro_cs->H, MILAGRO_CS_BUF(milagro_cs, H), PGS);
+    milagro_cs_octet_setup(&milagro_cs->Key, MILAGRO_CS_BUF(milagro_cs, Key), PAS);
     milagro_cs->timevalue = MPIN_GET_TIME();
     
     if(client_or_server == MBEDTLS_SSL_IS_SERVER)
     {
-        milagro_cs->HID.val = mbedtls_alloc_or_die(2*PFS+1);
+#if defined(MBEDTLS_SSL_SRV_C)
+        milagro_cs_octet_setup(&milagro_cs->HID, MILAGRO_CS_BUF(milagro_cs, HID), 2*PFS+1);
         milagro_cs->HID.len = 2*PFS+1;
-        milagro_cs->HTID.val = mbedtls_alloc_or_die(2*PFS+1);
+        milagro_cs_octet_setup(&milagro_cs->HTID, MILAGRO_CS_BUF(milagro_cs, HTID), 2*PFS+1);
         milagro_cs->HTID.len = 2*PFS+1;
+#endif
     }
     else if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
     {
-        milagro_cs->X.val = mbedtls_alloc_or_die(PGS);
+#if defined(MBEDTLS_SSL_CLI_C)
+        milagro_cs_octet_setup(&milagro_cs->X, MILAGRO_CS_BUF(milagro_cs, X), PGS);
 
         if (MPIN_CLIENT(milagro_cs->date,
                         &milagro_cs->client_identity,
@@ -170,6 +247,7 @@ int mbedtls_ssl_milagro_cs_alloc_memory(int client_or_server, mbedtls_milagro_cs
         {
             return -1;
         }
+#endif
     }
     else
     {
@@ -199,23 +277,310 @@ int mbedtls_milagro_cs_check(int client_or_server, mbedtls_milagro_cs_context *m
 
 #if defined(MBEDTLS_SSL_SRV_C)
 
+void mbedtls_ssl_milagro_cs_set_hid_cache( mbedtls_milagro_cs_context *milagro_cs,
+                                           mbedtls_milagro_cs_hid_cache_context *cache )
+{
+    milagro_cs->hid_cache = cache;
+}
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+void mbedtls_ssl_milagro_cs_set_worker_pool( mbedtls_milagro_cs_context *milagro_cs,
+                                             mbedtls_milagro_cs_worker_pool *pool )
+{
+    milagro_cs->worker_pool = pool;
+}
+#endif
+
+void mbedtls_milagro_cs_hid_cache_init( mbedtls_milagro_cs_hid_cache_context *cache )
+{
+    memset( cache, 0, sizeof( mbedtls_milagro_cs_hid_cache_context ) );
+
+    cache->max_entries = MBEDTLS_MILAGRO_CS_HID_CACHE_DEFAULT_MAX_ENTRIES;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_init( &cache->mutex );
+#endif
+}
+
+static void hid_cache_flush( mbedtls_milagro_cs_hid_cache_context *cache )
+{
+    if( cache->entries != NULL )
+        memset( cache->entries, 0, cache->max_entries * sizeof( mbedtls_milagro_cs_hid_cache_entry ) );
+    mbedtls_free( cache->entries );
+    mbedtls_free( cache->buckets );
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->used = 0;
+}
+
+void mbedtls_milagro_cs_hid_cache_set_max_entries( mbedtls_milagro_cs_hid_cache_context *cache, int max )
+{
+    if( max < 0 ) max = 0;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &cache->mutex ) != 0 )
+        return;
+#endif
+
+    hid_cache_flush( cache );
+    cache->max_entries = max;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &cache->mutex );
+#endif
+}
+
+static size_t hid_cache_bucket( const mbedtls_milagro_cs_hid_cache_context *cache,
+                                const char *id, int id_len )
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    int i;
+
+    for( i = 0; i < id_len; i++ )
+    {
+        h ^= (unsigned char) id[i];
+        h *= 16777619u;
+    }
+
+    return( h % (uint32_t) cache->max_entries );
+}
+
+static mbedtls_milagro_cs_hid_cache_entry *hid_cache_find( mbedtls_milagro_cs_hid_cache_context *cache,
+                                                           const octet *hash_client_id )
+{
+    mbedtls_milagro_cs_hid_cache_entry *cur;
+
+    if( cache->buckets == NULL )
+        return( NULL );
+
+    for( cur = cache->buckets[hid_cache_bucket( cache, hash_client_id->val, hash_client_id->len )]; cur != NULL; cur = cur->chain )
+    {
+        if( cur->id_len == hash_client_id->len &&
+            memcmp( cur->id, hash_client_id->val, cur->id_len ) == 0 )
+            return( cur );
+    }
+
+    return( NULL );
+}
+
+static void hid_cache_unlink( mbedtls_milagro_cs_hid_cache_context *cache,
+                              mbedtls_milagro_cs_hid_cache_entry *entry )
+{
+    if( entry->prev != NULL )
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if( entry->next != NULL )
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void hid_cache_push_front( mbedtls_milagro_cs_hid_cache_context *cache,
+                                  mbedtls_milagro_cs_hid_cache_entry *entry )
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if( cache->head != NULL )
+        cache->head->prev = entry;
+    cache->head = entry;
+    if( cache->tail == NULL )
+        cache->tail = entry;
+}
+
+static void hid_cache_insert( mbedtls_milagro_cs_hid_cache_context *cache, int date,
+                              const octet *hash_client_id, const octet *HID, const octet *HTID )
+{
+    mbedtls_milagro_cs_hid_cache_entry *entry, **link;
+
+    if( cache->entries == NULL )
+    {
+        cache->entries = mbedtls_calloc( cache->max_entries, sizeof( mbedtls_milagro_cs_hid_cache_entry ) );
+        cache->buckets = mbedtls_calloc( cache->max_entries, sizeof( mbedtls_milagro_cs_hid_cache_entry * ) );
+        if( cache->entries == NULL || cache->buckets == NULL )
+        {
+            hid_cache_flush( cache );
+            return;
+        }
+    }
+
+    /* Another thread may have inserted it meanwhile, or the date changed */
+    if( ( entry = hid_cache_find( cache, hash_client_id ) ) != NULL )
+    {
+        hid_cache_unlink( cache, entry );
+    }
+    else
+    {
+        if( cache->used < cache->max_entries )
+        {
+            entry = &cache->entries[cache->used++];
+        }
+        else
+        {
+            /* Evict the least recently used identity */
+            entry = cache->tail;
+            hid_cache_unlink( cache, entry );
+
+            link = &cache->buckets[hid_cache_bucket( cache, entry->id, entry->id_len )];
+            while( *link != entry )
+                link = &(*link)->chain;
+            *link = entry->chain;
+        }
+
+        memcpy( entry->id, hash_client_id->val, hash_client_id->len );
+        entry->id_len = hash_client_id->len;
+
+        link = &cache->buckets[hid_cache_bucket( cache, hash_client_id->val, hash_client_id->len )];
+        entry->chain = *link;
+        *link = entry;
+    }
+
+    entry->date = date;
+    memcpy( entry->hid, HID->val, HID->len );
+    entry->hid_len = HID->len;
+    if( date != 0 )
+    {
+        memcpy( entry->htid, HTID->val, HTID->len );
+        entry->htid_len = HTID->len;
+    }
+
+    hid_cache_push_front( cache, entry );
+}
+
+int mbedtls_milagro_cs_hid_cache_get( mbedtls_milagro_cs_hid_cache_context *cache, int date,
+                                      octet *hash_client_id, octet *HID, octet *HTID )
+{
+    mbedtls_milagro_cs_hid_cache_entry *entry;
+    int hit = 0;
+    int cacheable = cache->max_entries > 0 &&
+                    hash_client_id->len > 0 && hash_client_id->len <= PGS;
+
+    if( cacheable )
+    {
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_lock( &cache->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+        entry = hid_cache_find( cache, hash_client_id );
+        if( entry != NULL && entry->date == date )
+        {
+            memcpy( HID->val, entry->hid, entry->hid_len );
+            HID->len = entry->hid_len;
+            if( date != 0 )
+            {
+                memcpy( HTID->val, entry->htid, entry->htid_len );
+                HTID->len = entry->htid_len;
+            }
+
+            hid_cache_unlink( cache, entry );
+            hid_cache_push_front( cache, entry );
+            cache->hits++;
+            hit = 1;
+        }
+        else
+        {
+            cache->misses++;
+        }
+
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_unlock( &cache->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+        /* The entry may be evicted as soon as the lock is released */
+        if( hit )
+            return( 0 );
+    }
+
+    /* Map to the curve outside of the lock */
+    MPIN_SERVER_1(date, hash_client_id, HID, HTID);
+
+    if( cacheable )
+    {
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_lock( &cache->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+        if( cache->max_entries > 0 )
+            hid_cache_insert( cache, date, hash_client_id, HID, HTID );
+
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_unlock( &cache->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+    }
+
+    return( 0 );
+}
+
+void mbedtls_milagro_cs_hid_cache_stats( mbedtls_milagro_cs_hid_cache_context *cache,
+                                         unsigned long *hits, unsigned long *misses )
+{
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &cache->mutex ) != 0 )
+        return;
+#endif
+
+    *hits = cache->hits;
+    *misses = cache->misses;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &cache->mutex );
+#endif
+}
+
+void mbedtls_milagro_cs_hid_cache_free( mbedtls_milagro_cs_hid_cache_context *cache )
+{
+    if( cache == NULL )
+        return;
+
+    hid_cache_flush( cache );
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_free( &cache->mutex );
+#endif
+}
+
 int mbedtls_milagro_cs_read_client_parameters( mbedtls_milagro_cs_context *milagro_cs, const unsigned char *buf, size_t len )
 {
     unsign32 client_time = 0;
     int32_t check_time = 0;
+    int id_len, u_len, v_len;
+
+    if( len < 10 )
+        return(MBEDTLS_ERR_MILAGRO_CS_READ_PARAM_FAILED);
+
+    id_len = UINT16_MAX & (buf[1] |((uint16_t)buf[0])<< 8);
+    u_len = UINT16_MAX & (buf[3] |((uint16_t)buf[2])<< 8);
+    v_len = UINT16_MAX & (buf[5] |((uint16_t)buf[4])<< 8);
+
+    /* The parameters are copied into octets of fixed size */
+    if( id_len == 0 || id_len > PGS || u_len > 2*PFS+1 || v_len > 2*PFS+1 ||
+        len != (size_t) id_len + u_len + v_len + 10 )
+        return(MBEDTLS_ERR_MILAGRO_CS_READ_PARAM_FAILED);
+
     // Copy the client's identity length
-    milagro_cs->hash_client_id.len = UINT16_MAX & (buf[1] |((uint16_t)buf[0])<< 8);
-    milagro_cs->hash_client_id.val = mbedtls_alloc_or_die(milagro_cs->hash_client_id.len);
+    milagro_cs_octet_setup(&milagro_cs->hash_client_id, MILAGRO_CS_BUF(milagro_cs, hash_client_id), PGS);
+    milagro_cs->hash_client_id.len = id_len;
 
 #if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
     // Copy the length of the parameter UT
-    milagro_cs->UT.len =  UINT16_MAX & (buf[3] |((uint16_t)buf[2])<< 8);
+    milagro_cs->UT.len = u_len;
 #else
     // Copy the length of the parameter UT
-    milagro_cs->U.len =  UINT16_MAX & (buf[3] |((uint16_t)buf[2])<< 8);
+    milagro_cs->U.len = u_len;
 #endif
     // Copy the length of the parameter V
-    milagro_cs->V.len = UINT16_MAX & (buf[5] |((uint16_t)buf[4])<< 8);
+    milagro_cs->V.len = v_len;
     
     // Copy the client identity
     memcpy(milagro_cs->hash_client_id.val, &buf[6], milagro_cs->hash_client_id.len);
@@ -256,15 +621,6 @@ int mbedtls_milagro_cs_read_client_parameters( mbedtls_milagro_cs_context *milag
     else
         return(MBEDTLS_ERR_MILAGRO_CS_AUTHENTICATION_FAILED);
     
-    if((int)len != milagro_cs->hash_client_id.len +
-#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
-       milagro_cs->UT.len +
-#else
-       milagro_cs->U.len +
-#endif
-       milagro_cs->V.len + 10)
-        return(MBEDTLS_ERR_MILAGRO_CS_AUTHENTICATION_FAILED);
-    
     return 0;
 }
 
@@ -276,6 +632,24 @@ int mbedtls_milagro_cs_authenticate_client( mbedtls_milagro_cs_context *milagro_
     milagro_cs->date=MPIN_today();
 #endif
     
+    if( milagro_cs->hid_cache != NULL )
+    {
+        /* Same as MPIN_SERVER, with HID/HTID taken from the cache */
+        if( ( ret = mbedtls_milagro_cs_hid_cache_get( milagro_cs->hid_cache, milagro_cs->date,
+                                                      &milagro_cs->hash_client_id,
+                                                      &milagro_cs->HID, &milagro_cs->HTID ) ) != 0 )
+        {
+            return( ret );
+        }
+        MPIN_GET_Y(milagro_cs->timevalue, milagro_cs->date ? &milagro_cs->UT : &milagro_cs->U, &milagro_cs->Y);
+        if ( MPIN_SERVER_2(milagro_cs->date,&milagro_cs->HID,&milagro_cs->HTID,&milagro_cs->Y,&milagro_cs->secret,
+                           &milagro_cs->U,&milagro_cs->UT,&milagro_cs->V,NULL,NULL) != 0 )
+        {
+            ret = MBEDTLS_ERR_MILAGRO_CS_AUTHENTICATION_FAILED;
+        }
+        return ret;
+    }
+    
     if ( MPIN_SERVER(milagro_cs->date,&milagro_cs->HID,&milagro_cs->HTID,&milagro_cs->Y,&milagro_cs->secret,&milagro_cs->U,
                      &milagro_cs->UT,&milagro_cs->V,NULL,NULL,&milagro_cs->hash_client_id,NULL,milagro_cs->timevalue) != 0)
     {
@@ -285,89 +659,459 @@ int mbedtls_milagro_cs_authenticate_client( mbedtls_milagro_cs_context *milagro_
     return ret;
 }
 
-
-#endif /* MBEDTLS_SSL_SRV_C */
-
-int mbedtls_milagro_cs_write_exchange_parameter( int client_or_server, mbedtls_milagro_cs_context *milagro_cs,
-                                          unsigned char *buf, size_t len, size_t *ec_point_len )
+/*
+ * Copy HID/HTID from a context of the same batch which has the same identity
+ */
+static int milagro_cs_batch_share_hid( mbedtls_milagro_cs_context **milagro_cs,
+                                       const int *results, int i )
 {
-    unsigned char *p = buf;
-    const unsigned char *end = buf + len;
-    
-    if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    mbedtls_milagro_cs_context *cur = milagro_cs[i], *prev;
+    int j;
+
+    for( j = 0; j < i; j++ )
     {
-        if(MPIN_GET_G1_MULTIPLE(&milagro_cs->RNG,1,&milagro_cs->param_rand,&milagro_cs->hash_client_id,&milagro_cs->R) != 0)
+        prev = milagro_cs[j];
+        if( results[j] != 0 && results[j] != MBEDTLS_ERR_MILAGRO_CS_AUTHENTICATION_FAILED )
+            continue;
+        if( prev->hash_client_id.len != cur->hash_client_id.len ||
+            memcmp( prev->hash_client_id.val, cur->hash_client_id.val, cur->hash_client_id.len ) != 0 )
+            continue;
+
+        memcpy( cur->HID.val, prev->HID.val, prev->HID.len );
+        cur->HID.len = prev->HID.len;
+        if( cur->date != 0 )
         {
-            return MBEDTLS_ERR_MILAGRO_CS_CLI_PUB_PARAM_FAILED;
+            memcpy( cur->HTID.val, prev->HTID.val, prev->HTID.len );
+            cur->HTID.len = prev->HTID.len;
         }
-        *p++ = (unsigned char)( ( ( milagro_cs->R.len     ) >> 8 ) & 0xFF );
-        *p++ = (unsigned char)( ( ( milagro_cs->R.len     )      ) & 0xFF );
-        
-        memcpy(p, milagro_cs->R.val, milagro_cs->R.len);
-        p += milagro_cs->R.len;
+        return( 1 );
     }
-    else if(client_or_server == MBEDTLS_SSL_IS_SERVER)
-    {
-        int ret;
+
+    return( 0 );
+}
+
+int mbedtls_milagro_cs_authenticate_clients( mbedtls_milagro_cs_context **milagro_cs, int n, int *results )
+{
+    int i, ret = 0;
+    int date = 0;
+
 #if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
-        ret = MPIN_GET_G1_MULTIPLE(&milagro_cs->RNG,0,&milagro_cs->param_rand,&milagro_cs->HTID,&milagro_cs->W);
-#else
-        ret = MPIN_GET_G1_MULTIPLE(&milagro_cs->RNG,0,&milagro_cs->param_rand,&milagro_cs->HID,&milagro_cs->W);
+    date = MPIN_today();
 #endif
-        if( ret != 0)
+
+    for( i = 0; i < n; i++ )
+    {
+        mbedtls_milagro_cs_context *cur = milagro_cs[i];
+
+        cur->date = date;
+        results[i] = 0;
+
+        /* Same as MPIN_SERVER, with HID/HTID computed once per identity */
+        if( !milagro_cs_batch_share_hid( milagro_cs, results, i ) )
         {
-            return(MBEDTLS_ERR_MILAGRO_CS_SRV_PUB_PARAM_FAILED);
+            if( cur->hid_cache != NULL )
+                results[i] = mbedtls_milagro_cs_hid_cache_get( cur->hid_cache, date, &cur->hash_client_id,
+                                                               &cur->HID, &cur->HTID );
+            else
+                MPIN_SERVER_1(date, &cur->hash_client_id, &cur->HID, &cur->HTID);
         }
-        *p++ = (unsigned char)( ( ( milagro_cs->W.len     ) >> 8 ) & 0xFF );
-        *p++ = (unsigned char)( ( ( milagro_cs->W.len     )      ) & 0xFF );
-        
-        memcpy(p, milagro_cs->W.val, milagro_cs->W.len);
-        p += milagro_cs->W.len;
+
+        if( results[i] == 0 )
+        {
+            MPIN_GET_Y(cur->timevalue, date ? &cur->UT : &cur->U, &cur->Y);
+            if( MPIN_SERVER_2(date,&cur->HID,&cur->HTID,&cur->Y,&cur->secret,
+                              &cur->U,&cur->UT,&cur->V,NULL,NULL) != 0 )
+            {
+                results[i] = MBEDTLS_ERR_MILAGRO_CS_AUTHENTICATION_FAILED;
+            }
+        }
+
+        if( results[i] != 0 )
+            ret = MBEDTLS_ERR_MILAGRO_CS_AUTHENTICATION_FAILED;
     }
-    else
+
+    return( ret );
+}
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+void mbedtls_milagro_cs_worker_pool_init( mbedtls_milagro_cs_worker_pool *pool )
+{
+    memset( pool, 0, sizeof( mbedtls_milagro_cs_worker_pool ) );
+}
+
+void mbedtls_milagro_cs_worker_pool_set_batch( mbedtls_milagro_cs_worker_pool *pool,
+                                                int max_batch, unsigned int window_ms )
+{
+    if( max_batch < 1 )
+        max_batch = 1;
+    if( max_batch > MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH )
+        max_batch = MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH;
+
+    pool->max_batch = max_batch;
+    pool->window_ms = window_ms;
+}
+
+/*
+ * Called with the mutex held: wait until max_batch contexts are queued
+ * or window_ms have passed
+ */
+static void worker_pool_wait_batch( mbedtls_milagro_cs_worker_pool *pool )
+{
+    struct timespec deadline;
+
+    if( pool->max_batch <= 1 || pool->window_ms == 0 )
+        return;
+
+    /* pool->work runs on the monotonic clock, see the setup */
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    deadline.tv_sec += pool->window_ms / 1000;
+    deadline.tv_nsec += ( pool->window_ms % 1000 ) * 1000000L;
+    if( deadline.tv_nsec >= 1000000000L )
     {
-        return(MBEDTLS_ERR_SSL_INTERNAL_ERROR);
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
     }
-    
-    if( end < p )
+
+    while( pool->queued < pool->max_batch && !pool->shutdown )
     {
-        return(MBEDTLS_ERR_MILAGRO_CS_CLI_PUB_PARAM_FAILED);
+        if( pthread_cond_timedwait( &pool->work, &pool->mutex, &deadline ) != 0 )
+            break;
     }
-    
-    *ec_point_len = p - buf;
-    return 0;
 }
 
-int mbedtls_milagro_cs_read_public_parameter( int client_or_server, mbedtls_milagro_cs_context *milagro_cs,
-                                       const unsigned char *buf, size_t len  )
+static void *worker_pool_main( void *arg )
 {
-#if defined(MBEDTLS_SSL_CLI_C)
-    if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    mbedtls_milagro_cs_worker_pool *pool = (mbedtls_milagro_cs_worker_pool *) arg;
+    mbedtls_milagro_cs_context *batch[MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH];
+    int results[MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH];
+    int i, n;
+
+    pthread_mutex_lock( &pool->mutex );
+
+    for( ;; )
     {
-        // Copy the length of the parameter W
-        milagro_cs->W.len =  UINT16_MAX & (buf[1] |((uint16_t)buf[0])<< 8);
-        
-        // Copy the parameter W
-        memcpy(milagro_cs->W.val, &buf[2], milagro_cs->W.len);
-        if ((int)len != milagro_cs->W.len + 2)
+        while( pool->head == NULL && !pool->shutdown )
+            pthread_cond_wait( &pool->work, &pool->mutex );
+
+        /* On shutdown, leave only once the queue has been drained */
+        if( pool->head == NULL )
+            break;
+
+        worker_pool_wait_batch( pool );
+
+        for( n = 0; n < pool->max_batch && pool->head != NULL; n++ )
         {
-            return (MBEDTLS_ERR_MILAGRO_CS_READ_PARAM_FAILED);
+            batch[n] = pool->head;
+            pool->head = batch[n]->async_next;
+            batch[n]->async_next = NULL;
+            batch[n]->async_state = MBEDTLS_MILAGRO_CS_ASYNC_RUNNING;
+        }
+        if( pool->head == NULL )
+            pool->tail = NULL;
+        pool->queued -= n;
+
+        /* Another worker may have taken the queue while waiting */
+        if( n == 0 )
+            continue;
+
+        pthread_mutex_unlock( &pool->mutex );
+        if( n == 1 )
+            results[0] = mbedtls_milagro_cs_authenticate_client( batch[0] );
+        else
+            (void) mbedtls_milagro_cs_authenticate_clients( batch, n, results );
+        pthread_mutex_lock( &pool->mutex );
+
+        for( i = 0; i < n; i++ )
+        {
+            batch[i]->async_ret = results[i];
+            batch[i]->async_state = MBEDTLS_MILAGRO_CS_ASYNC_DONE;
         }
+        pthread_cond_broadcast( &pool->done );
+    }
+
+    pthread_mutex_unlock( &pool->mutex );
+
+    return( NULL );
+}
+
+int mbedtls_milagro_cs_worker_pool_setup( mbedtls_milagro_cs_worker_pool *pool, int nb_threads )
+{
+    pthread_condattr_t attr;
+    int i;
+
+    if( nb_threads < 1 || nb_threads > MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_THREADS )
+        return( MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA );
+
+    if( pool->max_batch == 0 )
+        pool->max_batch = 1;
+
+    if( pthread_mutex_init( &pool->mutex, NULL ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+
+    /* Batch windows must not follow steps of the wall clock */
+    if( pthread_condattr_init( &attr ) != 0 )
+    {
+        pthread_mutex_destroy( &pool->mutex );
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+    }
+    if( pthread_condattr_setclock( &attr, CLOCK_MONOTONIC ) != 0 ||
+        pthread_cond_init( &pool->work, &attr ) != 0 )
+    {
+        pthread_condattr_destroy( &attr );
+        pthread_mutex_destroy( &pool->mutex );
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+    }
+    pthread_condattr_destroy( &attr );
+    if( pthread_cond_init( &pool->done, NULL ) != 0 )
+    {
+        pthread_cond_destroy( &pool->work );
+        pthread_mutex_destroy( &pool->mutex );
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+    }
+
+    for( i = 0; i < nb_threads; i++ )
+    {
+        if( pthread_create( &pool->threads[i], NULL, worker_pool_main, pool ) != 0 )
+        {
+            if( pool->nb_threads > 0 )
+            {
+                mbedtls_milagro_cs_worker_pool_free( pool );
+            }
+            else
+            {
+                pthread_cond_destroy( &pool->done );
+                pthread_cond_destroy( &pool->work );
+                pthread_mutex_destroy( &pool->mutex );
+            }
+            return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+        }
+        pool->nb_threads++;
+    }
+
+    return( 0 );
+}
+
+void mbedtls_milagro_cs_worker_pool_free( mbedtls_milagro_cs_worker_pool *pool )
+{
+    int i;
+
+    if( pool == NULL || pool->nb_threads == 0 )
+        return;
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->shutdown = 1;
+    pthread_cond_broadcast( &pool->work );
+    pthread_mutex_unlock( &pool->mutex );
+
+    for( i = 0; i < pool->nb_threads; i++ )
+        pthread_join( pool->threads[i], NULL );
+
+    pthread_cond_destroy( &pool->done );
+    pthread_cond_destroy( &pool->work );
+    pthread_mutex_destroy( &pool->mutex );
+
+    memset( pool, 0, sizeof( mbedtls_milagro_cs_worker_pool ) );
+}
+
+int mbedtls_milagro_cs_authenticate_client_async( mbedtls_milagro_cs_context *milagro_cs )
+{
+    mbedtls_milagro_cs_worker_pool *pool = milagro_cs->worker_pool;
+
+    if( pool == NULL || pool->nb_threads == 0 )
+        return( MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA );
+
+    pthread_mutex_lock( &pool->mutex );
+
+    if( milagro_cs->async_state != MBEDTLS_MILAGRO_CS_ASYNC_IDLE )
+    {
+        pthread_mutex_unlock( &pool->mutex );
+        return( MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA );
+    }
+
+    milagro_cs->async_state = MBEDTLS_MILAGRO_CS_ASYNC_QUEUED;
+    milagro_cs->async_next = NULL;
+    if( pool->tail != NULL )
+        pool->tail->async_next = milagro_cs;
+    else
+        pool->head = milagro_cs;
+    pool->tail = milagro_cs;
+    pool->queued++;
+
+    /* A worker may be holding a partial batch open */
+    if( pool->queued >= pool->max_batch )
+        pthread_cond_broadcast( &pool->work );
+    else
+        pthread_cond_signal( &pool->work );
+    pthread_mutex_unlock( &pool->mutex );
+
+    return( 0 );
+}
+
+int mbedtls_milagro_cs_authenticate_client_poll( mbedtls_milagro_cs_context *milagro_cs )
+{
+    mbedtls_milagro_cs_worker_pool *pool = milagro_cs->worker_pool;
+    int ret;
+
+    if( pool == NULL )
+        return( MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA );
+
+    pthread_mutex_lock( &pool->mutex );
+
+    switch( milagro_cs->async_state )
+    {
+        case MBEDTLS_MILAGRO_CS_ASYNC_QUEUED:
+        case MBEDTLS_MILAGRO_CS_ASYNC_RUNNING:
+            ret = MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS;
+            break;
+
+        case MBEDTLS_MILAGRO_CS_ASYNC_DONE:
+            ret = milagro_cs->async_ret;
+            milagro_cs->async_state = MBEDTLS_MILAGRO_CS_ASYNC_IDLE;
+            break;
+
+        default:
+            ret = MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA;
+            break;
+    }
+
+    pthread_mutex_unlock( &pool->mutex );
+
+    return( ret );
+}
+
+/*
+ * Take back a context from the pool before its parameters are released:
+ * unlink it if still queued, wait for the worker if running
+ */
+static void milagro_cs_async_cancel( mbedtls_milagro_cs_context *milagro_cs )
+{
+    mbedtls_milagro_cs_worker_pool *pool = milagro_cs->worker_pool;
+    mbedtls_milagro_cs_context *cur, *prev = NULL;
+
+    if( pool == NULL || pool->nb_threads == 0 )
+        return;
+
+    pthread_mutex_lock( &pool->mutex );
+
+    if( milagro_cs->async_state == MBEDTLS_MILAGRO_CS_ASYNC_QUEUED )
+    {
+        for( cur = pool->head; cur != NULL; prev = cur, cur = cur->async_next )
+        {
+            if( cur != milagro_cs )
+                continue;
+
+            if( prev != NULL )
+                prev->async_next = cur->async_next;
+            else
+                pool->head = cur->async_next;
+            if( pool->tail == cur )
+                pool->tail = prev;
+            pool->queued--;
+            break;
+        }
+        milagro_cs->async_next = NULL;
+    }
+
+    while( milagro_cs->async_state == MBEDTLS_MILAGRO_CS_ASYNC_RUNNING )
+        pthread_cond_wait( &pool->done, &pool->mutex );
+
+    milagro_cs->async_state = MBEDTLS_MILAGRO_CS_ASYNC_IDLE;
+
+    pthread_mutex_unlock( &pool->mutex );
+}
+#endif /* MBEDTLS_TLS_MILAGRO_CS_ASYNC */
+
+
+#endif /* MBEDTLS_SSL_SRV_C */
+
+int mbedtls_milagro_cs_write_exchange_parameter( int client_or_server, mbedtls_milagro_cs_context *milagro_cs,
+                                          unsigned char *buf, size_t len, size_t *ec_point_len )
+{
+    unsigned char *p = buf;
+    const unsigned char *end = buf + len;
+    
+    if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    {
+        if(MPIN_GET_G1_MULTIPLE(&milagro_cs->RNG,1,&milagro_cs->param_rand,&milagro_cs->hash_client_id,&milagro_cs->R) != 0)
+        {
+            return MBEDTLS_ERR_MILAGRO_CS_CLI_PUB_PARAM_FAILED;
+        }
+        *p++ = (unsigned char)( ( ( milagro_cs->R.len     ) >> 8 ) & 0xFF );
+        *p++ = (unsigned char)( ( ( milagro_cs->R.len     )      ) & 0xFF );
+        
+        memcpy(p, milagro_cs->R.val, milagro_cs->R.len);
+        p += milagro_cs->R.len;
+    }
+    else if(client_or_server == MBEDTLS_SSL_IS_SERVER)
+    {
+        int ret;
+#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
+        ret = MPIN_GET_G1_MULTIPLE(&milagro_cs->RNG,0,&milagro_cs->param_rand,&milagro_cs->HTID,&milagro_cs->W);
+#else
+        ret = MPIN_GET_G1_MULTIPLE(&milagro_cs->RNG,0,&milagro_cs->param_rand,&milagro_cs->HID,&milagro_cs->W);
+#endif
+        if( ret != 0)
+        {
+            return(MBEDTLS_ERR_MILAGRO_CS_SRV_PUB_PARAM_FAILED);
+        }
+        *p++ = (unsigned char)( ( ( milagro_cs->W.len     ) >> 8 ) & 0xFF );
+        *p++ = (unsigned char)( ( ( milagro_cs->W.len     )      ) & 0xFF );
+        
+        memcpy(p, milagro_cs->W.val, milagro_cs->W.len);
+        p += milagro_cs->W.len;
+    }
+    else
+    {
+        return(MBEDTLS_ERR_SSL_INTERNAL_ERROR);
+    }
+    
+    if( end < p )
+    {
+        return(MBEDTLS_ERR_MILAGRO_CS_CLI_PUB_PARAM_FAILED);
+    }
+    
+    *ec_point_len = p - buf;
+    return 0;
+}
+
+int mbedtls_milagro_cs_read_public_parameter( int client_or_server, mbedtls_milagro_cs_context *milagro_cs,
+                                       const unsigned char *buf, size_t len  )
+{
+#if defined(MBEDTLS_SSL_CLI_C)
+    if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    {
+        if (len < 2)
+        {
+            return (MBEDTLS_ERR_MILAGRO_CS_READ_PARAM_FAILED);
+        }
+        // Copy the length of the parameter W
+        milagro_cs->W.len =  UINT16_MAX & (buf[1] |((uint16_t)buf[0])<< 8);
+        if ((int)len != milagro_cs->W.len + 2 || milagro_cs->W.len > milagro_cs->W.max)
+        {
+            return (MBEDTLS_ERR_MILAGRO_CS_READ_PARAM_FAILED);
+        }
+        
+        // Copy the parameter W
+        memcpy(milagro_cs->W.val, &buf[2], milagro_cs->W.len);
     }
     else
 #endif
 #if defined(MBEDTLS_SSL_SRV_C)
     if(client_or_server == MBEDTLS_SSL_IS_SERVER)
     {
+        if (len < 2)
+        {
+            return (MBEDTLS_ERR_MILAGRO_CS_READ_PARAM_FAILED);
+        }
         // Copy the length of the parameter R
         milagro_cs->R.len =  UINT16_MAX & (buf[1] |((uint16_t)buf[0])<< 8);
-        
-        // Copy the parameter R
-        memcpy(milagro_cs->R.val, &buf[2], milagro_cs->R.len);
-        if ((int)len != milagro_cs->R.len + 2)
+        if ((int)len != milagro_cs->R.len + 2 || milagro_cs->R.len > milagro_cs->R.max)
         {
             return (MBEDTLS_ERR_MILAGRO_CS_READ_PARAM_FAILED);
         }
+        
+        // Copy the parameter R
+        memcpy(milagro_cs->R.val, &buf[2], milagro_cs->R.len);
     }
     else
 #endif
@@ -377,154 +1121,785 @@ int mbedtls_milagro_cs_read_public_parameter( int client_or_server, mbedtls_mila
 }
 
 
-void mbedtls_milagro_cs_free( mbedtls_milagro_cs_context *milagro_cs)
+/*
+ * Release the parameters which only live for one handshake
+ */
+static void milagro_cs_release_handshake( mbedtls_milagro_cs_context *milagro_cs )
+{
+#if defined(MBEDTLS_SSL_CLI_C)
+    milagro_cs_octet_release(&milagro_cs->X);
+#endif
+#if defined(MBEDTLS_SSL_SRV_C)
+    milagro_cs_octet_release(&milagro_cs->HID);
+    milagro_cs_octet_release(&milagro_cs->HTID);
+#endif
+    /* The hash of the identity is only per-handshake on the server side */
+    if(milagro_cs->client_identity.val == NULL)
+        milagro_cs_octet_release(&milagro_cs->hash_client_id);
+    milagro_cs_octet_release(&milagro_cs->param_rand);
+    milagro_cs_octet_release(&milagro_cs->W);
+    milagro_cs_octet_release(&milagro_cs->R);
+    milagro_cs_octet_release(&milagro_cs->U);
+    milagro_cs_octet_release(&milagro_cs->UT);
+    milagro_cs_octet_release(&milagro_cs->Y);
+    milagro_cs_octet_release(&milagro_cs->V);
+    milagro_cs_octet_release(&milagro_cs->H);
+    milagro_cs_octet_release(&milagro_cs->Key);
+}
+
+
+void mbedtls_milagro_cs_reset( mbedtls_milagro_cs_context *milagro_cs)
+{
+    if(!milagro_cs)
+        return;
+    
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    milagro_cs_async_cancel(milagro_cs);
+#endif
+    milagro_cs_release_handshake(milagro_cs);
+}
+
+
+void mbedtls_milagro_cs_free( mbedtls_milagro_cs_context *milagro_cs)
+{
+    if(!milagro_cs)
+        return;
+    
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    milagro_cs_async_cancel(milagro_cs);
+#endif
+    milagro_cs_release_handshake(milagro_cs);
+#if defined(MBEDTLS_SSL_CLI_C)
+    mbedtls_free_octet(&milagro_cs->G1);
+    mbedtls_free_octet(&milagro_cs->G2);
+    mbedtls_free_octet(&milagro_cs->time_permits);
+#endif
+    mbedtls_free_octet(&milagro_cs->hash_client_id);
+    mbedtls_free_octet(&milagro_cs->client_identity);
+    mbedtls_free_octet(&milagro_cs->secret);
+    MPIN_KILL_CSPRNG(&milagro_cs->RNG);
+}
+
+
+void mbedtls_milagro_cs_context_pool_init( mbedtls_milagro_cs_context_pool *pool )
+{
+    memset( pool, 0, sizeof( mbedtls_milagro_cs_context_pool ) );
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_init( &pool->mutex );
+#endif
+}
+
+int mbedtls_milagro_cs_context_pool_setup( mbedtls_milagro_cs_context_pool *pool,
+                                           const mbedtls_milagro_cs_context *model,
+                                           mbedtls_entropy_context *entropy )
+{
+    if( model == NULL || model->secret.val == NULL || entropy == NULL )
+        return( MBEDTLS_ERR_MILAGRO_CS_BAD_INPUT_DATA );
+
+    pool->model = model;
+    pool->entropy = entropy;
+
+    return( 0 );
+}
+
+/*
+ * Make a new context of the pool from the long-lived material of the model
+ */
+static int milagro_cs_context_pool_new( mbedtls_milagro_cs_context_pool *pool,
+                                        mbedtls_milagro_cs_context **milagro_cs )
+{
+    const mbedtls_milagro_cs_context *model = pool->model;
+    mbedtls_milagro_cs_context *ctx;
+    int ret;
+
+    ctx = mbedtls_alloc_or_die( sizeof( mbedtls_milagro_cs_context ) );
+    mbedtls_ssl_milagro_cs_init( ctx );
+
+    mbedtls_ssl_milagro_cs_set_secret( ctx, model->secret.val, model->secret.len );
+#if defined(MBEDTLS_SSL_CLI_C)
+    if( model->client_identity.val != NULL )
+        mbedtls_ssl_milagro_cs_set_client_identity( ctx, model->client_identity.val );
+    if( model->time_permits.val != NULL )
+        mbedtls_ssl_milagro_cs_set_timepermit( ctx, model->time_permits.val, model->time_permits.max );
+    ctx->pin = model->pin;
+    if( model->precomputed )
+    {
+        ctx->G1.val = mbedtls_alloc_or_die(12*PFS);
+        ctx->G1.max = 12*PFS;
+        ctx->G1.len = model->G1.len;
+        memcpy( ctx->G1.val, model->G1.val, model->G1.len );
+        ctx->G2.val = mbedtls_alloc_or_die(12*PFS);
+        ctx->G2.max = 12*PFS;
+        ctx->G2.len = model->G2.len;
+        memcpy( ctx->G2.val, model->G2.val, model->G2.len );
+        ctx->precomputed = 1;
+    }
+#endif
+#if defined(MBEDTLS_SSL_SRV_C)
+    ctx->hid_cache = model->hid_cache;
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    ctx->worker_pool = model->worker_pool;
+#endif
+#endif
+    ctx->reusable = 1;
+    ctx->pool = pool;
+
+    if( ( ret = mbedtls_ssl_milagro_cs_setup_RNG( ctx, pool->entropy ) ) != 0 )
+    {
+        mbedtls_milagro_cs_free( ctx );
+        mbedtls_free( ctx );
+        return( ret );
+    }
+
+    *milagro_cs = ctx;
+
+    return( 0 );
+}
+
+int mbedtls_milagro_cs_context_pool_get( mbedtls_milagro_cs_context_pool *pool,
+                                         mbedtls_milagro_cs_context **milagro_cs )
+{
+    mbedtls_milagro_cs_context *ctx;
+    int ret;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    ctx = pool->free_list;
+    if( ctx != NULL )
+    {
+        pool->free_list = ctx->pool_next;
+        pool->nb_free--;
+    }
+    else
+        pool->nb_contexts++;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_unlock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    if( ctx == NULL )
+    {
+        /* Seed the new context outside of the lock */
+        if( ( ret = milagro_cs_context_pool_new( pool, &ctx ) ) != 0 )
+        {
+#if defined(MBEDTLS_THREADING_C)
+            if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+                return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+            pool->nb_contexts--;
+#if defined(MBEDTLS_THREADING_C)
+            mbedtls_mutex_unlock( &pool->mutex );
+#endif
+            return( ret );
+        }
+    }
+
+    ctx->pool_next = NULL;
+    *milagro_cs = ctx;
+
+    return( 0 );
+}
+
+void mbedtls_milagro_cs_context_pool_put( mbedtls_milagro_cs_context *milagro_cs )
+{
+    mbedtls_milagro_cs_context_pool *pool = milagro_cs->pool;
+
+    mbedtls_milagro_cs_reset( milagro_cs );
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+    {
+        /* The free list can't be reached, don't leak the context */
+        mbedtls_milagro_cs_free( milagro_cs );
+        mbedtls_free( milagro_cs );
+        return;
+    }
+#endif
+
+    milagro_cs->pool_next = pool->free_list;
+    pool->free_list = milagro_cs;
+    pool->nb_free++;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &pool->mutex );
+#endif
+}
+
+void mbedtls_milagro_cs_context_pool_free( mbedtls_milagro_cs_context_pool *pool )
+{
+    mbedtls_milagro_cs_context *ctx;
+
+    if( pool == NULL )
+        return;
+
+    while( ( ctx = pool->free_list ) != NULL )
+    {
+        pool->free_list = ctx->pool_next;
+        mbedtls_milagro_cs_free( ctx );
+        mbedtls_free( ctx );
+    }
+    pool->nb_free = 0;
+    pool->nb_contexts = 0;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_free( &pool->mutex );
+#endif
+}
+
+
+#endif /* MBEDTLS_TLS_MILAGRO_CS */
+
+
+
+#if defined(MBEDTLS_TLS_MILAGRO_P2P)
+
+
+int mbedtls_ssl_milagro_p2p_alloc_memory(int client_or_server, mbedtls_milagro_p2p_context *milagro_p2p)
+{
+    milagro_p2p->shared_secret.val = mbedtls_alloc_or_die(16);
+    milagro_p2p->shared_secret.max = 16;
+    milagro_p2p->client_PIA.val = mbedtls_alloc_or_die(PGS);
+    milagro_p2p->client_PIA.max = PGS;
+    milagro_p2p->client_PIB.val = mbedtls_alloc_or_die(PGS);
+    milagro_p2p->client_PIB.max = PGS;
+    
+    if(client_or_server == MBEDTLS_SSL_IS_SERVER)
+    {
+        milagro_p2p->X.val = mbedtls_alloc_or_die(PGS);
+        milagro_p2p->X.max = PGS;
+        milagro_p2p->server_pub_param_G1.val = mbedtls_alloc_or_die(2*PFS+1);
+        milagro_p2p->server_pub_param_G1.max = 2*PFS+1;
+    }
+    else if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    {
+        milagro_p2p->W.val = mbedtls_alloc_or_die(PGS);
+        milagro_p2p->W.max = PGS;
+        milagro_p2p->Y.val = mbedtls_alloc_or_die(PGS);
+        milagro_p2p->Y.max = PGS;
+        milagro_p2p->client_pub_param_G1.val = mbedtls_alloc_or_die(2*PFS+1);
+        milagro_p2p->client_pub_param_G1.max = 2*PFS+1;
+        milagro_p2p->client_pub_param_G2.val = mbedtls_alloc_or_die(4*PFS);
+        milagro_p2p->client_pub_param_G2.max = 4*PFS;
+    }
+    else
+    {
+        exit(MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA);
+    }
+    return 0;
+}
+
+
+
+void mbedtls_ssl_milagro_p2p_init(mbedtls_milagro_p2p_context * milagro_p2p)
+{
+    memset(milagro_p2p,0,sizeof(*milagro_p2p));
+}
+
+
+int mbedtls_ssl_milagro_p2p_set_identity(int client_or_server, mbedtls_milagro_p2p_context *milagro_p2p, char * identity)
+{
+    if(client_or_server == MBEDTLS_SSL_IS_SERVER)
+    {
+        
+        milagro_p2p->server_identity.val = mbedtls_alloc_or_die(strlen(identity));
+        memcpy(milagro_p2p->server_identity.val, identity, strlen(identity));
+        milagro_p2p->server_identity.len = (int)strlen(identity);
+        milagro_p2p->server_identity.max = 256;
+    }
+    else if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    {
+        milagro_p2p->client_identity.val = mbedtls_alloc_or_die(strlen(identity));
+        memcpy(milagro_p2p->client_identity.val, identity, strlen(identity));
+        milagro_p2p->client_identity.len = (int)strlen(identity);
+        milagro_p2p->client_identity.max = 256;
+    }
+    else
+    {
+        exit(MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA);
+    }
+    
+    return 0;
+}
+
+
+void mbedtls_ssl_milagro_p2p_set_key(int client_or_server, mbedtls_milagro_p2p_context *milagro_p2p, char* key, int len_key)
+{
+    if(client_or_server == MBEDTLS_SSL_IS_SERVER)
+    {
+        milagro_p2p->server_sen_key .val = mbedtls_alloc_or_die(256);
+        memcpy(milagro_p2p->server_sen_key.val, key, len_key);
+        milagro_p2p->server_sen_key.max = len_key;
+        milagro_p2p->server_sen_key.len = len_key;
+
+    }
+    else if (client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    {
+        milagro_p2p->client_rec_key .val = mbedtls_alloc_or_die(256);
+        memcpy(milagro_p2p->client_rec_key.val, key, len_key);
+        milagro_p2p->client_rec_key.max = len_key;
+        milagro_p2p->client_rec_key.len = len_key;
+    }
+    else
+    {
+        exit(MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA);
+    }
+}
+
+
+/*
+ * Seed a milagro-crypto RNG from the entropy of this library
+ */
+static int milagro_p2p_create_csprng( csprng *RNG, mbedtls_entropy_context *entropy )
+{
+    unsigned char seed[20] = {0};
+    char raw[100] = {0};
+    
+    octet RAW={0,sizeof(raw),raw};
+    
+    for (int i = 0; i<5; i++) {
+        if (mbedtls_entropy_func(entropy, seed, 20) != 0)
+        {
+            return(MBEDTLS_ERR_ENTROPY_SOURCE_FAILED);
+        }
+        RAW.len=100;
+        memcpy(RAW.val+i*20,&seed,20);
+    }
+    /* initialise strong RNG */
+    WCC_CREATE_CSPRNG(RNG,&RAW);
+    
+    return 0;
+}
+
+
+int mbedtls_ssl_milagro_p2p_setup_RNG( mbedtls_milagro_p2p_context *milagro_p2p, mbedtls_entropy_context *entropy)
+{
+    return( milagro_p2p_create_csprng( &milagro_p2p->RNG, entropy ) );
+}
+
+
+void mbedtls_ssl_milagro_p2p_set_precomp( mbedtls_milagro_p2p_context *milagro_p2p,
+                                          mbedtls_milagro_p2p_precomp_context *precomp )
+{
+    milagro_p2p->precomp = precomp;
+}
+
+
+/*
+ * Give the refill thread some work, if there is one
+ */
+static void milagro_p2p_precomp_wakeup( mbedtls_milagro_p2p_precomp_context *precomp )
+{
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_mutex_lock( &precomp->wake_mutex );
+    if( precomp->running )
+    {
+        precomp->wakeup = 1;
+        pthread_cond_signal( &precomp->wake );
+    }
+    pthread_mutex_unlock( &precomp->wake_mutex );
+#else
+    (void) precomp;
+#endif
+}
+
+static mbedtls_milagro_p2p_precomp_identity *milagro_p2p_precomp_find_peer(
+        mbedtls_milagro_p2p_precomp_context *precomp, const char *id, int id_len )
+{
+    int i;
+
+    for( i = 0; i < precomp->max_peers; i++ )
+    {
+        if( precomp->peers[i].id_len == id_len &&
+            memcmp( precomp->peers[i].id, id, id_len ) == 0 )
+            return( &precomp->peers[i] );
+    }
+
+    return( NULL );
+}
+
+/*
+ * Store an identity and its hash in a slot, dropping the pairs of the
+ * identity it held before
+ */
+static void milagro_p2p_precomp_set_identity( mbedtls_milagro_p2p_precomp_identity *ident,
+                                              int max_pairs, const char *id, int id_len, int g2 )
+{
+    octet ID = { id_len, MBEDTLS_MILAGRO_P2P_MAX_IDENTITY_LEN, ident->id };
+    octet HV = { 0, HASH_BYTES, ident->hash };
+
+    memset( ident->pairs, 0, max_pairs * sizeof( mbedtls_milagro_p2p_precomp_pair ) );
+    ident->nb_pairs = 0;
+    memcpy( ident->id, id, id_len );
+    ident->id_len = id_len;
+    ident->g2 = g2;
+    WCC_HASH_ID( &ID, &HV );
+}
+
+/*
+ * Find a peer, taking the slot of the least recently used one if it is new
+ */
+static mbedtls_milagro_p2p_precomp_identity *milagro_p2p_precomp_add_peer(
+        mbedtls_milagro_p2p_precomp_context *precomp, const char *id, int id_len )
+{
+    mbedtls_milagro_p2p_precomp_identity *ident;
+    int i;
+
+    if( ( ident = milagro_p2p_precomp_find_peer( precomp, id, id_len ) ) != NULL )
+        return( ident );
+
+    ident = &precomp->peers[0];
+    for( i = 0; i < precomp->max_peers; i++ )
+    {
+        if( precomp->peers[i].id_len == 0 )
+        {
+            ident = &precomp->peers[i];
+            break;
+        }
+        if( precomp->peers[i].last_use < ident->last_use )
+            ident = &precomp->peers[i];
+    }
+
+    milagro_p2p_precomp_set_identity( ident, precomp->max_pairs, id, id_len, 0 );
+
+    return( ident );
+}
+
+/*
+ * Take a precomputed pair for the own identity (peer == 0) or for the
+ * identity of a server (peer == 1), returns 1 if one was ready
+ */
+static int milagro_p2p_precomp_take( mbedtls_milagro_p2p_precomp_context *precomp,
+                                     const octet *id, int peer, octet *scalar, octet *point )
+{
+    mbedtls_milagro_p2p_precomp_identity *ident = NULL;
+    mbedtls_milagro_p2p_precomp_pair *pair;
+    int found = 0, refill = 0;
+
+    if( id->val == NULL || id->len <= 0 || id->len > MBEDTLS_MILAGRO_P2P_MAX_IDENTITY_LEN )
+        return( 0 );
+
+    /* The own identity is not modified after the setup */
+    if( !peer && ( precomp->own.id_len != id->len ||
+                   memcmp( precomp->own.id, id->val, id->len ) != 0 ) )
+        return( 0 );
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &precomp->mutex ) != 0 )
+        return( 0 );
+#endif
+
+    if( !peer )
+        ident = &precomp->own;
+    else if( precomp->peers != NULL )
+        ident = milagro_p2p_precomp_add_peer( precomp, id->val, id->len );
+
+    if( ident != NULL )
+    {
+        ident->last_use = ++precomp->clock;
+
+        if( ident->nb_pairs > 0 &&
+            scalar->max >= PGS && point->max >= ident->pairs[ident->nb_pairs - 1].point_len )
+        {
+            pair = &ident->pairs[--ident->nb_pairs];
+            memcpy( scalar->val, pair->scalar, PGS );
+            scalar->len = PGS;
+            memcpy( point->val, pair->point, pair->point_len );
+            point->len = pair->point_len;
+            memset( pair, 0, sizeof( mbedtls_milagro_p2p_precomp_pair ) );
+            found = 1;
+        }
+
+        refill = ident->nb_pairs < precomp->low_water;
+    }
+
+    if( found )
+        precomp->hits++;
+    else
+        precomp->misses++;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &precomp->mutex );
+#endif
+
+    if( refill )
+        milagro_p2p_precomp_wakeup( precomp );
+
+    return( found );
+}
+
+
+void mbedtls_milagro_p2p_precomp_init( mbedtls_milagro_p2p_precomp_context *precomp )
+{
+    memset( precomp, 0, sizeof( mbedtls_milagro_p2p_precomp_context ) );
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_init( &precomp->mutex );
+#endif
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_mutex_init( &precomp->wake_mutex, NULL );
+    pthread_cond_init( &precomp->wake, NULL );
+#endif
+}
+
+int mbedtls_milagro_p2p_precomp_setup( mbedtls_milagro_p2p_precomp_context *precomp,
+                                       int client_or_server, const char *identity,
+                                       mbedtls_entropy_context *entropy, int max_pairs )
+{
+    size_t id_len;
+    int i, ret;
+
+    if( identity == NULL || ( id_len = strlen( identity ) ) == 0 ||
+        id_len > MBEDTLS_MILAGRO_P2P_MAX_IDENTITY_LEN ||
+        max_pairs < 1 || max_pairs > MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PAIRS ||
+        ( client_or_server != MBEDTLS_SSL_IS_CLIENT && client_or_server != MBEDTLS_SSL_IS_SERVER ) ||
+        precomp->own.pairs != NULL )
+    {
+        return( MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA );
+    }
+
+    if( ( ret = milagro_p2p_create_csprng( &precomp->RNG, entropy ) ) != 0 )
+        return( ret );
+
+    precomp->endpoint = client_or_server;
+    precomp->max_pairs = max_pairs;
+    precomp->low_water = ( max_pairs + 1 ) / 2;
+
+    /* The server multiplies its identity in G1, the client in G2 */
+    precomp->own.pairs = mbedtls_alloc_or_die( max_pairs * sizeof( mbedtls_milagro_p2p_precomp_pair ) );
+    milagro_p2p_precomp_set_identity( &precomp->own, max_pairs, identity, (int) id_len,
+                                      client_or_server == MBEDTLS_SSL_IS_CLIENT );
+
+    if( client_or_server == MBEDTLS_SSL_IS_CLIENT )
+    {
+        precomp->max_peers = MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PEERS;
+        precomp->peers = mbedtls_alloc_or_die( precomp->max_peers *
+                                               sizeof( mbedtls_milagro_p2p_precomp_identity ) );
+        for( i = 0; i < precomp->max_peers; i++ )
+            precomp->peers[i].pairs = mbedtls_alloc_or_die( max_pairs *
+                                                            sizeof( mbedtls_milagro_p2p_precomp_pair ) );
+    }
+
+    return( 0 );
+}
+
+int mbedtls_milagro_p2p_precomp_add_peer( mbedtls_milagro_p2p_precomp_context *precomp,
+                                          const char *identity )
+{
+    size_t id_len;
+
+    if( precomp->peers == NULL || identity == NULL || ( id_len = strlen( identity ) ) == 0 ||
+        id_len > MBEDTLS_MILAGRO_P2P_MAX_IDENTITY_LEN )
+    {
+        return( MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA );
+    }
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &precomp->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    milagro_p2p_precomp_add_peer( precomp, identity, (int) id_len )->last_use = ++precomp->clock;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_unlock( &precomp->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    milagro_p2p_precomp_wakeup( precomp );
+
+    return( 0 );
+}
+
+/*
+ * Next identity missing pairs: the own one first, then the servers
+ */
+static mbedtls_milagro_p2p_precomp_identity *milagro_p2p_precomp_next(
+        mbedtls_milagro_p2p_precomp_context *precomp )
+{
+    int i;
+
+    if( precomp->own.pairs != NULL && precomp->own.nb_pairs < precomp->max_pairs )
+        return( &precomp->own );
+
+    for( i = 0; i < precomp->max_peers; i++ )
+    {
+        if( precomp->peers[i].id_len != 0 && precomp->peers[i].nb_pairs < precomp->max_pairs )
+            return( &precomp->peers[i] );
+    }
+
+    return( NULL );
+}
+
+int mbedtls_milagro_p2p_precomp_refill( mbedtls_milagro_p2p_precomp_context *precomp )
 {
-    if(!milagro_cs)
-        return;
-    
-#if defined(MBEDTLS_SSL_CLI_C)
-    mbedtls_free_octet(&milagro_cs->X);
-    mbedtls_free_octet(&milagro_cs->G1);
-    mbedtls_free_octet(&milagro_cs->G2);
-    mbedtls_free_octet(&milagro_cs->time_permits);
+    mbedtls_milagro_p2p_precomp_identity *ident;
+    mbedtls_milagro_p2p_precomp_pair pair;
+    char hash[HASH_BYTES];
+    octet S = { 0, PGS, pair.scalar };
+    octet H = { HASH_BYTES, HASH_BYTES, hash };
+    octet P = { 0, 4*PFS, pair.point };
+    int g2 = 0, ret = 0;
+
+    for( ;; )
+    {
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_lock( &precomp->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
 #endif
-#if defined(MBEDTLS_SSL_SRV_C)
-    mbedtls_free_octet(&milagro_cs->HID);
-    mbedtls_free_octet(&milagro_cs->HTID);
-#endif
-    mbedtls_free_octet(&milagro_cs->param_rand);
-    mbedtls_free_octet(&milagro_cs->W);
-    mbedtls_free_octet(&milagro_cs->R);
-    mbedtls_free_octet(&milagro_cs->U);
-    mbedtls_free_octet(&milagro_cs->UT);
-    mbedtls_free_octet(&milagro_cs->hash_client_id);
-    mbedtls_free_octet(&milagro_cs->Y);
-    mbedtls_free_octet(&milagro_cs->V);
-    mbedtls_free_octet(&milagro_cs->H);
-    mbedtls_free_octet(&milagro_cs->Key);
-    mbedtls_free_octet(&milagro_cs->secret);
-    MPIN_KILL_CSPRNG(&milagro_cs->RNG);
-}
 
+        if( ( ident = milagro_p2p_precomp_next( precomp ) ) != NULL )
+        {
+            memcpy( hash, ident->hash, HASH_BYTES );
+            g2 = ident->g2;
+            S.len = 0;
+            if( WCC_RANDOM_GENERATE( &precomp->RNG, &S ) != 0 )
+                ret = MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED;
+        }
 
-#endif /* MBEDTLS_TLS_MILAGRO_CS */
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_unlock( &precomp->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
 
+        if( ident == NULL || ret != 0 )
+            break;
 
+        /* The point multiplication is made outside of the lock */
+        P.len = 0;
+        P.max = g2 ? 4*PFS : 2*PFS+1;
+        if( ( g2 ? WCC_GET_G2_MULTIPLE( hashDoneON, &S, &H, &P ) :
+                   WCC_GET_G1_MULTIPLE( hashDoneON, &S, &H, &P ) ) != 0 )
+        {
+            ret = MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED;
+            break;
+        }
+        pair.point_len = P.len;
 
-#if defined(MBEDTLS_TLS_MILAGRO_P2P)
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_lock( &precomp->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
 
+        /* The server may have been evicted in the meantime */
+        if( ident->id_len != 0 && memcmp( ident->hash, hash, HASH_BYTES ) == 0 &&
+            ident->nb_pairs < precomp->max_pairs )
+        {
+            memcpy( &ident->pairs[ident->nb_pairs++], &pair, sizeof( pair ) );
+        }
 
-int mbedtls_ssl_milagro_p2p_alloc_memory(int client_or_server, mbedtls_milagro_p2p_context *milagro_p2p)
-{
-    milagro_p2p->shared_secret.val = mbedtls_alloc_or_die(16);
-    milagro_p2p->shared_secret.max = 16;
-    milagro_p2p->client_PIA.val = mbedtls_alloc_or_die(PGS);
-    milagro_p2p->client_PIA.max = PGS;
-    milagro_p2p->client_PIB.val = mbedtls_alloc_or_die(PGS);
-    milagro_p2p->client_PIB.max = PGS;
-    
-    if(client_or_server == MBEDTLS_SSL_IS_SERVER)
-    {
-        milagro_p2p->X.val = mbedtls_alloc_or_die(PGS);
-        milagro_p2p->X.max = PGS;
-        milagro_p2p->server_pub_param_G1.val = mbedtls_alloc_or_die(2*PFS+1);
-        milagro_p2p->server_pub_param_G1.max = 2*PFS+1;
-    }
-    else if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
-    {
-        milagro_p2p->W.val = mbedtls_alloc_or_die(PGS);
-        milagro_p2p->W.max = PGS;
-        milagro_p2p->Y.val = mbedtls_alloc_or_die(PGS);
-        milagro_p2p->Y.max = PGS;
-        milagro_p2p->client_pub_param_G1.val = mbedtls_alloc_or_die(2*PFS+1);
-        milagro_p2p->client_pub_param_G1.max = 2*PFS+1;
-        milagro_p2p->client_pub_param_G2.val = mbedtls_alloc_or_die(4*PFS);
-        milagro_p2p->client_pub_param_G2.max = 4*PFS;
-    }
-    else
-    {
-        exit(MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA);
+#if defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_unlock( &precomp->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
     }
-    return 0;
-}
 
+    memset( &pair, 0, sizeof( pair ) );
 
-
-void mbedtls_ssl_milagro_p2p_init(mbedtls_milagro_p2p_context * milagro_p2p)
-{
-    memset(milagro_p2p,0,sizeof(*milagro_p2p));
+    return( ret );
 }
 
-
-int mbedtls_ssl_milagro_p2p_set_identity(int client_or_server, mbedtls_milagro_p2p_context *milagro_p2p, char * identity)
+#if defined(MBEDTLS_THREADING_PTHREAD)
+static void *milagro_p2p_precomp_main( void *arg )
 {
-    if(client_or_server == MBEDTLS_SSL_IS_SERVER)
-    {
-        
-        milagro_p2p->server_identity.val = mbedtls_alloc_or_die(strlen(identity));
-        memcpy(milagro_p2p->server_identity.val, identity, strlen(identity));
-        milagro_p2p->server_identity.len = (int)strlen(identity);
-        milagro_p2p->server_identity.max = 256;
-    }
-    else if(client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    mbedtls_milagro_p2p_precomp_context *precomp = (mbedtls_milagro_p2p_precomp_context *) arg;
+
+    pthread_mutex_lock( &precomp->wake_mutex );
+    while( !precomp->shutdown )
     {
-        milagro_p2p->client_identity.val = mbedtls_alloc_or_die(strlen(identity));
-        memcpy(milagro_p2p->client_identity.val, identity, strlen(identity));
-        milagro_p2p->client_identity.len = (int)strlen(identity);
-        milagro_p2p->client_identity.max = 256;
+        precomp->wakeup = 0;
+        pthread_mutex_unlock( &precomp->wake_mutex );
+
+        (void) mbedtls_milagro_p2p_precomp_refill( precomp );
+
+        pthread_mutex_lock( &precomp->wake_mutex );
+        while( !precomp->wakeup && !precomp->shutdown )
+            pthread_cond_wait( &precomp->wake, &precomp->wake_mutex );
     }
-    else
+    pthread_mutex_unlock( &precomp->wake_mutex );
+
+    return( NULL );
+}
+
+int mbedtls_milagro_p2p_precomp_start( mbedtls_milagro_p2p_precomp_context *precomp )
+{
+    int ret = 0;
+
+    if( precomp->own.pairs == NULL )
+        return( MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA );
+
+    pthread_mutex_lock( &precomp->wake_mutex );
+    if( !precomp->running )
     {
-        exit(MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA);
+        precomp->shutdown = 0;
+        if( pthread_create( &precomp->thread, NULL, milagro_p2p_precomp_main, precomp ) != 0 )
+            ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+        else
+            precomp->running = 1;
     }
-    
-    return 0;
+    pthread_mutex_unlock( &precomp->wake_mutex );
+
+    return( ret );
 }
+#endif /* MBEDTLS_THREADING_PTHREAD */
 
+void mbedtls_milagro_p2p_precomp_stats( mbedtls_milagro_p2p_precomp_context *precomp,
+                                        unsigned long *hits, unsigned long *misses )
+{
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &precomp->mutex ) != 0 )
+        return;
+#endif
 
-void mbedtls_ssl_milagro_p2p_set_key(int client_or_server, mbedtls_milagro_p2p_context *milagro_p2p, char* key, int len_key)
+    *hits = precomp->hits;
+    *misses = precomp->misses;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &precomp->mutex );
+#endif
+}
+
+void mbedtls_milagro_p2p_precomp_free( mbedtls_milagro_p2p_precomp_context *precomp )
 {
-    if(client_or_server == MBEDTLS_SSL_IS_SERVER)
-    {
-        milagro_p2p->server_sen_key .val = mbedtls_alloc_or_die(256);
-        memcpy(milagro_p2p->server_sen_key.val, key, len_key);
-        milagro_p2p->server_sen_key.max = len_key;
-        milagro_p2p->server_sen_key.len = len_key;
+    int i;
 
-    }
-    else if (client_or_server == MBEDTLS_SSL_IS_CLIENT)
+    if( precomp == NULL )
+        return;
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_mutex_lock( &precomp->wake_mutex );
+    precomp->shutdown = 1;
+    pthread_cond_signal( &precomp->wake );
+    pthread_mutex_unlock( &precomp->wake_mutex );
+    if( precomp->running )
+        pthread_join( precomp->thread, NULL );
+    precomp->running = 0;
+    pthread_cond_destroy( &precomp->wake );
+    pthread_mutex_destroy( &precomp->wake_mutex );
+#endif
+
+    if( precomp->own.pairs != NULL )
     {
-        milagro_p2p->client_rec_key .val = mbedtls_alloc_or_die(256);
-        memcpy(milagro_p2p->client_rec_key.val, key, len_key);
-        milagro_p2p->client_rec_key.max = len_key;
-        milagro_p2p->client_rec_key.len = len_key;
+        memset( precomp->own.pairs, 0, precomp->max_pairs * sizeof( mbedtls_milagro_p2p_precomp_pair ) );
+        mbedtls_free( precomp->own.pairs );
+        WCC_KILL_CSPRNG( &precomp->RNG );
     }
-    else
+    for( i = 0; i < precomp->max_peers; i++ )
     {
-        exit(MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA);
+        memset( precomp->peers[i].pairs, 0, precomp->max_pairs * sizeof( mbedtls_milagro_p2p_precomp_pair ) );
+        mbedtls_free( precomp->peers[i].pairs );
     }
-}
+    mbedtls_free( precomp->peers );
 
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_free( &precomp->mutex );
+#endif
 
-int mbedtls_ssl_milagro_p2p_setup_RNG( mbedtls_milagro_p2p_context *milagro_p2p, mbedtls_entropy_context *entropy)
-{
-    unsigned char seed[20] = {0};
-    char raw[100] = {0};
-    
-    octet RAW={0,sizeof(raw),raw};
-    
-    for (int i = 0; i<5; i++) {
-        if (mbedtls_entropy_func(entropy, seed, 20) != 0)
-        {
-            return(MBEDTLS_ERR_ENTROPY_SOURCE_FAILED);
-        }
-        RAW.len=100;
-        memcpy(RAW.val+i*20,&seed,20);
-    }
-    /* initialise strong RNG */
-    WCC_CREATE_CSPRNG(&milagro_p2p->RNG,&RAW);
-    
-    return 0;
+    memset( precomp, 0, sizeof( mbedtls_milagro_p2p_precomp_context ) );
 }
 
 
@@ -533,6 +1908,13 @@ int mbedtls_milagro_p2p_compute_public_param( mbedtls_milagro_p2p_context *milag
 {
     mbedtls_ssl_milagro_p2p_alloc_memory(MBEDTLS_SSL_IS_SERVER, milagro_p2p);
     
+    if( milagro_p2p->precomp != NULL &&
+        milagro_p2p_precomp_take( milagro_p2p->precomp, &milagro_p2p->server_identity, 0,
+                                  &milagro_p2p->X, &milagro_p2p->server_pub_param_G1 ) )
+    {
+        return 0;
+    }
+    
     if (WCC_RANDOM_GENERATE(&milagro_p2p->RNG,&milagro_p2p->X) != 0)
     {
         return(MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
@@ -546,6 +1928,44 @@ int mbedtls_milagro_p2p_compute_public_param( mbedtls_milagro_p2p_context *milag
 }
 
 
+int mbedtls_milagro_p2p_compute_client_param( mbedtls_milagro_p2p_context *milagro_p2p)
+{
+    mbedtls_ssl_milagro_p2p_alloc_memory(MBEDTLS_SSL_IS_CLIENT, milagro_p2p);
+    
+    if( milagro_p2p->precomp == NULL ||
+        !milagro_p2p_precomp_take( milagro_p2p->precomp, &milagro_p2p->server_identity, 1,
+                                   &milagro_p2p->W, &milagro_p2p->client_pub_param_G1 ) )
+    {
+        if( WCC_RANDOM_GENERATE(&milagro_p2p->RNG, &milagro_p2p->W) != 0 )
+        {
+            return(MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
+        }
+        if( WCC_GET_G1_MULTIPLE(hashDoneOFF, &milagro_p2p->W, &milagro_p2p->server_identity,
+                                &milagro_p2p->client_pub_param_G1) != 0 )
+        {
+            return(MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
+        }
+    }
+    
+    if( milagro_p2p->precomp == NULL ||
+        !milagro_p2p_precomp_take( milagro_p2p->precomp, &milagro_p2p->client_identity, 0,
+                                   &milagro_p2p->Y, &milagro_p2p->client_pub_param_G2 ) )
+    {
+        if( WCC_RANDOM_GENERATE(&milagro_p2p->RNG, &milagro_p2p->Y) != 0 )
+        {
+            return(MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
+        }
+        if( WCC_GET_G2_MULTIPLE(hashDoneOFF, &milagro_p2p->Y, &milagro_p2p->client_identity,
+                                &milagro_p2p->client_pub_param_G2) != 0 )
+        {
+            return(MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
+        }
+    }
+    
+    return 0;
+}
+
+
 int mbedtls_milagro_p2p_write_public_parameters(int client_or_server, mbedtls_milagro_p2p_context *milagro_p2p,
                                                 unsigned char *buf, size_t len, size_t *param_len )
 {
@@ -669,28 +2089,215 @@ int mbedtls_milagro_p2p_read_public_parameters( int client_or_server, mbedtls_mi
 }
 
 
-void mbedtls_milagro_p2p_free( mbedtls_milagro_p2p_context *milagro_p2p)
+void mbedtls_milagro_p2p_reset( mbedtls_milagro_p2p_context *milagro_p2p)
 {
     if(!milagro_p2p)
         return;
     
-    mbedtls_free_octet(&milagro_p2p->client_identity);
-    mbedtls_free_octet(&milagro_p2p->server_identity);
+    /* The identity of the peer is read during the handshake */
+    if(milagro_p2p->server_sen_key.val != NULL)
+        mbedtls_free_octet(&milagro_p2p->client_identity);
+    else
+        mbedtls_free_octet(&milagro_p2p->server_identity);
     mbedtls_free_octet(&milagro_p2p->client_PIA);
     mbedtls_free_octet(&milagro_p2p->client_PIB);
     mbedtls_free_octet(&milagro_p2p->client_pub_param_G1);
     mbedtls_free_octet(&milagro_p2p->client_pub_param_G2);
     mbedtls_free_octet(&milagro_p2p->server_pub_param_G1);
     mbedtls_free_octet(&milagro_p2p->shared_secret);
-    mbedtls_free_octet(&milagro_p2p->client_rec_key);
-    mbedtls_free_octet(&milagro_p2p->server_sen_key);
     mbedtls_free_octet(&milagro_p2p->W);
     mbedtls_free_octet(&milagro_p2p->X);
     mbedtls_free_octet(&milagro_p2p->Y);
+}
+
+
+void mbedtls_milagro_p2p_free( mbedtls_milagro_p2p_context *milagro_p2p)
+{
+    if(!milagro_p2p)
+        return;
+    
+    mbedtls_milagro_p2p_reset(milagro_p2p);
+    mbedtls_free_octet(&milagro_p2p->client_identity);
+    mbedtls_free_octet(&milagro_p2p->server_identity);
+    mbedtls_free_octet(&milagro_p2p->client_rec_key);
+    mbedtls_free_octet(&milagro_p2p->server_sen_key);
     WCC_KILL_CSPRNG(&milagro_p2p->RNG);
 }
 
 
+void mbedtls_milagro_p2p_context_pool_init( mbedtls_milagro_p2p_context_pool *pool )
+{
+    memset( pool, 0, sizeof( mbedtls_milagro_p2p_context_pool ) );
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_init( &pool->mutex );
+#endif
+}
+
+int mbedtls_milagro_p2p_context_pool_setup( mbedtls_milagro_p2p_context_pool *pool,
+                                            const mbedtls_milagro_p2p_context *model,
+                                            mbedtls_entropy_context *entropy )
+{
+    if( model == NULL || entropy == NULL ||
+        ( model->server_sen_key.val == NULL && model->client_rec_key.val == NULL ) )
+        return( MBEDTLS_ERR_MILAGRO_P2P_BAD_INPUT_DATA );
+
+    pool->model = model;
+    pool->entropy = entropy;
+
+    return( 0 );
+}
+
+/*
+ * Copy an identity set with mbedtls_ssl_milagro_p2p_set_identity()
+ */
+static void milagro_p2p_copy_identity( octet *dst, const octet *src )
+{
+    if( src->val == NULL )
+        return;
+
+    dst->val = mbedtls_alloc_or_die(src->len);
+    memcpy( dst->val, src->val, src->len );
+    dst->len = src->len;
+    dst->max = src->max;
+}
+
+/*
+ * Make a new context of the pool from the long-lived material of the model
+ */
+static int milagro_p2p_context_pool_new( mbedtls_milagro_p2p_context_pool *pool,
+                                         mbedtls_milagro_p2p_context **milagro_p2p )
+{
+    const mbedtls_milagro_p2p_context *model = pool->model;
+    mbedtls_milagro_p2p_context *ctx;
+    int ret;
+
+    ctx = mbedtls_alloc_or_die( sizeof( mbedtls_milagro_p2p_context ) );
+    mbedtls_ssl_milagro_p2p_init( ctx );
+
+    ctx->date = model->date;
+    if( model->server_sen_key.val != NULL )
+    {
+        mbedtls_ssl_milagro_p2p_set_key( MBEDTLS_SSL_IS_SERVER, ctx, model->server_sen_key.val,
+                                         model->server_sen_key.len );
+        milagro_p2p_copy_identity( &ctx->server_identity, &model->server_identity );
+    }
+    else
+    {
+        mbedtls_ssl_milagro_p2p_set_key( MBEDTLS_SSL_IS_CLIENT, ctx, model->client_rec_key.val,
+                                         model->client_rec_key.len );
+        milagro_p2p_copy_identity( &ctx->client_identity, &model->client_identity );
+    }
+    ctx->precomp = model->precomp;
+    ctx->pool = pool;
+
+    if( ( ret = mbedtls_ssl_milagro_p2p_setup_RNG( ctx, pool->entropy ) ) != 0 )
+    {
+        mbedtls_milagro_p2p_free( ctx );
+        mbedtls_free( ctx );
+        return( ret );
+    }
+
+    *milagro_p2p = ctx;
+
+    return( 0 );
+}
+
+int mbedtls_milagro_p2p_context_pool_get( mbedtls_milagro_p2p_context_pool *pool,
+                                          mbedtls_milagro_p2p_context **milagro_p2p )
+{
+    mbedtls_milagro_p2p_context *ctx;
+    int ret;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    ctx = pool->free_list;
+    if( ctx != NULL )
+    {
+        pool->free_list = ctx->pool_next;
+        pool->nb_free--;
+    }
+    else
+        pool->nb_contexts++;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_unlock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    if( ctx == NULL )
+    {
+        /* Seed the new context outside of the lock */
+        if( ( ret = milagro_p2p_context_pool_new( pool, &ctx ) ) != 0 )
+        {
+#if defined(MBEDTLS_THREADING_C)
+            if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+                return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+            pool->nb_contexts--;
+#if defined(MBEDTLS_THREADING_C)
+            mbedtls_mutex_unlock( &pool->mutex );
+#endif
+            return( ret );
+        }
+    }
+
+    ctx->pool_next = NULL;
+    *milagro_p2p = ctx;
+
+    return( 0 );
+}
+
+void mbedtls_milagro_p2p_context_pool_put( mbedtls_milagro_p2p_context *milagro_p2p )
+{
+    mbedtls_milagro_p2p_context_pool *pool = milagro_p2p->pool;
+
+    mbedtls_milagro_p2p_reset( milagro_p2p );
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+    {
+        /* The free list can't be reached, don't leak the context */
+        mbedtls_milagro_p2p_free( milagro_p2p );
+        mbedtls_free( milagro_p2p );
+        return;
+    }
+#endif
+
+    milagro_p2p->pool_next = pool->free_list;
+    pool->free_list = milagro_p2p;
+    pool->nb_free++;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &pool->mutex );
+#endif
+}
+
+void mbedtls_milagro_p2p_context_pool_free( mbedtls_milagro_p2p_context_pool *pool )
+{
+    mbedtls_milagro_p2p_context *ctx;
+
+    if( pool == NULL )
+        return;
+
+    while( ( ctx = pool->free_list ) != NULL )
+    {
+        pool->free_list = ctx->pool_next;
+        mbedtls_milagro_p2p_free( ctx );
+        mbedtls_free( ctx );
+    }
+    pool->nb_free = 0;
+    pool->nb_contexts = 0;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_free( &pool->mutex );
+#endif
+}
+
+
 
 
 
@@ -19,6 +19,14 @@
  *  This file is part of mbed TLS (https://tls.mbed.org)
  */
 
+/* Enable definition of getaddrinfo() even when compiling with -std=c99. Must
+ * be set before config.h, which pulls in glibc's features.h indirectly.
+ * Harmless on other platforms. */
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200112L
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #if !defined(MBEDTLS_CONFIG_FILE)
 #include "mbedtls/config.h"
 #else
@@ -70,6 +78,7 @@ static int wsa_init_done = 0;
 #include <fcntl.h>
 #include <netdb.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #endif /* ( _WIN32 || _WIN32_WCE ) && !EFIX64 && !EFI32 */
 
@@ -558,6 +567,67 @@ int mbedtls_net_send( void *ctx, const unsigned char *buf, size_t len )
     return( ret );
 }
 
+/*
+ * Write at most the total length of the fragments, see mbedtls_net_send()
+ */
+#define NET_SEND_VEC_MAX    16
+
+int mbedtls_net_send_vec( void *ctx, const mbedtls_ssl_iovec *iov, int iovcnt )
+{
+#if ( defined(_WIN32) || defined(_WIN32_WCE) ) && !defined(EFIX64) && \
+    !defined(EFI32)
+    /* No gather write here, send the first non-empty fragment only */
+    while( iovcnt > 0 && iov->len == 0 )
+    {
+        iov++;
+        iovcnt--;
+    }
+
+    if( iovcnt == 0 )
+        return( 0 );
+
+    return( mbedtls_net_send( ctx, iov->base, iov->len ) );
+#else
+    int ret, i;
+    struct iovec vec[NET_SEND_VEC_MAX];
+    int fd = ((mbedtls_net_context *) ctx)->fd;
+
+    if( fd < 0 )
+        return( MBEDTLS_ERR_NET_INVALID_CONTEXT );
+
+    if( iovcnt < 0 )
+        return( MBEDTLS_ERR_NET_SEND_FAILED );
+
+    /* Extra fragments are left to the next call, as with a partial write */
+    if( iovcnt > NET_SEND_VEC_MAX )
+        iovcnt = NET_SEND_VEC_MAX;
+
+    for( i = 0; i < iovcnt; i++ )
+    {
+        vec[i].iov_base = (void *) iov[i].base;
+        vec[i].iov_len  = iov[i].len;
+    }
+
+    ret = (int) writev( fd, vec, iovcnt );
+
+    if( ret < 0 )
+    {
+        if( net_would_block( ctx ) != 0 )
+            return( MBEDTLS_ERR_SSL_WANT_WRITE );
+
+        if( errno == EPIPE || errno == ECONNRESET )
+            return( MBEDTLS_ERR_NET_CONN_RESET );
+
+        if( errno == EINTR )
+            return( MBEDTLS_ERR_SSL_WANT_WRITE );
+
+        return( MBEDTLS_ERR_NET_SEND_FAILED );
+    }
+
+    return( ret );
+#endif
+}
+
 /*
  * Gracefully close the connection
  */
@@ -0,0 +1,425 @@
+/*
+ *  Poly1305 one-time authenticator (RFC 7539)
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+
+/*
+ * https://tools.ietf.org/html/rfc7539
+ *
+ * The 130-bit accumulator and r are kept in five 26-bit limbs, so that
+ * the products fit in 64 bits and the reduction modulo 2^130 - 5 folds
+ * the carry out of the top limb back in multiplied by 5. Only 32x32->64
+ * multiplications are used, which suits 32-bit targets.
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_POLY1305_C)
+
+#include "mbedtls/poly1305.h"
+
+#include <string.h>
+
+#if defined(MBEDTLS_SELF_TEST)
+#if defined(MBEDTLS_PLATFORM_C)
+#include "mbedtls/platform.h"
+#else
+#include <stdio.h>
+#define mbedtls_printf printf
+#endif /* MBEDTLS_PLATFORM_C */
+#endif /* MBEDTLS_SELF_TEST */
+
+/* Implementation that should never be optimized out by the compiler */
+static void mbedtls_zeroize( void *v, size_t n ) {
+    volatile unsigned char *p = v; while( n-- ) *p++ = 0;
+}
+
+/*
+ * 32-bit integer manipulation macros (little endian)
+ */
+#ifndef GET_UINT32_LE
+#define GET_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ]       )             \
+        | ( (uint32_t) (b)[(i) + 1] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 2] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 3] << 24 );            \
+}
+#endif
+
+#ifndef PUT_UINT32_LE
+#define PUT_UINT32_LE(n,b,i)                                    \
+{                                                               \
+    (b)[(i)    ] = (unsigned char) ( ( (n)       ) & 0xFF );    \
+    (b)[(i) + 1] = (unsigned char) ( ( (n) >>  8 ) & 0xFF );    \
+    (b)[(i) + 2] = (unsigned char) ( ( (n) >> 16 ) & 0xFF );    \
+    (b)[(i) + 3] = (unsigned char) ( ( (n) >> 24 ) & 0xFF );    \
+}
+#endif
+
+#define LIMB_MASK   0x3ffffff
+
+/*
+ * Process 16-byte blocks: acc = ( acc + block + hibit * 2^128 ) * r
+ * hibit is 1 for full blocks, 0 for the padded last block
+ */
+static void poly1305_process( mbedtls_poly1305_context *ctx,
+                              const unsigned char *input,
+                              size_t nblocks,
+                              uint32_t hibit )
+{
+    const uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2];
+    const uint32_t r3 = ctx->r[3], r4 = ctx->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = ctx->acc[0], h1 = ctx->acc[1], h2 = ctx->acc[2];
+    uint32_t h3 = ctx->acc[3], h4 = ctx->acc[4];
+    uint64_t d0, d1, d2, d3, d4;
+    uint32_t t, c;
+
+    hibit <<= 24;
+
+    while( nblocks-- > 0 )
+    {
+        GET_UINT32_LE( t, input,  0 ); h0 += t & LIMB_MASK;
+        GET_UINT32_LE( t, input,  3 ); h1 += ( t >> 2 ) & LIMB_MASK;
+        GET_UINT32_LE( t, input,  6 ); h2 += ( t >> 4 ) & LIMB_MASK;
+        GET_UINT32_LE( t, input,  9 ); h3 += ( t >> 6 ) & LIMB_MASK;
+        GET_UINT32_LE( t, input, 12 ); h4 += ( t >> 8 ) | hibit;
+
+        /* Limbs above 2^130 wrap around times 5, hence s = 5 * r */
+        d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3 +
+             (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4 +
+             (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0 +
+             (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1 +
+             (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2 +
+             (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        /* Partial carry propagation, enough to keep the limbs in range */
+        c = (uint32_t)( d0 >> 26 ); h0 = (uint32_t) d0 & LIMB_MASK;
+        d1 += c; c = (uint32_t)( d1 >> 26 ); h1 = (uint32_t) d1 & LIMB_MASK;
+        d2 += c; c = (uint32_t)( d2 >> 26 ); h2 = (uint32_t) d2 & LIMB_MASK;
+        d3 += c; c = (uint32_t)( d3 >> 26 ); h3 = (uint32_t) d3 & LIMB_MASK;
+        d4 += c; c = (uint32_t)( d4 >> 26 ); h4 = (uint32_t) d4 & LIMB_MASK;
+        h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+        h1 += c;
+
+        input += 16;
+    }
+
+    ctx->acc[0] = h0;
+    ctx->acc[1] = h1;
+    ctx->acc[2] = h2;
+    ctx->acc[3] = h3;
+    ctx->acc[4] = h4;
+}
+
+void mbedtls_poly1305_init( mbedtls_poly1305_context *ctx )
+{
+    memset( ctx, 0, sizeof( mbedtls_poly1305_context ) );
+}
+
+void mbedtls_poly1305_free( mbedtls_poly1305_context *ctx )
+{
+    if( ctx == NULL )
+        return;
+
+    mbedtls_zeroize( ctx, sizeof( mbedtls_poly1305_context ) );
+}
+
+int mbedtls_poly1305_starts( mbedtls_poly1305_context *ctx,
+                             const unsigned char key[32] )
+{
+    uint32_t t;
+    int i;
+
+    if( ctx == NULL || key == NULL )
+        return( MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA );
+
+    /* r is clamped as it is split into limbs */
+    GET_UINT32_LE( t, key,  0 ); ctx->r[0] = t & 0x3ffffff;
+    GET_UINT32_LE( t, key,  3 ); ctx->r[1] = ( t >> 2 ) & 0x3ffff03;
+    GET_UINT32_LE( t, key,  6 ); ctx->r[2] = ( t >> 4 ) & 0x3ffc0ff;
+    GET_UINT32_LE( t, key,  9 ); ctx->r[3] = ( t >> 6 ) & 0x3f03fff;
+    GET_UINT32_LE( t, key, 12 ); ctx->r[4] = ( t >> 8 ) & 0x00fffff;
+
+    for( i = 0; i < 4; i++ )
+        GET_UINT32_LE( ctx->s[i], key, 16 + 4 * i );
+
+    memset( ctx->acc, 0, sizeof( ctx->acc ) );
+    memset( ctx->queue, 0, sizeof( ctx->queue ) );
+    ctx->queue_len = 0;
+
+    return( 0 );
+}
+
+int mbedtls_poly1305_update( mbedtls_poly1305_context *ctx,
+                             const unsigned char *input,
+                             size_t ilen )
+{
+    size_t fill;
+
+    if( ctx == NULL || ( ilen != 0 && input == NULL ) )
+        return( MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA );
+
+    if( ctx->queue_len > 0 )
+    {
+        fill = 16 - ctx->queue_len;
+
+        if( ilen < fill )
+        {
+            memcpy( ctx->queue + ctx->queue_len, input, ilen );
+            ctx->queue_len += ilen;
+            return( 0 );
+        }
+
+        memcpy( ctx->queue + ctx->queue_len, input, fill );
+        poly1305_process( ctx, ctx->queue, 1, 1 );
+        ctx->queue_len = 0;
+
+        input += fill;
+        ilen  -= fill;
+    }
+
+    if( ilen >= 16 )
+    {
+        poly1305_process( ctx, input, ilen / 16, 1 );
+
+        input += ilen & ~(size_t) 15;
+        ilen  &= 15;
+    }
+
+    if( ilen > 0 )
+    {
+        memcpy( ctx->queue, input, ilen );
+        ctx->queue_len = ilen;
+    }
+
+    return( 0 );
+}
+
+int mbedtls_poly1305_finish( mbedtls_poly1305_context *ctx,
+                             unsigned char mac[16] )
+{
+    uint32_t h0, h1, h2, h3, h4, g0, g1, g2, g3, g4, c, mask;
+    uint64_t f;
+
+    if( ctx == NULL || mac == NULL )
+        return( MBEDTLS_ERR_POLY1305_BAD_INPUT_DATA );
+
+    /* The last partial block is padded with a 1 byte, then zeroes */
+    if( ctx->queue_len > 0 )
+    {
+        ctx->queue[ctx->queue_len] = 1;
+        memset( ctx->queue + ctx->queue_len + 1, 0, 15 - ctx->queue_len );
+        poly1305_process( ctx, ctx->queue, 1, 0 );
+        ctx->queue_len = 0;
+    }
+
+    h0 = ctx->acc[0]; h1 = ctx->acc[1]; h2 = ctx->acc[2];
+    h3 = ctx->acc[3]; h4 = ctx->acc[4];
+
+    /* Full carry propagation */
+    c = h1 >> 26; h1 &= LIMB_MASK;
+    h2 += c; c = h2 >> 26; h2 &= LIMB_MASK;
+    h3 += c; c = h3 >> 26; h3 &= LIMB_MASK;
+    h4 += c; c = h4 >> 26; h4 &= LIMB_MASK;
+    h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+    h1 += c;
+
+    /* g = h + 5 - 2^130, kept instead of h if it doesn't go negative */
+    g0 = h0 + 5; c = g0 >> 26; g0 &= LIMB_MASK;
+    g1 = h1 + c; c = g1 >> 26; g1 &= LIMB_MASK;
+    g2 = h2 + c; c = g2 >> 26; g2 &= LIMB_MASK;
+    g3 = h3 + c; c = g3 >> 26; g3 &= LIMB_MASK;
+    g4 = h4 + c - ( (uint32_t) 1 << 26 );
+
+    /* Constant-time select: mask is all ones if g4 didn't borrow */
+    mask = ( g4 >> 31 ) - 1;
+    h0 = ( h0 & ~mask ) | ( g0 & mask );
+    h1 = ( h1 & ~mask ) | ( g1 & mask );
+    h2 = ( h2 & ~mask ) | ( g2 & mask );
+    h3 = ( h3 & ~mask ) | ( g3 & mask );
+    h4 = ( h4 & ~mask ) | ( g4 & mask );
+
+    /* Back to 32-bit words, mod 2^128, and add s */
+    h0 = ( h0       ) | ( h1 << 26 );
+    h1 = ( h1 >>  6 ) | ( h2 << 20 );
+    h2 = ( h2 >> 12 ) | ( h3 << 14 );
+    h3 = ( h3 >> 18 ) | ( h4 <<  8 );
+
+    f = (uint64_t) h0 + ctx->s[0];               h0 = (uint32_t) f;
+    f = (uint64_t) h1 + ctx->s[1] + ( f >> 32 ); h1 = (uint32_t) f;
+    f = (uint64_t) h2 + ctx->s[2] + ( f >> 32 ); h2 = (uint32_t) f;
+    f = (uint64_t) h3 + ctx->s[3] + ( f >> 32 ); h3 = (uint32_t) f;
+
+    PUT_UINT32_LE( h0, mac,  0 );
+    PUT_UINT32_LE( h1, mac,  4 );
+    PUT_UINT32_LE( h2, mac,  8 );
+    PUT_UINT32_LE( h3, mac, 12 );
+
+    /* The key is single-use */
+    mbedtls_zeroize( ctx, sizeof( mbedtls_poly1305_context ) );
+
+    return( 0 );
+}
+
+int mbedtls_poly1305_mac( const unsigned char key[32],
+                          const unsigned char *input,
+                          size_t ilen,
+                          unsigned char mac[16] )
+{
+    mbedtls_poly1305_context ctx;
+    int ret;
+
+    mbedtls_poly1305_init( &ctx );
+
+    if( ( ret = mbedtls_poly1305_starts( &ctx, key ) ) != 0 )
+        goto cleanup;
+
+    if( ( ret = mbedtls_poly1305_update( &ctx, input, ilen ) ) != 0 )
+        goto cleanup;
+
+    ret = mbedtls_poly1305_finish( &ctx, mac );
+
+cleanup:
+    mbedtls_poly1305_free( &ctx );
+    return( ret );
+}
+
+#if defined(MBEDTLS_SELF_TEST)
+/*
+ * Test vectors from RFC 7539, 2.5.2 and A.3 #5 to #7 (carry edge cases)
+ */
+#define POLY1305_TESTS  4
+
+static const unsigned char test_keys[POLY1305_TESTS][32] =
+{
+    { 0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33,
+      0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+      0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd,
+      0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b },
+    { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+    { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
+};
+
+static const unsigned char test_data[POLY1305_TESTS][48] =
+{
+    { 0x43, 0x72, 0x79, 0x70, 0x74, 0x6f, 0x67, 0x72,
+      0x61, 0x70, 0x68, 0x69, 0x63, 0x20, 0x46, 0x6f,
+      0x72, 0x75, 0x6d, 0x20, 0x52, 0x65, 0x73, 0x65,
+      0x61, 0x72, 0x63, 0x68, 0x20, 0x47, 0x72, 0x6f,
+      0x75, 0x70 },
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+    { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0xf0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
+};
+
+static const size_t test_data_len[POLY1305_TESTS] =
+    { 34, 16, 16, 48 };
+
+static const unsigned char test_mac[POLY1305_TESTS][16] =
+{
+    { 0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6,
+      0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9 },
+    { 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
+};
+
+int mbedtls_poly1305_self_test( int verbose )
+{
+    mbedtls_poly1305_context ctx;
+    unsigned char mac[16];
+    size_t j;
+    int i;
+
+    for( i = 0; i < POLY1305_TESTS; i++ )
+    {
+        if( verbose != 0 )
+            mbedtls_printf( "  Poly1305 test #%d: ", i + 1 );
+
+        if( mbedtls_poly1305_mac( test_keys[i], test_data[i],
+                                  test_data_len[i], mac ) != 0 ||
+            memcmp( mac, test_mac[i], 16 ) != 0 )
+        {
+            if( verbose != 0 )
+                mbedtls_printf( "failed\n" );
+
+            return( 1 );
+        }
+
+        /* Same again, a byte at a time */
+        mbedtls_poly1305_init( &ctx );
+        mbedtls_poly1305_starts( &ctx, test_keys[i] );
+
+        for( j = 0; j < test_data_len[i]; j++ )
+            mbedtls_poly1305_update( &ctx, test_data[i] + j, 1 );
+
+        mbedtls_poly1305_finish( &ctx, mac );
+        mbedtls_poly1305_free( &ctx );
+
+        if( memcmp( mac, test_mac[i], 16 ) != 0 )
+        {
+            if( verbose != 0 )
+                mbedtls_printf( "failed\n" );
+
+            return( 1 );
+        }
+
+        if( verbose != 0 )
+            mbedtls_printf( "passed\n" );
+    }
+
+    if( verbose != 0 )
+        mbedtls_printf( "\n" );
+
+    return( 0 );
+}
+
+#endif /* MBEDTLS_SELF_TEST */
+
+#endif /* MBEDTLS_POLY1305_C */
@@ -33,6 +33,7 @@
 #if defined(MBEDTLS_SHA256_C)
 
 #include "mbedtls/sha256.h"
+#include "mbedtls/cpu.h"
 
 #include <string.h>
 
@@ -47,6 +48,31 @@
 
 #if !defined(MBEDTLS_SHA256_ALT)
 
+#if !defined(MBEDTLS_SHA256_PROCESS_ALT)
+#if defined(MBEDTLS_HAVE_SHANI_INTRIN)
+#define SHA256_SHANI
+#endif
+
+#if defined(MBEDTLS_HAVE_AVX2_INTRIN)
+#define SHA256_AVX2
+#endif
+
+#if defined(MBEDTLS_HAVE_SSE2_INTRIN)
+#define SHA256_SSE2
+#endif
+
+#if defined(SHA256_SHANI) || defined(SHA256_AVX2)
+#include <immintrin.h>
+#elif defined(SHA256_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(MBEDTLS_HAVE_ARMV8_CRYPTO_INTRIN)
+#define SHA256_ARMV8
+#include <arm_neon.h>
+#endif
+#endif /* !MBEDTLS_SHA256_PROCESS_ALT */
+
 /* Implementation that should never be optimized out by the compiler */
 static void mbedtls_zeroize( void *v, size_t n ) {
     volatile unsigned char *p = v; while( n-- ) *p++ = 0;
@@ -176,7 +202,8 @@ static const uint32_t K[] =
     d += temp1; h = temp1 + temp2;              \
 }
 
-void mbedtls_sha256_process( mbedtls_sha256_context *ctx, const unsigned char data[64] )
+static void sha256_process_c( mbedtls_sha256_context *ctx,
+                              const unsigned char data[64] )
 {
     uint32_t temp1, temp2, W[64];
     uint32_t A[8];
@@ -230,8 +257,489 @@ void mbedtls_sha256_process( mbedtls_sha256_context *ctx, const unsigned char da
     for( i = 0; i < 8; i++ )
         ctx->state[i] += A[i];
 }
+
+#if defined(SHA256_SHANI)
+/*
+ * Four rounds with the SHA extensions, and the part of the message
+ * schedule interleaved with them: msg2 completes the words for 4 rounds
+ * ahead, msg1 starts those for 12 rounds ahead.
+ */
+#define SHANI_ROUNDS(i,cur,prev,next)                                       \
+{                                                                           \
+    wk = _mm_add_epi32( cur, _mm_loadu_si128( (const __m128i *)( K + 4 * i ) ) ); \
+    state1 = _mm_sha256rnds2_epu32( state1, state0, wk );                   \
+    if( i >= 3 && i <= 14 )                                                 \
+    {                                                                       \
+        next = _mm_add_epi32( next, _mm_alignr_epi8( cur, prev, 4 ) );      \
+        next = _mm_sha256msg2_epu32( next, cur );                           \
+    }                                                                       \
+    state0 = _mm_sha256rnds2_epu32( state0, state1,                         \
+                                    _mm_shuffle_epi32( wk, 0x0E ) );        \
+    if( i >= 1 && i <= 12 )                                                 \
+        prev = _mm_sha256msg1_epu32( prev, cur );                           \
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_shani_blocks( uint32_t state[8], const unsigned char *data,
+                                 size_t blocks )
+{
+    const __m128i bswap = _mm_set_epi8( 12, 13, 14, 15, 8, 9, 10, 11,
+                                        4, 5, 6, 7, 0, 1, 2, 3 );
+    __m128i state0, state1, abef, cdgh, tmp, wk, m0, m1, m2, m3;
+
+    /* The rounds instruction wants the state as ABEF and CDGH */
+    tmp    = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) state ), 0xB1 );
+    state1 = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)( state + 4 ) ), 0x1B );
+    state0 = _mm_alignr_epi8( tmp, state1, 8 );
+    state1 = _mm_blend_epi16( state1, tmp, 0xF0 );
+
+    for( ; blocks > 0; blocks--, data += 64 )
+    {
+        abef = state0;
+        cdgh = state1;
+
+        m0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( data +  0 ) ), bswap );
+        m1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( data + 16 ) ), bswap );
+        m2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( data + 32 ) ), bswap );
+        m3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( data + 48 ) ), bswap );
+
+        SHANI_ROUNDS(  0, m0, m3, m1 );
+        SHANI_ROUNDS(  1, m1, m0, m2 );
+        SHANI_ROUNDS(  2, m2, m1, m3 );
+        SHANI_ROUNDS(  3, m3, m2, m0 );
+        SHANI_ROUNDS(  4, m0, m3, m1 );
+        SHANI_ROUNDS(  5, m1, m0, m2 );
+        SHANI_ROUNDS(  6, m2, m1, m3 );
+        SHANI_ROUNDS(  7, m3, m2, m0 );
+        SHANI_ROUNDS(  8, m0, m3, m1 );
+        SHANI_ROUNDS(  9, m1, m0, m2 );
+        SHANI_ROUNDS( 10, m2, m1, m3 );
+        SHANI_ROUNDS( 11, m3, m2, m0 );
+        SHANI_ROUNDS( 12, m0, m3, m1 );
+        SHANI_ROUNDS( 13, m1, m0, m2 );
+        SHANI_ROUNDS( 14, m2, m1, m3 );
+        SHANI_ROUNDS( 15, m3, m2, m0 );
+
+        state0 = _mm_add_epi32( state0, abef );
+        state1 = _mm_add_epi32( state1, cdgh );
+    }
+
+    tmp    = _mm_shuffle_epi32( state0, 0x1B );
+    state1 = _mm_shuffle_epi32( state1, 0xB1 );
+    _mm_storeu_si128( (__m128i *) state, _mm_blend_epi16( tmp, state1, 0xF0 ) );
+    _mm_storeu_si128( (__m128i *)( state + 4 ), _mm_alignr_epi8( state1, tmp, 8 ) );
+}
+#endif /* SHA256_SHANI */
+
+#if defined(SHA256_ARMV8)
+/*
+ * Four rounds with the ARMv8 SHA-256 instructions, scheduling the words
+ * for 16 rounds ahead
+ */
+#define ARMV8_ROUNDS(i,m0,m1,m2,m3)                                         \
+{                                                                           \
+    wk = vaddq_u32( m0, vld1q_u32( K + 4 * i ) );                           \
+    if( i < 12 )                                                            \
+        m0 = vsha256su1q_u32( vsha256su0q_u32( m0, m1 ), m2, m3 );          \
+    tmp = state0;                                                           \
+    state0 = vsha256hq_u32( state0, state1, wk );                           \
+    state1 = vsha256h2q_u32( state1, tmp, wk );                             \
+}
+
+#if !defined(__ARM_FEATURE_CRYPTO)
+__attribute__((target("+crypto")))
+#endif
+static void sha256_armv8_blocks( uint32_t state[8], const unsigned char *data,
+                                 size_t blocks )
+{
+    uint32x4_t state0, state1, abcd, efgh, tmp, wk, m0, m1, m2, m3;
+
+    state0 = vld1q_u32( state );
+    state1 = vld1q_u32( state + 4 );
+
+    for( ; blocks > 0; blocks--, data += 64 )
+    {
+        abcd = state0;
+        efgh = state1;
+
+        m0 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data +  0 ) ) );
+        m1 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 16 ) ) );
+        m2 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 32 ) ) );
+        m3 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 48 ) ) );
+
+        ARMV8_ROUNDS(  0, m0, m1, m2, m3 );
+        ARMV8_ROUNDS(  1, m1, m2, m3, m0 );
+        ARMV8_ROUNDS(  2, m2, m3, m0, m1 );
+        ARMV8_ROUNDS(  3, m3, m0, m1, m2 );
+        ARMV8_ROUNDS(  4, m0, m1, m2, m3 );
+        ARMV8_ROUNDS(  5, m1, m2, m3, m0 );
+        ARMV8_ROUNDS(  6, m2, m3, m0, m1 );
+        ARMV8_ROUNDS(  7, m3, m0, m1, m2 );
+        ARMV8_ROUNDS(  8, m0, m1, m2, m3 );
+        ARMV8_ROUNDS(  9, m1, m2, m3, m0 );
+        ARMV8_ROUNDS( 10, m2, m3, m0, m1 );
+        ARMV8_ROUNDS( 11, m3, m0, m1, m2 );
+        ARMV8_ROUNDS( 12, m0, m1, m2, m3 );
+        ARMV8_ROUNDS( 13, m1, m2, m3, m0 );
+        ARMV8_ROUNDS( 14, m2, m3, m0, m1 );
+        ARMV8_ROUNDS( 15, m3, m0, m1, m2 );
+
+        state0 = vaddq_u32( state0, abcd );
+        state1 = vaddq_u32( state1, efgh );
+    }
+
+    vst1q_u32( state, state0 );
+    vst1q_u32( state + 4, state1 );
+}
+#endif /* SHA256_ARMV8 */
+
+#if defined(SHA256_AVX2)
+#define AVX2_ROTR(x,n)                                                      \
+    _mm256_or_si256( _mm256_srli_epi32( x, n ), _mm256_slli_epi32( x, 32 - n ) )
+
+#define AVX2_S0(x) _mm256_xor_si256( _mm256_xor_si256( AVX2_ROTR( x,  7 ),    \
+                   AVX2_ROTR( x, 18 ) ), _mm256_srli_epi32( x,  3 ) )
+#define AVX2_S1(x) _mm256_xor_si256( _mm256_xor_si256( AVX2_ROTR( x, 17 ),    \
+                   AVX2_ROTR( x, 19 ) ), _mm256_srli_epi32( x, 10 ) )
+
+/*
+ * Next 4 words of the message schedule of two blocks, one per 128-bit
+ * lane, from the previous 16 in x0..x3. The first two words need the
+ * last two of x3, the other two the first two being computed.
+ */
+__attribute__((target("avx2")))
+static inline __m256i sha256_avx2_schedule( __m256i x0, __m256i x1,
+                                            __m256i x2, __m256i x3 )
+{
+    __m256i w;
+
+    w = _mm256_add_epi32( x0, AVX2_S0( _mm256_alignr_epi8( x1, x0, 4 ) ) );
+    w = _mm256_add_epi32( w, _mm256_alignr_epi8( x3, x2, 4 ) );
+    w = _mm256_add_epi32( w, _mm256_srli_si256( AVX2_S1( x3 ), 8 ) );
+    w = _mm256_add_epi32( w, _mm256_slli_si256( AVX2_S1( w ), 8 ) );
+
+    return( w );
+}
+
+/*
+ * Message schedule plus round constants of two blocks: words 4j to 4j+3
+ * of the first block are at wk[8j], those of the second at wk[8j+4]
+ */
+__attribute__((target("avx2")))
+static void sha256_avx2_schedule_2( uint32_t wk[128], const unsigned char data[128] )
+{
+    const __m256i bswap = _mm256_set_epi8( 12, 13, 14, 15, 8, 9, 10, 11,
+                                           4, 5, 6, 7, 0, 1, 2, 3,
+                                           12, 13, 14, 15, 8, 9, 10, 11,
+                                           4, 5, 6, 7, 0, 1, 2, 3 );
+    __m256i x0, x1, x2, x3, w;
+    unsigned int j;
+
+#define AVX2_LOAD2(i)                                                       \
+    _mm256_shuffle_epi8( _mm256_inserti128_si256( _mm256_castsi128_si256(   \
+        _mm_loadu_si128( (const __m128i *)( data + 16 * i ) ) ),            \
+        _mm_loadu_si128( (const __m128i *)( data + 64 + 16 * i ) ), 1 ), bswap )
+
+#define AVX2_STORE_WK(j,w)                                                  \
+    _mm256_storeu_si256( (__m256i *)( wk + 8 * (j) ), _mm256_add_epi32( w,  \
+        _mm256_broadcastsi128_si256(                                        \
+            _mm_loadu_si128( (const __m128i *)( K + 4 * (j) ) ) ) ) )
+
+    x0 = AVX2_LOAD2( 0 );
+    x1 = AVX2_LOAD2( 1 );
+    x2 = AVX2_LOAD2( 2 );
+    x3 = AVX2_LOAD2( 3 );
+
+    AVX2_STORE_WK( 0, x0 );
+    AVX2_STORE_WK( 1, x1 );
+    AVX2_STORE_WK( 2, x2 );
+    AVX2_STORE_WK( 3, x3 );
+
+    for( j = 4; j < 16; j++ )
+    {
+        w = sha256_avx2_schedule( x0, x1, x2, x3 );
+        AVX2_STORE_WK( j, w );
+
+        x0 = x1;
+        x1 = x2;
+        x2 = x3;
+        x3 = w;
+    }
+}
+
+/*
+ * Rounds of one block with the message schedule and constants added in wk
+ */
+#define WK(t)   wk[( (t) & ~3u ) * 2 + ( (t) & 3 )]
+
+static void sha256_rounds_wk( uint32_t state[8], const uint32_t *wk )
+{
+    uint32_t temp1, temp2;
+    uint32_t A[8];
+    unsigned int i;
+
+    for( i = 0; i < 8; i++ )
+        A[i] = state[i];
+
+    for( i = 0; i < 64; i += 8 )
+    {
+        P( A[0], A[1], A[2], A[3], A[4], A[5], A[6], A[7], WK(i+0), 0 );
+        P( A[7], A[0], A[1], A[2], A[3], A[4], A[5], A[6], WK(i+1), 0 );
+        P( A[6], A[7], A[0], A[1], A[2], A[3], A[4], A[5], WK(i+2), 0 );
+        P( A[5], A[6], A[7], A[0], A[1], A[2], A[3], A[4], WK(i+3), 0 );
+        P( A[4], A[5], A[6], A[7], A[0], A[1], A[2], A[3], WK(i+4), 0 );
+        P( A[3], A[4], A[5], A[6], A[7], A[0], A[1], A[2], WK(i+5), 0 );
+        P( A[2], A[3], A[4], A[5], A[6], A[7], A[0], A[1], WK(i+6), 0 );
+        P( A[1], A[2], A[3], A[4], A[5], A[6], A[7], A[0], WK(i+7), 0 );
+    }
+
+    for( i = 0; i < 8; i++ )
+        state[i] += A[i];
+}
+
+static void sha256_avx2_blocks( uint32_t state[8], const unsigned char *data,
+                                size_t pairs )
+{
+    uint32_t wk[128];
+
+    for( ; pairs > 0; pairs--, data += 128 )
+    {
+        sha256_avx2_schedule_2( wk, data );
+        sha256_rounds_wk( state, wk );
+        sha256_rounds_wk( state, wk + 4 );
+    }
+}
+#endif /* SHA256_AVX2 */
+
+/*
+ * Process a run of blocks with the implementation selected for the CPU
+ */
+static void sha256_process_blocks( mbedtls_sha256_context *ctx,
+                                   const unsigned char *data, size_t blocks )
+{
+#if defined(MBEDTLS_CPU_C)
+    switch( mbedtls_cpu_impl( MBEDTLS_CPU_SHA256 ) )
+    {
+#if defined(SHA256_SHANI)
+        case MBEDTLS_CPU_IMPL_SHANI:
+            sha256_shani_blocks( ctx->state, data, blocks );
+            return;
+#endif
+#if defined(SHA256_ARMV8)
+        case MBEDTLS_CPU_IMPL_ARMV8:
+            sha256_armv8_blocks( ctx->state, data, blocks );
+            return;
+#endif
+#if defined(SHA256_AVX2)
+        case MBEDTLS_CPU_IMPL_AVX2:
+            /* Blocks go by two, an odd one is left to the generic code */
+            sha256_avx2_blocks( ctx->state, data, blocks / 2 );
+            data += 64 * ( blocks & ~(size_t) 1 );
+            blocks &= 1;
+            break;
+#endif
+        default:
+            break;
+    }
+#endif /* MBEDTLS_CPU_C */
+
+    for( ; blocks > 0; blocks--, data += 64 )
+        sha256_process_c( ctx, data );
+}
+
+void mbedtls_sha256_process( mbedtls_sha256_context *ctx, const unsigned char data[64] )
+{
+    sha256_process_blocks( ctx, data, 1 );
+}
+
+/*
+ * Multi-buffer hashing: each 32-bit lane of a vector belongs to a different
+ * message, s[i][lane] is word i of the state of that lane and blk[lane]
+ * its next block.
+ */
+#if defined(SHA256_SSE2)
+#define LANE_WORD(blk,lane,t)                                               \
+    ( (uint32_t) (blk)[lane][4 * (t)    ] << 24 |                           \
+      (uint32_t) (blk)[lane][4 * (t) + 1] << 16 |                           \
+      (uint32_t) (blk)[lane][4 * (t) + 2] <<  8 |                           \
+      (uint32_t) (blk)[lane][4 * (t) + 3]       )
+
+#define SSE2_ROTR(x,n)                                                      \
+    _mm_or_si128( _mm_srli_epi32( x, n ), _mm_slli_epi32( x, 32 - n ) )
+#define SSE2_XOR3(x,y,z)    _mm_xor_si128( _mm_xor_si128( x, y ), z )
+
+#define SSE2_S0(x) SSE2_XOR3( SSE2_ROTR( x,  7 ), SSE2_ROTR( x, 18 ), _mm_srli_epi32( x,  3 ) )
+#define SSE2_S1(x) SSE2_XOR3( SSE2_ROTR( x, 17 ), SSE2_ROTR( x, 19 ), _mm_srli_epi32( x, 10 ) )
+#define SSE2_S2(x) SSE2_XOR3( SSE2_ROTR( x,  2 ), SSE2_ROTR( x, 13 ), SSE2_ROTR( x, 22 ) )
+#define SSE2_S3(x) SSE2_XOR3( SSE2_ROTR( x,  6 ), SSE2_ROTR( x, 11 ), SSE2_ROTR( x, 25 ) )
+
+/* Four lanes, from lane to lane + 3 */
+static void sha256_sse2_x4( uint32_t s[8][MBEDTLS_SHA256_MULTI_LANES],
+                            const unsigned char * const blk[], size_t lane )
+{
+    __m128i a, b, c, d, e, f, g, h, t1, t2, w[16];
+    unsigned int t;
+
+    blk += lane;
+
+    a = _mm_loadu_si128( (const __m128i *)( s[0] + lane ) );
+    b = _mm_loadu_si128( (const __m128i *)( s[1] + lane ) );
+    c = _mm_loadu_si128( (const __m128i *)( s[2] + lane ) );
+    d = _mm_loadu_si128( (const __m128i *)( s[3] + lane ) );
+    e = _mm_loadu_si128( (const __m128i *)( s[4] + lane ) );
+    f = _mm_loadu_si128( (const __m128i *)( s[5] + lane ) );
+    g = _mm_loadu_si128( (const __m128i *)( s[6] + lane ) );
+    h = _mm_loadu_si128( (const __m128i *)( s[7] + lane ) );
+
+    for( t = 0; t < 64; t++ )
+    {
+        if( t < 16 )
+            w[t] = _mm_set_epi32( LANE_WORD( blk, 3, t ), LANE_WORD( blk, 2, t ),
+                                  LANE_WORD( blk, 1, t ), LANE_WORD( blk, 0, t ) );
+        else
+            w[t & 15] = _mm_add_epi32(
+                            _mm_add_epi32( SSE2_S1( w[( t - 2 ) & 15] ), w[( t - 7 ) & 15] ),
+                            _mm_add_epi32( SSE2_S0( w[( t - 15 ) & 15] ), w[t & 15] ) );
+
+        /* t1 = h + S3(e) + F1(e,f,g) + K[t] + W[t], t2 = S2(a) + F0(a,b,c) */
+        t1 = _mm_xor_si128( g, _mm_and_si128( e, _mm_xor_si128( f, g ) ) );
+        t1 = _mm_add_epi32( _mm_add_epi32( h, SSE2_S3( e ) ), t1 );
+        t1 = _mm_add_epi32( t1, _mm_add_epi32( _mm_set1_epi32( K[t] ), w[t & 15] ) );
+        t2 = _mm_or_si128( _mm_and_si128( a, b ), _mm_and_si128( c, _mm_or_si128( a, b ) ) );
+        t2 = _mm_add_epi32( SSE2_S2( a ), t2 );
+
+        h = g; g = f; f = e;
+        e = _mm_add_epi32( d, t1 );
+        d = c; c = b; b = a;
+        a = _mm_add_epi32( t1, t2 );
+    }
+
+#define SSE2_ADD_STATE(i,x)                                                 \
+    _mm_storeu_si128( (__m128i *)( s[i] + lane ), _mm_add_epi32( x,         \
+                      _mm_loadu_si128( (const __m128i *)( s[i] + lane ) ) ) )
+
+    SSE2_ADD_STATE( 0, a );
+    SSE2_ADD_STATE( 1, b );
+    SSE2_ADD_STATE( 2, c );
+    SSE2_ADD_STATE( 3, d );
+    SSE2_ADD_STATE( 4, e );
+    SSE2_ADD_STATE( 5, f );
+    SSE2_ADD_STATE( 6, g );
+    SSE2_ADD_STATE( 7, h );
+}
+#endif /* SHA256_SSE2 */
+
+#if defined(SHA256_AVX2)
+#define AVX2_XOR3(x,y,z)    _mm256_xor_si256( _mm256_xor_si256( x, y ), z )
+
+#define AVX2_S2(x) AVX2_XOR3( AVX2_ROTR( x,  2 ), AVX2_ROTR( x, 13 ), AVX2_ROTR( x, 22 ) )
+#define AVX2_S3(x) AVX2_XOR3( AVX2_ROTR( x,  6 ), AVX2_ROTR( x, 11 ), AVX2_ROTR( x, 25 ) )
+
+/*
+ * Words off to off + 7 of the 8 blocks, one block per lane: transpose the
+ * 8x8 matrix of words and make them big endian
+ */
+__attribute__((target("avx2")))
+static void sha256_avx2_load8( __m256i w[8], const unsigned char * const blk[],
+                               size_t off )
+{
+    const __m256i bswap = _mm256_set_epi8( 12, 13, 14, 15, 8, 9, 10, 11,
+                                           4, 5, 6, 7, 0, 1, 2, 3,
+                                           12, 13, 14, 15, 8, 9, 10, 11,
+                                           4, 5, 6, 7, 0, 1, 2, 3 );
+    __m256i r[8], t[8], u[8];
+    unsigned int i;
+
+    for( i = 0; i < 8; i++ )
+        r[i] = _mm256_loadu_si256( (const __m256i *)( blk[i] + off ) );
+
+    for( i = 0; i < 8; i += 2 )
+    {
+        t[i]     = _mm256_unpacklo_epi32( r[i], r[i + 1] );
+        t[i + 1] = _mm256_unpackhi_epi32( r[i], r[i + 1] );
+    }
+
+    for( i = 0; i < 8; i += 4 )
+    {
+        u[i]     = _mm256_unpacklo_epi64( t[i],     t[i + 2] );
+        u[i + 1] = _mm256_unpackhi_epi64( t[i],     t[i + 2] );
+        u[i + 2] = _mm256_unpacklo_epi64( t[i + 1], t[i + 3] );
+        u[i + 3] = _mm256_unpackhi_epi64( t[i + 1], t[i + 3] );
+    }
+
+    for( i = 0; i < 4; i++ )
+    {
+        w[i]     = _mm256_shuffle_epi8(
+                       _mm256_permute2x128_si256( u[i], u[i + 4], 0x20 ), bswap );
+        w[i + 4] = _mm256_shuffle_epi8(
+                       _mm256_permute2x128_si256( u[i], u[i + 4], 0x31 ), bswap );
+    }
+}
+
+__attribute__((target("avx2")))
+static void sha256_avx2_x8( uint32_t s[8][MBEDTLS_SHA256_MULTI_LANES],
+                            const unsigned char * const blk[] )
+{
+    __m256i a, b, c, d, e, f, g, h, t1, t2, w[16];
+    unsigned int t;
+
+    a = _mm256_loadu_si256( (const __m256i *) s[0] );
+    b = _mm256_loadu_si256( (const __m256i *) s[1] );
+    c = _mm256_loadu_si256( (const __m256i *) s[2] );
+    d = _mm256_loadu_si256( (const __m256i *) s[3] );
+    e = _mm256_loadu_si256( (const __m256i *) s[4] );
+    f = _mm256_loadu_si256( (const __m256i *) s[5] );
+    g = _mm256_loadu_si256( (const __m256i *) s[6] );
+    h = _mm256_loadu_si256( (const __m256i *) s[7] );
+
+    sha256_avx2_load8( w, blk, 0 );
+    sha256_avx2_load8( w + 8, blk, 32 );
+
+    for( t = 0; t < 64; t++ )
+    {
+        if( t >= 16 )
+            w[t & 15] = _mm256_add_epi32(
+                            _mm256_add_epi32( AVX2_S1( w[( t - 2 ) & 15] ), w[( t - 7 ) & 15] ),
+                            _mm256_add_epi32( AVX2_S0( w[( t - 15 ) & 15] ), w[t & 15] ) );
+
+        /* t1 = h + S3(e) + F1(e,f,g) + K[t] + W[t], t2 = S2(a) + F0(a,b,c) */
+        t1 = _mm256_xor_si256( g, _mm256_and_si256( e, _mm256_xor_si256( f, g ) ) );
+        t1 = _mm256_add_epi32( _mm256_add_epi32( h, AVX2_S3( e ) ), t1 );
+        t1 = _mm256_add_epi32( t1, _mm256_add_epi32( _mm256_set1_epi32( K[t] ), w[t & 15] ) );
+        t2 = _mm256_or_si256( _mm256_and_si256( a, b ), _mm256_and_si256( c, _mm256_or_si256( a, b ) ) );
+        t2 = _mm256_add_epi32( AVX2_S2( a ), t2 );
+
+        h = g; g = f; f = e;
+        e = _mm256_add_epi32( d, t1 );
+        d = c; c = b; b = a;
+        a = _mm256_add_epi32( t1, t2 );
+    }
+
+#define AVX2_ADD_STATE(i,x)                                                 \
+    _mm256_storeu_si256( (__m256i *) s[i], _mm256_add_epi32( x,             \
+                         _mm256_loadu_si256( (const __m256i *) s[i] ) ) )
+
+    AVX2_ADD_STATE( 0, a );
+    AVX2_ADD_STATE( 1, b );
+    AVX2_ADD_STATE( 2, c );
+    AVX2_ADD_STATE( 3, d );
+    AVX2_ADD_STATE( 4, e );
+    AVX2_ADD_STATE( 5, f );
+    AVX2_ADD_STATE( 6, g );
+    AVX2_ADD_STATE( 7, h );
+}
+#endif /* SHA256_AVX2 */
 #endif /* !MBEDTLS_SHA256_PROCESS_ALT */
 
+#if defined(MBEDTLS_SHA256_PROCESS_ALT)
+static void sha256_process_blocks( mbedtls_sha256_context *ctx,
+                                   const unsigned char *data, size_t blocks )
+{
+    for( ; blocks > 0; blocks--, data += 64 )
+        mbedtls_sha256_process( ctx, data );
+}
+#endif
+
 /*
  * SHA-256 process buffer
  */
@@ -256,17 +764,17 @@ void mbedtls_sha256_update( mbedtls_sha256_context *ctx, const unsigned char *in
     if( left && ilen >= fill )
     {
         memcpy( (void *) (ctx->buffer + left), input, fill );
-        mbedtls_sha256_process( ctx, ctx->buffer );
+        sha256_process_blocks( ctx, ctx->buffer, 1 );
         input += fill;
         ilen  -= fill;
         left = 0;
     }
 
-    while( ilen >= 64 )
+    if( ilen >= 64 )
     {
-        mbedtls_sha256_process( ctx, input );
-        input += 64;
-        ilen  -= 64;
+        sha256_process_blocks( ctx, input, ilen / 64 );
+        input += ilen & ~(size_t) 63;
+        ilen  &= 63;
     }
 
     if( ilen > 0 )
@@ -315,6 +823,129 @@ void mbedtls_sha256_finish( mbedtls_sha256_context *ctx, unsigned char output[32
         PUT_UINT32_BE( ctx->state[7], output, 28 );
 }
 
+#if defined(SHA256_SSE2) || defined(SHA256_AVX2)
+/*
+ * Finish up to MBEDTLS_SHA256_MULTI_LANES hashes side by side, all contexts
+ * being at a block boundary. Lanes that are done or unused hash a dummy
+ * block, and each digest is read as soon as its last block is in.
+ */
+static void sha256_multi_lanes( mbedtls_sha256_context * const ctx[],
+                                const unsigned char * const input[],
+                                const size_t ilen[],
+                                unsigned char * const output[],
+                                size_t n, mbedtls_cpu_impl_t impl )
+{
+    uint32_t s[8][MBEDTLS_SHA256_MULTI_LANES];
+    unsigned char tail[MBEDTLS_SHA256_MULTI_LANES][128];
+    const unsigned char *blk[MBEDTLS_SHA256_MULTI_LANES];
+    size_t full[MBEDTLS_SHA256_MULTI_LANES], blocks[MBEDTLS_SHA256_MULTI_LANES];
+    size_t i, j, rest, step, steps = 0;
+    uint64_t bits;
+
+    memset( s, 0, sizeof( s ) );
+
+    for( i = 0; i < n; i++ )
+    {
+        /* The end of the message, padding and length, in one or two blocks */
+        full[i] = ilen[i] / 64;
+        rest = ilen[i] % 64;
+        blocks[i] = ( rest < 56 ) ? 1 : 2;
+
+        memcpy( tail[i], input[i] + 64 * full[i], rest );
+        memset( tail[i] + rest, 0, 64 * blocks[i] - rest );
+        tail[i][rest] = 0x80;
+
+        bits = ( ( (uint64_t) ctx[i]->total[1] << 32 | ctx[i]->total[0] )
+                 + ilen[i] ) << 3;
+        PUT_UINT32_BE( (uint32_t) ( bits >> 32 ), tail[i], 64 * blocks[i] - 8 );
+        PUT_UINT32_BE( (uint32_t) bits, tail[i], 64 * blocks[i] - 4 );
+
+        blocks[i] += full[i];
+        if( blocks[i] > steps )
+            steps = blocks[i];
+
+        for( j = 0; j < 8; j++ )
+            s[j][i] = ctx[i]->state[j];
+    }
+
+    for( step = 0; step < steps; step++ )
+    {
+        for( i = 0; i < MBEDTLS_SHA256_MULTI_LANES; i++ )
+        {
+            if( i >= n || step >= blocks[i] )
+                blk[i] = tail[0];
+            else if( step < full[i] )
+                blk[i] = input[i] + 64 * step;
+            else
+                blk[i] = tail[i] + 64 * ( step - full[i] );
+        }
+
+#if defined(SHA256_AVX2)
+        if( impl == MBEDTLS_CPU_IMPL_AVX2 )
+            sha256_avx2_x8( s, blk );
+        else
+#endif
+        {
+#if defined(SHA256_SSE2)
+            sha256_sse2_x4( s, blk, 0 );
+            if( n > 4 )
+                sha256_sse2_x4( s, blk, 4 );
+#endif
+        }
+
+        for( i = 0; i < n; i++ )
+        {
+            if( step + 1 != blocks[i] )
+                continue;
+
+            for( j = 0; j < 7; j++ )
+                PUT_UINT32_BE( s[j][i], output[i], 4 * j );
+
+            if( ctx[i]->is224 == 0 )
+                PUT_UINT32_BE( s[7][i], output[i], 28 );
+        }
+    }
+
+    mbedtls_zeroize( s, sizeof( s ) );
+    mbedtls_zeroize( tail, n * sizeof( tail[0] ) );
+}
+#endif /* SHA256_SSE2 || SHA256_AVX2 */
+
+/*
+ * Finish n independent hashes, ctx[i] taking input[i] as the last of its
+ * data. The contexts are left in an unspecified state.
+ */
+static void sha256_finish_multi( mbedtls_sha256_context * const ctx[],
+                                 const unsigned char * const input[],
+                                 const size_t ilen[],
+                                 unsigned char * const output[], size_t n )
+{
+    size_t i;
+#if defined(SHA256_SSE2) || defined(SHA256_AVX2)
+    mbedtls_cpu_impl_t impl = mbedtls_cpu_impl( MBEDTLS_CPU_SHA256_MULTI );
+
+    if( ( impl == MBEDTLS_CPU_IMPL_AVX2 || impl == MBEDTLS_CPU_IMPL_SSE2 ) &&
+        n > 1 && n <= MBEDTLS_SHA256_MULTI_LANES )
+    {
+        for( i = 0; i < n; i++ )
+            if( ( ctx[i]->total[0] & 0x3F ) != 0 )
+                break;
+
+        if( i == n )
+        {
+            sha256_multi_lanes( ctx, input, ilen, output, n, impl );
+            return;
+        }
+    }
+#endif
+
+    for( i = 0; i < n; i++ )
+    {
+        mbedtls_sha256_update( ctx[i], input[i], ilen[i] );
+        mbedtls_sha256_finish( ctx[i], output[i] );
+    }
+}
+
 #endif /* !MBEDTLS_SHA256_ALT */
 
 /*
@@ -332,6 +963,133 @@ void mbedtls_sha256( const unsigned char *input, size_t ilen,
     mbedtls_sha256_free( &ctx );
 }
 
+#if defined(MBEDTLS_SHA256_ALT)
+/* Implementation that should never be optimized out by the compiler */
+static void mbedtls_zeroize( void *v, size_t n ) {
+    volatile unsigned char *p = v; while( n-- ) *p++ = 0;
+}
+
+static void sha256_finish_multi( mbedtls_sha256_context * const ctx[],
+                                 const unsigned char * const input[],
+                                 const size_t ilen[],
+                                 unsigned char * const output[], size_t n )
+{
+    size_t i;
+
+    for( i = 0; i < n; i++ )
+    {
+        mbedtls_sha256_update( ctx[i], input[i], ilen[i] );
+        mbedtls_sha256_finish( ctx[i], output[i] );
+    }
+}
+#endif /* MBEDTLS_SHA256_ALT */
+
+/*
+ * output[i] = SHA-256( input[i] ), MBEDTLS_SHA256_MULTI_LANES at a time
+ */
+void mbedtls_sha256_multi( size_t n, const unsigned char * const input[],
+                           const size_t ilen[], unsigned char * const output[],
+                           int is224 )
+{
+    mbedtls_sha256_context ctx[MBEDTLS_SHA256_MULTI_LANES];
+    mbedtls_sha256_context *pctx[MBEDTLS_SHA256_MULTI_LANES];
+    size_t i, k;
+
+    for( ; n > 0; n -= k, input += k, ilen += k, output += k )
+    {
+        k = ( n < MBEDTLS_SHA256_MULTI_LANES ) ? n : MBEDTLS_SHA256_MULTI_LANES;
+
+        for( i = 0; i < k; i++ )
+        {
+            mbedtls_sha256_init( &ctx[i] );
+            mbedtls_sha256_starts( &ctx[i], is224 );
+            pctx[i] = &ctx[i];
+        }
+
+        sha256_finish_multi( pctx, input, ilen, output, k );
+
+        for( i = 0; i < k; i++ )
+            mbedtls_sha256_free( &ctx[i] );
+    }
+}
+
+/*
+ * output[i] = HMAC-SHA-256( key, input[i] ): the padded key is hashed once,
+ * then the inner and outer hashes of all the messages go side by side
+ */
+void mbedtls_sha256_hmac_multi( const unsigned char *key, size_t keylen,
+                                size_t n, const unsigned char * const input[],
+                                const size_t ilen[],
+                                unsigned char * const output[] )
+{
+    mbedtls_sha256_context ipad_ctx, opad_ctx;
+    mbedtls_sha256_context ctx[MBEDTLS_SHA256_MULTI_LANES];
+    mbedtls_sha256_context *pctx[MBEDTLS_SHA256_MULTI_LANES];
+    unsigned char inner[MBEDTLS_SHA256_MULTI_LANES][32];
+    unsigned char *inner_out[MBEDTLS_SHA256_MULTI_LANES];
+    const unsigned char *inner_in[MBEDTLS_SHA256_MULTI_LANES];
+    size_t inner_len[MBEDTLS_SHA256_MULTI_LANES];
+    unsigned char pad[64], sum[32];
+    size_t i, k;
+
+    if( keylen > 64 )
+    {
+        mbedtls_sha256( key, keylen, sum, 0 );
+        key = sum;
+        keylen = 32;
+    }
+
+    mbedtls_sha256_init( &ipad_ctx );
+    mbedtls_sha256_init( &opad_ctx );
+
+    memset( pad, 0x36, sizeof( pad ) );
+    for( i = 0; i < keylen; i++ )
+        pad[i] ^= key[i];
+
+    mbedtls_sha256_starts( &ipad_ctx, 0 );
+    mbedtls_sha256_update( &ipad_ctx, pad, sizeof( pad ) );
+
+    for( i = 0; i < sizeof( pad ); i++ )
+        pad[i] ^= 0x36 ^ 0x5C;
+
+    mbedtls_sha256_starts( &opad_ctx, 0 );
+    mbedtls_sha256_update( &opad_ctx, pad, sizeof( pad ) );
+
+    for( i = 0; i < MBEDTLS_SHA256_MULTI_LANES; i++ )
+    {
+        mbedtls_sha256_init( &ctx[i] );
+        pctx[i] = &ctx[i];
+        inner_out[i] = inner[i];
+        inner_in[i] = inner[i];
+        inner_len[i] = sizeof( inner[i] );
+    }
+
+    for( ; n > 0; n -= k, input += k, ilen += k, output += k )
+    {
+        k = ( n < MBEDTLS_SHA256_MULTI_LANES ) ? n : MBEDTLS_SHA256_MULTI_LANES;
+
+        for( i = 0; i < k; i++ )
+            mbedtls_sha256_clone( &ctx[i], &ipad_ctx );
+
+        sha256_finish_multi( pctx, input, ilen, inner_out, k );
+
+        for( i = 0; i < k; i++ )
+            mbedtls_sha256_clone( &ctx[i], &opad_ctx );
+
+        sha256_finish_multi( pctx, inner_in, inner_len, output, k );
+    }
+
+    for( i = 0; i < MBEDTLS_SHA256_MULTI_LANES; i++ )
+        mbedtls_sha256_free( &ctx[i] );
+
+    mbedtls_sha256_free( &ipad_ctx );
+    mbedtls_sha256_free( &opad_ctx );
+
+    mbedtls_zeroize( inner, sizeof( inner ) );
+    mbedtls_zeroize( pad, sizeof( pad ) );
+    mbedtls_zeroize( sum, sizeof( sum ) );
+}
+
 #if defined(MBEDTLS_SELF_TEST)
 /*
  * FIPS-180-2 test vectors
@@ -33,6 +33,7 @@
 #if defined(MBEDTLS_SHA512_C)
 
 #include "mbedtls/sha512.h"
+#include "mbedtls/cpu.h"
 
 #if defined(_MSC_VER) || defined(__WATCOMC__)
   #define UL64(x) x##ui64
@@ -53,6 +54,11 @@
 
 #if !defined(MBEDTLS_SHA512_ALT)
 
+#if !defined(MBEDTLS_SHA512_PROCESS_ALT) && defined(MBEDTLS_HAVE_AVX2_INTRIN)
+#define SHA512_AVX2
+#include <immintrin.h>
+#endif
+
 /* Implementation that should never be optimized out by the compiler */
 static void mbedtls_zeroize( void *v, size_t n ) {
     volatile unsigned char *p = v; while( n-- ) *p++ = 0;
@@ -192,7 +198,8 @@ void mbedtls_sha512_starts( mbedtls_sha512_context *ctx, int is384 )
 }
 
 #if !defined(MBEDTLS_SHA512_PROCESS_ALT)
-void mbedtls_sha512_process( mbedtls_sha512_context *ctx, const unsigned char data[128] )
+static void sha512_process_c( mbedtls_sha512_context *ctx,
+                              const unsigned char data[128] )
 {
     int i;
     uint64_t temp1, temp2, W[80];
@@ -260,8 +267,164 @@ void mbedtls_sha512_process( mbedtls_sha512_context *ctx, const unsigned char da
     ctx->state[6] += G;
     ctx->state[7] += H;
 }
+
+#if defined(SHA512_AVX2)
+#define AVX2_ROTR(x,n)                                                      \
+    _mm256_or_si256( _mm256_srli_epi64( x, n ), _mm256_slli_epi64( x, 64 - n ) )
+
+#define AVX2_S0(x) _mm256_xor_si256( _mm256_xor_si256( AVX2_ROTR( x,  1 ),    \
+                   AVX2_ROTR( x,  8 ) ), _mm256_srli_epi64( x,  7 ) )
+#define AVX2_S1(x) _mm256_xor_si256( _mm256_xor_si256( AVX2_ROTR( x, 19 ),    \
+                   AVX2_ROTR( x, 61 ) ), _mm256_srli_epi64( x,  6 ) )
+
+/* Words 1-4 of the 8 in (x0, x1) */
+#define AVX2_ALIGN1(x0,x1)                                                  \
+    _mm256_alignr_epi8( _mm256_permute2x128_si256( x0, x1, 0x21 ), x0, 8 )
+
+/*
+ * Next 4 words of the message schedule from the previous 16 in x0..x3.
+ * The first two words need the last two of x3, the other two the first
+ * two being computed.
+ */
+__attribute__((target("avx2")))
+static inline __m256i sha512_avx2_schedule( __m256i x0, __m256i x1,
+                                            __m256i x2, __m256i x3 )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i w;
+
+    w = _mm256_add_epi64( x0, AVX2_S0( AVX2_ALIGN1( x0, x1 ) ) );
+    w = _mm256_add_epi64( w, AVX2_ALIGN1( x2, x3 ) );
+    w = _mm256_add_epi64( w, _mm256_blend_epi32( zero,
+            _mm256_permute4x64_epi64( AVX2_S1( x3 ), 0x0E ), 0x0F ) );
+    w = _mm256_add_epi64( w, _mm256_blend_epi32( zero,
+            _mm256_permute4x64_epi64( AVX2_S1( w ), 0x40 ), 0xF0 ) );
+
+    return( w );
+}
+
+/*
+ * Message schedule plus round constants of one block
+ */
+__attribute__((target("avx2")))
+static void sha512_avx2_schedule_1( uint64_t wk[80], const unsigned char data[128] )
+{
+    const __m256i bswap = _mm256_set_epi8( 8, 9, 10, 11, 12, 13, 14, 15,
+                                           0, 1, 2, 3, 4, 5, 6, 7,
+                                           8, 9, 10, 11, 12, 13, 14, 15,
+                                           0, 1, 2, 3, 4, 5, 6, 7 );
+    __m256i x0, x1, x2, x3, w;
+    unsigned int j;
+
+#define AVX2_LOAD(i)                                                        \
+    _mm256_shuffle_epi8( _mm256_loadu_si256(                                \
+        (const __m256i *)( data + 32 * i ) ), bswap )
+
+#define AVX2_STORE_WK(j,w)                                                  \
+    _mm256_storeu_si256( (__m256i *)( wk + 4 * (j) ), _mm256_add_epi64( w,  \
+        _mm256_loadu_si256( (const __m256i *)( K + 4 * (j) ) ) ) )
+
+    x0 = AVX2_LOAD( 0 );
+    x1 = AVX2_LOAD( 1 );
+    x2 = AVX2_LOAD( 2 );
+    x3 = AVX2_LOAD( 3 );
+
+    AVX2_STORE_WK( 0, x0 );
+    AVX2_STORE_WK( 1, x1 );
+    AVX2_STORE_WK( 2, x2 );
+    AVX2_STORE_WK( 3, x3 );
+
+    for( j = 4; j < 20; j++ )
+    {
+        w = sha512_avx2_schedule( x0, x1, x2, x3 );
+        AVX2_STORE_WK( j, w );
+
+        x0 = x1;
+        x1 = x2;
+        x2 = x3;
+        x3 = w;
+    }
+}
+
+static void sha512_avx2_blocks( uint64_t state[8], const unsigned char *data,
+                                size_t blocks )
+{
+    uint64_t temp1, temp2, wk[80];
+    uint64_t A, B, C, D, E, F, G, H;
+    unsigned int i;
+
+    for( ; blocks > 0; blocks--, data += 128 )
+    {
+        sha512_avx2_schedule_1( wk, data );
+
+        A = state[0];
+        B = state[1];
+        C = state[2];
+        D = state[3];
+        E = state[4];
+        F = state[5];
+        G = state[6];
+        H = state[7];
+        i = 0;
+
+        do
+        {
+            P( A, B, C, D, E, F, G, H, wk[i], 0 ); i++;
+            P( H, A, B, C, D, E, F, G, wk[i], 0 ); i++;
+            P( G, H, A, B, C, D, E, F, wk[i], 0 ); i++;
+            P( F, G, H, A, B, C, D, E, wk[i], 0 ); i++;
+            P( E, F, G, H, A, B, C, D, wk[i], 0 ); i++;
+            P( D, E, F, G, H, A, B, C, wk[i], 0 ); i++;
+            P( C, D, E, F, G, H, A, B, wk[i], 0 ); i++;
+            P( B, C, D, E, F, G, H, A, wk[i], 0 ); i++;
+        }
+        while( i < 80 );
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+        state[5] += F;
+        state[6] += G;
+        state[7] += H;
+    }
+}
+#endif /* SHA512_AVX2 */
+
+/*
+ * Process a run of blocks with the implementation selected for the CPU
+ */
+static void sha512_process_blocks( mbedtls_sha512_context *ctx,
+                                   const unsigned char *data, size_t blocks )
+{
+#if defined(SHA512_AVX2)
+    if( mbedtls_cpu_impl( MBEDTLS_CPU_SHA512 ) == MBEDTLS_CPU_IMPL_AVX2 )
+    {
+        sha512_avx2_blocks( ctx->state, data, blocks );
+        return;
+    }
+#endif
+
+    for( ; blocks > 0; blocks--, data += 128 )
+        sha512_process_c( ctx, data );
+}
+
+void mbedtls_sha512_process( mbedtls_sha512_context *ctx, const unsigned char data[128] )
+{
+    sha512_process_blocks( ctx, data, 1 );
+}
 #endif /* !MBEDTLS_SHA512_PROCESS_ALT */
 
+#if defined(MBEDTLS_SHA512_PROCESS_ALT)
+static void sha512_process_blocks( mbedtls_sha512_context *ctx,
+                                   const unsigned char *data, size_t blocks )
+{
+    for( ; blocks > 0; blocks--, data += 128 )
+        mbedtls_sha512_process( ctx, data );
+}
+#endif
+
 /*
  * SHA-512 process buffer
  */
@@ -285,17 +448,17 @@ void mbedtls_sha512_update( mbedtls_sha512_context *ctx, const unsigned char *in
     if( left && ilen >= fill )
     {
         memcpy( (void *) (ctx->buffer + left), input, fill );
-        mbedtls_sha512_process( ctx, ctx->buffer );
+        sha512_process_blocks( ctx, ctx->buffer, 1 );
         input += fill;
         ilen  -= fill;
         left = 0;
     }
 
-    while( ilen >= 128 )
+    if( ilen >= 128 )
     {
-        mbedtls_sha512_process( ctx, input );
-        input += 128;
-        ilen  -= 128;
+        sha512_process_blocks( ctx, input, ilen / 128 );
+        input += ilen & ~(size_t) 127;
+        ilen  &= 127;
     }
 
     if( ilen > 0 )
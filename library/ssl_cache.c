@@ -19,8 +19,9 @@
  *  This file is part of mbed TLS (https://tls.mbed.org)
  */
 /*
- * These session callbacks use a simple chained list
- * to store and retrieve the session information.
+ * These session callbacks store the session information in a hash table
+ * split into independently locked shards, each keeping its entries in
+ * expiry order.
  */
 
 #if !defined(MBEDTLS_CONFIG_FILE)
@@ -43,94 +44,291 @@
 #define mbedtls_free       free
 #endif
 
+/* Implementation that should never be optimized out by the compiler */
+static void mbedtls_zeroize( void *v, size_t n ) {
+    volatile unsigned char *p = v; while( n-- ) *p++ = 0;
+}
+
 void mbedtls_ssl_cache_init( mbedtls_ssl_cache_context *cache )
 {
+#if defined(MBEDTLS_THREADING_C)
+    int i;
+#endif
+
     memset( cache, 0, sizeof( mbedtls_ssl_cache_context ) );
 
     cache->timeout = MBEDTLS_SSL_CACHE_DEFAULT_TIMEOUT;
     cache->max_entries = MBEDTLS_SSL_CACHE_DEFAULT_MAX_ENTRIES;
 
 #if defined(MBEDTLS_THREADING_C)
-    mbedtls_mutex_init( &cache->mutex );
+    for( i = 0; i < MBEDTLS_SSL_CACHE_SHARDS; i++ )
+        mbedtls_mutex_init( &cache->shards[i].mutex );
+    mbedtls_mutex_init( &cache->count_mutex );
 #endif
 }
 
-int mbedtls_ssl_cache_get( void *data, mbedtls_ssl_session *session )
+/*
+ * FNV-1a of the session ID: the shard is picked from the low bits,
+ * the bucket within the shard from the others
+ */
+static uint32_t cache_hash( const unsigned char *id, size_t id_len )
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for( i = 0; i < id_len; i++ )
+    {
+        h ^= id[i];
+        h *= 16777619u;
+    }
+
+    return( h );
+}
+
+static mbedtls_ssl_cache_entry **cache_bucket( mbedtls_ssl_cache_shard *shard,
+                                               uint32_t h )
+{
+    return( &shard->buckets[( h / MBEDTLS_SSL_CACHE_SHARDS ) &
+                            ( shard->nb_buckets - 1 )] );
+}
+
+/*
+ * Count one more entry in the whole cache if max_entries allows it.
+ * Called with a shard locked.
+ */
+static int cache_reserve( mbedtls_ssl_cache_context *cache )
 {
     int ret = 1;
-#if defined(MBEDTLS_HAVE_TIME)
-    time_t t = time( NULL );
-#endif
-    mbedtls_ssl_cache_context *cache = (mbedtls_ssl_cache_context *) data;
-    mbedtls_ssl_cache_entry *cur, *entry;
 
 #if defined(MBEDTLS_THREADING_C)
-    if( mbedtls_mutex_lock( &cache->mutex ) != 0 )
+    if( mbedtls_mutex_lock( &cache->count_mutex ) != 0 )
         return( 1 );
 #endif
 
-    cur = cache->chain;
-    entry = NULL;
+    if( cache->count < cache->max_entries )
+    {
+        cache->count++;
+        ret = 0;
+    }
 
-    while( cur != NULL )
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &cache->count_mutex );
+#endif
+
+    return( ret );
+}
+
+static void cache_release( mbedtls_ssl_cache_context *cache )
+{
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &cache->count_mutex ) != 0 )
+        return;
+#endif
+
+    cache->count--;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &cache->count_mutex );
+#endif
+}
+
+static mbedtls_ssl_cache_entry *cache_find( mbedtls_ssl_cache_shard *shard,
+                                            uint32_t h,
+                                            const mbedtls_ssl_session *session )
+{
+    mbedtls_ssl_cache_entry *cur;
+
+    if( shard->nb_buckets == 0 )
+        return( NULL );
+
+    for( cur = *cache_bucket( shard, h ); cur != NULL; cur = cur->chain )
     {
-        entry = cur;
-        cur = cur->next;
+        if( cur->id_len == session->id_len &&
+            memcmp( cur->id, session->id, session->id_len ) == 0 )
+            return( cur );
+    }
+
+    return( NULL );
+}
+
+static void cache_entry_free( mbedtls_ssl_cache_entry *entry )
+{
+    if( entry->session != NULL )
+    {
+        mbedtls_zeroize( entry->session, entry->session_len );
+        mbedtls_free( entry->session );
+    }
+
+    mbedtls_zeroize( entry, sizeof( mbedtls_ssl_cache_entry ) );
+    mbedtls_free( entry );
+}
+
+/*
+ * Take an entry out of the index and of the expiry order, and free it.
+ * The entry is still counted in the whole cache.
+ */
+static void cache_unlink( mbedtls_ssl_cache_shard *shard,
+                          mbedtls_ssl_cache_entry *entry )
+{
+    mbedtls_ssl_cache_entry **link;
+
+    link = cache_bucket( shard, cache_hash( entry->id, entry->id_len ) );
+    while( *link != entry )
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    if( entry->prev != NULL )
+        entry->prev->next = entry->next;
+    else
+        shard->oldest = entry->next;
+
+    if( entry->next != NULL )
+        entry->next->prev = entry->prev;
+    else
+        shard->newest = entry->prev;
+
+    shard->count--;
+
+    cache_entry_free( entry );
+}
+
+static void cache_remove( mbedtls_ssl_cache_context *cache,
+                          mbedtls_ssl_cache_shard *shard,
+                          mbedtls_ssl_cache_entry *entry )
+{
+    cache_unlink( shard, entry );
+    cache_release( cache );
+}
 
 #if defined(MBEDTLS_HAVE_TIME)
-        if( cache->timeout != 0 &&
-            (int) ( t - entry->timestamp ) > cache->timeout )
-            continue;
+static int cache_expired( const mbedtls_ssl_cache_context *cache,
+                          const mbedtls_ssl_cache_entry *entry, time_t t )
+{
+    return( cache->timeout != 0 &&
+            (int) ( t - entry->timestamp ) > cache->timeout );
+}
 #endif
 
-        if( session->ciphersuite != entry->session.ciphersuite ||
-            session->compression != entry->session.compression ||
-            session->id_len != entry->session.id_len )
-            continue;
+/*
+ * Make room for max entries in the index, rehashing the existing ones
+ */
+static int cache_grow( mbedtls_ssl_cache_shard *shard, int max )
+{
+    mbedtls_ssl_cache_entry **buckets, *cur;
+    size_t nb_buckets = 4;
 
-        if( memcmp( session->id, entry->session.id,
-                    entry->session.id_len ) != 0 )
-            continue;
+    while( nb_buckets < (size_t) max )
+        nb_buckets *= 2;
 
-        memcpy( session->master, entry->session.master, 48 );
+    if( nb_buckets <= shard->nb_buckets )
+        return( 0 );
 
-        session->verify_result = entry->session.verify_result;
+    if( ( buckets = mbedtls_calloc( nb_buckets,
+                                    sizeof( mbedtls_ssl_cache_entry * ) ) ) == NULL )
+        return( shard->nb_buckets == 0 );
 
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-        /*
-         * Restore peer certificate (without rest of the original chain)
-         */
-        if( entry->peer_cert.p != NULL )
-        {
-            if( ( session->peer_cert = mbedtls_calloc( 1,
-                                 sizeof(mbedtls_x509_crt) ) ) == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
+    mbedtls_free( shard->buckets );
+    shard->buckets = buckets;
+    shard->nb_buckets = nb_buckets;
 
-            mbedtls_x509_crt_init( session->peer_cert );
-            if( mbedtls_x509_crt_parse( session->peer_cert, entry->peer_cert.p,
-                                entry->peer_cert.len ) != 0 )
-            {
-                mbedtls_free( session->peer_cert );
-                session->peer_cert = NULL;
-                ret = 1;
-                goto exit;
-            }
-        }
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
+    for( cur = shard->oldest; cur != NULL; cur = cur->next )
+    {
+        mbedtls_ssl_cache_entry **link = cache_bucket( shard,
+                cache_hash( cur->id, cur->id_len ) );
 
-        ret = 0;
+        cur->chain = *link;
+        *link = cur;
+    }
+
+    return( 0 );
+}
+
+int mbedtls_ssl_cache_get( void *data, mbedtls_ssl_session *session )
+{
+    int ret = 1;
+#if defined(MBEDTLS_HAVE_TIME)
+    time_t t = time( NULL );
+#endif
+    mbedtls_ssl_cache_context *cache = (mbedtls_ssl_cache_context *) data;
+    uint32_t h = cache_hash( session->id, session->id_len );
+    mbedtls_ssl_cache_shard *shard = &cache->shards[h % MBEDTLS_SSL_CACHE_SHARDS];
+    mbedtls_ssl_cache_entry *entry;
+    mbedtls_ssl_session entry_session;
+    unsigned char *buf = NULL;
+    size_t len = 0;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &shard->mutex ) != 0 )
+        return( 1 );
+#endif
+
+    if( ( entry = cache_find( shard, h, session ) ) == NULL )
+        goto exit;
+
+#if defined(MBEDTLS_HAVE_TIME)
+    if( cache_expired( cache, entry, t ) )
+    {
+        cache_remove( cache, shard, entry );
         goto exit;
     }
+#endif
+
+    /*
+     * Copy the serialized session, it is restored once the shard is
+     * unlocked
+     */
+    if( ( buf = mbedtls_calloc( 1, entry->session_len ) ) == NULL )
+        goto exit;
+
+    memcpy( buf, entry->session, entry->session_len );
+    len = entry->session_len;
+
+    ret = 0;
 
 exit:
 #if defined(MBEDTLS_THREADING_C)
-    if( mbedtls_mutex_unlock( &cache->mutex ) != 0 )
+    if( mbedtls_mutex_unlock( &shard->mutex ) != 0 )
         ret = 1;
 #endif
 
+    if( ret != 0 )
+    {
+        mbedtls_free( buf );
+        return( ret );
+    }
+
+    mbedtls_ssl_session_init( &entry_session );
+
+    if( mbedtls_ssl_session_load( &entry_session, buf, len ) != 0 ||
+        session->ciphersuite != entry_session.ciphersuite ||
+        session->compression != entry_session.compression )
+    {
+        ret = 1;
+        goto cleanup;
+    }
+
+    memcpy( session->master, entry_session.master, 48 );
+
+    session->verify_result = entry_session.verify_result;
+
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    /*
+     * Hand over the peer certificate (without rest of the original chain)
+     */
+    session->peer_cert = entry_session.peer_cert;
+    entry_session.peer_cert = NULL;
+#endif /* MBEDTLS_X509_CRT_PARSE_C */
+
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    memcpy( session->peer_cert_digest, entry_session.peer_cert_digest, 32 );
+    session->peer_cert_digest_len = entry_session.peer_cert_digest_len;
+#endif
+
+cleanup:
+    mbedtls_ssl_session_free( &entry_session );
+    mbedtls_zeroize( buf, len );
+    mbedtls_free( buf );
+
     return( ret );
 }
 
@@ -138,147 +336,129 @@ int mbedtls_ssl_cache_set( void *data, const mbedtls_ssl_session *session )
 {
     int ret = 1;
 #if defined(MBEDTLS_HAVE_TIME)
-    time_t t = time( NULL ), oldest = 0;
-    mbedtls_ssl_cache_entry *old = NULL;
+    time_t t = time( NULL );
 #endif
     mbedtls_ssl_cache_context *cache = (mbedtls_ssl_cache_context *) data;
-    mbedtls_ssl_cache_entry *cur, *prv;
-    int count = 0;
+    uint32_t h = cache_hash( session->id, session->id_len );
+    mbedtls_ssl_cache_shard *shard = &cache->shards[h % MBEDTLS_SSL_CACHE_SHARDS];
+    mbedtls_ssl_cache_entry *cur, **link;
+    unsigned char *buf;
+    size_t len;
 
-#if defined(MBEDTLS_THREADING_C)
-    if( ( ret = mbedtls_mutex_lock( &cache->mutex ) ) != 0 )
-        return( ret );
-#endif
-
-    cur = cache->chain;
-    prv = NULL;
+    /*
+     * Serialize the session before locking the shard
+     */
+    if( mbedtls_ssl_session_save( session, NULL, 0, &len ) !=
+            MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL ||
+        ( buf = mbedtls_calloc( 1, len ) ) == NULL )
+    {
+        return( 1 );
+    }
 
-    while( cur != NULL )
+    if( mbedtls_ssl_session_save( session, buf, len, &len ) != 0 )
     {
-        count++;
+        mbedtls_free( buf );
+        return( 1 );
+    }
 
-#if defined(MBEDTLS_HAVE_TIME)
-        if( cache->timeout != 0 &&
-            (int) ( t - cur->timestamp ) > cache->timeout )
-        {
-            cur->timestamp = t;
-            break; /* expired, reuse this slot, update timestamp */
-        }
+#if defined(MBEDTLS_THREADING_C)
+    if( ( ret = mbedtls_mutex_lock( &shard->mutex ) ) != 0 )
+    {
+        mbedtls_zeroize( buf, len );
+        mbedtls_free( buf );
+        return( ret );
+    }
 #endif
 
-        if( memcmp( session->id, cur->session.id, cur->session.id_len ) == 0 )
-            break; /* client reconnected, keep timestamp for session id */
-
 #if defined(MBEDTLS_HAVE_TIME)
-        if( oldest == 0 || cur->timestamp < oldest )
-        {
-            oldest = cur->timestamp;
-            old = cur;
-        }
+    /*
+     * Entries are in expiry order, drop the expired ones
+     */
+    while( shard->oldest != NULL && cache_expired( cache, shard->oldest, t ) )
+        cache_remove( cache, shard, shard->oldest );
 #endif
 
-        prv = cur;
-        cur = cur->next;
-    }
-
-    if( cur == NULL )
+    /*
+     * A client reconnecting updates its entry, which keeps its timestamp
+     */
+    if( ( cur = cache_find( shard, h, session ) ) == NULL )
     {
-#if defined(MBEDTLS_HAVE_TIME)
-        /*
-         * Reuse oldest entry if max_entries reached
-         */
-        if( count >= cache->max_entries )
+        if( cache_grow( shard, shard->count + 1 ) != 0 )
         {
-            if( old == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
-
-            cur = old;
+            ret = 1;
+            goto exit;
         }
-#else /* MBEDTLS_HAVE_TIME */
+
         /*
-         * Reuse first entry in chain if max_entries reached,
-         * but move to last place
+         * If max_entries is reached, the oldest entry of the shard makes
+         * room for the new one
          */
-        if( count >= cache->max_entries )
+        if( cache_reserve( cache ) != 0 )
         {
-            if( cache->chain == NULL )
+            if( shard->oldest == NULL )
             {
                 ret = 1;
                 goto exit;
             }
 
-            cur = cache->chain;
-            cache->chain = cur->next;
-            cur->next = NULL;
-            prv->next = cur;
+            cache_unlink( shard, shard->oldest );
         }
-#endif /* MBEDTLS_HAVE_TIME */
-        else
-        {
-            /*
-             * max_entries not reached, create new entry
-             */
-            cur = mbedtls_calloc( 1, sizeof(mbedtls_ssl_cache_entry) );
-            if( cur == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
 
-            if( prv == NULL )
-                cache->chain = cur;
-            else
-                prv->next = cur;
+        cur = mbedtls_calloc( 1, sizeof(mbedtls_ssl_cache_entry) );
+        if( cur == NULL )
+        {
+            cache_release( cache );
+            ret = 1;
+            goto exit;
         }
 
 #if defined(MBEDTLS_HAVE_TIME)
         cur->timestamp = t;
 #endif
-    }
+        memcpy( cur->id, session->id, session->id_len );
+        cur->id_len = session->id_len;
 
-    memcpy( &cur->session, session, sizeof( mbedtls_ssl_session ) );
+        link = cache_bucket( shard, h );
+        cur->chain = *link;
+        *link = cur;
 
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-    /*
-     * If we're reusing an entry, free its certificate first
-     */
-    if( cur->peer_cert.p != NULL )
-    {
-        mbedtls_free( cur->peer_cert.p );
-        memset( &cur->peer_cert, 0, sizeof(mbedtls_x509_buf) );
+        cur->prev = shard->newest;
+        if( shard->newest != NULL )
+            shard->newest->next = cur;
+        else
+            shard->oldest = cur;
+        shard->newest = cur;
+
+        shard->count++;
     }
 
     /*
-     * Store peer certificate
+     * If we're reusing an entry, free its session first
      */
-    if( session->peer_cert != NULL )
+    if( cur->session != NULL )
     {
-        cur->peer_cert.p = mbedtls_calloc( 1, session->peer_cert->raw.len );
-        if( cur->peer_cert.p == NULL )
-        {
-            ret = 1;
-            goto exit;
-        }
-
-        memcpy( cur->peer_cert.p, session->peer_cert->raw.p,
-                session->peer_cert->raw.len );
-        cur->peer_cert.len = session->peer_cert->raw.len;
-
-        cur->session.peer_cert = NULL;
+        mbedtls_zeroize( cur->session, cur->session_len );
+        mbedtls_free( cur->session );
     }
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
+
+    cur->session = buf;
+    cur->session_len = len;
+    buf = NULL;
 
     ret = 0;
 
 exit:
 #if defined(MBEDTLS_THREADING_C)
-    if( mbedtls_mutex_unlock( &cache->mutex ) != 0 )
+    if( mbedtls_mutex_unlock( &shard->mutex ) != 0 )
         ret = 1;
 #endif
 
+    if( buf != NULL )
+    {
+        mbedtls_zeroize( buf, len );
+        mbedtls_free( buf );
+    }
+
     return( ret );
 }
 
@@ -300,26 +480,32 @@ void mbedtls_ssl_cache_set_max_entries( mbedtls_ssl_cache_context *cache, int ma
 
 void mbedtls_ssl_cache_free( mbedtls_ssl_cache_context *cache )
 {
+    mbedtls_ssl_cache_shard *shard;
     mbedtls_ssl_cache_entry *cur, *prv;
+    int i;
 
-    cur = cache->chain;
-
-    while( cur != NULL )
+    for( i = 0; i < MBEDTLS_SSL_CACHE_SHARDS; i++ )
     {
-        prv = cur;
-        cur = cur->next;
+        shard = &cache->shards[i];
+        cur = shard->oldest;
 
-        mbedtls_ssl_session_free( &prv->session );
+        while( cur != NULL )
+        {
+            prv = cur;
+            cur = cur->next;
 
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-        mbedtls_free( prv->peer_cert.p );
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
+            cache_entry_free( prv );
+        }
 
-        mbedtls_free( prv );
+        mbedtls_free( shard->buckets );
+
+#if defined(MBEDTLS_THREADING_C)
+        mbedtls_mutex_free( &shard->mutex );
+#endif
     }
 
 #if defined(MBEDTLS_THREADING_C)
-    mbedtls_mutex_free( &cache->mutex );
+    mbedtls_mutex_free( &cache->count_mutex );
 #endif
 }
 
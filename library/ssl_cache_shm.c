@@ -0,0 +1,460 @@
+/*
+ *  SSL session cache in memory shared by forked processes
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+/*
+ * These session callbacks store the session information in fixed-size
+ * slots of an anonymous shared mapping, so that the worker processes
+ * forked by a server resume each other's sessions. The slots form a
+ * set-associative table: a session ID hashes to one set of
+ * MBEDTLS_SSL_CACHE_SHM_WAYS slots, and each set is protected by one of
+ * MBEDTLS_SSL_CACHE_SHM_LOCKS process-shared mutexes.
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_SSL_CACHE_SHM_C)
+
+#include "mbedtls/ssl_cache_shm.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(MBEDTLS_PLATFORM_C)
+#include "mbedtls/platform.h"
+#else
+#include <stdlib.h>
+#define mbedtls_calloc    calloc
+#define mbedtls_free       free
+#endif
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <errno.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Implementation that should never be optimized out by the compiler */
+static void mbedtls_zeroize( void *v, size_t n ) {
+    volatile unsigned char *p = v; while( n-- ) *p++ = 0;
+}
+
+/*
+ * Session as stored in a slot: serialized by mbedtls_ssl_session_save(),
+ * plus the key and the age of the entry
+ */
+typedef struct
+{
+    int64_t timestamp;          /* time of the first handshake, 0 if empty */
+    unsigned char id_len;
+    unsigned char id[32];
+    uint16_t session_len;
+    unsigned char session[MBEDTLS_SSL_CACHE_SHM_SESSION_LEN];
+}
+cache_shm_slot;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    int64_t clock;              /* entry counter without MBEDTLS_HAVE_TIME */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+}
+cache_shm_lock;
+
+struct mbedtls_ssl_cache_shm_region
+{
+    cache_shm_lock locks[MBEDTLS_SSL_CACHE_SHM_LOCKS];
+    uint32_t nb_sets;
+    int timeout;
+    cache_shm_slot slots[1];    /* nb_sets * MBEDTLS_SSL_CACHE_SHM_WAYS    */
+};
+
+void mbedtls_ssl_cache_shm_init( mbedtls_ssl_cache_shm_context *cache )
+{
+    memset( cache, 0, sizeof( mbedtls_ssl_cache_shm_context ) );
+}
+
+int mbedtls_ssl_cache_shm_setup( mbedtls_ssl_cache_shm_context *cache,
+                                 int max_entries, int timeout )
+{
+    mbedtls_ssl_cache_shm_region *region;
+    pthread_mutexattr_t attr;
+    size_t nb_sets, len;
+    int i, ret = 0;
+
+    if( cache->region != NULL || max_entries < 1 )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    nb_sets = ( (size_t) max_entries + MBEDTLS_SSL_CACHE_SHM_WAYS - 1 ) /
+              MBEDTLS_SSL_CACHE_SHM_WAYS;
+    len = offsetof( mbedtls_ssl_cache_shm_region, slots ) +
+          nb_sets * MBEDTLS_SSL_CACHE_SHM_WAYS * sizeof( cache_shm_slot );
+
+    /* Pages are zero-filled, so every slot starts empty */
+    region = mmap( NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( region == MAP_FAILED )
+        return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+
+    if( pthread_mutexattr_init( &attr ) != 0 )
+    {
+        munmap( region, len );
+        return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+    }
+
+    if( pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED ) != 0 )
+        ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+
+#if defined(__linux__)
+    /* A worker dying with a lock held must not block the others */
+    if( ret == 0 && pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST ) != 0 )
+        ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+#endif
+
+    for( i = 0; ret == 0 && i < MBEDTLS_SSL_CACHE_SHM_LOCKS; i++ )
+    {
+        if( pthread_mutex_init( &region->locks[i].mutex, &attr ) != 0 )
+            ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+    }
+
+    pthread_mutexattr_destroy( &attr );
+
+    if( ret != 0 )
+    {
+        munmap( region, len );
+        return( ret );
+    }
+
+    region->nb_sets = (uint32_t) nb_sets;
+    region->timeout = timeout < 0 ? 0 : timeout;
+
+    cache->region = region;
+    cache->region_len = len;
+
+    return( 0 );
+}
+
+/*
+ * FNV-1a of the session ID
+ */
+static uint32_t cache_shm_hash( const unsigned char *id, size_t id_len )
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for( i = 0; i < id_len; i++ )
+    {
+        h ^= id[i];
+        h *= 16777619u;
+    }
+
+    return( h );
+}
+
+/*
+ * Lock the mutex of a set. If its last owner died holding it, the slots
+ * it guards may be half written: empty them and carry on.
+ */
+static cache_shm_lock *cache_shm_lock_set( mbedtls_ssl_cache_shm_region *region,
+                                           uint32_t set )
+{
+    cache_shm_lock *lock = &region->locks[set % MBEDTLS_SSL_CACHE_SHM_LOCKS];
+    int ret = pthread_mutex_lock( &lock->mutex );
+
+#if defined(__linux__)
+    if( ret == EOWNERDEAD )
+    {
+        uint32_t s;
+
+        for( s = set % MBEDTLS_SSL_CACHE_SHM_LOCKS; s < region->nb_sets;
+             s += MBEDTLS_SSL_CACHE_SHM_LOCKS )
+        {
+            memset( &region->slots[(size_t) s * MBEDTLS_SSL_CACHE_SHM_WAYS], 0,
+                    MBEDTLS_SSL_CACHE_SHM_WAYS * sizeof( cache_shm_slot ) );
+        }
+
+        ret = pthread_mutex_consistent( &lock->mutex );
+    }
+#endif
+
+    return( ret == 0 ? lock : NULL );
+}
+
+static int64_t cache_shm_now( cache_shm_lock *lock )
+{
+#if defined(MBEDTLS_HAVE_TIME)
+    ((void) lock);
+    return( (int64_t) time( NULL ) );
+#else
+    /* Only used to order the entries of the sets sharing the lock */
+    return( ++lock->clock );
+#endif
+}
+
+static int cache_shm_expired( const mbedtls_ssl_cache_shm_region *region,
+                              const cache_shm_slot *slot, int64_t now )
+{
+#if defined(MBEDTLS_HAVE_TIME)
+    return( region->timeout != 0 &&
+            now - slot->timestamp > region->timeout );
+#else
+    ((void) region);
+    ((void) slot);
+    ((void) now);
+    return( 0 );
+#endif
+}
+
+static cache_shm_slot *cache_shm_find( cache_shm_slot *set,
+                                       const mbedtls_ssl_session *session )
+{
+    int i;
+
+    for( i = 0; i < MBEDTLS_SSL_CACHE_SHM_WAYS; i++ )
+    {
+        if( set[i].timestamp != 0 &&
+            set[i].id_len == session->id_len &&
+            memcmp( set[i].id, session->id, session->id_len ) == 0 )
+            return( &set[i] );
+    }
+
+    return( NULL );
+}
+
+int mbedtls_ssl_cache_shm_get( void *data, mbedtls_ssl_session *session )
+{
+    int ret = 1;
+    mbedtls_ssl_cache_shm_context *cache = (mbedtls_ssl_cache_shm_context *) data;
+    mbedtls_ssl_cache_shm_region *region = cache->region;
+    cache_shm_lock *lock;
+    cache_shm_slot *slot;
+    mbedtls_ssl_session slot_session;
+    unsigned char *buf = NULL;
+    size_t len = 0;
+    uint32_t set;
+
+    if( region == NULL || session->id_len > 32 )
+        return( 1 );
+
+    set = cache_shm_hash( session->id, session->id_len ) % region->nb_sets;
+
+    if( ( lock = cache_shm_lock_set( region, set ) ) == NULL )
+        return( 1 );
+
+    slot = cache_shm_find( &region->slots[(size_t) set * MBEDTLS_SSL_CACHE_SHM_WAYS],
+                           session );
+
+    if( slot == NULL ||
+        cache_shm_expired( region, slot, cache_shm_now( lock ) ) )
+    {
+        lock->misses++;
+        goto exit;
+    }
+
+    /*
+     * Copy the serialized session, it is restored once the set is unlocked
+     */
+    if( ( buf = mbedtls_calloc( 1, slot->session_len ) ) == NULL )
+        goto exit;
+
+    memcpy( buf, slot->session, slot->session_len );
+    len = slot->session_len;
+
+    lock->hits++;
+    ret = 0;
+
+exit:
+    if( pthread_mutex_unlock( &lock->mutex ) != 0 )
+        ret = 1;
+
+    if( ret != 0 )
+    {
+        mbedtls_free( buf );
+        return( ret );
+    }
+
+    mbedtls_ssl_session_init( &slot_session );
+
+    if( mbedtls_ssl_session_load( &slot_session, buf, len ) != 0 ||
+        session->ciphersuite != slot_session.ciphersuite ||
+        session->compression != slot_session.compression )
+    {
+        ret = 1;
+        goto cleanup;
+    }
+
+    memcpy( session->master, slot_session.master, 48 );
+
+    session->verify_result = slot_session.verify_result;
+
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    /*
+     * Hand over the peer certificate (without rest of the original chain)
+     */
+    session->peer_cert = slot_session.peer_cert;
+    slot_session.peer_cert = NULL;
+#endif /* MBEDTLS_X509_CRT_PARSE_C */
+
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    memcpy( session->peer_cert_digest, slot_session.peer_cert_digest, 32 );
+    session->peer_cert_digest_len = slot_session.peer_cert_digest_len;
+#endif
+
+cleanup:
+    mbedtls_ssl_session_free( &slot_session );
+    mbedtls_zeroize( buf, len );
+    mbedtls_free( buf );
+
+    return( ret );
+}
+
+int mbedtls_ssl_cache_shm_set( void *data, const mbedtls_ssl_session *session )
+{
+    int ret = 1, i;
+    mbedtls_ssl_cache_shm_context *cache = (mbedtls_ssl_cache_shm_context *) data;
+    mbedtls_ssl_cache_shm_region *region = cache->region;
+    cache_shm_lock *lock;
+    cache_shm_slot *set, *slot;
+    uint32_t s;
+    int64_t now;
+    size_t len;
+
+    if( region == NULL || session->id_len > 32 )
+        return( 1 );
+
+    /*
+     * Sessions that don't fit in a slot are not cached
+     */
+    if( mbedtls_ssl_session_save( session, NULL, 0, &len ) !=
+            MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL ||
+        len > MBEDTLS_SSL_CACHE_SHM_SESSION_LEN )
+        return( 1 );
+
+    s = cache_shm_hash( session->id, session->id_len ) % region->nb_sets;
+    set = &region->slots[(size_t) s * MBEDTLS_SSL_CACHE_SHM_WAYS];
+
+    if( ( lock = cache_shm_lock_set( region, s ) ) == NULL )
+        return( 1 );
+
+    now = cache_shm_now( lock );
+
+    /*
+     * A client reconnecting updates its slot, which keeps its timestamp
+     * unless it expired. Otherwise take an empty or expired slot, or the
+     * oldest one.
+     */
+    if( ( slot = cache_shm_find( set, session ) ) != NULL &&
+        cache_shm_expired( region, slot, now ) )
+    {
+        slot->timestamp = now != 0 ? now : 1;
+    }
+    else if( slot == NULL )
+    {
+        slot = &set[0];
+
+        for( i = 0; i < MBEDTLS_SSL_CACHE_SHM_WAYS; i++ )
+        {
+            if( set[i].timestamp == 0 || cache_shm_expired( region, &set[i], now ) )
+            {
+                slot = &set[i];
+                break;
+            }
+
+            if( set[i].timestamp < slot->timestamp )
+                slot = &set[i];
+        }
+
+        if( i == MBEDTLS_SSL_CACHE_SHM_WAYS )
+            lock->evictions++;
+
+        mbedtls_zeroize( slot, sizeof( cache_shm_slot ) );
+        /* 0 marks an empty slot */
+        slot->timestamp = now != 0 ? now : 1;
+        slot->id_len = (unsigned char) session->id_len;
+        memcpy( slot->id, session->id, session->id_len );
+    }
+
+    if( mbedtls_ssl_session_save( session, slot->session,
+                                  sizeof( slot->session ), &len ) == 0 )
+    {
+        slot->session_len = (uint16_t) len;
+        ret = 0;
+    }
+    else
+    {
+        /* Can't happen after the size check above, but don't keep a
+         * half-written slot */
+        mbedtls_zeroize( slot, sizeof( cache_shm_slot ) );
+    }
+
+    if( pthread_mutex_unlock( &lock->mutex ) != 0 )
+        ret = 1;
+
+    return( ret );
+}
+
+void mbedtls_ssl_cache_shm_stats( const mbedtls_ssl_cache_shm_context *cache,
+                                  unsigned long *hits, unsigned long *misses,
+                                  unsigned long *evictions )
+{
+    mbedtls_ssl_cache_shm_region *region = cache->region;
+    cache_shm_lock *lock;
+    uint32_t i;
+
+    *hits = 0;
+    *misses = 0;
+    *evictions = 0;
+
+    if( region == NULL )
+        return;
+
+    for( i = 0; i < MBEDTLS_SSL_CACHE_SHM_LOCKS; i++ )
+    {
+        if( ( lock = cache_shm_lock_set( region, i ) ) == NULL )
+            continue;
+
+        *hits += lock->hits;
+        *misses += lock->misses;
+        *evictions += lock->evictions;
+
+        pthread_mutex_unlock( &lock->mutex );
+    }
+}
+
+void mbedtls_ssl_cache_shm_free( mbedtls_ssl_cache_shm_context *cache )
+{
+    if( cache == NULL )
+        return;
+
+    if( cache->region != NULL )
+        munmap( cache->region, cache->region_len );
+
+    cache->region = NULL;
+    cache->region_len = 0;
+}
+
+#endif /* MBEDTLS_SSL_CACHE_SHM_C */
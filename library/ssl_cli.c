@@ -2924,23 +2924,32 @@ static int ssl_write_client_key_exchange( mbedtls_ssl_context *ssl )
          */
         i = 4;
 
-        ret = mbedtls_ecdh_make_public( &ssl->handshake->ecdh_ctx,
-                                &n,
-                                &ssl->out_msg[i], 1000,
-                                ssl->conf->f_rng, ssl->conf->p_rng );
+        if( ( ret = mbedtls_ssl_ecdh_gen_public( ssl ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_ecdh_gen_public", ret );
+            return( ret );
+        }
+
+        ret = mbedtls_ecp_tls_write_point( &ssl->handshake->ecdh_ctx.grp,
+                                &ssl->handshake->ecdh_ctx.Q,
+                                ssl->handshake->ecdh_ctx.point_format,
+                                &n, &ssl->out_msg[i], 1000 );
         if( ret != 0 )
         {
-            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecdh_make_public", ret );
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecp_tls_write_point", ret );
             return( ret );
         }
 
         MBEDTLS_SSL_DEBUG_ECP( 3, "ECDH: Q", &ssl->handshake->ecdh_ctx.Q );
 
-        if( ( ret = mbedtls_ecdh_calc_secret( &ssl->handshake->ecdh_ctx,
+        MBEDTLS_SSL_TIMING_BEGIN( ssl );
+        ret = mbedtls_ecdh_calc_secret( &ssl->handshake->ecdh_ctx,
                                       &ssl->handshake->pmslen,
                                        ssl->handshake->premaster,
                                        MBEDTLS_MPI_MAX_SIZE,
-                                       ssl->conf->f_rng, ssl->conf->p_rng ) ) != 0 )
+                                       ssl->conf->f_rng, ssl->conf->p_rng );
+        MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_ECP_MUL );
+        if( ret != 0 )
         {
             MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecdh_calc_secret", ret );
             return( ret );
@@ -3035,12 +3044,19 @@ static int ssl_write_client_key_exchange( mbedtls_ssl_context *ssl )
             /*
              * ClientECDiffieHellmanPublic public;
              */
-            ret = mbedtls_ecdh_make_public( &ssl->handshake->ecdh_ctx, &n,
-                    &ssl->out_msg[i], MBEDTLS_SSL_MAX_CONTENT_LEN - i,
-                    ssl->conf->f_rng, ssl->conf->p_rng );
+            if( ( ret = mbedtls_ssl_ecdh_gen_public( ssl ) ) != 0 )
+            {
+                MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_ecdh_gen_public", ret );
+                return( ret );
+            }
+
+            ret = mbedtls_ecp_tls_write_point( &ssl->handshake->ecdh_ctx.grp,
+                    &ssl->handshake->ecdh_ctx.Q,
+                    ssl->handshake->ecdh_ctx.point_format,
+                    &n, &ssl->out_msg[i], MBEDTLS_SSL_MAX_CONTENT_LEN - i );
             if( ret != 0 )
             {
-                MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecdh_make_public", ret );
+                MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecp_tls_write_point", ret );
                 return( ret );
             }
 
@@ -3109,8 +3125,11 @@ static int ssl_write_client_key_exchange( mbedtls_ssl_context *ssl )
             MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_milagro_cs_write_public_parameter", ret );
             return( ret );
         }
-        if( ( ret = mbedtls_ssl_milagro_cs_derive_premaster(MBEDTLS_SSL_IS_CLIENT, ssl,
-                                                      MBEDTLS_KEY_EXCHANGE_MILAGRO_CS ) ) != 0 )
+        MBEDTLS_SSL_TIMING_BEGIN( ssl );
+        ret = mbedtls_ssl_milagro_cs_derive_premaster(MBEDTLS_SSL_IS_CLIENT, ssl,
+                                                      MBEDTLS_KEY_EXCHANGE_MILAGRO_CS );
+        MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_PAIRING );
+        if( ret != 0 )
         {
             MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_milagro_cs_derive_premaster", ret );
             return( ret );
@@ -3124,8 +3143,11 @@ static int ssl_write_client_key_exchange( mbedtls_ssl_context *ssl )
         {
             i = 4;
             
-            if( ( ret = mbedtls_ssl_milagro_p2p_derive_premaster(MBEDTLS_SSL_IS_CLIENT, ssl,
-                                                          MBEDTLS_KEY_EXCHANGE_MILAGRO_P2P ) ) != 0 )
+            MBEDTLS_SSL_TIMING_BEGIN( ssl );
+            ret = mbedtls_ssl_milagro_p2p_derive_premaster(MBEDTLS_SSL_IS_CLIENT, ssl,
+                                                          MBEDTLS_KEY_EXCHANGE_MILAGRO_P2P );
+            MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_PAIRING );
+            if( ret != 0 )
             {
                 MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_milagro_p2p_derive_premaster", ret );
                 return( ret );
@@ -3322,9 +3344,13 @@ static int ssl_write_certificate_verify( mbedtls_ssl_context *ssl )
         return( MBEDTLS_ERR_SSL_INTERNAL_ERROR );
     }
 
-    if( ( ret = mbedtls_pk_sign( mbedtls_ssl_own_key( ssl ), md_alg, hash_start, hashlen,
+    MBEDTLS_SSL_TIMING_BEGIN( ssl );
+    ret = mbedtls_pk_sign( mbedtls_ssl_own_key( ssl ), md_alg, hash_start, hashlen,
                          ssl->out_msg + 6 + offset, &n,
-                         ssl->conf->f_rng, ssl->conf->p_rng ) ) != 0 )
+                         ssl->conf->f_rng, ssl->conf->p_rng );
+    MBEDTLS_SSL_TIMING_END( ssl, mbedtls_pk_can_do( mbedtls_ssl_own_key( ssl ), MBEDTLS_PK_RSA ) ?
+                            MBEDTLS_SSL_TIMING_RSA_PRIVATE : MBEDTLS_SSL_TIMING_ECP_MUL );
+    if( ret != 0 )
     {
         MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_pk_sign", ret );
         return( ret );
@@ -0,0 +1,443 @@
+/*
+ *  Pool of precomputed ephemeral ECDH key pairs
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+/*
+ * Every ECDHE handshake needs a fresh key pair, that is a fixed-base point
+ * multiplication. The pool generates them ahead of time, from
+ * mbedtls_ssl_keyshare_refill() or from background threads, so that the
+ * handshake only has to take one.
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+
+#include "mbedtls/ssl_keyshare.h"
+#include "mbedtls/ecdh.h"
+
+#if defined(MBEDTLS_PLATFORM_C)
+#include "mbedtls/platform.h"
+#else
+#include <stdlib.h>
+#define mbedtls_calloc    calloc
+#define mbedtls_free       free
+#endif
+
+#include <string.h>
+
+/* Implementation that should never be optimized out by the compiler */
+static void mbedtls_zeroize( void *v, size_t n ) {
+    volatile unsigned char *p = v; while( n-- ) *p++ = 0;
+}
+
+void mbedtls_ssl_keyshare_init( mbedtls_ssl_keyshare_pool *pool )
+{
+    memset( pool, 0, sizeof( mbedtls_ssl_keyshare_pool ) );
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_init( &pool->mutex );
+#endif
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_mutex_init( &pool->wake_mutex, NULL );
+    pthread_cond_init( &pool->wake, NULL );
+#endif
+}
+
+int mbedtls_ssl_keyshare_setup( mbedtls_ssl_keyshare_pool *pool,
+                                const mbedtls_ecp_group_id *curves,
+                                int max_pairs,
+                                int (*f_rng)(void *, unsigned char *, size_t),
+                                void *p_rng )
+{
+    mbedtls_ssl_keyshare_curve *curve;
+    int i;
+
+    if( curves == NULL || curves[0] == MBEDTLS_ECP_DP_NONE || max_pairs < 1 ||
+        f_rng == NULL || pool->nb_curves != 0 )
+    {
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    }
+
+    for( ; *curves != MBEDTLS_ECP_DP_NONE; curves++ )
+    {
+        if( pool->nb_curves == MBEDTLS_SSL_KEYSHARE_MAX_CURVES ||
+            mbedtls_ecp_curve_info_from_grp_id( *curves ) == NULL )
+        {
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+        }
+
+        curve = &pool->curves[pool->nb_curves++];
+        curve->grp_id = *curves;
+
+        curve->d = mbedtls_calloc( max_pairs, sizeof( mbedtls_mpi ) );
+        curve->Q = mbedtls_calloc( max_pairs, sizeof( mbedtls_ecp_point ) );
+        if( curve->d == NULL || curve->Q == NULL )
+            return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+
+        for( i = 0; i < max_pairs; i++ )
+        {
+            mbedtls_mpi_init( &curve->d[i] );
+            mbedtls_ecp_point_init( &curve->Q[i] );
+        }
+    }
+
+    pool->max_pairs = max_pairs;
+    pool->low_water = ( max_pairs + 1 ) / 2;
+    pool->f_rng = f_rng;
+    pool->p_rng = p_rng;
+
+    return( 0 );
+}
+
+void mbedtls_ssl_keyshare_set_low_water( mbedtls_ssl_keyshare_pool *pool,
+                                         int low_water )
+{
+    if( low_water < 1 )
+        low_water = 1;
+    if( low_water > pool->max_pairs )
+        low_water = pool->max_pairs;
+
+    pool->low_water = low_water;
+}
+
+static mbedtls_ssl_keyshare_curve *ssl_keyshare_find( mbedtls_ssl_keyshare_pool *pool,
+                                                      mbedtls_ecp_group_id grp_id )
+{
+    int i;
+
+    for( i = 0; i < pool->nb_curves; i++ )
+        if( pool->curves[i].grp_id == grp_id )
+            return( &pool->curves[i] );
+
+    return( NULL );
+}
+
+static void ssl_keyshare_swap_point( mbedtls_ecp_point *P, mbedtls_ecp_point *Q )
+{
+    mbedtls_mpi_swap( &P->X, &Q->X );
+    mbedtls_mpi_swap( &P->Y, &Q->Y );
+    mbedtls_mpi_swap( &P->Z, &Q->Z );
+}
+
+/*
+ * Tell the refill threads, if any, that a curve went under the low-water mark
+ */
+static void ssl_keyshare_wakeup( mbedtls_ssl_keyshare_pool *pool )
+{
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_mutex_lock( &pool->wake_mutex );
+    if( pool->nb_threads > 0 )
+    {
+        pool->wakeup++;
+        pthread_cond_broadcast( &pool->wake );
+    }
+    pthread_mutex_unlock( &pool->wake_mutex );
+#else
+    ((void) pool);
+#endif
+}
+
+int mbedtls_ssl_keyshare_get( void *p_keyshare, mbedtls_ecp_group_id grp_id,
+                              mbedtls_mpi *d, mbedtls_ecp_point *Q )
+{
+    mbedtls_ssl_keyshare_pool *pool = (mbedtls_ssl_keyshare_pool *) p_keyshare;
+    mbedtls_ssl_keyshare_curve *curve;
+    int ret = 1, refill = 0;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+        return( 1 );
+#endif
+
+    if( ( curve = ssl_keyshare_find( pool, grp_id ) ) != NULL )
+    {
+        if( curve->nb_pairs > 0 )
+        {
+            curve->nb_pairs--;
+            mbedtls_mpi_swap( d, &curve->d[curve->nb_pairs] );
+            ssl_keyshare_swap_point( Q, &curve->Q[curve->nb_pairs] );
+
+            /* Do not keep what the caller had in d and Q */
+            mbedtls_mpi_free( &curve->d[curve->nb_pairs] );
+            mbedtls_ecp_point_free( &curve->Q[curve->nb_pairs] );
+
+            curve->hits++;
+            ret = 0;
+        }
+        else
+            curve->misses++;
+
+        refill = curve->nb_pairs < pool->low_water;
+    }
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &pool->mutex );
+#endif
+
+    if( refill )
+        ssl_keyshare_wakeup( pool );
+
+    return( ret );
+}
+
+/*
+ * Fill the pool, using grp[i] for pool->curves[i]. The groups belong to the
+ * caller: the point multiplication caches its precomputations in the group,
+ * so a group can't be shared between threads.
+ */
+static int ssl_keyshare_fill( mbedtls_ssl_keyshare_pool *pool, mbedtls_ecp_group *grp )
+{
+    mbedtls_ssl_keyshare_curve *curve;
+    mbedtls_mpi d;
+    mbedtls_ecp_point Q;
+    int i, next, ret = 0;
+
+    mbedtls_mpi_init( &d );
+    mbedtls_ecp_point_init( &Q );
+
+    for( ;; )
+    {
+#if defined(MBEDTLS_THREADING_C)
+        if( ( ret = mbedtls_mutex_lock( &pool->mutex ) ) != 0 )
+            break;
+#endif
+
+        /* Emptiest curve first */
+        next = -1;
+        for( i = 0; i < pool->nb_curves; i++ )
+        {
+            if( pool->curves[i].nb_pairs < pool->max_pairs &&
+                ( next < 0 || pool->curves[i].nb_pairs < pool->curves[next].nb_pairs ) )
+                next = i;
+        }
+
+#if defined(MBEDTLS_THREADING_C)
+        if( ( ret = mbedtls_mutex_unlock( &pool->mutex ) ) != 0 )
+            break;
+#endif
+
+        if( next < 0 )
+            break;
+
+        if( ( ret = mbedtls_ecdh_gen_public( &grp[next], &d, &Q,
+                                             pool->f_rng, pool->p_rng ) ) != 0 )
+            break;
+
+#if defined(MBEDTLS_THREADING_C)
+        if( ( ret = mbedtls_mutex_lock( &pool->mutex ) ) != 0 )
+            break;
+#endif
+
+        /* Another thread may have filled the curve in the meantime */
+        curve = &pool->curves[next];
+        if( curve->nb_pairs < pool->max_pairs )
+        {
+            mbedtls_mpi_swap( &d, &curve->d[curve->nb_pairs] );
+            ssl_keyshare_swap_point( &Q, &curve->Q[curve->nb_pairs] );
+            curve->nb_pairs++;
+            curve->generated++;
+        }
+
+#if defined(MBEDTLS_THREADING_C)
+        if( ( ret = mbedtls_mutex_unlock( &pool->mutex ) ) != 0 )
+            break;
+#endif
+    }
+
+    mbedtls_mpi_free( &d );
+    mbedtls_ecp_point_free( &Q );
+
+    return( ret );
+}
+
+static int ssl_keyshare_load_groups( mbedtls_ssl_keyshare_pool *pool, mbedtls_ecp_group *grp )
+{
+    int i, ret;
+
+    for( i = 0; i < pool->nb_curves; i++ )
+        mbedtls_ecp_group_init( &grp[i] );
+
+    for( i = 0; i < pool->nb_curves; i++ )
+        if( ( ret = mbedtls_ecp_group_load( &grp[i], pool->curves[i].grp_id ) ) != 0 )
+            return( ret );
+
+    return( 0 );
+}
+
+static void ssl_keyshare_free_groups( mbedtls_ssl_keyshare_pool *pool, mbedtls_ecp_group *grp )
+{
+    int i;
+
+    for( i = 0; i < pool->nb_curves; i++ )
+        mbedtls_ecp_group_free( &grp[i] );
+}
+
+int mbedtls_ssl_keyshare_refill( mbedtls_ssl_keyshare_pool *pool )
+{
+    mbedtls_ecp_group grp[MBEDTLS_SSL_KEYSHARE_MAX_CURVES];
+    int ret;
+
+    if( ( ret = ssl_keyshare_load_groups( pool, grp ) ) == 0 )
+        ret = ssl_keyshare_fill( pool, grp );
+
+    ssl_keyshare_free_groups( pool, grp );
+
+    return( ret );
+}
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+static void *ssl_keyshare_main( void *arg )
+{
+    mbedtls_ssl_keyshare_pool *pool = (mbedtls_ssl_keyshare_pool *) arg;
+    mbedtls_ecp_group grp[MBEDTLS_SSL_KEYSHARE_MAX_CURVES];
+    unsigned long seen;
+
+    /* Each thread keeps its groups, with their precomputations, for its lifetime */
+    if( ssl_keyshare_load_groups( pool, grp ) == 0 )
+    {
+        pthread_mutex_lock( &pool->wake_mutex );
+        while( !pool->shutdown )
+        {
+            seen = pool->wakeup;
+            pthread_mutex_unlock( &pool->wake_mutex );
+
+            (void) ssl_keyshare_fill( pool, grp );
+
+            pthread_mutex_lock( &pool->wake_mutex );
+            while( seen == pool->wakeup && !pool->shutdown )
+                pthread_cond_wait( &pool->wake, &pool->wake_mutex );
+        }
+        pthread_mutex_unlock( &pool->wake_mutex );
+    }
+
+    ssl_keyshare_free_groups( pool, grp );
+
+    return( NULL );
+}
+
+int mbedtls_ssl_keyshare_start( mbedtls_ssl_keyshare_pool *pool, int nb_threads )
+{
+    int ret = 0;
+
+    if( pool->nb_curves == 0 || nb_threads < 1 ||
+        nb_threads > MBEDTLS_SSL_KEYSHARE_MAX_THREADS )
+    {
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    }
+
+    pthread_mutex_lock( &pool->wake_mutex );
+
+    if( pool->nb_threads != 0 )
+        ret = MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+
+    while( ret == 0 && pool->nb_threads < nb_threads )
+    {
+        if( pthread_create( &pool->threads[pool->nb_threads], NULL,
+                            ssl_keyshare_main, pool ) != 0 )
+            ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+        else
+            pool->nb_threads++;
+    }
+
+    pthread_mutex_unlock( &pool->wake_mutex );
+
+    return( ret );
+}
+#endif /* MBEDTLS_THREADING_PTHREAD */
+
+int mbedtls_ssl_keyshare_stats( mbedtls_ssl_keyshare_pool *pool,
+                                mbedtls_ecp_group_id grp_id,
+                                int *available,
+                                unsigned long *hits,
+                                unsigned long *misses,
+                                unsigned long *generated )
+{
+    mbedtls_ssl_keyshare_curve *curve;
+    int ret = 0;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( ( ret = mbedtls_mutex_lock( &pool->mutex ) ) != 0 )
+        return( ret );
+#endif
+
+    if( ( curve = ssl_keyshare_find( pool, grp_id ) ) != NULL )
+    {
+        *available = curve->nb_pairs;
+        *hits = curve->hits;
+        *misses = curve->misses;
+        *generated = curve->generated;
+    }
+    else
+        ret = MBEDTLS_ERR_ECP_FEATURE_UNAVAILABLE;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_unlock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    return( ret );
+}
+
+void mbedtls_ssl_keyshare_free( mbedtls_ssl_keyshare_pool *pool )
+{
+    mbedtls_ssl_keyshare_curve *curve;
+    int i, j;
+
+    if( pool == NULL )
+        return;
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+    pthread_mutex_lock( &pool->wake_mutex );
+    pool->shutdown = 1;
+    pthread_cond_broadcast( &pool->wake );
+    pthread_mutex_unlock( &pool->wake_mutex );
+
+    for( i = 0; i < pool->nb_threads; i++ )
+        pthread_join( pool->threads[i], NULL );
+
+    pthread_cond_destroy( &pool->wake );
+    pthread_mutex_destroy( &pool->wake_mutex );
+#endif
+
+    for( i = 0; i < pool->nb_curves; i++ )
+    {
+        curve = &pool->curves[i];
+
+        for( j = 0; curve->d != NULL && j < pool->max_pairs; j++ )
+            mbedtls_mpi_free( &curve->d[j] );
+        for( j = 0; curve->Q != NULL && j < pool->max_pairs; j++ )
+            mbedtls_ecp_point_free( &curve->Q[j] );
+
+        mbedtls_free( curve->d );
+        mbedtls_free( curve->Q );
+    }
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_free( &pool->mutex );
+#endif
+
+    mbedtls_zeroize( pool, sizeof( mbedtls_ssl_keyshare_pool ) );
+}
+
+#endif /* MBEDTLS_SSL_KEYSHARE_C */
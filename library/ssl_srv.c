@@ -170,7 +170,24 @@ static int ssl_parse_milagro_cs_ext( mbedtls_ssl_context *ssl,
         return( ret );
     }
 
-    if ( ( ret = mbedtls_milagro_cs_authenticate_client(ssl->handshake->milagro_cs) ) != 0 ) {
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    if( ssl->handshake->milagro_cs->worker_pool != NULL )
+    {
+        /* The result is collected before writing the ServerHello */
+        if( ( ret = mbedtls_milagro_cs_authenticate_client_async( ssl->handshake->milagro_cs ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_milagro_cs_authenticate_client_async", ret );
+            return( ret );
+        }
+        ssl->handshake->cli_exts |= MBEDTLS_TLS_EXT_MILAGRO_CS_PENDING;
+        return( 0 );
+    }
+#endif
+
+    MBEDTLS_SSL_TIMING_BEGIN( ssl );
+    ret = mbedtls_milagro_cs_authenticate_client(ssl->handshake->milagro_cs);
+    MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_PAIRING );
+    if ( ret != 0 ) {
         return( ret );
     }
 
@@ -181,6 +198,39 @@ static int ssl_parse_milagro_cs_ext( mbedtls_ssl_context *ssl,
     
     return( 0 );
 }
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+/*
+ * Wait for the worker pool to authenticate the client, without blocking
+ */
+static int ssl_milagro_cs_async_result( mbedtls_ssl_context *ssl )
+{
+    int ret;
+
+    if( ( ssl->handshake->cli_exts & MBEDTLS_TLS_EXT_MILAGRO_CS_PENDING ) == 0 )
+        return( 0 );
+
+    ret = mbedtls_milagro_cs_authenticate_client_poll( ssl->handshake->milagro_cs );
+    if( ret == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 3, ( "milagro_cs authentication in progress" ) );
+        return( ret );
+    }
+
+    ssl->handshake->cli_exts &= ~MBEDTLS_TLS_EXT_MILAGRO_CS_PENDING;
+
+    if( ret != 0 )
+    {
+        MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_milagro_cs_authenticate_client", ret );
+        return( ret );
+    }
+
+    /* Only mark the extension as OK when we're sure it is */
+    ssl->handshake->cli_exts |= MBEDTLS_TLS_EXT_MILAGRO_CS_OK;
+
+    return( 0 );
+}
+#endif /* MBEDTLS_TLS_MILAGRO_CS_ASYNC */
 #endif
 
 static int ssl_parse_renegotiation_info( mbedtls_ssl_context *ssl,
@@ -2228,7 +2278,7 @@ static int ssl_write_hello_verify_request( mbedtls_ssl_context *ssl )
     cookie_len_byte = p++;
 
     if( ( ret = ssl->conf->f_cookie_write( ssl->conf->p_cookie,
-                                     &p, ssl->out_buf + MBEDTLS_SSL_BUFFER_LEN,
+                                     &p, ssl->out_buf + MBEDTLS_SSL_OUT_BUFFER_LEN( ssl ),
                                      ssl->cli_id, ssl->cli_id_len ) ) != 0 )
     {
         MBEDTLS_SSL_DEBUG_RET( 1, "f_cookie_write", ret );
@@ -2888,6 +2938,7 @@ static int ssl_write_server_key_exchange( mbedtls_ssl_context *ssl )
          */
         const mbedtls_ecp_curve_info **curve = NULL;
         const mbedtls_ecp_group_id *gid;
+        size_t pt_len;
 
         /* Match our preference list against the offered curves */
         for( gid = ssl->conf->curve_list; *gid != MBEDTLS_ECP_DP_NONE; gid++ )
@@ -2911,14 +2962,30 @@ curve_matching_done:
             return( ret );
         }
 
-        if( ( ret = mbedtls_ecdh_make_params( &ssl->handshake->ecdh_ctx, &len,
-                                      p, MBEDTLS_SSL_MAX_CONTENT_LEN - n,
-                                      ssl->conf->f_rng, ssl->conf->p_rng ) ) != 0 )
+        if( ( ret = mbedtls_ssl_ecdh_gen_public( ssl ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_ecdh_gen_public", ret );
+            return( ret );
+        }
+
+        if( ( ret = mbedtls_ecp_tls_write_group( &ssl->handshake->ecdh_ctx.grp, &len,
+                                      p, MBEDTLS_SSL_MAX_CONTENT_LEN - n ) ) != 0 )
         {
-            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecdh_make_params", ret );
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecp_tls_write_group", ret );
             return( ret );
         }
 
+        if( ( ret = mbedtls_ecp_tls_write_point( &ssl->handshake->ecdh_ctx.grp,
+                                      &ssl->handshake->ecdh_ctx.Q,
+                                      ssl->handshake->ecdh_ctx.point_format, &pt_len,
+                                      p + len, MBEDTLS_SSL_MAX_CONTENT_LEN - n - len ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecp_tls_write_point", ret );
+            return( ret );
+        }
+
+        len += pt_len;
+
         dig_signed = p;
         dig_signed_len = len;
 
@@ -3075,9 +3142,13 @@ curve_matching_done:
         }
 #endif /* MBEDTLS_SSL_PROTO_TLS1_2 */
 
-        if( ( ret = mbedtls_pk_sign( mbedtls_ssl_own_key( ssl ), md_alg, hash, hashlen,
+        MBEDTLS_SSL_TIMING_BEGIN( ssl );
+        ret = mbedtls_pk_sign( mbedtls_ssl_own_key( ssl ), md_alg, hash, hashlen,
                         p + 2 , &signature_len,
-                        ssl->conf->f_rng, ssl->conf->p_rng ) ) != 0 )
+                        ssl->conf->f_rng, ssl->conf->p_rng );
+        MBEDTLS_SSL_TIMING_END( ssl, mbedtls_pk_can_do( mbedtls_ssl_own_key( ssl ), MBEDTLS_PK_RSA ) ?
+                                MBEDTLS_SSL_TIMING_RSA_PRIVATE : MBEDTLS_SSL_TIMING_ECP_MUL );
+        if( ret != 0 )
         {
             MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_pk_sign", ret );
             return( ret );
@@ -3240,10 +3311,12 @@ static int ssl_parse_encrypted_pms( mbedtls_ssl_context *ssl,
     if( ret != 0 )
         return( ret );
 
+    MBEDTLS_SSL_TIMING_BEGIN( ssl );
     ret = mbedtls_pk_decrypt( mbedtls_ssl_own_key( ssl ), p, len,
                       peer_pms, &peer_pmslen,
                       sizeof( peer_pms ),
                       ssl->conf->f_rng, ssl->conf->p_rng );
+    MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_RSA_PRIVATE );
 
     diff  = (unsigned int) ret;
     diff |= peer_pmslen ^ 48;
@@ -3429,11 +3502,14 @@ static int ssl_parse_client_key_exchange( mbedtls_ssl_context *ssl )
 
         MBEDTLS_SSL_DEBUG_ECP( 3, "ECDH: Qp ", &ssl->handshake->ecdh_ctx.Qp );
 
-        if( ( ret = mbedtls_ecdh_calc_secret( &ssl->handshake->ecdh_ctx,
+        MBEDTLS_SSL_TIMING_BEGIN( ssl );
+        ret = mbedtls_ecdh_calc_secret( &ssl->handshake->ecdh_ctx,
                                       &ssl->handshake->pmslen,
                                        ssl->handshake->premaster,
                                        MBEDTLS_MPI_MAX_SIZE,
-                                       ssl->conf->f_rng, ssl->conf->p_rng ) ) != 0 )
+                                       ssl->conf->f_rng, ssl->conf->p_rng );
+        MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_ECP_MUL );
+        if( ret != 0 )
         {
             MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecdh_calc_secret", ret );
             return( MBEDTLS_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE_CS );
@@ -3593,8 +3669,11 @@ static int ssl_parse_client_key_exchange( mbedtls_ssl_context *ssl )
                 MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_milagro_cs_read_public_parameter", ret );
                 return( MBEDTLS_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE );
             }
-            if( ( ret = mbedtls_ssl_milagro_cs_derive_premaster(MBEDTLS_SSL_IS_SERVER, ssl,
-                                                          MBEDTLS_KEY_EXCHANGE_MILAGRO_CS ) ) != 0 )
+            MBEDTLS_SSL_TIMING_BEGIN( ssl );
+            ret = mbedtls_ssl_milagro_cs_derive_premaster(MBEDTLS_SSL_IS_SERVER, ssl,
+                                                          MBEDTLS_KEY_EXCHANGE_MILAGRO_CS );
+            MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_PAIRING );
+            if( ret != 0 )
             {
                 MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_milagro_cs_derive_premaster", ret );
                 return( ret );
@@ -3612,8 +3691,11 @@ static int ssl_parse_client_key_exchange( mbedtls_ssl_context *ssl )
                     MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_milagro_p2p_read_public_parameter", ret );
                     return( MBEDTLS_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE );
                 }
-                if( ( ret = mbedtls_ssl_milagro_p2p_derive_premaster(MBEDTLS_SSL_IS_SERVER, ssl,
-                                                              MBEDTLS_KEY_EXCHANGE_MILAGRO_P2P ) ) != 0 )
+                MBEDTLS_SSL_TIMING_BEGIN( ssl );
+                ret = mbedtls_ssl_milagro_p2p_derive_premaster(MBEDTLS_SSL_IS_SERVER, ssl,
+                                                              MBEDTLS_KEY_EXCHANGE_MILAGRO_P2P );
+                MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_PAIRING );
+                if( ret != 0 )
                 {
                     MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_milagro_p2p_derive_premaster", ret );
                     return( ret );
@@ -3937,6 +4019,10 @@ int mbedtls_ssl_handshake_server_step( mbedtls_ssl_context *ssl )
          *        ServerHelloDone
          */
         case MBEDTLS_SSL_SERVER_HELLO:
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+            if( ( ret = ssl_milagro_cs_async_result( ssl ) ) != 0 )
+                break;
+#endif
             ret = ssl_write_server_hello( ssl );
             break;
 
@@ -58,6 +58,49 @@ void mbedtls_ssl_ticket_init( mbedtls_ssl_ticket_context *ctx )
 
 #define MAX_KEY_BYTES 32    /* 256 bits */
 
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+/*
+ * The keys are published like with a seqlock: the sequence number of a
+ * key is odd while it is replaced, and readers copy the key again if the
+ * number changed while they were copying it.
+ */
+#define TICKET_LOAD( p )        __atomic_load_n( p, __ATOMIC_ACQUIRE )
+#define TICKET_STORE( p, v )    __atomic_store_n( p, v, __ATOMIC_RELEASE )
+
+static void ssl_ticket_read_key( mbedtls_ssl_ticket_key *key,
+                                 mbedtls_ssl_ticket_key *copy )
+{
+    unsigned int seq;
+
+    do
+    {
+        while( ( seq = TICKET_LOAD( &key->seq ) ) & 1 )
+            ;
+
+        memcpy( copy, key, sizeof( mbedtls_ssl_ticket_key ) );
+
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    }
+    while( __atomic_load_n( &key->seq, __ATOMIC_RELAXED ) != seq );
+}
+
+/*
+ * Cipher context of a single ticket operation
+ */
+static int ssl_ticket_cipher_setup( const mbedtls_ssl_ticket_context *ctx,
+                                    mbedtls_cipher_context_t *cipher,
+                                    const unsigned char *key )
+{
+    int ret;
+
+    if( ( ret = mbedtls_cipher_setup( cipher, ctx->cipher_info ) ) != 0 )
+        return( ret );
+
+    return( mbedtls_cipher_setkey( cipher, key, ctx->cipher_info->key_bitlen,
+                                   MBEDTLS_ENCRYPT ) );
+}
+#endif /* MBEDTLS_SSL_TICKET_LOCKLESS */
+
 /*
  * Generate/update a key
  */
@@ -65,23 +108,45 @@ static int ssl_ticket_gen_key( mbedtls_ssl_ticket_context *ctx,
                                unsigned char index )
 {
     int ret;
+    unsigned char name[4];
     unsigned char buf[MAX_KEY_BYTES];
     mbedtls_ssl_ticket_key *key = ctx->keys + index;
+    uint32_t generation_time = 0;
 
 #if defined(MBEDTLS_HAVE_TIME)
-    key->generation_time = (uint32_t) time( NULL );
+    generation_time = (uint32_t) time( NULL );
 #endif
 
-    if( ( ret = ctx->f_rng( ctx->p_rng, key->name, sizeof( key->name ) ) ) != 0 )
+    if( ( ret = ctx->f_rng( ctx->p_rng, name, sizeof( name ) ) ) != 0 )
         return( ret );
 
     if( ( ret = ctx->f_rng( ctx->p_rng, buf, sizeof( buf ) ) ) != 0 )
         return( ret );
 
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    {
+        /* Rotations are serialized, only readers run concurrently */
+        unsigned int seq = key->seq;
+
+        __atomic_store_n( &key->seq, seq + 1, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_RELEASE );
+
+        memcpy( key->name, name, sizeof( name ) );
+        memcpy( key->key, buf, sizeof( buf ) );
+        __atomic_store_n( &key->generation_time, generation_time,
+                          __ATOMIC_RELAXED );
+
+        TICKET_STORE( &key->seq, seq + 2 );
+    }
+#else
+    memcpy( key->name, name, sizeof( name ) );
+    key->generation_time = generation_time;
+
     /* With GCM and CCM, same context can encrypt & decrypt */
     ret = mbedtls_cipher_setkey( &key->ctx, buf,
                                  mbedtls_cipher_get_key_bitlen( &key->ctx ),
                                  MBEDTLS_ENCRYPT );
+#endif /* MBEDTLS_SSL_TICKET_LOCKLESS */
 
     mbedtls_zeroize( buf, sizeof( buf ) );
 
@@ -89,7 +154,12 @@ static int ssl_ticket_gen_key( mbedtls_ssl_ticket_context *ctx,
 }
 
 /*
- * Rotate/generate keys if necessary
+ * Rotate/generate keys if necessary: the active key is replaced every
+ * lifetime / (MBEDTLS_SSL_TICKET_KEYS - 1) seconds, so that the oldest
+ * key still accepted is at least as old as the tickets.
+ *
+ * With MBEDTLS_SSL_TICKET_LOCKLESS, the mutex is only taken when a new
+ * key is due, otherwise it must be held by the caller.
  */
 static int ssl_ticket_update_keys( mbedtls_ssl_ticket_context *ctx )
 {
@@ -98,18 +168,64 @@ static int ssl_ticket_update_keys( mbedtls_ssl_ticket_context *ctx )
 #else
     if( ctx->ticket_lifetime != 0 )
     {
+        int ret;
         uint32_t current_time = (uint32_t) time( NULL );
-        uint32_t key_time = ctx->keys[ctx->active].generation_time;
+        uint32_t interval = ctx->ticket_lifetime / ( MBEDTLS_SSL_TICKET_KEYS - 1 );
+        uint32_t key_time;
+        unsigned char active;
+
+        if( interval == 0 )
+            interval = 1;
 
-        if( current_time > key_time &&
-            current_time - key_time < ctx->ticket_lifetime )
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+        active = TICKET_LOAD( &ctx->active );
+        key_time = __atomic_load_n( &ctx->keys[active].generation_time,
+                                    __ATOMIC_RELAXED );
+
+        if( current_time >= key_time &&
+            current_time - key_time < interval )
         {
             return( 0 );
         }
 
-        ctx->active = 1 - ctx->active;
+#if defined(MBEDTLS_THREADING_C)
+        if( ( ret = mbedtls_mutex_lock( &ctx->mutex ) ) != 0 )
+            return( ret );
+#endif
+
+        /* Another thread may have rotated the keys in the meantime */
+        active = ctx->active;
+        key_time = ctx->keys[active].generation_time;
+#else
+        active = ctx->active;
+        key_time = ctx->keys[active].generation_time;
+#endif /* MBEDTLS_SSL_TICKET_LOCKLESS */
+
+        if( current_time >= key_time &&
+            current_time - key_time < interval )
+        {
+            ret = 0;
+        }
+        else
+        {
+            active = ( active + 1 ) % MBEDTLS_SSL_TICKET_KEYS;
+
+            if( ( ret = ssl_ticket_gen_key( ctx, active ) ) == 0 )
+            {
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+                TICKET_STORE( &ctx->active, active );
+#else
+                ctx->active = active;
+#endif
+            }
+        }
+
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS) && defined(MBEDTLS_THREADING_C)
+        if( mbedtls_mutex_unlock( &ctx->mutex ) != 0 )
+            return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
 
-        return( ssl_ticket_gen_key( ctx, ctx->active ) );
+        return( ret );
     }
     else
 #endif /* MBEDTLS_HAVE_TIME */
@@ -125,6 +241,7 @@ int mbedtls_ssl_ticket_setup( mbedtls_ssl_ticket_context *ctx,
     uint32_t lifetime )
 {
     int ret;
+    unsigned char i;
     const mbedtls_cipher_info_t *cipher_info;
 
     ctx->f_rng = f_rng;
@@ -145,126 +262,21 @@ int mbedtls_ssl_ticket_setup( mbedtls_ssl_ticket_context *ctx,
     if( cipher_info->key_bitlen > 8 * MAX_KEY_BYTES )
         return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
 
-    if( ( ret = mbedtls_cipher_setup( &ctx->keys[0].ctx, cipher_info ) ) != 0 ||
-        ( ret = mbedtls_cipher_setup( &ctx->keys[1].ctx, cipher_info ) ) != 0 )
-    {
-        return( ret );
-    }
-
-    if( ( ret = ssl_ticket_gen_key( ctx, 0 ) ) != 0 ||
-        ( ret = ssl_ticket_gen_key( ctx, 1 ) ) != 0 )
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    ctx->cipher_info = cipher_info;
+#else
+    for( i = 0; i < MBEDTLS_SSL_TICKET_KEYS; i++ )
     {
-        return( ret );
+        if( ( ret = mbedtls_cipher_setup( &ctx->keys[i].ctx, cipher_info ) ) != 0 )
+            return( ret );
     }
+#endif
 
-    return( 0 );
-}
-
-/*
- * Serialize a session in the following format:
- *  0   .   n-1     session structure, n = sizeof(mbedtls_ssl_session)
- *  n   .   n+2     peer_cert length = m (0 if no certificate)
- *  n+3 .   n+2+m   peer cert ASN.1
- */
-static int ssl_save_session( const mbedtls_ssl_session *session,
-                             unsigned char *buf, size_t buf_len,
-                             size_t *olen )
-{
-    unsigned char *p = buf;
-    size_t left = buf_len;
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-    size_t cert_len;
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
-
-    if( left < sizeof( mbedtls_ssl_session ) )
-        return( MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL );
-
-    memcpy( p, session, sizeof( mbedtls_ssl_session ) );
-    p += sizeof( mbedtls_ssl_session );
-    left -= sizeof( mbedtls_ssl_session );
-
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-    if( session->peer_cert == NULL )
-        cert_len = 0;
-    else
-        cert_len = session->peer_cert->raw.len;
-
-    if( left < 3 + cert_len )
-        return( MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL );
-
-    *p++ = (unsigned char)( cert_len >> 16 & 0xFF );
-    *p++ = (unsigned char)( cert_len >>  8 & 0xFF );
-    *p++ = (unsigned char)( cert_len       & 0xFF );
-
-    if( session->peer_cert != NULL )
-        memcpy( p, session->peer_cert->raw.p, cert_len );
-
-    p += cert_len;
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
-
-    *olen = p - buf;
-
-    return( 0 );
-}
-
-/*
- * Unserialise session, see ssl_save_session()
- */
-static int ssl_load_session( mbedtls_ssl_session *session,
-                             const unsigned char *buf, size_t len )
-{
-    const unsigned char *p = buf;
-    const unsigned char * const end = buf + len;
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-    size_t cert_len;
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
-
-    if( p + sizeof( mbedtls_ssl_session ) > end )
-        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
-
-    memcpy( session, p, sizeof( mbedtls_ssl_session ) );
-    p += sizeof( mbedtls_ssl_session );
-
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-    if( p + 3 > end )
-        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
-
-    cert_len = ( p[0] << 16 ) | ( p[1] << 8 ) | p[2];
-    p += 3;
-
-    if( cert_len == 0 )
-    {
-        session->peer_cert = NULL;
-    }
-    else
+    for( i = 0; i < MBEDTLS_SSL_TICKET_KEYS; i++ )
     {
-        int ret;
-
-        if( p + cert_len > end )
-            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
-
-        session->peer_cert = mbedtls_calloc( 1, sizeof( mbedtls_x509_crt ) );
-
-        if( session->peer_cert == NULL )
-            return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
-
-        mbedtls_x509_crt_init( session->peer_cert );
-
-        if( ( ret = mbedtls_x509_crt_parse_der( session->peer_cert,
-                                        p, cert_len ) ) != 0 )
-        {
-            mbedtls_x509_crt_free( session->peer_cert );
-            mbedtls_free( session->peer_cert );
-            session->peer_cert = NULL;
+        if( ( ret = ssl_ticket_gen_key( ctx, i ) ) != 0 )
             return( ret );
-        }
-
-        p += cert_len;
     }
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
-
-    if( p != end )
-        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
 
     return( 0 );
 }
@@ -291,13 +303,17 @@ int mbedtls_ssl_ticket_write( void *p_ticket,
 {
     int ret;
     mbedtls_ssl_ticket_context *ctx = p_ticket;
-    mbedtls_ssl_ticket_key *key;
     unsigned char *key_name = start;
     unsigned char *iv = start + 4;
     unsigned char *state_len_bytes = iv + 12;
     unsigned char *state = state_len_bytes + 2;
     unsigned char *tag;
     size_t clear_len, ciph_len;
+    mbedtls_cipher_context_t *cipher;
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    mbedtls_ssl_ticket_key key;
+    mbedtls_cipher_context_t key_cipher;
+#endif
 
     *tlen = 0;
 
@@ -309,6 +325,33 @@ int mbedtls_ssl_ticket_write( void *p_ticket,
     if( end - start < 4 + 12 + 2 + 16 )
         return( MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL );
 
+    /* Dump session state, see mbedtls_ssl_session_save() */
+    if( ( ret = mbedtls_ssl_session_save( session, state,
+                                          end - state - 16, &clear_len ) ) != 0 )
+        return( ret );
+
+    if( (unsigned long) clear_len > 65535 )
+        return( MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL );
+
+    state_len_bytes[0] = ( clear_len >> 8 ) & 0xff;
+    state_len_bytes[1] = ( clear_len      ) & 0xff;
+
+    *ticket_lifetime = ctx->ticket_lifetime;
+
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    mbedtls_cipher_init( &key_cipher );
+    cipher = &key_cipher;
+
+    if( ( ret = ssl_ticket_update_keys( ctx ) ) != 0 )
+        goto cleanup;
+
+    ssl_ticket_read_key( &ctx->keys[TICKET_LOAD( &ctx->active )], &key );
+
+    memcpy( key_name, key.name, 4 );
+
+    if( ( ret = ssl_ticket_cipher_setup( ctx, cipher, key.key ) ) != 0 )
+        goto cleanup;
+#else
 #if defined(MBEDTLS_THREADING_C)
     if( ( ret = mbedtls_mutex_lock( &ctx->mutex ) ) != 0 )
         return( ret );
@@ -317,28 +360,17 @@ int mbedtls_ssl_ticket_write( void *p_ticket,
     if( ( ret = ssl_ticket_update_keys( ctx ) ) != 0 )
         goto cleanup;
 
-    key = &ctx->keys[ctx->active];
+    cipher = &ctx->keys[ctx->active].ctx;
 
-    *ticket_lifetime = ctx->ticket_lifetime;
-
-    memcpy( key_name, key->name, 4 );
+    memcpy( key_name, ctx->keys[ctx->active].name, 4 );
+#endif /* MBEDTLS_SSL_TICKET_LOCKLESS */
 
     if( ( ret = ctx->f_rng( ctx->p_rng, iv, 12 ) ) != 0 )
         goto cleanup;
 
-    /* Dump session state */
-    if( ( ret = ssl_save_session( session,
-                                  state, end - state, &clear_len ) ) != 0 ||
-        (unsigned long) clear_len > 65535 )
-    {
-         goto cleanup;
-    }
-    state_len_bytes[0] = ( clear_len >> 8 ) & 0xff;
-    state_len_bytes[1] = ( clear_len      ) & 0xff;
-
     /* Encrypt and authenticate */
     tag = state + clear_len;
-    if( ( ret = mbedtls_cipher_auth_encrypt( &key->ctx,
+    if( ( ret = mbedtls_cipher_auth_encrypt( cipher,
                     iv, 12, key_name, 4 + 12 + 2,
                     state, clear_len, state, &ciph_len, tag, 16 ) ) != 0 )
     {
@@ -353,7 +385,10 @@ int mbedtls_ssl_ticket_write( void *p_ticket,
     *tlen = 4 + 12 + 2 + 16 + ciph_len;
 
 cleanup:
-#if defined(MBEDTLS_THREADING_C)
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    mbedtls_cipher_free( &key_cipher );
+    mbedtls_zeroize( &key, sizeof( key ) );
+#elif defined(MBEDTLS_THREADING_C)
     if( mbedtls_mutex_unlock( &ctx->mutex ) != 0 )
         return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
 #endif
@@ -364,18 +399,37 @@ cleanup:
 /*
  * Select key based on name
  */
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+static int ssl_ticket_select_key( mbedtls_ssl_ticket_context *ctx,
+                                  const unsigned char name[4],
+                                  mbedtls_ssl_ticket_key *key )
+{
+    unsigned char i;
+
+    for( i = 0; i < MBEDTLS_SSL_TICKET_KEYS; i++ )
+    {
+        ssl_ticket_read_key( &ctx->keys[i], key );
+
+        if( memcmp( name, key->name, 4 ) == 0 )
+            return( 0 );
+    }
+
+    return( -1 );
+}
+#else
 static mbedtls_ssl_ticket_key *ssl_ticket_select_key(
         mbedtls_ssl_ticket_context *ctx,
         const unsigned char name[4] )
 {
     unsigned char i;
 
-    for( i = 0; i < sizeof( ctx->keys ) / sizeof( *ctx->keys ); i++ )
+    for( i = 0; i < MBEDTLS_SSL_TICKET_KEYS; i++ )
         if( memcmp( name, ctx->keys[i].name, 4 ) == 0 )
             return( &ctx->keys[i] );
 
     return( NULL );
 }
+#endif /* MBEDTLS_SSL_TICKET_LOCKLESS */
 
 /*
  * Load session ticket (see mbedtls_ssl_ticket_write for structure)
@@ -387,13 +441,19 @@ int mbedtls_ssl_ticket_parse( void *p_ticket,
 {
     int ret;
     mbedtls_ssl_ticket_context *ctx = p_ticket;
-    mbedtls_ssl_ticket_key *key;
     unsigned char *key_name = buf;
     unsigned char *iv = buf + 4;
     unsigned char *enc_len_p = iv + 12;
     unsigned char *ticket = enc_len_p + 2;
     unsigned char *tag;
     size_t enc_len, clear_len;
+    mbedtls_cipher_context_t *cipher;
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    mbedtls_ssl_ticket_key key;
+    mbedtls_cipher_context_t key_cipher;
+#else
+    mbedtls_ssl_ticket_key *key;
+#endif
 
     if( ctx == NULL || ctx->f_rng == NULL )
         return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
@@ -402,23 +462,39 @@ int mbedtls_ssl_ticket_parse( void *p_ticket,
     if( len < 4 + 12 + 2 + 16 )
         return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
 
-#if defined(MBEDTLS_THREADING_C)
-    if( ( ret = mbedtls_mutex_lock( &ctx->mutex ) ) != 0 )
-        return( ret );
-#endif
-
-    if( ( ret = ssl_ticket_update_keys( ctx ) ) != 0 )
-        goto cleanup;
-
     enc_len = ( enc_len_p[0] << 8 ) | enc_len_p[1];
     tag = ticket + enc_len;
 
     if( len != 4 + 12 + 2 + enc_len + 16 )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    mbedtls_cipher_init( &key_cipher );
+    cipher = &key_cipher;
+
+    if( ( ret = ssl_ticket_update_keys( ctx ) ) != 0 )
+        goto cleanup;
+
+    /* Select key */
+    if( ssl_ticket_select_key( ctx, key_name, &key ) != 0 )
     {
-        ret = MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+        /* We can't know for sure but this is a likely option unless we're
+         * under attack - this is only informative anyway */
+        ret = MBEDTLS_ERR_SSL_SESSION_TICKET_EXPIRED;
         goto cleanup;
     }
 
+    if( ( ret = ssl_ticket_cipher_setup( ctx, cipher, key.key ) ) != 0 )
+        goto cleanup;
+#else
+#if defined(MBEDTLS_THREADING_C)
+    if( ( ret = mbedtls_mutex_lock( &ctx->mutex ) ) != 0 )
+        return( ret );
+#endif
+
+    if( ( ret = ssl_ticket_update_keys( ctx ) ) != 0 )
+        goto cleanup;
+
     /* Select key */
     if( ( key = ssl_ticket_select_key( ctx, key_name ) ) == NULL )
     {
@@ -428,8 +504,11 @@ int mbedtls_ssl_ticket_parse( void *p_ticket,
         goto cleanup;
     }
 
+    cipher = &key->ctx;
+#endif /* MBEDTLS_SSL_TICKET_LOCKLESS */
+
     /* Decrypt and authenticate */
-    if( ( ret = mbedtls_cipher_auth_decrypt( &key->ctx, iv, 12,
+    if( ( ret = mbedtls_cipher_auth_decrypt( cipher, iv, 12,
                     key_name, 4 + 12 + 2, ticket, enc_len,
                     ticket, &clear_len, tag, 16 ) ) != 0 )
     {
@@ -444,9 +523,21 @@ int mbedtls_ssl_ticket_parse( void *p_ticket,
         goto cleanup;
     }
 
-    /* Actually load session */
-    if( ( ret = ssl_load_session( session, ticket, clear_len ) ) != 0 )
-        goto cleanup;
+cleanup:
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    mbedtls_cipher_free( &key_cipher );
+    mbedtls_zeroize( &key, sizeof( key ) );
+#elif defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_unlock( &ctx->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    if( ret != 0 )
+        return( ret );
+
+    /* Actually load session, the keys are no longer needed */
+    if( ( ret = mbedtls_ssl_session_load( session, ticket, clear_len ) ) != 0 )
+        return( ret );
 
 #if defined(MBEDTLS_HAVE_TIME)
     {
@@ -456,19 +547,12 @@ int mbedtls_ssl_ticket_parse( void *p_ticket,
         if( current_time < session->start ||
             (uint32_t)( current_time - session->start ) > ctx->ticket_lifetime )
         {
-            ret = MBEDTLS_ERR_SSL_SESSION_TICKET_EXPIRED;
-            goto cleanup;
+            return( MBEDTLS_ERR_SSL_SESSION_TICKET_EXPIRED );
         }
     }
 #endif
 
-cleanup:
-#if defined(MBEDTLS_THREADING_C)
-    if( mbedtls_mutex_unlock( &ctx->mutex ) != 0 )
-        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
-#endif
-
-    return( ret );
+    return( 0 );
 }
 
 /*
@@ -476,8 +560,12 @@ cleanup:
  */
 void mbedtls_ssl_ticket_free( mbedtls_ssl_ticket_context *ctx )
 {
-    mbedtls_cipher_free( &ctx->keys[0].ctx );
-    mbedtls_cipher_free( &ctx->keys[1].ctx );
+#if !defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    unsigned char i;
+
+    for( i = 0; i < MBEDTLS_SSL_TICKET_KEYS; i++ )
+        mbedtls_cipher_free( &ctx->keys[i].ctx );
+#endif
 
 #if defined(MBEDTLS_THREADING_C)
     mbedtls_mutex_free( &ctx->mutex );
@@ -369,6 +369,7 @@ static int tls1_prf( const unsigned char *secret, size_t slen,
 #endif /* MBEDTLS_SSL_PROTO_TLS1) || MBEDTLS_SSL_PROTO_TLS1_1 */
 
 #if defined(MBEDTLS_SSL_PROTO_TLS1_2)
+#if defined(MBEDTLS_SHA512_C)
 static int tls_prf_generic( mbedtls_md_type_t md_type,
                            const unsigned char *secret, size_t slen,
                            const char *label,
@@ -432,14 +433,90 @@ static int tls_prf_generic( mbedtls_md_type_t md_type,
     return( 0 );
 }
 
+#endif /* MBEDTLS_SHA512_C */
+
 #if defined(MBEDTLS_SHA256_C)
-static int tls_prf_sha256( const unsigned char *secret, size_t slen,
-                          const char *label,
-                          const unsigned char *random, size_t rlen,
-                          unsigned char *dstbuf, size_t dlen )
-{
-    return( tls_prf_generic( MBEDTLS_MD_SHA256, secret, slen,
-                            label, random, rlen, dstbuf, dlen ) );
+/*
+ * P_SHA256: the chain A(i) = HMAC(secret, A(i-1)) is sequential, but the
+ * output blocks HMAC(secret, A(i) + label + random) only depend on it, so
+ * they are computed MBEDTLS_SHA256_MULTI_LANES at a time
+ */
+int mbedtls_ssl_tls_prf_sha256( const unsigned char *secret, size_t slen,
+                                const char *label,
+                                const unsigned char *random, size_t rlen,
+                                unsigned char *dstbuf, size_t dlen )
+{
+    size_t nb, i, j, n;
+    unsigned char tmp[MBEDTLS_SHA256_MULTI_LANES][128];
+    unsigned char h_i[MBEDTLS_SHA256_MULTI_LANES][32];
+    const unsigned char *input[MBEDTLS_SHA256_MULTI_LANES];
+    size_t ilen[MBEDTLS_SHA256_MULTI_LANES];
+    unsigned char *output[MBEDTLS_SHA256_MULTI_LANES];
+    const mbedtls_md_info_t *md_info;
+    mbedtls_md_context_t md_ctx;
+    int ret;
+
+    mbedtls_md_init( &md_ctx );
+
+    if( ( md_info = mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ) ) == NULL )
+        return( MBEDTLS_ERR_SSL_INTERNAL_ERROR );
+
+    if( sizeof( tmp[0] ) < 32 + strlen( label ) + rlen )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    nb = strlen( label );
+    memcpy( tmp[0] + 32, label, nb );
+    memcpy( tmp[0] + 32 + nb, random, rlen );
+    nb += rlen;
+
+    if ( ( ret = mbedtls_md_setup( &md_ctx, md_info, 1 ) ) != 0 )
+        return( ret );
+
+    /* A(1) */
+    mbedtls_md_hmac_starts( &md_ctx, secret, slen );
+    mbedtls_md_hmac_update( &md_ctx, tmp[0] + 32, nb );
+    mbedtls_md_hmac_finish( &md_ctx, tmp[0] );
+
+    for( i = 0; i < dlen; i += n * 32 )
+    {
+        n = ( dlen - i + 31 ) / 32;
+        if( n > MBEDTLS_SHA256_MULTI_LANES )
+            n = MBEDTLS_SHA256_MULTI_LANES;
+
+        /* tmp[j] = A(i + j) + label + random */
+        for( j = 0; j < n; j++ )
+        {
+            if( j > 0 )
+            {
+                mbedtls_md_hmac_reset ( &md_ctx );
+                mbedtls_md_hmac_update( &md_ctx, tmp[j - 1], 32 );
+                mbedtls_md_hmac_finish( &md_ctx, tmp[j] );
+                memcpy( tmp[j] + 32, tmp[0] + 32, nb );
+            }
+
+            input[j] = tmp[j];
+            ilen[j] = 32 + nb;
+            output[j] = h_i[j];
+        }
+
+        mbedtls_sha256_hmac_multi( secret, slen, n, input, ilen, output );
+
+        memcpy( dstbuf + i, h_i, ( dlen - i < n * 32 ) ? dlen - i : n * 32 );
+
+        if( i + n * 32 < dlen )
+        {
+            mbedtls_md_hmac_reset ( &md_ctx );
+            mbedtls_md_hmac_update( &md_ctx, tmp[n - 1], 32 );
+            mbedtls_md_hmac_finish( &md_ctx, tmp[0] );
+        }
+    }
+
+    mbedtls_md_free( &md_ctx );
+
+    mbedtls_zeroize( tmp, sizeof( tmp ) );
+    mbedtls_zeroize( h_i, sizeof( h_i ) );
+
+    return( 0 );
 }
 #endif /* MBEDTLS_SHA256_C */
 
@@ -556,7 +633,7 @@ int mbedtls_ssl_derive_keys( mbedtls_ssl_context *ssl )
 #if defined(MBEDTLS_SHA256_C)
                 if( ssl->minor_ver == MBEDTLS_SSL_MINOR_VERSION_3 )
                 {
-                    handshake->tls_prf = tls_prf_sha256;
+                    handshake->tls_prf = mbedtls_ssl_tls_prf_sha256;
                     handshake->calc_verify = ssl_calc_verify_tls_sha256;
                     handshake->calc_finished = ssl_calc_finished_tls_sha256;
                 }
@@ -682,7 +759,17 @@ int mbedtls_ssl_derive_keys( mbedtls_ssl_context *ssl )
     
     transform->keylen = cipher_info->key_bitlen / 8;
     
-    if( cipher_info->mode == MBEDTLS_MODE_GCM ||
+    if( cipher_info->mode == MBEDTLS_MODE_CHACHAPOLY )
+    {
+        transform->maclen = 0;
+        
+        /* RFC 7905: the whole IV is fixed, there is no explicit part */
+        transform->ivlen = 12;
+        transform->fixed_ivlen = 12;
+        
+        transform->minlen = 16;
+    }
+    else if( cipher_info->mode == MBEDTLS_MODE_GCM ||
        cipher_info->mode == MBEDTLS_MODE_CCM )
     {
         transform->maclen = 0;
@@ -1139,14 +1226,22 @@ int mbedtls_ssl_milagro_cs_derive_premaster(int client_or_server, mbedtls_ssl_co
         {
             char g1[12*PFS],g2[12*PFS];
             octet G1={0,sizeof(g1),g1}, G2={0,sizeof(g2),g2};
-            if ( (ret = MPIN_PRECOMPUTE(&ssl->handshake->milagro_cs->secret,
-                                        &ssl->handshake->milagro_cs->hash_client_id,
-                                        &G1,&G2) ) != 0)
+            octet *pG1 = &G1, *pG2 = &G2;
+
+            /* Skip the pairings if they were computed once for this identity */
+            if( ssl->handshake->milagro_cs->precomputed )
+            {
+                pG1 = &ssl->handshake->milagro_cs->G1;
+                pG2 = &ssl->handshake->milagro_cs->G2;
+            }
+            else if ( (ret = MPIN_PRECOMPUTE(&ssl->handshake->milagro_cs->secret,
+                                             &ssl->handshake->milagro_cs->hash_client_id,
+                                             &G1,&G2) ) != 0)
             {
                 return (MBEDTLS_ERR_MILAGRO_CS_KEY_COMPUTATOIN_FAILED);
             }
             
-            if ( (ret = MPIN_CLIENT_KEY(&G1,&G2,ssl->handshake->milagro_cs->pin,
+            if ( (ret = MPIN_CLIENT_KEY(pG1,pG2,ssl->handshake->milagro_cs->pin,
                                         &ssl->handshake->milagro_cs->param_rand,
                                         &ssl->handshake->milagro_cs->X,
                                         &ssl->handshake->milagro_cs->H,
@@ -1194,6 +1289,7 @@ int mbedtls_ssl_milagro_p2p_derive_premaster(int client_or_server,
     unsigned char *p = ssl->handshake->premaster;
     unsigned char *end = p + sizeof( ssl->handshake->premaster );
     size_t key_len;
+    int ret;
     
     if( key_ex == MBEDTLS_KEY_EXCHANGE_MILAGRO_P2P )
     {
@@ -1226,29 +1322,9 @@ int mbedtls_ssl_milagro_p2p_derive_premaster(int client_or_server,
         }
         else if (client_or_server == MBEDTLS_SSL_IS_CLIENT)
         {
-            mbedtls_ssl_milagro_p2p_alloc_memory(MBEDTLS_SSL_IS_CLIENT,
-                                                 ssl->handshake->milagro_p2p);
-            if(WCC_RANDOM_GENERATE(&ssl->handshake->milagro_p2p->RNG ,
-                                    &ssl->handshake->milagro_p2p->W) != 0)
-            {
-                return (MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
-            }
-            if( WCC_GET_G1_MULTIPLE(hashDoneOFF,&ssl->handshake->milagro_p2p->W,
-                                     &ssl->handshake->milagro_p2p->server_identity,
-                                     &ssl->handshake->milagro_p2p->client_pub_param_G1) != 0)
-            {
-                return (MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
-            }
-            if(WCC_RANDOM_GENERATE(&ssl->handshake->milagro_p2p->RNG ,
-                                    &ssl->handshake->milagro_p2p->Y) != 0)
-            {
-                return (MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
-            }
-            if(WCC_GET_G2_MULTIPLE(hashDoneOFF,&ssl->handshake->milagro_p2p->Y,
-                                    &ssl->handshake->milagro_p2p->client_identity,
-                                    &ssl->handshake->milagro_p2p->client_pub_param_G2) != 0)
+            if( ( ret = mbedtls_milagro_p2p_compute_client_param( ssl->handshake->milagro_p2p ) ) != 0 )
             {
-                return (MBEDTLS_ERR_MILAGRO_P2P_PARAMETERS_COMPUTATOIN_FAILED);
+                return( ret );
             }
             WCC_Hq(&ssl->handshake->milagro_p2p->server_pub_param_G1,
                    &ssl->handshake->milagro_p2p->client_pub_param_G2,
@@ -1305,6 +1381,44 @@ int mbedtls_ssl_milagro_p2p_derive_premaster(int client_or_server,
 #endif /* MBEDTLS_KEY_EXCHANGE_MILAGRO_P2P_ENABLED */
 
 
+#if defined(MBEDTLS_ECDH_C)
+/*
+ * Generate our ephemeral ECDH key pair, or take a precomputed one
+ */
+int mbedtls_ssl_ecdh_gen_public( mbedtls_ssl_context *ssl )
+{
+    int ret;
+    mbedtls_ecdh_context *ecdh = &ssl->handshake->ecdh_ctx;
+
+    if( ssl->conf->f_keyshare != NULL &&
+        ssl->conf->f_keyshare( ssl->conf->p_keyshare, ecdh->grp.id,
+                               &ecdh->d, &ecdh->Q ) == 0 )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 3, ( "using a precomputed ECDH key pair" ) );
+        return( 0 );
+    }
+
+    MBEDTLS_SSL_TIMING_BEGIN( ssl );
+    ret = mbedtls_ecdh_gen_public( &ecdh->grp, &ecdh->d, &ecdh->Q,
+                                   ssl->conf->f_rng, ssl->conf->p_rng );
+    MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_ECP_MUL );
+
+    return( ret );
+}
+#endif /* MBEDTLS_ECDH_C */
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+/*
+ * Report an operation started with MBEDTLS_SSL_TIMING_BEGIN()
+ */
+void mbedtls_ssl_timing_report( mbedtls_ssl_context *ssl, int event )
+{
+    ssl->conf->f_timing( ssl->conf->p_timing, ssl, event, ssl->state,
+                         ssl->handshake->timing_start,
+                         mbedtls_timing_monotonic_us() );
+}
+#endif /* MBEDTLS_SSL_HANDSHAKE_TIMING */
+
 #if defined(MBEDTLS_KEY_EXCHANGE__SOME__PSK_ENABLED)
 int mbedtls_ssl_psk_derive_premaster( mbedtls_ssl_context *ssl, mbedtls_key_exchange_type_t key_ex )
 {
@@ -1385,9 +1499,12 @@ int mbedtls_ssl_psk_derive_premaster( mbedtls_ssl_context *ssl, mbedtls_key_exch
                     int ret;
                     size_t zlen;
                     
-                    if( ( ret = mbedtls_ecdh_calc_secret( &ssl->handshake->ecdh_ctx, &zlen,
-                                                         p + 2, end - ( p + 2 ),
-                                                         ssl->conf->f_rng, ssl->conf->p_rng ) ) != 0 )
+                    MBEDTLS_SSL_TIMING_BEGIN( ssl );
+                    ret = mbedtls_ecdh_calc_secret( &ssl->handshake->ecdh_ctx, &zlen,
+                                                   p + 2, end - ( p + 2 ),
+                                                   ssl->conf->f_rng, ssl->conf->p_rng );
+                    MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_ECP_MUL );
+                    if( ret != 0 )
                     {
                         MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ecdh_calc_secret", ret );
                         return( ret );
@@ -1476,6 +1593,119 @@ static void ssl_mac( mbedtls_md_context_t *md_ctx, unsigned char *secret,
 /*
  * Encryption/decryption functions
  */
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
+#if defined(MBEDTLS_CHACHAPOLY_C)
+/*
+ * RFC 7905 nonce: the fixed IV XORed with the left-padded sequence number
+ */
+static void ssl_chachapoly_nonce( unsigned char iv[12],
+                                  const unsigned char fixed_iv[12],
+                                  const unsigned char ctr[8] )
+{
+    size_t i;
+    
+    memcpy( iv, fixed_iv, 12 );
+    for( i = 0; i < 8; i++ )
+        iv[i + 4] ^= ctr[i];
+}
+#endif /* MBEDTLS_CHACHAPOLY_C */
+
+/*
+ * Build the additional data of the outgoing AEAD record of out_msglen bytes,
+ * generate its IV into iv and write the explicit part of it to out_iv
+ */
+static int ssl_prepare_aead_out( mbedtls_ssl_context *ssl,
+                                 unsigned char add_data[13],
+                                 unsigned char iv[12] )
+{
+    const mbedtls_ssl_transform *transform = ssl->transform_out;
+#if defined(MBEDTLS_SSL_AEAD_RANDOM_IV)
+    int ret;
+#endif
+
+    memcpy( add_data, ssl->out_ctr, 8 );
+    add_data[8]  = ssl->out_msgtype;
+    mbedtls_ssl_write_version( ssl->major_ver, ssl->minor_ver,
+                              ssl->conf->transport, add_data + 9 );
+    add_data[11] = ( ssl->out_msglen >> 8 ) & 0xFF;
+    add_data[12] = ssl->out_msglen & 0xFF;
+    
+    MBEDTLS_SSL_DEBUG_BUF( 4, "additional data used for AEAD",
+                          add_data, 13 );
+    
+    /*
+     * Generate IV
+     */
+#if defined(MBEDTLS_CHACHAPOLY_C)
+    if( mbedtls_cipher_get_cipher_mode( &transform->cipher_ctx_enc ) ==
+        MBEDTLS_MODE_CHACHAPOLY )
+    {
+        ssl_chachapoly_nonce( iv, transform->iv_enc, ssl->out_ctr );
+        
+        MBEDTLS_SSL_DEBUG_BUF( 4, "IV used", iv, transform->ivlen );
+        
+        return( 0 );
+    }
+#endif
+    
+    memcpy( iv, transform->iv_enc, transform->fixed_ivlen );
+    
+#if defined(MBEDTLS_SSL_AEAD_RANDOM_IV)
+    ret = ssl->conf->f_rng( ssl->conf->p_rng, iv + transform->fixed_ivlen,
+                           transform->ivlen - transform->fixed_ivlen );
+    if( ret != 0 )
+        return( ret );
+    
+    memcpy( ssl->out_iv, iv + transform->fixed_ivlen,
+           transform->ivlen - transform->fixed_ivlen );
+#else
+    if( transform->ivlen - transform->fixed_ivlen != 8 )
+    {
+        /* Reminder if we ever add an AEAD mode with a different size */
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "should never happen" ) );
+        return( MBEDTLS_ERR_SSL_INTERNAL_ERROR );
+    }
+    
+    memcpy( iv + transform->fixed_ivlen, ssl->out_ctr, 8 );
+    memcpy( ssl->out_iv, ssl->out_ctr, 8 );
+#endif
+    
+    MBEDTLS_SSL_DEBUG_BUF( 4, "IV used", ssl->out_iv,
+                          transform->ivlen - transform->fixed_ivlen );
+    
+    return( 0 );
+}
+#endif /* MBEDTLS_GCM_C || MBEDTLS_CCM_C || MBEDTLS_CHACHAPOLY_C */
+
+/*
+ * Length of the tag or MAC ending the outgoing records, if sent after the
+ * ciphertext rather than encrypted with it
+ */
+static size_t ssl_out_taglen( const mbedtls_ssl_context *ssl )
+{
+    mbedtls_cipher_mode_t mode;
+    
+    if( ssl->transform_out == NULL )
+        return( 0 );
+    
+    mode = mbedtls_cipher_get_cipher_mode( &ssl->transform_out->cipher_ctx_enc );
+    
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
+    if( mode == MBEDTLS_MODE_GCM || mode == MBEDTLS_MODE_CCM ||
+        mode == MBEDTLS_MODE_CHACHAPOLY )
+        return( ssl->transform_out->ciphersuite_info->flags &
+                MBEDTLS_CIPHERSUITE_SHORT_TAG ? 8 : 16 );
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    if( mode == MBEDTLS_MODE_CBC &&
+        ssl->session_out->encrypt_then_mac == MBEDTLS_SSL_ETM_ENABLED )
+        return( ssl->transform_out->maclen );
+#endif
+    
+    (void) mode;
+    return( 0 );
+}
+
 static int ssl_encrypt_buf( mbedtls_ssl_context *ssl )
 {
     mbedtls_cipher_mode_t mode;
@@ -1575,56 +1805,22 @@ defined(MBEDTLS_SSL_PROTO_TLS1_2)
     }
     else
 #endif /* MBEDTLS_ARC4_C || MBEDTLS_CIPHER_NULL_CIPHER */
-#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C)
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
         if( mode == MBEDTLS_MODE_GCM ||
-           mode == MBEDTLS_MODE_CCM )
+           mode == MBEDTLS_MODE_CCM ||
+           mode == MBEDTLS_MODE_CHACHAPOLY )
         {
             int ret;
             size_t enc_msglen, olen;
             unsigned char *enc_msg;
             unsigned char add_data[13];
+            unsigned char iv[12];
             unsigned char taglen = ssl->transform_out->ciphersuite_info->flags &
             MBEDTLS_CIPHERSUITE_SHORT_TAG ? 8 : 16;
             
-            memcpy( add_data, ssl->out_ctr, 8 );
-            add_data[8]  = ssl->out_msgtype;
-            mbedtls_ssl_write_version( ssl->major_ver, ssl->minor_ver,
-                                      ssl->conf->transport, add_data + 9 );
-            add_data[11] = ( ssl->out_msglen >> 8 ) & 0xFF;
-            add_data[12] = ssl->out_msglen & 0xFF;
-            
-            MBEDTLS_SSL_DEBUG_BUF( 4, "additional data used for AEAD",
-                                  add_data, 13 );
-            
-            /*
-             * Generate IV
-             */
-#if defined(MBEDTLS_SSL_AEAD_RANDOM_IV)
-            ret = ssl->conf->f_rng( ssl->conf->p_rng,
-                                   ssl->transform_out->iv_enc + ssl->transform_out->fixed_ivlen,
-                                   ssl->transform_out->ivlen - ssl->transform_out->fixed_ivlen );
-            if( ret != 0 )
+            if( ( ret = ssl_prepare_aead_out( ssl, add_data, iv ) ) != 0 )
                 return( ret );
             
-            memcpy( ssl->out_iv,
-                   ssl->transform_out->iv_enc + ssl->transform_out->fixed_ivlen,
-                   ssl->transform_out->ivlen - ssl->transform_out->fixed_ivlen );
-#else
-            if( ssl->transform_out->ivlen - ssl->transform_out->fixed_ivlen != 8 )
-            {
-                /* Reminder if we ever add an AEAD mode with a different size */
-                MBEDTLS_SSL_DEBUG_MSG( 1, ( "should never happen" ) );
-                return( MBEDTLS_ERR_SSL_INTERNAL_ERROR );
-            }
-            
-            memcpy( ssl->transform_out->iv_enc + ssl->transform_out->fixed_ivlen,
-                   ssl->out_ctr, 8 );
-            memcpy( ssl->out_iv, ssl->out_ctr, 8 );
-#endif
-            
-            MBEDTLS_SSL_DEBUG_BUF( 4, "IV used", ssl->out_iv,
-                                  ssl->transform_out->ivlen - ssl->transform_out->fixed_ivlen );
-            
             /*
              * Fix pointer positions and message length with added IV
              */
@@ -1641,8 +1837,7 @@ defined(MBEDTLS_SSL_PROTO_TLS1_2)
              * Encrypt and authenticate
              */
             if( ( ret = mbedtls_cipher_auth_encrypt( &ssl->transform_out->cipher_ctx_enc,
-                                                    ssl->transform_out->iv_enc,
-                                                    ssl->transform_out->ivlen,
+                                                    iv, ssl->transform_out->ivlen,
                                                     add_data, 13,
                                                     enc_msg, enc_msglen,
                                                     enc_msg, &olen,
@@ -1664,7 +1859,7 @@ defined(MBEDTLS_SSL_PROTO_TLS1_2)
             MBEDTLS_SSL_DEBUG_BUF( 4, "after encrypt: tag", enc_msg + enc_msglen, taglen );
         }
         else
-#endif /* MBEDTLS_GCM_C || MBEDTLS_CCM_C */
+#endif /* MBEDTLS_GCM_C || MBEDTLS_CCM_C || MBEDTLS_CHACHAPOLY_C */
 #if defined(MBEDTLS_CIPHER_MODE_CBC) &&                                    \
 ( defined(MBEDTLS_AES_C) || defined(MBEDTLS_CAMELLIA_C) )
             if( mode == MBEDTLS_MODE_CBC )
@@ -1854,15 +2049,17 @@ static int ssl_decrypt_buf( mbedtls_ssl_context *ssl )
     }
     else
 #endif /* MBEDTLS_ARC4_C || MBEDTLS_CIPHER_NULL_CIPHER */
-#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C)
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
         if( mode == MBEDTLS_MODE_GCM ||
-           mode == MBEDTLS_MODE_CCM )
+           mode == MBEDTLS_MODE_CCM ||
+           mode == MBEDTLS_MODE_CHACHAPOLY )
         {
             int ret;
             size_t dec_msglen, olen;
             unsigned char *dec_msg;
             unsigned char *dec_msg_result;
             unsigned char add_data[13];
+            unsigned char iv[12];
             unsigned char taglen = ssl->transform_in->ciphersuite_info->flags &
             MBEDTLS_CIPHERSUITE_SHORT_TAG ? 8 : 16;
             size_t explicit_iv_len = ssl->transform_in->ivlen -
@@ -1891,20 +2088,26 @@ static int ssl_decrypt_buf( mbedtls_ssl_context *ssl )
             MBEDTLS_SSL_DEBUG_BUF( 4, "additional data used for AEAD",
                                   add_data, 13 );
             
-            memcpy( ssl->transform_in->iv_dec + ssl->transform_in->fixed_ivlen,
-                   ssl->in_iv,
-                   ssl->transform_in->ivlen - ssl->transform_in->fixed_ivlen );
+#if defined(MBEDTLS_CHACHAPOLY_C)
+            if( mode == MBEDTLS_MODE_CHACHAPOLY )
+                ssl_chachapoly_nonce( iv, ssl->transform_in->iv_dec, ssl->in_ctr );
+            else
+#endif
+            {
+                memcpy( iv, ssl->transform_in->iv_dec,
+                       ssl->transform_in->fixed_ivlen );
+                memcpy( iv + ssl->transform_in->fixed_ivlen, ssl->in_iv,
+                       ssl->transform_in->ivlen - ssl->transform_in->fixed_ivlen );
+            }
             
-            MBEDTLS_SSL_DEBUG_BUF( 4, "IV used", ssl->transform_in->iv_dec,
-                                  ssl->transform_in->ivlen );
+            MBEDTLS_SSL_DEBUG_BUF( 4, "IV used", iv, ssl->transform_in->ivlen );
             MBEDTLS_SSL_DEBUG_BUF( 4, "TAG used", dec_msg + dec_msglen, taglen );
             
             /*
              * Decrypt and authenticate
              */
             if( ( ret = mbedtls_cipher_auth_decrypt( &ssl->transform_in->cipher_ctx_dec,
-                                                    ssl->transform_in->iv_dec,
-                                                    ssl->transform_in->ivlen,
+                                                    iv, ssl->transform_in->ivlen,
                                                     add_data, 13,
                                                     dec_msg, dec_msglen,
                                                     dec_msg_result, &olen,
@@ -1926,7 +2129,7 @@ static int ssl_decrypt_buf( mbedtls_ssl_context *ssl )
             }
         }
         else
-#endif /* MBEDTLS_GCM_C || MBEDTLS_CCM_C */
+#endif /* MBEDTLS_GCM_C || MBEDTLS_CCM_C || MBEDTLS_CHACHAPOLY_C */
 #if defined(MBEDTLS_CIPHER_MODE_CBC) &&                                    \
 ( defined(MBEDTLS_AES_C) || defined(MBEDTLS_CAMELLIA_C) )
             if( mode == MBEDTLS_MODE_CBC )
@@ -2423,47 +2626,701 @@ static int ssl_resend_hello_request( mbedtls_ssl_context *ssl )
 #endif
 #endif /* MBEDTLS_SSL_SRV_C && MBEDTLS_SSL_RENEGOTIATION */
 
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
 /*
- * Fill the input message buffer by appending data to it.
- * The amount of data already fetched is in ssl->in_left.
- *
- * If we return 0, is it guaranteed that (at least) nb_want bytes are
- * available (from this read and/or a previous one). Otherwise, an error code
- * is returned (possibly EOF or WANT_READ).
- *
- * With stream transport (TLS) on success ssl->in_left == nb_want, but
- * with datagram transport (DTLS) on success ssl->in_left >= nb_want,
- * since we always read a whole datagram at once.
- *
- * For DTLS, it is up to the caller to set ssl->next_record_offset when
- * they're done reading a record.
+ * Move the record pointers from the last batched record back to out_buf,
+ * with the layout of mbedtls_ssl_setup() for TLS
  */
-int mbedtls_ssl_fetch_input( mbedtls_ssl_context *ssl, size_t nb_want )
+static void ssl_end_batch( mbedtls_ssl_context *ssl )
 {
-    int ret;
-    size_t len;
+    size_t len_off, iv_off, msg_off;
     
-    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> fetch input" ) );
+    if( ssl->out_batched == 0 )
+        return;
     
-    if( ssl->f_recv == NULL && ssl->f_recv_timeout == NULL )
-    {
-        MBEDTLS_SSL_DEBUG_MSG( 1, ( "Bad usage of mbedtls_ssl_set_bio() "
-                                   "or mbedtls_ssl_set_bio()" ) );
-        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
-    }
+    len_off = ssl->out_len - ssl->out_hdr;
+    iv_off  = ssl->out_iv  - ssl->out_hdr;
+    msg_off = ssl->out_msg - ssl->out_hdr;
+    
+    ssl->out_hdr = ssl->out_buf + 8;
+    ssl->out_len = ssl->out_hdr + len_off;
+    ssl->out_iv  = ssl->out_hdr + iv_off;
+    ssl->out_msg = ssl->out_hdr + msg_off;
     
-    if( nb_want > MBEDTLS_SSL_BUFFER_LEN - (size_t)( ssl->in_hdr - ssl->in_buf ) )
+    ssl->out_batched = 0;
+}
+
+/*
+ * Free the staging area of an idle context
+ */
+static void ssl_free_out_batch( mbedtls_ssl_context *ssl )
+{
+    if( ssl->out_batch == NULL || ssl->out_batched != 0 )
+        return;
+    
+    mbedtls_zeroize( ssl->out_batch, ssl->out_batch_len );
+    mbedtls_free( ssl->out_batch );
+    
+    ssl->out_batch = NULL;
+    ssl->out_batch_len = 0;
+}
+#endif /* MBEDTLS_SSL_WRITE_BATCH */
+
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+/*
+ * Largest record payload that fits in an idle-size buffer
+ */
+#define SSL_IDLE_PAYLOAD_LEN    ( MBEDTLS_SSL_IDLE_BUFFER_LEN -              \
+                                  ( MBEDTLS_SSL_BUFFER_LEN -                \
+                                    MBEDTLS_SSL_MAX_CONTENT_LEN ) )
+
+/*
+ * Replace *buf by a buffer of len bytes, keeping its first bytes.
+ * The old buffer is wiped before being released.
+ */
+static int ssl_realloc_buffer( unsigned char **buf, size_t *buf_len,
+                               size_t len )
+{
+    unsigned char *new_buf;
+
+    if( ( new_buf = mbedtls_calloc( 1, len ) ) == NULL )
+        return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+
+    memcpy( new_buf, *buf, len < *buf_len ? len : *buf_len );
+
+    mbedtls_zeroize( *buf, *buf_len );
+    mbedtls_free( *buf );
+
+    *buf = new_buf;
+    *buf_len = len;
+
+    return( 0 );
+}
+
+/*
+ * Resize the input buffer and move the record pointers with it.
+ * Datagram contexts always keep full-size buffers.
+ */
+static int ssl_resize_in_buf( mbedtls_ssl_context *ssl, size_t len )
+{
+    int ret;
+    size_t ctr, hdr, len_off, iv, msg, offt;
+
+    if( ssl->in_buf == NULL || ssl->in_buf_len == len )
+        return( 0 );
+
+#if defined(MBEDTLS_SSL_PROTO_DTLS)
+    if( ssl->conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
+        return( 0 );
+#endif
+
+    ctr     = ssl->in_ctr - ssl->in_buf;
+    hdr     = ssl->in_hdr - ssl->in_buf;
+    len_off = ssl->in_len - ssl->in_buf;
+    iv      = ssl->in_iv  - ssl->in_buf;
+    msg     = ssl->in_msg - ssl->in_buf;
+    offt    = ssl->in_offt != NULL ? (size_t)( ssl->in_offt - ssl->in_buf ) : 0;
+
+    MBEDTLS_SSL_DEBUG_MSG( 3, ( "resize input buffer: %d -> %d bytes",
+                                ssl->in_buf_len, len ) );
+
+    if( ( ret = ssl_realloc_buffer( &ssl->in_buf, &ssl->in_buf_len, len ) ) != 0 )
     {
-        MBEDTLS_SSL_DEBUG_MSG( 1, ( "requesting more data than fits" ) );
-        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "alloc(%d bytes) failed", len ) );
+        return( ret );
     }
-    
+
+    ssl->in_ctr = ssl->in_buf + ctr;
+    ssl->in_hdr = ssl->in_buf + hdr;
+    ssl->in_len = ssl->in_buf + len_off;
+    ssl->in_iv  = ssl->in_buf + iv;
+    ssl->in_msg = ssl->in_buf + msg;
+    if( ssl->in_offt != NULL )
+        ssl->in_offt = ssl->in_buf + offt;
+
+    return( 0 );
+}
+
+/*
+ * Resize the output buffer and move the record pointers with it
+ */
+static int ssl_resize_out_buf( mbedtls_ssl_context *ssl, size_t len )
+{
+    int ret;
+    size_t ctr, hdr, len_off, iv, msg;
+
+    if( ssl->out_buf == NULL || ssl->out_buf_len == len )
+        return( 0 );
+
 #if defined(MBEDTLS_SSL_PROTO_DTLS)
     if( ssl->conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
+        return( 0 );
+#endif
+
+    ctr     = ssl->out_ctr - ssl->out_buf;
+    hdr     = ssl->out_hdr - ssl->out_buf;
+    len_off = ssl->out_len - ssl->out_buf;
+    iv      = ssl->out_iv  - ssl->out_buf;
+    msg     = ssl->out_msg - ssl->out_buf;
+
+    MBEDTLS_SSL_DEBUG_MSG( 3, ( "resize output buffer: %d -> %d bytes",
+                                ssl->out_buf_len, len ) );
+
+    if( ( ret = ssl_realloc_buffer( &ssl->out_buf, &ssl->out_buf_len, len ) ) != 0 )
     {
-        uint32_t timeout;
-        
-        /* Just to be sure */
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "alloc(%d bytes) failed", len ) );
+        return( ret );
+    }
+
+    ssl->out_ctr = ssl->out_buf + ctr;
+    ssl->out_hdr = ssl->out_buf + hdr;
+    ssl->out_len = ssl->out_buf + len_off;
+    ssl->out_iv  = ssl->out_buf + iv;
+    ssl->out_msg = ssl->out_buf + msg;
+
+    return( 0 );
+}
+
+/*
+ * Give both buffers their full size, as the handshake writers and parsers
+ * assume MBEDTLS_SSL_MAX_CONTENT_LEN bytes of room
+ */
+static int ssl_grow_buffers( mbedtls_ssl_context *ssl )
+{
+    int ret;
+
+    if( ( ret = ssl_resize_in_buf( ssl, MBEDTLS_SSL_BUFFER_LEN ) ) != 0 ||
+        ( ret = ssl_resize_out_buf( ssl, MBEDTLS_SSL_BUFFER_LEN ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    return( 0 );
+}
+
+/*
+ * The constant-time CBC padding check of ssl_decrypt_buf() reads up to 256
+ * bytes past the start of the padding, which may be beyond the end of a
+ * short record: such records need a full-size input buffer.
+ */
+static int ssl_in_transform_is_cbc( const mbedtls_ssl_context *ssl )
+{
+    return( ssl->transform_in != NULL &&
+            mbedtls_cipher_get_cipher_mode( &ssl->transform_in->cipher_ctx_dec )
+            == MBEDTLS_MODE_CBC );
+}
+
+/*
+ * Count consecutive application records that would fit in idle buffers
+ */
+static void ssl_note_record_len( mbedtls_ssl_context *ssl, size_t len )
+{
+    if( len > SSL_IDLE_PAYLOAD_LEN )
+        ssl->small_records = 0;
+    else if( ssl->small_records < MBEDTLS_SSL_BUFFER_SHRINK_RECORDS )
+        ssl->small_records++;
+}
+
+/*
+ * Shrink the buffers back to their idle size if no record is in flight,
+ * either unconditionally (end of handshake) or after enough small records.
+ * Failing to allocate the smaller buffers is not an error.
+ */
+static void ssl_shrink_buffers( mbedtls_ssl_context *ssl, int force )
+{
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    /* Pooled buffers are given back whole instead */
+    if( ssl->conf->buf_pool != NULL )
+        return;
+#endif
+
+    if( ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER ||
+        ssl->in_left != 0 || ssl->in_offt != NULL || ssl->out_left != 0 ||
+        ( ssl->in_hslen != 0 && ssl->in_hslen < ssl->in_msglen ) )
+    {
+        return;
+    }
+
+    if( ! force && ssl->small_records < MBEDTLS_SSL_BUFFER_SHRINK_RECORDS )
+        return;
+
+    if( ! ssl_in_transform_is_cbc( ssl ) )
+        (void) ssl_resize_in_buf( ssl, MBEDTLS_SSL_IDLE_BUFFER_LEN );
+    (void) ssl_resize_out_buf( ssl, MBEDTLS_SSL_IDLE_BUFFER_LEN );
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    ssl_free_out_batch( ssl );
+#endif
+}
+#endif /* MBEDTLS_SSL_VARIABLE_BUFFERS */
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+/*
+ * Allocate the read-ahead area on first use
+ */
+static int ssl_alloc_read_ahead( mbedtls_ssl_context *ssl )
+{
+    if( ssl->in_ahead != NULL )
+        return( 0 );
+    
+    if( ( ssl->in_ahead = mbedtls_calloc( 1, ssl->conf->read_ahead ) ) == NULL )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "alloc(%d bytes) failed",
+                                    ssl->conf->read_ahead ) );
+        return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+    }
+    
+    ssl->in_ahead_len = ssl->conf->read_ahead;
+    ssl->in_ahead_start = 0;
+    ssl->in_ahead_end = 0;
+    
+    return( 0 );
+}
+
+/*
+ * Append up to len of the bytes read ahead to the current record
+ */
+static void ssl_take_read_ahead( mbedtls_ssl_context *ssl, size_t len )
+{
+    size_t avail = ssl->in_ahead_end - ssl->in_ahead_start;
+    
+    if( len > avail )
+        len = avail;
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "taking %d of %d bytes read ahead",
+                                len, avail ) );
+    
+    memcpy( ssl->in_hdr + ssl->in_left, ssl->in_ahead + ssl->in_ahead_start,
+            len );
+    
+    ssl->in_left += len;
+    ssl->in_ahead_start += len;
+    
+    if( ssl->in_ahead_start == ssl->in_ahead_end )
+        ssl->in_ahead_start = ssl->in_ahead_end = 0;
+}
+#endif /* MBEDTLS_SSL_READ_AHEAD */
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+void mbedtls_ssl_buffer_pool_init( mbedtls_ssl_buffer_pool *pool )
+{
+    memset( pool, 0, sizeof( mbedtls_ssl_buffer_pool ) );
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_init( &pool->mutex );
+#endif
+}
+
+void mbedtls_ssl_buffer_pool_set_max_free( mbedtls_ssl_buffer_pool *pool,
+                                           size_t max_free )
+{
+    pool->max_free = max_free;
+}
+
+/*
+ * Take a buffer from the pool, allocating a new one if none is free.
+ * Free buffers are chained through their first bytes.
+ */
+static int ssl_buffer_pool_get( mbedtls_ssl_buffer_pool *pool,
+                                unsigned char **buf )
+{
+    unsigned char *p;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    p = pool->free_list;
+    if( p != NULL )
+    {
+        memcpy( &pool->free_list, p, sizeof( unsigned char * ) );
+        pool->nb_free--;
+
+        if( ++pool->nb_in_use > pool->peak_in_use )
+            pool->peak_in_use = pool->nb_in_use;
+    }
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &pool->mutex );
+#endif
+
+    if( p != NULL )
+    {
+        mbedtls_zeroize( p, sizeof( unsigned char * ) );
+        *buf = p;
+        return( 0 );
+    }
+
+    /* Allocate outside of the lock, count the buffer once it exists */
+    if( ( p = mbedtls_calloc( 1, MBEDTLS_SSL_BUFFER_LEN ) ) == NULL )
+        return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+    {
+        mbedtls_free( p );
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+    }
+#endif
+
+    if( ++pool->nb_in_use > pool->peak_in_use )
+        pool->peak_in_use = pool->nb_in_use;
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &pool->mutex );
+#endif
+
+    *buf = p;
+
+    return( 0 );
+}
+
+/*
+ * Wipe a buffer and give it back to the pool
+ */
+static void ssl_buffer_pool_put( mbedtls_ssl_buffer_pool *pool,
+                                 unsigned char *buf )
+{
+    mbedtls_zeroize( buf, MBEDTLS_SSL_BUFFER_LEN );
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+    {
+        mbedtls_free( buf );
+        return;
+    }
+#endif
+
+    pool->nb_in_use--;
+
+    if( pool->max_free == 0 || pool->nb_free < pool->max_free )
+    {
+        memcpy( buf, &pool->free_list, sizeof( unsigned char * ) );
+        pool->free_list = buf;
+        pool->nb_free++;
+        buf = NULL;
+    }
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_unlock( &pool->mutex );
+#endif
+
+    mbedtls_free( buf );
+}
+
+int mbedtls_ssl_buffer_pool_stats( mbedtls_ssl_buffer_pool *pool,
+                                   size_t *in_use, size_t *idle,
+                                   size_t *peak )
+{
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_lock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    *in_use = pool->nb_in_use * MBEDTLS_SSL_BUFFER_LEN;
+    *idle = pool->nb_free * MBEDTLS_SSL_BUFFER_LEN;
+    *peak = pool->peak_in_use * MBEDTLS_SSL_BUFFER_LEN;
+
+#if defined(MBEDTLS_THREADING_C)
+    if( mbedtls_mutex_unlock( &pool->mutex ) != 0 )
+        return( MBEDTLS_ERR_THREADING_MUTEX_ERROR );
+#endif
+
+    return( 0 );
+}
+
+void mbedtls_ssl_buffer_pool_free( mbedtls_ssl_buffer_pool *pool )
+{
+    unsigned char *p;
+
+    if( pool == NULL )
+        return;
+
+    while( ( p = pool->free_list ) != NULL )
+    {
+        memcpy( &pool->free_list, p, sizeof( unsigned char * ) );
+        mbedtls_free( p );
+    }
+
+#if defined(MBEDTLS_THREADING_C)
+    mbedtls_mutex_free( &pool->mutex );
+#endif
+
+    mbedtls_zeroize( pool, sizeof( mbedtls_ssl_buffer_pool ) );
+}
+
+/*
+ * Take the input buffer back from the pool and restore the record pointers
+ * and the incoming counter. The layout is the one of mbedtls_ssl_setup()
+ * for TLS, as datagram contexts never give their buffers back.
+ */
+static int ssl_acquire_in_buf( mbedtls_ssl_context *ssl )
+{
+    int ret;
+
+    if( ssl->in_buf != NULL || ssl->conf->buf_pool == NULL )
+        return( 0 );
+
+    if( ( ret = ssl_buffer_pool_get( ssl->conf->buf_pool, &ssl->in_buf ) ) != 0 )
+    {
+        MBEDTLS_SSL_DEBUG_RET( 1, "ssl_buffer_pool_get", ret );
+        return( ret );
+    }
+
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl->in_buf_len = MBEDTLS_SSL_BUFFER_LEN;
+#endif
+
+    ssl->in_ctr = ssl->in_buf;
+    ssl->in_hdr = ssl->in_buf +  8;
+    ssl->in_len = ssl->in_buf + 11;
+    ssl->in_iv  = ssl->in_buf + 13;
+    ssl->in_msg = ssl->in_buf + ssl->in_msg_idle;
+
+    memcpy( ssl->in_ctr, ssl->in_ctr_idle, 8 );
+
+    return( 0 );
+}
+
+/*
+ * Give the input buffer back to the pool if no record is pending.
+ * Meanwhile in_ctr points to a copy of the counter in the context.
+ */
+static void ssl_release_in_buf( mbedtls_ssl_context *ssl )
+{
+    if( ssl->in_buf == NULL || ssl->conf->buf_pool == NULL ||
+        ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER ||
+        ssl->in_left != 0 || ssl->in_offt != NULL ||
+        ( ssl->in_hslen != 0 && ssl->in_hslen < ssl->in_msglen ) )
+    {
+        return;
+    }
+
+#if defined(MBEDTLS_SSL_PROTO_DTLS)
+    if( ssl->conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
+        return;
+#endif
+
+    memcpy( ssl->in_ctr_idle, ssl->in_ctr, 8 );
+    ssl->in_msg_idle = ssl->in_msg - ssl->in_buf;
+
+    ssl_buffer_pool_put( ssl->conf->buf_pool, ssl->in_buf );
+
+    ssl->in_buf = NULL;
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl->in_buf_len = 0;
+#endif
+    ssl->in_ctr = ssl->in_ctr_idle;
+    ssl->in_hdr = NULL;
+    ssl->in_len = NULL;
+    ssl->in_iv  = NULL;
+    ssl->in_msg = NULL;
+}
+
+/*
+ * Take the output buffer back from the pool, see ssl_acquire_in_buf()
+ */
+static int ssl_acquire_out_buf( mbedtls_ssl_context *ssl )
+{
+    int ret;
+
+    if( ssl->out_buf != NULL || ssl->conf->buf_pool == NULL )
+        return( 0 );
+
+    if( ( ret = ssl_buffer_pool_get( ssl->conf->buf_pool, &ssl->out_buf ) ) != 0 )
+    {
+        MBEDTLS_SSL_DEBUG_RET( 1, "ssl_buffer_pool_get", ret );
+        return( ret );
+    }
+
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl->out_buf_len = MBEDTLS_SSL_BUFFER_LEN;
+#endif
+
+    ssl->out_ctr = ssl->out_buf;
+    ssl->out_hdr = ssl->out_buf +  8;
+    ssl->out_len = ssl->out_buf + 11;
+    ssl->out_iv  = ssl->out_buf + 13;
+    ssl->out_msg = ssl->out_buf + ssl->out_msg_idle;
+
+    memcpy( ssl->out_ctr, ssl->out_ctr_idle, 8 );
+
+    return( 0 );
+}
+
+/*
+ * Give the output buffer back to the pool once everything is sent
+ */
+static void ssl_release_out_buf( mbedtls_ssl_context *ssl )
+{
+    if( ssl->out_buf == NULL || ssl->conf->buf_pool == NULL ||
+        ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER || ssl->out_left != 0 )
+    {
+        return;
+    }
+
+#if defined(MBEDTLS_SSL_PROTO_DTLS)
+    if( ssl->conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
+        return;
+#endif
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    ssl_free_out_batch( ssl );
+#endif
+
+    memcpy( ssl->out_ctr_idle, ssl->out_ctr, 8 );
+    ssl->out_msg_idle = ssl->out_msg - ssl->out_buf;
+
+    ssl_buffer_pool_put( ssl->conf->buf_pool, ssl->out_buf );
+
+    ssl->out_buf = NULL;
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl->out_buf_len = 0;
+#endif
+    ssl->out_ctr = ssl->out_ctr_idle;
+    ssl->out_hdr = NULL;
+    ssl->out_len = NULL;
+    ssl->out_iv  = NULL;
+    ssl->out_msg = NULL;
+}
+
+/*
+ * With the input buffer back in the pool, wait for the peer without it:
+ * the first bytes of the next record are received on the stack and the
+ * buffer is only taken again once they are here.
+ */
+static int ssl_fetch_idle_input( mbedtls_ssl_context *ssl, size_t nb_want )
+{
+    int ret;
+    unsigned char *buf = ssl->in_hdr_idle;
+    size_t len = nb_want < sizeof( ssl->in_hdr_idle ) ?
+                 nb_want : sizeof( ssl->in_hdr_idle );
+
+    if( ssl->in_left == 0 )
+        ssl_release_in_buf( ssl );
+
+    if( ssl->in_buf != NULL )
+        return( 0 );
+
+    /* A previous call got the bytes but not the buffer */
+    if( ssl->in_hdr_idle_len != 0 )
+        goto acquire;
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    /*
+     * Bytes already read ahead belong in front of anything new; otherwise
+     * read ahead straight away instead of peeking at the header
+     */
+    if( ssl->in_ahead_end > ssl->in_ahead_start )
+        return( ssl_acquire_in_buf( ssl ) );
+
+    if( ssl->conf->read_ahead > 0 )
+    {
+        if( ( ret = ssl_alloc_read_ahead( ssl ) ) != 0 )
+            return( ret );
+
+        buf = ssl->in_ahead;
+        len = ssl->in_ahead_len;
+    }
+#endif
+
+    if( ssl_check_timer( ssl ) != 0 )
+        ret = MBEDTLS_ERR_SSL_TIMEOUT;
+    else if( ssl->f_recv_timeout != NULL )
+        ret = ssl->f_recv_timeout( ssl->p_bio, buf, len,
+                                   ssl->conf->read_timeout );
+    else
+        ret = ssl->f_recv( ssl->p_bio, buf, len );
+
+    MBEDTLS_SSL_DEBUG_RET( 2, "ssl->f_recv(_timeout)", ret );
+
+    if( ret == 0 )
+        return( MBEDTLS_ERR_SSL_CONN_EOF );
+
+    if( ret < 0 )
+        return( ret );
+
+    len = (size_t) ret;
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    if( buf == ssl->in_ahead )
+    {
+        ssl->in_ahead_start = 0;
+        ssl->in_ahead_end = len;
+        return( ssl_acquire_in_buf( ssl ) );
+    }
+#endif
+
+    ssl->in_hdr_idle_len = len;
+
+acquire:
+    /* On failure the bytes stay in in_hdr_idle until the next call */
+    if( ( ret = ssl_acquire_in_buf( ssl ) ) != 0 )
+        return( ret );
+
+    memcpy( ssl->in_hdr, ssl->in_hdr_idle, ssl->in_hdr_idle_len );
+    ssl->in_left = ssl->in_hdr_idle_len;
+    ssl->in_hdr_idle_len = 0;
+
+    return( 0 );
+}
+#endif /* MBEDTLS_SSL_BUFFER_POOL */
+
+/*
+ * Fill the input message buffer by appending data to it.
+ * The amount of data already fetched is in ssl->in_left.
+ *
+ * If we return 0, is it guaranteed that (at least) nb_want bytes are
+ * available (from this read and/or a previous one). Otherwise, an error code
+ * is returned (possibly EOF or WANT_READ).
+ *
+ * With stream transport (TLS) on success ssl->in_left == nb_want, but
+ * with datagram transport (DTLS) on success ssl->in_left >= nb_want,
+ * since we always read a whole datagram at once.
+ *
+ * For DTLS, it is up to the caller to set ssl->next_record_offset when
+ * they're done reading a record.
+ */
+int mbedtls_ssl_fetch_input( mbedtls_ssl_context *ssl, size_t nb_want )
+{
+    int ret;
+    size_t len;
+    unsigned char *buf;
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> fetch input" ) );
+    
+    if( ssl->f_recv == NULL && ssl->f_recv_timeout == NULL )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "Bad usage of mbedtls_ssl_set_bio() "
+                                   "or mbedtls_ssl_set_bio()" ) );
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    }
+    
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( ( ret = ssl_fetch_idle_input( ssl, nb_want ) ) != 0 )
+        return( ret );
+#endif
+
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    if( nb_want > ssl->in_buf_len - (size_t)( ssl->in_hdr - ssl->in_buf ) &&
+        ( ret = ssl_resize_in_buf( ssl, MBEDTLS_SSL_BUFFER_LEN ) ) != 0 )
+    {
+        return( ret );
+    }
+#endif
+
+    if( nb_want > MBEDTLS_SSL_IN_BUFFER_LEN( ssl ) - (size_t)( ssl->in_hdr - ssl->in_buf ) )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "requesting more data than fits" ) );
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    }
+    
+#if defined(MBEDTLS_SSL_PROTO_DTLS)
+    if( ssl->conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
+    {
+        uint32_t timeout;
+        
+        /* Just to be sure */
         if( ssl->f_set_timer == NULL || ssl->f_get_timer == NULL )
         {
             MBEDTLS_SSL_DEBUG_MSG( 1, ( "You must use "
@@ -2535,7 +3392,7 @@ int mbedtls_ssl_fetch_input( mbedtls_ssl_context *ssl, size_t nb_want )
             ret = MBEDTLS_ERR_SSL_TIMEOUT;
         else
         {
-            len = MBEDTLS_SSL_BUFFER_LEN - ( ssl->in_hdr - ssl->in_buf );
+            len = MBEDTLS_SSL_IN_BUFFER_LEN( ssl ) - ( ssl->in_hdr - ssl->in_buf );
             
             if( ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER )
                 timeout = ssl->handshake->retransmit_timeout;
@@ -2605,22 +3462,42 @@ int mbedtls_ssl_fetch_input( mbedtls_ssl_context *ssl, size_t nb_want )
         
         while( ssl->in_left < nb_want )
         {
+            buf = ssl->in_hdr + ssl->in_left;
             len = nb_want - ssl->in_left;
             
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+            /*
+             * Take what was read ahead first, then read ahead again unless
+             * the rest of the record is too large to be worth staging
+             */
+            if( ssl->in_ahead_end > ssl->in_ahead_start )
+            {
+                ssl_take_read_ahead( ssl, len );
+                continue;
+            }
+            
+            if( len < ssl->conf->read_ahead )
+            {
+                if( ( ret = ssl_alloc_read_ahead( ssl ) ) != 0 )
+                    return( ret );
+                
+                buf = ssl->in_ahead;
+                len = ssl->in_ahead_len;
+            }
+#endif
+            
             if( ssl_check_timer( ssl ) != 0 )
                 ret = MBEDTLS_ERR_SSL_TIMEOUT;
             else
             {
                 if( ssl->f_recv_timeout != NULL )
                 {
-                    ret = ssl->f_recv_timeout( ssl->p_bio,
-                                              ssl->in_hdr + ssl->in_left, len,
+                    ret = ssl->f_recv_timeout( ssl->p_bio, buf, len,
                                               ssl->conf->read_timeout );
                 }
                 else
                 {
-                    ret = ssl->f_recv( ssl->p_bio,
-                                      ssl->in_hdr + ssl->in_left, len );
+                    ret = ssl->f_recv( ssl->p_bio, buf, len );
                 }
             }
             
@@ -2634,6 +3511,15 @@ int mbedtls_ssl_fetch_input( mbedtls_ssl_context *ssl, size_t nb_want )
             if( ret < 0 )
                 return( ret );
             
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+            if( buf == ssl->in_ahead )
+            {
+                ssl->in_ahead_start = 0;
+                ssl->in_ahead_end = ret;
+                continue;
+            }
+#endif
+            
             ssl->in_left += ret;
         }
     }
@@ -2643,17 +3529,84 @@ int mbedtls_ssl_fetch_input( mbedtls_ssl_context *ssl, size_t nb_want )
     return( 0 );
 }
 
+/*
+ * Increment the outgoing record counter after a record is sealed and sent
+ */
+static int ssl_out_ctr_increment( mbedtls_ssl_context *ssl )
+{
+    unsigned char i;
+    
+    for( i = 8; i > ssl_ep_len( ssl ); i-- )
+        if( ++ssl->out_ctr[i - 1] != 0 )
+            break;
+    
+    /* The loop goes to its end iff the counter is wrapping */
+    if( i == ssl_ep_len( ssl ) )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "outgoing message counter would wrap" ) );
+        return( MBEDTLS_ERR_SSL_COUNTER_WRAPPING );
+    }
+    
+    return( 0 );
+}
+
+/*
+ * Offer the unsent part of the pending records, from buf on, to the
+ * vectored write callback: for each record, header and explicit IV,
+ * ciphertext, then tag or MAC
+ */
+#define SSL_SEND_VEC_RECORDS    8
+
+static int ssl_send_vec( mbedtls_ssl_context *ssl, const unsigned char *buf )
+{
+    mbedtls_ssl_iovec iov[3 * SSL_SEND_VEC_RECORDS];
+    const unsigned char *end = buf + ssl->out_left;
+    const unsigned char *rec = ssl->out_hdr;
+    const unsigned char *bound[3];
+    size_t hdr_len = mbedtls_ssl_hdr_len( ssl );
+    size_t iv_off = ssl->out_msg - ssl->out_hdr;
+    int i, n = 0;
+    
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    if( ssl->out_batched != 0 )
+        rec = ssl->out_batch;
+#endif
+    
+    /* Records lie back to back, each one's length is in its header */
+    while( rec < end && n + 3 <= 3 * SSL_SEND_VEC_RECORDS )
+    {
+        bound[2] = rec + hdr_len +
+                   ( ( rec[hdr_len - 2] << 8 ) | rec[hdr_len - 1] );
+        bound[0] = rec + iv_off;
+        bound[1] = bound[2] - ssl->out_taglen;
+        
+        for( i = 0; i < 3; i++ )
+        {
+            if( bound[i] <= buf )
+                continue;
+            
+            iov[n].base = buf;
+            iov[n].len  = ( bound[i] < end ? bound[i] : end ) - buf;
+            buf += iov[n++].len;
+        }
+        
+        rec = bound[2];
+    }
+    
+    return( ssl->f_send_vec( ssl->p_bio, iov, n ) );
+}
+
 /*
  * Flush any data not yet written
  */
 int mbedtls_ssl_flush_output( mbedtls_ssl_context *ssl )
 {
     int ret;
-    unsigned char *buf, i;
+    unsigned char *buf;
     
     MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> flush output" ) );
     
-    if( ssl->f_send == NULL )
+    if( ssl->f_send == NULL && ssl->f_send_vec == NULL )
     {
         MBEDTLS_SSL_DEBUG_MSG( 1, ( "Bad usage of mbedtls_ssl_set_bio() "
                                    "or mbedtls_ssl_set_bio()" ) );
@@ -2674,9 +3627,18 @@ int mbedtls_ssl_flush_output( mbedtls_ssl_context *ssl )
         
         buf = ssl->out_hdr + mbedtls_ssl_hdr_len( ssl ) +
         ssl->out_msglen - ssl->out_left;
-        ret = ssl->f_send( ssl->p_bio, buf, ssl->out_left );
-        
-        MBEDTLS_SSL_DEBUG_RET( 2, "ssl->f_send", ret );
+        if( ssl->f_send_vec != NULL )
+        {
+            ret = ssl_send_vec( ssl, buf );
+            
+            MBEDTLS_SSL_DEBUG_RET( 2, "ssl->f_send_vec", ret );
+        }
+        else
+        {
+            ret = ssl->f_send( ssl->p_bio, buf, ssl->out_left );
+            
+            MBEDTLS_SSL_DEBUG_RET( 2, "ssl->f_send", ret );
+        }
         
         if( ret <= 0 )
             return( ret );
@@ -2684,16 +3646,16 @@ int mbedtls_ssl_flush_output( mbedtls_ssl_context *ssl )
         ssl->out_left -= ret;
     }
     
-    for( i = 8; i > ssl_ep_len( ssl ); i-- )
-        if( ++ssl->out_ctr[i - 1] != 0 )
-            break;
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    ssl_end_batch( ssl );
+#endif
     
-    /* The loop goes to its end iff the counter is wrapping */
-    if( i == ssl_ep_len( ssl ) )
-    {
-        MBEDTLS_SSL_DEBUG_MSG( 1, ( "outgoing message counter would wrap" ) );
-        return( MBEDTLS_ERR_SSL_COUNTER_WRAPPING );
-    }
+    if( ( ret = ssl_out_ctr_increment( ssl ) ) != 0 )
+        return( ret );
+    
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    ssl_release_out_buf( ssl );
+#endif
     
     MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= flush output" ) );
     
@@ -2875,65 +3837,141 @@ int mbedtls_ssl_resend( mbedtls_ssl_context *ssl )
         ssl_set_timer( ssl, ssl->handshake->retransmit_timeout );
     }
     
-    MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= mbedtls_ssl_resend" ) );
-    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= mbedtls_ssl_resend" ) );
+    
+    return( 0 );
+}
+
+/*
+ * To be called when the last message of an incoming flight is received.
+ */
+void mbedtls_ssl_recv_flight_completed( mbedtls_ssl_context *ssl )
+{
+    /* We won't need to resend that one any more */
+    ssl_flight_free( ssl->handshake->flight );
+    ssl->handshake->flight = NULL;
+    ssl->handshake->cur_msg = NULL;
+    
+    /* The next incoming flight will start with this msg_seq */
+    ssl->handshake->in_flight_start_seq = ssl->handshake->in_msg_seq;
+    
+    /* Cancel timer */
+    ssl_set_timer( ssl, 0 );
+    
+    if( ssl->in_msgtype == MBEDTLS_SSL_MSG_HANDSHAKE &&
+       ssl->in_msg[0] == MBEDTLS_SSL_HS_FINISHED )
+    {
+        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_FINISHED;
+    }
+    else
+        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_PREPARING;
+}
+
+/*
+ * To be called when the last message of an outgoing flight is send.
+ */
+void mbedtls_ssl_send_flight_completed( mbedtls_ssl_context *ssl )
+{
+    ssl_reset_retransmit_timeout( ssl );
+    ssl_set_timer( ssl, ssl->handshake->retransmit_timeout );
+    
+    if( ssl->in_msgtype == MBEDTLS_SSL_MSG_HANDSHAKE &&
+       ssl->in_msg[0] == MBEDTLS_SSL_HS_FINISHED )
+    {
+        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_FINISHED;
+    }
+    else
+        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_WAITING;
+}
+#endif /* MBEDTLS_SSL_PROTO_DTLS */
+
+/*
+ * Record layer functions
+ */
+
+/*
+ * Compress and encrypt the record of out_msglen bytes in out_msg, and
+ * write its header, leaving it in the output buffer for flushing
+ */
+static int ssl_seal_record( mbedtls_ssl_context *ssl )
+{
+    int ret, done = 0;
+    size_t len = ssl->out_msglen;
+    
+#if defined(MBEDTLS_ZLIB_SUPPORT)
+    if( ssl->transform_out != NULL &&
+       ssl->session_out->compression == MBEDTLS_SSL_COMPRESS_DEFLATE )
+    {
+        if( ( ret = ssl_compress_buf( ssl ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "ssl_compress_buf", ret );
+            return( ret );
+        }
+        
+        len = ssl->out_msglen;
+    }
+#endif /*MBEDTLS_ZLIB_SUPPORT */
+    
+#if defined(MBEDTLS_SSL_HW_RECORD_ACCEL)
+    if( mbedtls_ssl_hw_record_write != NULL )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 2, ( "going for mbedtls_ssl_hw_record_write()" ) );
+        
+        ret = mbedtls_ssl_hw_record_write( ssl );
+        if( ret != 0 && ret != MBEDTLS_ERR_SSL_HW_ACCEL_FALLTHROUGH )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_hw_record_write", ret );
+            return( MBEDTLS_ERR_SSL_HW_ACCEL_FAILED );
+        }
+        
+        if( ret == 0 )
+            done = 1;
+    }
+#endif /* MBEDTLS_SSL_HW_RECORD_ACCEL */
+    if( !done )
+    {
+        ssl->out_hdr[0] = (unsigned char) ssl->out_msgtype;
+        mbedtls_ssl_write_version( ssl->major_ver, ssl->minor_ver,
+                                  ssl->conf->transport, ssl->out_hdr + 1 );
+        
+        ssl->out_len[0] = (unsigned char)( len >> 8 );
+        ssl->out_len[1] = (unsigned char)( len      );
+        
+        if( ssl->transform_out != NULL )
+        {
+            if( ( ret = ssl_encrypt_buf( ssl ) ) != 0 )
+            {
+                MBEDTLS_SSL_DEBUG_RET( 1, "ssl_encrypt_buf", ret );
+                return( ret );
+            }
+            
+            len = ssl->out_msglen;
+            ssl->out_len[0] = (unsigned char)( len >> 8 );
+            ssl->out_len[1] = (unsigned char)( len      );
+        }
+        
+        ssl->out_taglen = ssl_out_taglen( ssl );
+        ssl->out_left = mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen;
+        
+        MBEDTLS_SSL_DEBUG_MSG( 3, ( "output record: msgtype = %d, "
+                                   "version = [%d:%d], msglen = %d",
+                                   ssl->out_hdr[0], ssl->out_hdr[1], ssl->out_hdr[2],
+                                   ( ssl->out_len[0] << 8 ) | ssl->out_len[1] ) );
+        
+        MBEDTLS_SSL_DEBUG_BUF( 4, "output record sent to network",
+                              ssl->out_hdr, mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen );
+    }
+    
     return( 0 );
 }
 
-/*
- * To be called when the last message of an incoming flight is received.
- */
-void mbedtls_ssl_recv_flight_completed( mbedtls_ssl_context *ssl )
-{
-    /* We won't need to resend that one any more */
-    ssl_flight_free( ssl->handshake->flight );
-    ssl->handshake->flight = NULL;
-    ssl->handshake->cur_msg = NULL;
-    
-    /* The next incoming flight will start with this msg_seq */
-    ssl->handshake->in_flight_start_seq = ssl->handshake->in_msg_seq;
-    
-    /* Cancel timer */
-    ssl_set_timer( ssl, 0 );
-    
-    if( ssl->in_msgtype == MBEDTLS_SSL_MSG_HANDSHAKE &&
-       ssl->in_msg[0] == MBEDTLS_SSL_HS_FINISHED )
-    {
-        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_FINISHED;
-    }
-    else
-        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_PREPARING;
-}
-
-/*
- * To be called when the last message of an outgoing flight is send.
- */
-void mbedtls_ssl_send_flight_completed( mbedtls_ssl_context *ssl )
-{
-    ssl_reset_retransmit_timeout( ssl );
-    ssl_set_timer( ssl, ssl->handshake->retransmit_timeout );
-    
-    if( ssl->in_msgtype == MBEDTLS_SSL_MSG_HANDSHAKE &&
-       ssl->in_msg[0] == MBEDTLS_SSL_HS_FINISHED )
-    {
-        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_FINISHED;
-    }
-    else
-        ssl->handshake->retransmit_state = MBEDTLS_SSL_RETRANS_WAITING;
-}
-#endif /* MBEDTLS_SSL_PROTO_DTLS */
-
-/*
- * Record layer functions
- */
-
 /*
  * Write current record.
  * Uses ssl->out_msgtype, ssl->out_msglen and bytes at ssl->out_msg.
  */
 int mbedtls_ssl_write_record( mbedtls_ssl_context *ssl )
 {
-    int ret, done = 0;
+    int ret;
     size_t len = ssl->out_msglen;
     
     MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> write record" ) );
@@ -3014,68 +4052,8 @@ int mbedtls_ssl_write_record( mbedtls_ssl_context *ssl )
     }
 #endif
     
-#if defined(MBEDTLS_ZLIB_SUPPORT)
-    if( ssl->transform_out != NULL &&
-       ssl->session_out->compression == MBEDTLS_SSL_COMPRESS_DEFLATE )
-    {
-        if( ( ret = ssl_compress_buf( ssl ) ) != 0 )
-        {
-            MBEDTLS_SSL_DEBUG_RET( 1, "ssl_compress_buf", ret );
-            return( ret );
-        }
-        
-        len = ssl->out_msglen;
-    }
-#endif /*MBEDTLS_ZLIB_SUPPORT */
-    
-#if defined(MBEDTLS_SSL_HW_RECORD_ACCEL)
-    if( mbedtls_ssl_hw_record_write != NULL )
-    {
-        MBEDTLS_SSL_DEBUG_MSG( 2, ( "going for mbedtls_ssl_hw_record_write()" ) );
-        
-        ret = mbedtls_ssl_hw_record_write( ssl );
-        if( ret != 0 && ret != MBEDTLS_ERR_SSL_HW_ACCEL_FALLTHROUGH )
-        {
-            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_hw_record_write", ret );
-            return( MBEDTLS_ERR_SSL_HW_ACCEL_FAILED );
-        }
-        
-        if( ret == 0 )
-            done = 1;
-    }
-#endif /* MBEDTLS_SSL_HW_RECORD_ACCEL */
-    if( !done )
-    {
-        ssl->out_hdr[0] = (unsigned char) ssl->out_msgtype;
-        mbedtls_ssl_write_version( ssl->major_ver, ssl->minor_ver,
-                                  ssl->conf->transport, ssl->out_hdr + 1 );
-        
-        ssl->out_len[0] = (unsigned char)( len >> 8 );
-        ssl->out_len[1] = (unsigned char)( len      );
-        
-        if( ssl->transform_out != NULL )
-        {
-            if( ( ret = ssl_encrypt_buf( ssl ) ) != 0 )
-            {
-                MBEDTLS_SSL_DEBUG_RET( 1, "ssl_encrypt_buf", ret );
-                return( ret );
-            }
-            
-            len = ssl->out_msglen;
-            ssl->out_len[0] = (unsigned char)( len >> 8 );
-            ssl->out_len[1] = (unsigned char)( len      );
-        }
-        
-        ssl->out_left = mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen;
-        
-        MBEDTLS_SSL_DEBUG_MSG( 3, ( "output record: msgtype = %d, "
-                                   "version = [%d:%d], msglen = %d",
-                                   ssl->out_hdr[0], ssl->out_hdr[1], ssl->out_hdr[2],
-                                   ( ssl->out_len[0] << 8 ) | ssl->out_len[1] ) );
-        
-        MBEDTLS_SSL_DEBUG_BUF( 4, "output record sent to network",
-                              ssl->out_hdr, mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen );
-    }
+    if( ( ret = ssl_seal_record( ssl ) ) != 0 )
+        return( ret );
     
     if( ( ret = mbedtls_ssl_flush_output( ssl ) ) != 0 )
     {
@@ -3284,7 +4262,7 @@ static int ssl_reassemble_dtls_handshake( mbedtls_ssl_context *ssl )
         ssl->next_record_offset = new_remain - ssl->in_hdr;
         ssl->in_left = ssl->next_record_offset + remain_len;
         
-        if( ssl->in_left > MBEDTLS_SSL_BUFFER_LEN -
+        if( ssl->in_left > MBEDTLS_SSL_IN_BUFFER_LEN( ssl ) -
            (size_t)( ssl->in_hdr - ssl->in_buf ) )
         {
             MBEDTLS_SSL_DEBUG_MSG( 1, ( "reassembled message too large for buffer" ) );
@@ -3663,7 +4641,16 @@ static int ssl_handle_possible_reconnect( mbedtls_ssl_context *ssl )
         /* Dont check write errors as we can't do anything here.
          * If the error is permanent we'll catch it later,
          * if it's not, then hopefully it'll work next time. */
-        (void) ssl->f_send( ssl->p_bio, ssl->out_buf, len );
+        if( ssl->f_send_vec != NULL )
+        {
+            mbedtls_ssl_iovec iov;
+            
+            iov.base = ssl->out_buf;
+            iov.len  = len;
+            (void) ssl->f_send_vec( ssl->p_bio, &iov, 1 );
+        }
+        else
+            (void) ssl->f_send( ssl->p_bio, ssl->out_buf, len );
         
         return( MBEDTLS_ERR_SSL_HELLO_VERIFY_REQUIRED );
     }
@@ -3750,7 +4737,7 @@ static int ssl_parse_record_header( mbedtls_ssl_context *ssl )
         return( MBEDTLS_ERR_SSL_INVALID_RECORD );
     }
     
-    /* Check length against the size of our buffer */
+    /* Check length against the size of our buffer (once grown, if needed) */
     if( ssl->in_msglen > MBEDTLS_SSL_BUFFER_LEN
        - (size_t)( ssl->in_msg - ssl->in_buf ) )
     {
@@ -3906,6 +4893,17 @@ static int ssl_prepare_record_content( mbedtls_ssl_context *ssl )
 #endif /* MBEDTLS_SSL_HW_RECORD_ACCEL */
     if( !done && ssl->transform_in != NULL )
     {
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+        /* Room for the padding check, see ssl_in_transform_is_cbc() */
+        if( ssl_in_transform_is_cbc( ssl ) &&
+            (size_t)( ssl->in_msg - ssl->in_buf ) + ssl->in_msglen + 256 >
+            ssl->in_buf_len &&
+            ( ret = ssl_resize_in_buf( ssl, MBEDTLS_SSL_BUFFER_LEN ) ) != 0 )
+        {
+            return( ret );
+        }
+#endif
+
         if( ( ret = ssl_decrypt_buf( ssl ) ) != 0 )
         {
             MBEDTLS_SSL_DEBUG_RET( 1, "ssl_decrypt_buf", ret );
@@ -4228,6 +5226,11 @@ int mbedtls_ssl_send_alert_message( mbedtls_ssl_context *ssl,
     
     MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> send alert message" ) );
     
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+        return( ret );
+#endif
+    
     ssl->out_msgtype = MBEDTLS_SSL_MSG_ALERT;
     ssl->out_msglen = 2;
     ssl->out_msg[0] = level;
@@ -4601,13 +5604,34 @@ MBEDTLS_SSL_PROTO_TLS1_2 */
     if( ssl->conf->endpoint == MBEDTLS_SSL_IS_CLIENT &&
        ssl->renego_status == MBEDTLS_SSL_RENEGOTIATION_IN_PROGRESS )
     {
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+        /*
+         * A session restored by mbedtls_ssl_session_load() may only have
+         * the digest of the server cert
+         */
+        if( ssl->session->peer_cert == NULL &&
+            ssl->session->peer_cert_digest_len != 0 )
+        {
+            unsigned char digest[32];
+
+            mbedtls_sha256( ssl->session_negotiate->peer_cert->raw.p,
+                            ssl->session_negotiate->peer_cert->raw.len,
+                            digest, 0 );
+
+            if( memcmp( digest, ssl->session->peer_cert_digest, 32 ) != 0 )
+            {
+                MBEDTLS_SSL_DEBUG_MSG( 1, ( "server cert changed during renegotiation" ) );
+                return( MBEDTLS_ERR_SSL_BAD_HS_CERTIFICATE );
+            }
+        }
+        else
+#endif /* MBEDTLS_SSL_SESSION_CERT_DIGEST */
         if( ssl->session->peer_cert == NULL )
         {
             MBEDTLS_SSL_DEBUG_MSG( 1, ( "new server cert during renegotiation" ) );
             return( MBEDTLS_ERR_SSL_BAD_HS_CERTIFICATE );
         }
-        
-        if( ssl->session->peer_cert->raw.len !=
+        else if( ssl->session->peer_cert->raw.len !=
            ssl->session_negotiate->peer_cert->raw.len ||
            memcmp( ssl->session->peer_cert->raw.p,
                   ssl->session_negotiate->peer_cert->raw.p,
@@ -4646,6 +5670,7 @@ MBEDTLS_SSL_PROTO_TLS1_2 */
         /*
          * Main check: verify certificate
          */
+        MBEDTLS_SSL_TIMING_BEGIN( ssl );
         ret = mbedtls_x509_crt_verify_with_profile(
                                                    ssl->session_negotiate->peer_cert,
                                                    ca_chain, ca_crl,
@@ -4653,6 +5678,7 @@ MBEDTLS_SSL_PROTO_TLS1_2 */
                                                    ssl->hostname,
                                                    &ssl->session_negotiate->verify_result,
                                                    ssl->conf->f_vrfy, ssl->conf->p_vrfy );
+        MBEDTLS_SSL_TIMING_END( ssl, MBEDTLS_SSL_TIMING_X509_VERIFY );
         
         if( ret != 0 )
         {
@@ -5594,13 +6620,43 @@ int mbedtls_ssl_setup( mbedtls_ssl_context *ssl,
                       const mbedtls_ssl_config *conf )
 {
     int ret;
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    size_t len = MBEDTLS_SSL_IDLE_BUFFER_LEN;
+#else
     const size_t len = MBEDTLS_SSL_BUFFER_LEN;
+#endif
     
     ssl->conf = conf;
     
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS) && defined(MBEDTLS_SSL_PROTO_DTLS)
+    /* A datagram is read in one go, its buffers never change size */
+    if( conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
+        len = MBEDTLS_SSL_BUFFER_LEN;
+#endif
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS) && defined(MBEDTLS_SSL_BUFFER_POOL)
+    /* Pooled buffers always have their full size */
+    if( conf->buf_pool != NULL )
+        len = MBEDTLS_SSL_BUFFER_LEN;
+#endif
+    
     /*
      * Prepare base structures
      */
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( conf->buf_pool != NULL )
+    {
+        if( ( ret = ssl_buffer_pool_get( conf->buf_pool, &ssl->in_buf ) ) != 0 ||
+            ( ret = ssl_buffer_pool_get( conf->buf_pool, &ssl->out_buf ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "ssl_buffer_pool_get", ret );
+            if( ssl->in_buf != NULL )
+                ssl_buffer_pool_put( conf->buf_pool, ssl->in_buf );
+            ssl->in_buf = NULL;
+            return( ret );
+        }
+    }
+    else
+#endif
     if( ( ssl-> in_buf = mbedtls_calloc( 1, len ) ) == NULL ||
        ( ssl->out_buf = mbedtls_calloc( 1, len ) ) == NULL )
     {
@@ -5610,6 +6666,11 @@ int mbedtls_ssl_setup( mbedtls_ssl_context *ssl,
         return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
     }
     
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl->in_buf_len = len;
+    ssl->out_buf_len = len;
+#endif
+    
 #if defined(MBEDTLS_SSL_PROTO_DTLS)
     if( conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
     {
@@ -5658,6 +6719,14 @@ static int ssl_session_reset_int( mbedtls_ssl_context *ssl, int partial )
 {
     int ret;
     
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( ( ret = ssl_acquire_in_buf( ssl ) ) != 0 ||
+        ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+#endif
+    
     ssl->state = MBEDTLS_SSL_HELLO_REQUEST;
     
     /* Cancel any possibly running timer */
@@ -5680,6 +6749,13 @@ static int ssl_session_reset_int( mbedtls_ssl_context *ssl, int partial )
     ssl->in_msglen = 0;
     if( partial == 0 )
         ssl->in_left = 0;
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    ssl->in_hdr_idle_len = 0;
+#endif
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    ssl->in_ahead_start = 0;
+    ssl->in_ahead_end = 0;
+#endif
 #if defined(MBEDTLS_SSL_PROTO_DTLS)
     ssl->next_record_offset = 0;
     ssl->in_epoch = 0;
@@ -5692,6 +6768,9 @@ static int ssl_session_reset_int( mbedtls_ssl_context *ssl, int partial )
     ssl->nb_zero = 0;
     ssl->record_read = 0;
     
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    ssl_end_batch( ssl );
+#endif
     ssl->out_msg = ssl->out_buf + 13;
     ssl->out_msgtype = 0;
     ssl->out_msglen = 0;
@@ -5704,9 +6783,14 @@ static int ssl_session_reset_int( mbedtls_ssl_context *ssl, int partial )
     ssl->transform_in = NULL;
     ssl->transform_out = NULL;
     
-    memset( ssl->out_buf, 0, MBEDTLS_SSL_BUFFER_LEN );
+    memset( ssl->out_buf, 0, MBEDTLS_SSL_OUT_BUFFER_LEN( ssl ) );
     if( partial == 0 )
-        memset( ssl->in_buf, 0, MBEDTLS_SSL_BUFFER_LEN );
+        memset( ssl->in_buf, 0, MBEDTLS_SSL_IN_BUFFER_LEN( ssl ) );
+    
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl->small_records = 0;
+    ssl_shrink_buffers( ssl, 1 );
+#endif
     
 #if defined(MBEDTLS_SSL_HW_RECORD_ACCEL)
     if( mbedtls_ssl_hw_record_reset != NULL )
@@ -5840,6 +6924,12 @@ void mbedtls_ssl_set_bio( mbedtls_ssl_context *ssl,
     ssl->f_recv_timeout = f_recv_timeout;
 }
 
+void mbedtls_ssl_set_bio_vec( mbedtls_ssl_context *ssl,
+                             int (*f_send_vec)(void *, const mbedtls_ssl_iovec *, int) )
+{
+    ssl->f_send_vec     = f_send_vec;
+}
+
 void mbedtls_ssl_conf_read_timeout( mbedtls_ssl_config *conf, uint32_t timeout )
 {
     conf->read_timeout   = timeout;
@@ -5928,6 +7018,81 @@ void mbedtls_ssl_set_milagro_p2p(mbedtls_ssl_handshake_params * handshake, mbedt
 }
 #endif
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS)
+void mbedtls_ssl_conf_milagro_cs( mbedtls_ssl_config *conf,
+                                  mbedtls_milagro_cs_context_pool *pool )
+{
+    conf->milagro_cs_pool = pool;
+}
+#endif
+
+#if defined(MBEDTLS_TLS_MILAGRO_P2P)
+void mbedtls_ssl_conf_milagro_p2p( mbedtls_ssl_config *conf,
+                                   mbedtls_milagro_p2p_context_pool *pool )
+{
+    conf->milagro_p2p_pool = pool;
+}
+#endif
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+void mbedtls_ssl_conf_buffer_pool( mbedtls_ssl_config *conf,
+                                   mbedtls_ssl_buffer_pool *pool )
+{
+    conf->buf_pool = pool;
+}
+#endif
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+void mbedtls_ssl_conf_write_batch( mbedtls_ssl_config *conf,
+                                   unsigned int records )
+{
+    if( records > MBEDTLS_SSL_WRITE_BATCH_MAX )
+        records = MBEDTLS_SSL_WRITE_BATCH_MAX;
+
+    conf->write_batch = records;
+}
+#endif
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+void mbedtls_ssl_conf_read_ahead( mbedtls_ssl_config *conf, size_t len )
+{
+    conf->read_ahead = len;
+}
+#endif
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS) || defined(MBEDTLS_TLS_MILAGRO_P2P)
+/*
+ * Take the Milagro contexts of the handshake from the pools of the
+ * configuration, unless the application has set its own
+ */
+static int ssl_milagro_get_contexts( mbedtls_ssl_context *ssl )
+{
+    int ret;
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS)
+    if( ssl->handshake->milagro_cs == NULL && ssl->conf->milagro_cs_pool != NULL &&
+        ( ret = mbedtls_milagro_cs_context_pool_get( ssl->conf->milagro_cs_pool,
+                                                     &ssl->handshake->milagro_cs ) ) != 0 )
+    {
+        MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_milagro_cs_context_pool_get", ret );
+        return( ret );
+    }
+#endif
+#if defined(MBEDTLS_TLS_MILAGRO_P2P)
+    if( ssl->handshake->milagro_p2p == NULL && ssl->conf->milagro_p2p_pool != NULL &&
+        ( ret = mbedtls_milagro_p2p_context_pool_get( ssl->conf->milagro_p2p_pool,
+                                                      &ssl->handshake->milagro_p2p ) ) != 0 )
+    {
+        MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_milagro_p2p_context_pool_get", ret );
+        return( ret );
+    }
+#endif
+    ((void) ret);
+
+    return( 0 );
+}
+#endif /* MBEDTLS_TLS_MILAGRO_CS || MBEDTLS_TLS_MILAGRO_P2P */
+
 #if defined(MBEDTLS_X509_CRT_PARSE_C)
 void mbedtls_ssl_conf_cert_profile( mbedtls_ssl_config *conf,
                                    const mbedtls_x509_crt_profile *profile )
@@ -6367,6 +7532,26 @@ void mbedtls_ssl_conf_export_keys_cb( mbedtls_ssl_config *conf,
 }
 #endif
 
+#if defined(MBEDTLS_ECDH_C)
+void mbedtls_ssl_conf_keyshare_cb( mbedtls_ssl_config *conf,
+                                   mbedtls_ssl_keyshare_t *f_keyshare,
+                                   void *p_keyshare )
+{
+    conf->f_keyshare = f_keyshare;
+    conf->p_keyshare = p_keyshare;
+}
+#endif
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+void mbedtls_ssl_conf_timing_cb( mbedtls_ssl_config *conf,
+                                 mbedtls_ssl_timing_t *f_timing,
+                                 void *p_timing )
+{
+    conf->f_timing = f_timing;
+    conf->p_timing = p_timing;
+}
+#endif
+
 /*
  * SSL get accessors
  */
@@ -6375,6 +7560,32 @@ size_t mbedtls_ssl_get_bytes_avail( const mbedtls_ssl_context *ssl )
     return( ssl->in_offt == NULL ? 0 : ssl->in_msglen );
 }
 
+int mbedtls_ssl_check_pending( const mbedtls_ssl_context *ssl )
+{
+    /* Application data of the current record */
+    if( ssl->in_offt != NULL )
+        return( 1 );
+    
+    /* More handshake messages in the current record */
+    if( ssl->in_hslen > 0 && ssl->in_hslen < ssl->in_msglen )
+        return( 1 );
+    
+#if defined(MBEDTLS_SSL_PROTO_DTLS)
+    /* More records in the current datagram */
+    if( ssl->conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM &&
+        ssl->in_left > ssl->next_record_offset )
+        return( 1 );
+#endif
+    
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    /* Bytes of the next records already received */
+    if( ssl->in_ahead_end > ssl->in_ahead_start )
+        return( 1 );
+#endif
+    
+    return( 0 );
+}
+
 uint32_t mbedtls_ssl_get_verify_result( const mbedtls_ssl_context *ssl )
 {
     if( ssl->session != NULL )
@@ -6449,6 +7660,7 @@ int mbedtls_ssl_get_record_expansion( const mbedtls_ssl_context *ssl )
     {
         case MBEDTLS_MODE_GCM:
         case MBEDTLS_MODE_CCM:
+        case MBEDTLS_MODE_CHACHAPOLY:
         case MBEDTLS_MODE_STREAM:
             transform_expansion = transform->minlen;
             break;
@@ -6489,6 +7701,28 @@ size_t mbedtls_ssl_get_max_frag_len( const mbedtls_ssl_context *ssl )
 }
 #endif /* MBEDTLS_SSL_MAX_FRAGMENT_LENGTH */
 
+size_t mbedtls_ssl_get_buffer_bytes( const mbedtls_ssl_context *ssl )
+{
+    size_t bytes = 0;
+    
+    if( ssl->in_buf != NULL )
+        bytes += MBEDTLS_SSL_IN_BUFFER_LEN( ssl );
+    if( ssl->out_buf != NULL )
+        bytes += MBEDTLS_SSL_OUT_BUFFER_LEN( ssl );
+#if defined(MBEDTLS_ZLIB_SUPPORT)
+    if( ssl->compress_buf != NULL )
+        bytes += MBEDTLS_SSL_BUFFER_LEN;
+#endif
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    bytes += ssl->out_batch_len;
+#endif
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    bytes += ssl->in_ahead_len;
+#endif
+    
+    return( bytes );
+}
+
 #if defined(MBEDTLS_X509_CRT_PARSE_C)
 const mbedtls_x509_crt *mbedtls_ssl_get_peer_cert( const mbedtls_ssl_context *ssl )
 {
@@ -6520,10 +7754,44 @@ int mbedtls_ssl_get_session( const mbedtls_ssl_context *ssl, mbedtls_ssl_session
 int mbedtls_ssl_handshake_step( mbedtls_ssl_context *ssl )
 {
     int ret = MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE;
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    int state = 0;
+    unsigned long start = 0;
+#endif
     
     if( ssl == NULL || ssl->conf == NULL )
         return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
     
+#if defined(MBEDTLS_TLS_MILAGRO_CS) || defined(MBEDTLS_TLS_MILAGRO_P2P)
+    if( ssl->handshake != NULL && ( ret = ssl_milagro_get_contexts( ssl ) ) != 0 )
+        return( ret );
+#endif
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER &&
+        ( ( ret = ssl_acquire_in_buf( ssl ) ) != 0 ||
+          ( ret = ssl_acquire_out_buf( ssl ) ) != 0 ) )
+    {
+        return( ret );
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    if( ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER &&
+        ( ret = ssl_grow_buffers( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    if( ssl->conf->f_timing != NULL )
+    {
+        state = ssl->state;
+        start = mbedtls_timing_monotonic_us();
+    }
+#endif
+
 #if defined(MBEDTLS_SSL_CLI_C)
     if( ssl->conf->endpoint == MBEDTLS_SSL_IS_CLIENT )
         ret = mbedtls_ssl_handshake_client_step( ssl );
@@ -6532,6 +7800,27 @@ int mbedtls_ssl_handshake_step( mbedtls_ssl_context *ssl )
     if( ssl->conf->endpoint == MBEDTLS_SSL_IS_SERVER )
         ret = mbedtls_ssl_handshake_server_step( ssl );
 #endif
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    if( ssl->conf->f_timing != NULL )
+    {
+        ssl->conf->f_timing( ssl->conf->p_timing, ssl, MBEDTLS_SSL_TIMING_STEP,
+                             state, start, mbedtls_timing_monotonic_us() );
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    if( ret == 0 && ssl->state == MBEDTLS_SSL_HANDSHAKE_OVER )
+        ssl_shrink_buffers( ssl, 1 );
+#endif
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( ret == 0 && ssl->state == MBEDTLS_SSL_HANDSHAKE_OVER )
+    {
+        ssl_release_in_buf( ssl );
+        ssl_release_out_buf( ssl );
+    }
+#endif
     
     return( ret );
 }
@@ -6572,6 +7861,11 @@ static int ssl_write_hello_request( mbedtls_ssl_context *ssl )
     
     MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> write hello request" ) );
     
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+        return( ret );
+#endif
+    
     ssl->out_msglen  = 4;
     ssl->out_msgtype = MBEDTLS_SSL_MSG_HANDSHAKE;
     ssl->out_msg[0]  = MBEDTLS_SSL_HS_HELLO_REQUEST;
@@ -6714,17 +8008,13 @@ static int ssl_check_ctr_renegotiate( mbedtls_ssl_context *ssl )
 #endif /* MBEDTLS_SSL_RENEGOTIATION */
 
 /*
- * Receive application data decrypted from the SSL layer
+ * Make sure decrypted application data is available at ssl->in_offt,
+ * reading a new record if the current one is consumed.
+ * Returns MBEDTLS_ERR_SSL_CONN_EOF if the peer closed the connection.
  */
-int mbedtls_ssl_read( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len )
+static int ssl_read_app_data( mbedtls_ssl_context *ssl )
 {
     int ret, record_read = 0;
-    size_t n;
-    
-    if( ssl == NULL || ssl->conf == NULL )
-        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
-    
-    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> read" ) );
     
 #if defined(MBEDTLS_SSL_PROTO_DTLS)
     if( ssl->conf->transport == MBEDTLS_SSL_TRANSPORT_DATAGRAM )
@@ -6777,7 +8067,7 @@ int mbedtls_ssl_read( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len )
             if( ( ret = mbedtls_ssl_read_record( ssl ) ) != 0 )
             {
                 if( ret == MBEDTLS_ERR_SSL_CONN_EOF )
-                    return( 0 );
+                    return( ret );
                 
                 MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_read_record", ret );
                 return( ret );
@@ -6793,7 +8083,7 @@ int mbedtls_ssl_read( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len )
             if( ( ret = mbedtls_ssl_read_record( ssl ) ) != 0 )
             {
                 if( ret == MBEDTLS_ERR_SSL_CONN_EOF )
-                    return( 0 );
+                    return( ret );
                 
                 MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_read_record", ret );
                 return( ret );
@@ -6928,6 +8218,10 @@ MBEDTLS_SSL_PROTO_TLS1_2 */
         
         ssl->in_offt = ssl->in_msg;
         
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+        ssl_note_record_len( ssl, ssl->in_msglen );
+#endif
+        
         /* We're going to return something now, cancel timer,
          * except if handshake (renegotiation) is in progress */
         if( ssl->state == MBEDTLS_SSL_HANDSHAKE_OVER )
@@ -6951,34 +8245,479 @@ MBEDTLS_SSL_PROTO_TLS1_2 */
 #endif
     }
     
+    return( 0 );
+}
+
+/*
+ * Mark n bytes of application data as consumed
+ */
+static void ssl_read_consume( mbedtls_ssl_context *ssl, size_t n )
+{
+    ssl->in_msglen -= n;
+    
+    if( ssl->in_msglen == 0 )
+    /* all bytes consumed  */
+        ssl->in_offt = NULL;
+    else
+    /* more data available */
+        ssl->in_offt += n;
+    
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl_shrink_buffers( ssl, 0 );
+#endif
+}
+
+/*
+ * Receive application data decrypted from the SSL layer
+ */
+int mbedtls_ssl_read( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len )
+{
+    int ret;
+    size_t n;
+    
+    if( ssl == NULL || ssl->conf == NULL )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> read" ) );
+    
+    if( ( ret = ssl_read_app_data( ssl ) ) != 0 )
+    {
+        if( ret == MBEDTLS_ERR_SSL_CONN_EOF )
+            return( 0 );
+        
+        return( ret );
+    }
+    
     n = ( len < ssl->in_msglen )
     ? len : ssl->in_msglen;
     
     memcpy( buf, ssl->in_offt, n );
-    ssl->in_msglen -= n;
+    ssl_read_consume( ssl, n );
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= read" ) );
+    
+    return( (int) n );
+}
+
+/*
+ * Lend the decrypted application data of the current record, in place
+ */
+int mbedtls_ssl_read_inplace( mbedtls_ssl_context *ssl,
+                              const unsigned char **buf )
+{
+    int ret;
+    
+    if( ssl == NULL || ssl->conf == NULL || buf == NULL )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> read inplace" ) );
+    
+    if( ( ret = ssl_read_app_data( ssl ) ) != 0 )
+    {
+        if( ret == MBEDTLS_ERR_SSL_CONN_EOF )
+            return( 0 );
+        
+        return( ret );
+    }
+    
+    *buf = ssl->in_offt;
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= read inplace" ) );
+    
+    return( (int) ssl->in_msglen );
+}
+
+/*
+ * Give back data lent by mbedtls_ssl_read_inplace()
+ */
+int mbedtls_ssl_read_release( mbedtls_ssl_context *ssl, size_t len )
+{
+    if( ssl == NULL || ssl->in_offt == NULL || len > ssl->in_msglen )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    
+    ssl_read_consume( ssl, len );
+    
+    return( 0 );
+}
+
+/*
+ * Return the record payload of len bytes starting off bytes into the
+ * fragment list if it lies in a single fragment, NULL otherwise
+ */
+static const unsigned char *ssl_iov_contiguous( const mbedtls_ssl_iovec *iov,
+                                                int iovcnt,
+                                                size_t off, size_t len )
+{
+    int i;
+    
+    for( i = 0; i < iovcnt; i++ )
+    {
+        if( off < iov[i].len || ( len == 0 && off == iov[i].len ) )
+            return( iov[i].len - off >= len ? iov[i].base + off : NULL );
+        
+        off -= iov[i].len;
+    }
+    
+    return( NULL );
+}
+
+/*
+ * Copy the record payload of len bytes starting off bytes into the fragment
+ * list to dst
+ */
+static void ssl_iov_gather( unsigned char *dst,
+                            const mbedtls_ssl_iovec *iov, int iovcnt,
+                            size_t off, size_t len )
+{
+    int i;
+    size_t n;
+    
+    for( i = 0; i < iovcnt && len > 0; i++ )
+    {
+        if( off >= iov[i].len )
+        {
+            off -= iov[i].len;
+            continue;
+        }
+        
+        n = iov[i].len - off;
+        if( n > len )
+            n = len;
+        
+        memcpy( dst, iov[i].base + off, n );
+        dst += n;
+        len -= n;
+        off = 0;
+    }
+}
+
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
+/*
+ * Feed the record payload of len bytes starting off bytes into the fragment
+ * list to a GCM or ChaCha20-Poly1305 operation, writing the ciphertext to
+ * out. GCM only accepts a partial block at the end, so blocks straddling two
+ * fragments go through a local buffer.
+ */
+static int ssl_aead_update_iov( mbedtls_cipher_context_t *ctx,
+                               const mbedtls_ssl_iovec *iov, int iovcnt,
+                               size_t off, size_t len, unsigned char *out )
+{
+    int ret = 0, i;
+    unsigned char block[16];
+    const unsigned char *p;
+    size_t n, use_len, fill = 0, olen;
+    
+    for( i = 0; i < iovcnt && len > 0; i++ )
+    {
+        if( off >= iov[i].len )
+        {
+            off -= iov[i].len;
+            continue;
+        }
+        
+        p = iov[i].base + off;
+        n = iov[i].len - off;
+        if( n > len )
+            n = len;
+        len -= n;
+        off = 0;
+        
+        if( fill > 0 )
+        {
+            use_len = 16 - fill < n ? 16 - fill : n;
+            memcpy( block + fill, p, use_len );
+            fill += use_len;
+            p += use_len;
+            n -= use_len;
+            
+            if( fill < 16 )
+                continue;
+            
+            if( ( ret = mbedtls_cipher_update( ctx, block, 16, out, &olen ) ) != 0 )
+                goto exit;
+            out += 16;
+            fill = 0;
+        }
+        
+        /* Whole blocks in place, plus the tail if it ends the payload */
+        use_len = len == 0 ? n : n & ~( (size_t) 15 );
+        if( use_len > 0 )
+        {
+            if( ( ret = mbedtls_cipher_update( ctx, p, use_len, out, &olen ) ) != 0 )
+                goto exit;
+            out += use_len;
+            p += use_len;
+            n -= use_len;
+        }
+        
+        memcpy( block, p, n );
+        fill = n;
+    }
+    
+    if( fill > 0 )
+        ret = mbedtls_cipher_update( ctx, block, fill, out, &olen );
+    
+exit:
+    mbedtls_zeroize( block, sizeof( block ) );
+    
+    return( ret );
+}
+#endif /* MBEDTLS_GCM_C || MBEDTLS_CHACHAPOLY_C */
+
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
+/*
+ * Whether the outgoing application data record can be encrypted from the
+ * caller's fragments (src being the payload if contiguous, or NULL)
+ */
+static int ssl_can_encrypt_iov( const mbedtls_ssl_context *ssl,
+                                const unsigned char *src )
+{
+    mbedtls_cipher_mode_t mode;
+    
+    if( ssl->transform_out == NULL )
+        return( 0 );
+    
+#if defined(MBEDTLS_ZLIB_SUPPORT)
+    if( ssl->session_out->compression == MBEDTLS_SSL_COMPRESS_DEFLATE )
+        return( 0 );
+#endif
+#if defined(MBEDTLS_SSL_HW_RECORD_ACCEL)
+    if( mbedtls_ssl_hw_record_write != NULL )
+        return( 0 );
+#endif
+    
+    mode = mbedtls_cipher_get_cipher_mode( &ssl->transform_out->cipher_ctx_enc );
+    
+#if defined(MBEDTLS_GCM_C)
+    if( mode == MBEDTLS_MODE_GCM )
+        return( 1 );
+#endif
+#if defined(MBEDTLS_CHACHAPOLY_C)
+    if( mode == MBEDTLS_MODE_CHACHAPOLY )
+        return( 1 );
+#endif
+    
+    return( mode == MBEDTLS_MODE_CCM && src != NULL );
+}
+
+/*
+ * Seal the outgoing application data record of out_msglen bytes, starting
+ * off bytes into the fragment list, encrypting straight from the fragments
+ * into out_msg. Counterpart of ssl_seal_record() and ssl_encrypt_buf() for
+ * AEAD records, see ssl_can_encrypt_iov().
+ */
+static int ssl_seal_record_iov( mbedtls_ssl_context *ssl,
+                                 const mbedtls_ssl_iovec *iov, int iovcnt,
+                                 size_t off, const unsigned char *src )
+{
+    int ret;
+    size_t len = ssl->out_msglen, olen = len;
+    unsigned char add_data[13];
+    unsigned char iv[12];
+    unsigned char taglen = ssl->transform_out->ciphersuite_info->flags &
+    MBEDTLS_CIPHERSUITE_SHORT_TAG ? 8 : 16;
+    mbedtls_cipher_context_t *ctx = &ssl->transform_out->cipher_ctx_enc;
+    
+    ssl->out_hdr[0] = (unsigned char) ssl->out_msgtype;
+    mbedtls_ssl_write_version( ssl->major_ver, ssl->minor_ver,
+                              ssl->conf->transport, ssl->out_hdr + 1 );
+    
+    if( ( ret = ssl_prepare_aead_out( ssl, add_data, iv ) ) != 0 )
+        return( ret );
+    
+    if( src != NULL )
+    {
+        ret = mbedtls_cipher_auth_encrypt( ctx, iv, ssl->transform_out->ivlen,
+                                           add_data, 13,
+                                           src, len,
+                                           ssl->out_msg, &olen,
+                                           ssl->out_msg + len, taglen );
+    }
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
+    else if( ( ret = mbedtls_cipher_set_iv( ctx, iv,
+                                         ssl->transform_out->ivlen ) ) != 0 ||
+             ( ret = mbedtls_cipher_reset( ctx ) ) != 0 ||
+             ( ret = mbedtls_cipher_update_ad( ctx, add_data, 13 ) ) != 0 ||
+             ( ret = ssl_aead_update_iov( ctx, iov, iovcnt, off, len,
+                                         ssl->out_msg ) ) != 0 )
+    {
+        ;
+    }
+    else
+        ret = mbedtls_cipher_write_tag( ctx, ssl->out_msg + len, taglen );
+#else
+    else
+        ret = MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+#endif
+    
+    if( ret != 0 )
+    {
+        MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_cipher_auth_encrypt", ret );
+        return( ret );
+    }
+    
+    if( olen != len )
+    {
+        MBEDTLS_SSL_DEBUG_MSG( 1, ( "should never happen" ) );
+        return( MBEDTLS_ERR_SSL_INTERNAL_ERROR );
+    }
+    
+    MBEDTLS_SSL_DEBUG_BUF( 4, "after encrypt: tag", ssl->out_msg + len, taglen );
+    
+    ssl->out_msglen += ssl->transform_out->ivlen -
+                       ssl->transform_out->fixed_ivlen + taglen;
+    ssl->out_len[0] = (unsigned char)( ssl->out_msglen >> 8 );
+    ssl->out_len[1] = (unsigned char)( ssl->out_msglen      );
+    
+    ssl->out_taglen = taglen;
+    ssl->out_left = mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen;
+    
+    MBEDTLS_SSL_DEBUG_BUF( 4, "output record sent to network",
+                          ssl->out_hdr, mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen );
+    
+    return( 0 );
+}
+#endif /* MBEDTLS_GCM_C || MBEDTLS_CCM_C || MBEDTLS_CHACHAPOLY_C */
+
+/*
+ * Seal the application data record of len bytes starting off bytes into
+ * the fragment list, leaving it in the output buffer for flushing
+ */
+static int ssl_seal_app_record( mbedtls_ssl_context *ssl,
+                                const mbedtls_ssl_iovec *iov, int iovcnt,
+                                size_t off, size_t len )
+{
+    int ret;
+    const unsigned char *src = ssl_iov_contiguous( iov, iovcnt, off, len );
+    
+    ssl->out_msglen  = len;
+    ssl->out_msgtype = MBEDTLS_SSL_MSG_APPLICATION_DATA;
+    
+#if defined(MBEDTLS_GCM_C) || defined(MBEDTLS_CCM_C) || defined(MBEDTLS_CHACHAPOLY_C)
+    if( ssl_can_encrypt_iov( ssl, src ) )
+    {
+        if( ( ret = ssl_seal_record_iov( ssl, iov, iovcnt, off, src ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "ssl_seal_record_iov", ret );
+            return( ret );
+        }
+        
+        return( 0 );
+    }
+#endif
+    
+    if( src != NULL )
+        memcpy( ssl->out_msg, src, len );
+    else
+        ssl_iov_gather( ssl->out_msg, iov, iovcnt, off, len );
+    
+    if( ( ret = ssl_seal_record( ssl ) ) != 0 )
+    {
+        MBEDTLS_SSL_DEBUG_RET( 1, "ssl_seal_record", ret );
+        return( ret );
+    }
+    
+    return( 0 );
+}
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+/*
+ * Seal the len bytes starting off bytes into the fragment list as
+ * consecutive records of at most max_len bytes in the staging area, to be
+ * sent by a single flush. The record pointers follow the last record until
+ * the flush is complete, see ssl_end_batch().
+ */
+static int ssl_seal_batch( mbedtls_ssl_context *ssl,
+                           const mbedtls_ssl_iovec *iov, int iovcnt,
+                           size_t off, size_t len, size_t max_len )
+{
+    int ret;
+    size_t done, n, total = 0, size;
+    size_t records = ( len - 1 ) / max_len + 1;
+    size_t len_off = ssl->out_len - ssl->out_hdr;
+    size_t iv_off  = ssl->out_iv  - ssl->out_hdr;
+    size_t msg_off = ssl->out_msg - ssl->out_hdr;
+    unsigned char *p;
+    
+    /* Each record takes at most a whole buffer but for the counter */
+    if( records > (size_t) -1 / ( MBEDTLS_SSL_BUFFER_LEN - 8 ) )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    
+    size = records * ( MBEDTLS_SSL_BUFFER_LEN - 8 );
+    
+    if( ssl->out_batch_len < size )
+    {
+        ssl_free_out_batch( ssl );
+        
+        if( ( ssl->out_batch = mbedtls_calloc( 1, size ) ) == NULL )
+        {
+            MBEDTLS_SSL_DEBUG_MSG( 1, ( "alloc(%d bytes) failed", size ) );
+            return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+        }
+        
+        ssl->out_batch_len = size;
+    }
+    
+    p = ssl->out_batch;
+    
+    for( done = 0; done < len; done += n )
+    {
+        /* The last record's counter is incremented by the flush */
+        if( ssl->out_batched > 0 )
+        {
+            if( ( ret = ssl_out_ctr_increment( ssl ) ) != 0 )
+            {
+                ssl_end_batch( ssl );
+                return( ret );
+            }
+            
+            p += mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen;
+        }
+        
+        ssl->out_hdr = p;
+        ssl->out_len = p + len_off;
+        ssl->out_iv  = p + iv_off;
+        ssl->out_msg = p + msg_off;
+        ssl->out_batched++;
+        
+        n = len - done < max_len ? len - done : max_len;
+        
+        if( ( ret = ssl_seal_app_record( ssl, iov, iovcnt, off + done, n ) ) != 0 )
+        {
+            ssl_end_batch( ssl );
+            return( ret );
+        }
+        
+        total += mbedtls_ssl_hdr_len( ssl ) + ssl->out_msglen;
+    }
     
-    if( ssl->in_msglen == 0 )
-    /* all bytes consumed  */
-        ssl->in_offt = NULL;
-    else
-    /* more data available */
-        ssl->in_offt += n;
+    MBEDTLS_SSL_DEBUG_MSG( 3, ( "batched %d records, %d bytes",
+                                ssl->out_batched, total ) );
     
-    MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= read" ) );
+    ssl->out_left = total;
     
-    return( (int) n );
+    return( 0 );
 }
+#endif /* MBEDTLS_SSL_WRITE_BATCH */
 
 /*
  * Send application data to be encrypted by the SSL layer,
- * taking care of max fragment length and buffer size
+ * taking care of max fragment length and buffer size.
+ * The data is the len bytes starting off bytes into the fragment list.
  */
 static int ssl_write_real( mbedtls_ssl_context *ssl,
-                          const unsigned char *buf, size_t len )
+                          const mbedtls_ssl_iovec *iov, int iovcnt,
+                          size_t off, size_t len )
 {
     int ret;
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    size_t records;
+#endif
 #if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
     size_t max_len = mbedtls_ssl_get_max_frag_len( ssl );
+#else
+    size_t max_len = MBEDTLS_SSL_MAX_CONTENT_LEN;
+#endif
     
     if( len > max_len )
     {
@@ -6990,11 +8729,19 @@ static int ssl_write_real( mbedtls_ssl_context *ssl,
                                        len, max_len ) );
             return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
         }
-        else
 #endif
-            len = max_len;
+        
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+        records = len / max_len + ( len % max_len != 0 );
+        if( records > ssl->conf->write_batch )
+        {
+            records = ssl->conf->write_batch > 1 ? ssl->conf->write_batch : 1;
+            len = records * max_len;
+        }
+#else
+        len = max_len;
+#endif
     }
-#endif /* MBEDTLS_SSL_MAX_FRAGMENT_LENGTH */
     
     if( ssl->out_left != 0 )
     {
@@ -7006,17 +8753,43 @@ static int ssl_write_real( mbedtls_ssl_context *ssl,
     }
     else
     {
-        ssl->out_msglen  = len;
-        ssl->out_msgtype = MBEDTLS_SSL_MSG_APPLICATION_DATA;
-        memcpy( ssl->out_msg, buf, len );
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+        if( ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+            return( ret );
+#endif
         
-        if( ( ret = mbedtls_ssl_write_record( ssl ) ) != 0 )
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+        ssl_note_record_len( ssl, len );
+        
+        /* Batched records are sealed in out_batch, not in out_buf */
+        if( len > SSL_IDLE_PAYLOAD_LEN && len <= max_len &&
+            ( ret = ssl_resize_out_buf( ssl, MBEDTLS_SSL_BUFFER_LEN ) ) != 0 )
         {
-            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_write_record", ret );
+            return( ret );
+        }
+#endif
+        
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+        if( len > max_len )
+            ret = ssl_seal_batch( ssl, iov, iovcnt, off, len, max_len );
+        else
+#endif
+            ret = ssl_seal_app_record( ssl, iov, iovcnt, off, len );
+        
+        if( ret != 0 )
+            return( ret );
+        
+        if( ( ret = mbedtls_ssl_flush_output( ssl ) ) != 0 )
+        {
+            MBEDTLS_SSL_DEBUG_RET( 1, "mbedtls_ssl_flush_output", ret );
             return( ret );
         }
     }
     
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    ssl_shrink_buffers( ssl, 0 );
+#endif
+    
     return( (int) len );
 }
 
@@ -7029,7 +8802,8 @@ static int ssl_write_real( mbedtls_ssl_context *ssl,
  */
 #if defined(MBEDTLS_SSL_CBC_RECORD_SPLITTING)
 static int ssl_write_split( mbedtls_ssl_context *ssl,
-                           const unsigned char *buf, size_t len )
+                           const mbedtls_ssl_iovec *iov, int iovcnt,
+                           size_t len )
 {
     int ret;
     
@@ -7040,17 +8814,17 @@ static int ssl_write_split( mbedtls_ssl_context *ssl,
        mbedtls_cipher_get_cipher_mode( &ssl->transform_out->cipher_ctx_enc )
        != MBEDTLS_MODE_CBC )
     {
-        return( ssl_write_real( ssl, buf, len ) );
+        return( ssl_write_real( ssl, iov, iovcnt, 0, len ) );
     }
     
     if( ssl->split_done == 0 )
     {
-        if( ( ret = ssl_write_real( ssl, buf, 1 ) ) <= 0 )
+        if( ( ret = ssl_write_real( ssl, iov, iovcnt, 0, 1 ) ) <= 0 )
             return( ret );
         ssl->split_done = 1;
     }
     
-    if( ( ret = ssl_write_real( ssl, buf + 1, len - 1 ) ) <= 0 )
+    if( ( ret = ssl_write_real( ssl, iov, iovcnt, 1, len - 1 ) ) <= 0 )
         return( ret );
     ssl->split_done = 0;
     
@@ -7059,17 +8833,14 @@ static int ssl_write_split( mbedtls_ssl_context *ssl,
 #endif /* MBEDTLS_SSL_CBC_RECORD_SPLITTING */
 
 /*
- * Write application data (public-facing wrapper)
+ * Write application data gathered from iovcnt fragments
  */
-int mbedtls_ssl_write( mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len )
+static int ssl_write_iov( mbedtls_ssl_context *ssl,
+                          const mbedtls_ssl_iovec *iov, int iovcnt,
+                          size_t len )
 {
     int ret;
     
-    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> write" ) );
-    
-    if( ssl == NULL || ssl->conf == NULL )
-        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
-    
 #if defined(MBEDTLS_SSL_RENEGOTIATION)
     if( ( ret = ssl_check_ctr_renegotiate( ssl ) ) != 0 )
     {
@@ -7088,16 +8859,70 @@ int mbedtls_ssl_write( mbedtls_ssl_context *ssl, const unsigned char *buf, size_
     }
     
 #if defined(MBEDTLS_SSL_CBC_RECORD_SPLITTING)
-    ret = ssl_write_split( ssl, buf, len );
+    ret = ssl_write_split( ssl, iov, iovcnt, len );
 #else
-    ret = ssl_write_real( ssl, buf, len );
+    ret = ssl_write_real( ssl, iov, iovcnt, 0, len );
 #endif
     
+    return( ret );
+}
+
+/*
+ * Write application data (public-facing wrapper)
+ */
+int mbedtls_ssl_write( mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len )
+{
+    int ret;
+    mbedtls_ssl_iovec iov;
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> write" ) );
+    
+    if( ssl == NULL || ssl->conf == NULL )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    
+    iov.base = buf;
+    iov.len  = len;
+    
+    ret = ssl_write_iov( ssl, &iov, 1, len );
+    
     MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= write" ) );
     
     return( ret );
 }
 
+/*
+ * Write application data from several buffers (public-facing wrapper)
+ */
+int mbedtls_ssl_writev( mbedtls_ssl_context *ssl,
+                        const mbedtls_ssl_iovec *iov, int iovcnt )
+{
+    int ret, i;
+    size_t len = 0;
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> writev" ) );
+    
+    if( ssl == NULL || ssl->conf == NULL || iovcnt < 0 ||
+        ( iov == NULL && iovcnt > 0 ) )
+    {
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    }
+    
+    /* Saturate, as at most a few records' worth is written anyway */
+    for( i = 0; i < iovcnt; i++ )
+    {
+        if( iov[i].base == NULL && iov[i].len > 0 )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+        
+        len = len + iov[i].len < len ? (size_t) -1 : len + iov[i].len;
+    }
+    
+    ret = ssl_write_iov( ssl, iov, iovcnt, len );
+    
+    MBEDTLS_SSL_DEBUG_MSG( 2, ( "<= writev" ) );
+    
+    return( ret );
+}
+
 /*
  * Notify the peer that the connection is being closed
  */
@@ -7196,10 +9021,19 @@ defined(MBEDTLS_SSL_PROTO_TLS1_1)
 #endif
 #endif
 #if defined(MBEDTLS_TLS_MILAGRO_CS)
-    mbedtls_milagro_cs_free(handshake->milagro_cs);
+    /* A reusable context outlives the handshake, it is owned by the caller */
+    if( handshake->milagro_cs != NULL && handshake->milagro_cs->pool != NULL )
+        mbedtls_milagro_cs_context_pool_put( handshake->milagro_cs );
+    else if( handshake->milagro_cs != NULL && handshake->milagro_cs->reusable )
+        mbedtls_milagro_cs_reset( handshake->milagro_cs );
+    else
+        mbedtls_milagro_cs_free(handshake->milagro_cs);
 #endif
 #if defined(MBEDTLS_TLS_MILAGRO_P2P)
-    mbedtls_milagro_p2p_free(handshake->milagro_p2p);
+    if( handshake->milagro_p2p != NULL && handshake->milagro_p2p->pool != NULL )
+        mbedtls_milagro_p2p_context_pool_put( handshake->milagro_p2p );
+    else
+        mbedtls_milagro_p2p_free(handshake->milagro_p2p);
 #endif
 #if defined(MBEDTLS_ECDH_C) || defined(MBEDTLS_ECDSA_C)
     /* explicit void pointer cast for buggy MS compiler */
@@ -7262,6 +9096,358 @@ void mbedtls_ssl_session_free( mbedtls_ssl_session *session )
     mbedtls_zeroize( session, sizeof( mbedtls_ssl_session ) );
 }
 
+/*
+ * Serialize a session, in the following format (big-endian):
+ *
+ *     1 byte   format version
+ *     1 byte   flags
+ *     8 bytes  start time, if SSL_SESSION_HAS_TIME
+ *     2 bytes  ciphersuite
+ *     1 byte   compression
+ *     1 byte   id_len
+ *    id_len    session id
+ *    48 bytes  master secret
+ *     4 bytes  verify_result
+ *     1 byte   mfl_code
+ *     1 byte   peer certificate type
+ *     3 bytes  length of the DER, then the DER, if SSL_SESSION_CERT_DER
+ *    32 bytes  SHA-256 of the DER, if SSL_SESSION_CERT_DIGEST
+ *     2 bytes  ticket length, then the ticket and its 4-byte lifetime,
+ *              if SSL_SESSION_HAS_TICKET
+ *
+ * Unlike a copy of mbedtls_ssl_session, it doesn't depend on the layout
+ * of the structure, and only takes a few bytes beyond the secrets.
+ */
+#define SSL_SESSION_FORMAT_VERSION      1
+
+#define SSL_SESSION_HAS_TIME            0x01
+#define SSL_SESSION_TRUNC_HMAC          0x02
+#define SSL_SESSION_ENCRYPT_THEN_MAC    0x04
+#define SSL_SESSION_HAS_TICKET          0x08
+
+#define SSL_SESSION_CERT_NONE           0
+#define SSL_SESSION_CERT_DER            1
+#define SSL_SESSION_CERT_DIGEST         2
+
+int mbedtls_ssl_session_save( const mbedtls_ssl_session *session,
+                              unsigned char *buf, size_t buf_len,
+                              size_t *olen )
+{
+    unsigned char *p = buf;
+    unsigned char flags = 0;
+    unsigned char cert_type = SSL_SESSION_CERT_NONE;
+    size_t needed;
+#if defined(MBEDTLS_HAVE_TIME)
+    uint64_t start;
+#endif
+#if defined(MBEDTLS_X509_CRT_PARSE_C) && !defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    size_t cert_len = 0;
+#endif
+
+    if( session->id_len > sizeof( session->id ) )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+#if defined(MBEDTLS_HAVE_TIME)
+    flags |= SSL_SESSION_HAS_TIME;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    if( session->trunc_hmac != 0 )
+        flags |= SSL_SESSION_TRUNC_HMAC;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    if( session->encrypt_then_mac != 0 )
+        flags |= SSL_SESSION_ENCRYPT_THEN_MAC;
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    if( session->ticket != NULL )
+    {
+        if( session->ticket_len > 0xFFFF )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+        flags |= SSL_SESSION_HAS_TICKET;
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    if( session->peer_cert != NULL || session->peer_cert_digest_len != 0 )
+        cert_type = SSL_SESSION_CERT_DIGEST;
+#elif defined(MBEDTLS_X509_CRT_PARSE_C)
+    if( session->peer_cert != NULL )
+    {
+        cert_type = SSL_SESSION_CERT_DER;
+        cert_len = session->peer_cert->raw.len;
+
+        if( cert_len > 0xFFFFFF )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+    }
+#endif
+
+    needed = 2 + 2 + 1 + 1 + session->id_len + 48 + 4 + 1 + 1;
+    if( flags & SSL_SESSION_HAS_TIME )
+        needed += 8;
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    if( cert_type == SSL_SESSION_CERT_DIGEST )
+        needed += 32;
+#elif defined(MBEDTLS_X509_CRT_PARSE_C)
+    if( cert_type == SSL_SESSION_CERT_DER )
+        needed += 3 + cert_len;
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    if( flags & SSL_SESSION_HAS_TICKET )
+        needed += 2 + session->ticket_len + 4;
+#endif
+
+    *olen = needed;
+
+    if( buf_len < needed )
+        return( MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL );
+
+    *p++ = SSL_SESSION_FORMAT_VERSION;
+    *p++ = flags;
+
+#if defined(MBEDTLS_HAVE_TIME)
+    start = (uint64_t) session->start;
+    *p++ = (unsigned char)( start >> 56 );
+    *p++ = (unsigned char)( start >> 48 );
+    *p++ = (unsigned char)( start >> 40 );
+    *p++ = (unsigned char)( start >> 32 );
+    *p++ = (unsigned char)( start >> 24 );
+    *p++ = (unsigned char)( start >> 16 );
+    *p++ = (unsigned char)( start >>  8 );
+    *p++ = (unsigned char)( start       );
+#endif
+
+    *p++ = (unsigned char)( session->ciphersuite >> 8 );
+    *p++ = (unsigned char)( session->ciphersuite      );
+    *p++ = (unsigned char)( session->compression      );
+
+    *p++ = (unsigned char)( session->id_len );
+    memcpy( p, session->id, session->id_len );
+    p += session->id_len;
+
+    memcpy( p, session->master, 48 );
+    p += 48;
+
+    *p++ = (unsigned char)( session->verify_result >> 24 );
+    *p++ = (unsigned char)( session->verify_result >> 16 );
+    *p++ = (unsigned char)( session->verify_result >>  8 );
+    *p++ = (unsigned char)( session->verify_result       );
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    *p++ = session->mfl_code;
+#else
+    *p++ = 0;
+#endif
+
+    *p++ = cert_type;
+
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    if( cert_type == SSL_SESSION_CERT_DIGEST )
+    {
+        if( session->peer_cert != NULL )
+            mbedtls_sha256( session->peer_cert->raw.p,
+                            session->peer_cert->raw.len, p, 0 );
+        else
+            memcpy( p, session->peer_cert_digest, 32 );
+        p += 32;
+    }
+#elif defined(MBEDTLS_X509_CRT_PARSE_C)
+    if( cert_type == SSL_SESSION_CERT_DER )
+    {
+        *p++ = (unsigned char)( cert_len >> 16 );
+        *p++ = (unsigned char)( cert_len >>  8 );
+        *p++ = (unsigned char)( cert_len       );
+        memcpy( p, session->peer_cert->raw.p, cert_len );
+        p += cert_len;
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    if( flags & SSL_SESSION_HAS_TICKET )
+    {
+        *p++ = (unsigned char)( session->ticket_len >> 8 );
+        *p++ = (unsigned char)( session->ticket_len      );
+        memcpy( p, session->ticket, session->ticket_len );
+        p += session->ticket_len;
+
+        *p++ = (unsigned char)( session->ticket_lifetime >> 24 );
+        *p++ = (unsigned char)( session->ticket_lifetime >> 16 );
+        *p++ = (unsigned char)( session->ticket_lifetime >>  8 );
+        *p++ = (unsigned char)( session->ticket_lifetime       );
+    }
+#endif
+
+    return( 0 );
+}
+
+/*
+ * Unserialize a session, see mbedtls_ssl_session_save()
+ */
+int mbedtls_ssl_session_load( mbedtls_ssl_session *session,
+                              const unsigned char *buf, size_t len )
+{
+    const unsigned char *p = buf;
+    const unsigned char * const end = buf + len;
+    unsigned char flags, cert_type;
+    size_t n;
+
+    if( len < 2 || p[0] != SSL_SESSION_FORMAT_VERSION )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    flags = p[1];
+    p += 2;
+
+    if( ( flags & ~( SSL_SESSION_HAS_TIME | SSL_SESSION_TRUNC_HMAC |
+                     SSL_SESSION_ENCRYPT_THEN_MAC |
+                     SSL_SESSION_HAS_TICKET ) ) != 0 )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    if( flags & SSL_SESSION_HAS_TIME )
+    {
+        if( end - p < 8 )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+#if defined(MBEDTLS_HAVE_TIME)
+        session->start = (time_t)( ( (uint64_t) p[0] << 56 ) |
+                                   ( (uint64_t) p[1] << 48 ) |
+                                   ( (uint64_t) p[2] << 40 ) |
+                                   ( (uint64_t) p[3] << 32 ) |
+                                   ( (uint64_t) p[4] << 24 ) |
+                                   ( (uint64_t) p[5] << 16 ) |
+                                   ( (uint64_t) p[6] <<  8 ) |
+                                   ( (uint64_t) p[7]       ) );
+#endif
+        p += 8;
+    }
+
+    if( end - p < 4 )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    session->ciphersuite = ( p[0] << 8 ) | p[1];
+    session->compression = p[2];
+    session->id_len = p[3];
+    p += 4;
+
+    if( session->id_len > sizeof( session->id ) ||
+        (size_t)( end - p ) < session->id_len + 48 + 4 + 1 + 1 )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    memcpy( session->id, p, session->id_len );
+    p += session->id_len;
+
+    memcpy( session->master, p, 48 );
+    p += 48;
+
+    session->verify_result = ( (uint32_t) p[0] << 24 ) |
+                             ( (uint32_t) p[1] << 16 ) |
+                             ( (uint32_t) p[2] <<  8 ) |
+                             ( (uint32_t) p[3]       );
+    p += 4;
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    session->mfl_code = p[0];
+#endif
+    cert_type = p[1];
+    p += 2;
+
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    session->trunc_hmac = ( flags & SSL_SESSION_TRUNC_HMAC ) != 0;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    session->encrypt_then_mac = ( flags & SSL_SESSION_ENCRYPT_THEN_MAC ) != 0;
+#endif
+
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    session->peer_cert = NULL;
+#endif
+
+    if( cert_type == SSL_SESSION_CERT_DER )
+    {
+        if( end - p < 3 )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+        n = ( p[0] << 16 ) | ( p[1] << 8 ) | p[2];
+        p += 3;
+
+        if( n == 0 || (size_t)( end - p ) < n )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+        {
+            int ret;
+
+            session->peer_cert = mbedtls_calloc( 1, sizeof( mbedtls_x509_crt ) );
+            if( session->peer_cert == NULL )
+                return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+
+            mbedtls_x509_crt_init( session->peer_cert );
+
+            if( ( ret = mbedtls_x509_crt_parse_der( session->peer_cert,
+                                                    p, n ) ) != 0 )
+            {
+                mbedtls_x509_crt_free( session->peer_cert );
+                mbedtls_free( session->peer_cert );
+                session->peer_cert = NULL;
+                return( ret );
+            }
+        }
+#endif /* MBEDTLS_X509_CRT_PARSE_C */
+
+        p += n;
+    }
+    else if( cert_type == SSL_SESSION_CERT_DIGEST )
+    {
+        if( end - p < 32 )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+        memcpy( session->peer_cert_digest, p, 32 );
+        session->peer_cert_digest_len = 32;
+#else
+        return( MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE );
+#endif
+
+        p += 32;
+    }
+    else if( cert_type != SSL_SESSION_CERT_NONE )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    if( flags & SSL_SESSION_HAS_TICKET )
+    {
+        if( end - p < 2 )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+        n = ( p[0] << 8 ) | p[1];
+        p += 2;
+
+        if( (size_t)( end - p ) < n + 4 )
+            return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+        if( n != 0 )
+        {
+            if( ( session->ticket = mbedtls_calloc( 1, n ) ) == NULL )
+                return( MBEDTLS_ERR_SSL_ALLOC_FAILED );
+
+            memcpy( session->ticket, p, n );
+        }
+        session->ticket_len = n;
+
+        session->ticket_lifetime = ( (uint32_t) p[n    ] << 24 ) |
+                                   ( (uint32_t) p[n + 1] << 16 ) |
+                                   ( (uint32_t) p[n + 2] <<  8 ) |
+                                   ( (uint32_t) p[n + 3]       );
+#endif
+
+        p += n + 4;
+    }
+
+    if( p != end )
+        return( MBEDTLS_ERR_SSL_BAD_INPUT_DATA );
+
+    return( 0 );
+}
+
 /*
  * Free an SSL context
  */
@@ -7272,15 +9458,40 @@ void mbedtls_ssl_free( mbedtls_ssl_context *ssl )
     
     MBEDTLS_SSL_DEBUG_MSG( 2, ( "=> free" ) );
     
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( ssl->conf != NULL && ssl->conf->buf_pool != NULL )
+    {
+        if( ssl->out_buf != NULL )
+            ssl_buffer_pool_put( ssl->conf->buf_pool, ssl->out_buf );
+        if( ssl->in_buf != NULL )
+            ssl_buffer_pool_put( ssl->conf->buf_pool, ssl->in_buf );
+        ssl->out_buf = NULL;
+        ssl->in_buf = NULL;
+    }
+#endif
+    
     if( ssl->out_buf != NULL )
     {
-        mbedtls_zeroize( ssl->out_buf, MBEDTLS_SSL_BUFFER_LEN );
+        mbedtls_zeroize( ssl->out_buf, MBEDTLS_SSL_OUT_BUFFER_LEN( ssl ) );
         mbedtls_free( ssl->out_buf );
     }
     
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    ssl->out_batched = 0;
+    ssl_free_out_batch( ssl );
+#endif
+    
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    if( ssl->in_ahead != NULL )
+    {
+        mbedtls_zeroize( ssl->in_ahead, ssl->in_ahead_len );
+        mbedtls_free( ssl->in_ahead );
+    }
+#endif
+    
     if( ssl->in_buf != NULL )
     {
-        mbedtls_zeroize( ssl->in_buf, MBEDTLS_SSL_BUFFER_LEN );
+        mbedtls_zeroize( ssl->in_buf, MBEDTLS_SSL_IN_BUFFER_LEN( ssl ) );
         mbedtls_free( ssl->in_buf );
     }
     
@@ -7452,6 +9663,14 @@ int mbedtls_ssl_config_defaults( mbedtls_ssl_config *conf,
     conf->renego_period[7] = 0x00;
 #endif
     
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    conf->write_batch = MBEDTLS_SSL_WRITE_BATCH_RECORDS;
+#endif
+    
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    conf->read_ahead = MBEDTLS_SSL_READ_AHEAD_LEN;
+#endif
+    
 #if defined(MBEDTLS_DHM_C) && defined(MBEDTLS_SSL_SRV_C)
     if( endpoint == MBEDTLS_SSL_IS_SERVER )
     {
@@ -256,6 +256,18 @@ unsigned long mbedtls_timing_get_timer( struct mbedtls_timing_hr_time *val, int
     return( delta );
 }
 
+unsigned long mbedtls_timing_monotonic_us( void )
+{
+    LARGE_INTEGER count, hfreq;
+
+    QueryPerformanceCounter(  &count );
+    QueryPerformanceFrequency( &hfreq );
+
+    return( (unsigned long)( ( count.QuadPart / hfreq.QuadPart ) * 1000000 +
+                             ( count.QuadPart % hfreq.QuadPart ) * 1000000 /
+                             hfreq.QuadPart ) );
+}
+
 /* It's OK to use a global because alarm() is supposed to be global anyway */
 static DWORD alarmMs;
 
@@ -299,6 +311,23 @@ unsigned long mbedtls_timing_get_timer( struct mbedtls_timing_hr_time *val, int
     return( delta );
 }
 
+unsigned long mbedtls_timing_monotonic_us( void )
+{
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0 && defined(CLOCK_MONOTONIC)
+    struct timespec now;
+
+    if( clock_gettime( CLOCK_MONOTONIC, &now ) == 0 )
+        return( (unsigned long) now.tv_sec * 1000000 + now.tv_nsec / 1000 );
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday( &tv, NULL );
+
+        return( (unsigned long) tv.tv_sec * 1000000 + tv.tv_usec );
+    }
+}
+
 static void sighandler( int signum )
 {
     mbedtls_timing_alarmed = 1;
@@ -381,9 +381,30 @@ static const char *features[] = {
 #if defined(MBEDTLS_SSL_SESSION_TICKETS)
     "MBEDTLS_SSL_SESSION_TICKETS",
 #endif /* MBEDTLS_SSL_SESSION_TICKETS */
+#if defined(MBEDTLS_SSL_SESSION_CERT_DIGEST)
+    "MBEDTLS_SSL_SESSION_CERT_DIGEST",
+#endif /* MBEDTLS_SSL_SESSION_CERT_DIGEST */
+#if defined(MBEDTLS_SSL_TICKET_LOCKLESS)
+    "MBEDTLS_SSL_TICKET_LOCKLESS",
+#endif /* MBEDTLS_SSL_TICKET_LOCKLESS */
 #if defined(MBEDTLS_SSL_EXPORT_KEYS)
     "MBEDTLS_SSL_EXPORT_KEYS",
 #endif /* MBEDTLS_SSL_EXPORT_KEYS */
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    "MBEDTLS_SSL_HANDSHAKE_TIMING",
+#endif /* MBEDTLS_SSL_HANDSHAKE_TIMING */
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFERS)
+    "MBEDTLS_SSL_VARIABLE_BUFFERS",
+#endif /* MBEDTLS_SSL_VARIABLE_BUFFERS */
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    "MBEDTLS_SSL_BUFFER_POOL",
+#endif /* MBEDTLS_SSL_BUFFER_POOL */
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    "MBEDTLS_SSL_WRITE_BATCH",
+#endif /* MBEDTLS_SSL_WRITE_BATCH */
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    "MBEDTLS_SSL_READ_AHEAD",
+#endif /* MBEDTLS_SSL_READ_AHEAD */
 #if defined(MBEDTLS_SSL_SERVER_NAME_INDICATION)
     "MBEDTLS_SSL_SERVER_NAME_INDICATION",
 #endif /* MBEDTLS_SSL_SERVER_NAME_INDICATION */
@@ -450,6 +471,12 @@ static const char *features[] = {
 #if defined(MBEDTLS_CERTS_C)
     "MBEDTLS_CERTS_C",
 #endif /* MBEDTLS_CERTS_C */
+#if defined(MBEDTLS_CHACHA20_C)
+    "MBEDTLS_CHACHA20_C",
+#endif /* MBEDTLS_CHACHA20_C */
+#if defined(MBEDTLS_CHACHAPOLY_C)
+    "MBEDTLS_CHACHAPOLY_C",
+#endif /* MBEDTLS_CHACHAPOLY_C */
 #if defined(MBEDTLS_CIPHER_C)
     "MBEDTLS_CIPHER_C",
 #endif /* MBEDTLS_CIPHER_C */
@@ -543,6 +570,9 @@ static const char *features[] = {
 #if defined(MBEDTLS_PLATFORM_C)
     "MBEDTLS_PLATFORM_C",
 #endif /* MBEDTLS_PLATFORM_C */
+#if defined(MBEDTLS_POLY1305_C)
+    "MBEDTLS_POLY1305_C",
+#endif /* MBEDTLS_POLY1305_C */
 #if defined(MBEDTLS_RIPEMD160_C)
     "MBEDTLS_RIPEMD160_C",
 #endif /* MBEDTLS_RIPEMD160_C */
@@ -561,9 +591,15 @@ static const char *features[] = {
 #if defined(MBEDTLS_SSL_CACHE_C)
     "MBEDTLS_SSL_CACHE_C",
 #endif /* MBEDTLS_SSL_CACHE_C */
+#if defined(MBEDTLS_SSL_CACHE_SHM_C)
+    "MBEDTLS_SSL_CACHE_SHM_C",
+#endif /* MBEDTLS_SSL_CACHE_SHM_C */
 #if defined(MBEDTLS_SSL_COOKIE_C)
     "MBEDTLS_SSL_COOKIE_C",
 #endif /* MBEDTLS_SSL_COOKIE_C */
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+    "MBEDTLS_SSL_KEYSHARE_C",
+#endif /* MBEDTLS_SSL_KEYSHARE_C */
 #if defined(MBEDTLS_SSL_TICKET_C)
     "MBEDTLS_SSL_TICKET_C",
 #endif /* MBEDTLS_SSL_TICKET_C */
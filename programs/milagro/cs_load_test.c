@@ -0,0 +1,525 @@
+/*
+ Licensed to the Apache Software Foundation (ASF) under one
+ or more contributor license agreements.  See the NOTICE file
+ distributed with this work for additional information
+ regarding copyright ownership.  The ASF licenses this file
+ to you under the Apache License, Version 2.0 (the
+ "License"); you may not use this file except in compliance
+ with the License.  You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing,
+ software distributed under the License is distributed on an
+ "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ KIND, either express or implied.  See the License for the
+ specific language governing permissions and limitations
+ under the License.
+ */
+
+/*
+ *
+ * cs_load_test.c
+ *
+ * A burst of MILAGRO_CS handshakes served by a single event loop, over
+ * in-memory transports. Reports how long each connection waited for its
+ * ServerHello (accept latency) and the longest time the loop was blocked
+ * in a single mbedtls_ssl_handshake() call, with the authentication of
+ * the clients done inline or in a worker pool.
+ *
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#include <stdio.h>
+#define mbedtls_free       free
+#define mbedtls_calloc    calloc
+#define mbedtls_printf     printf
+
+#if !defined(MBEDTLS_ENTROPY_C) || !defined(MBEDTLS_CTR_DRBG_C) || \
+    !defined(MBEDTLS_SSL_TLS_C) || !defined(MBEDTLS_SSL_SRV_C) || \
+    !defined(MBEDTLS_SSL_CLI_C) || !defined(MBEDTLS_TIMING_C) || \
+    !defined(MBEDTLS_TLS_MILAGRO_CS)
+int main( void )
+{
+    mbedtls_printf("MBEDTLS_ENTROPY_C and/or MBEDTLS_CTR_DRBG_C and/or "
+           "MBEDTLS_SSL_TLS_C and/or MBEDTLS_SSL_SRV_C and/or "
+           "MBEDTLS_SSL_CLI_C and/or MBEDTLS_TIMING_C and/or "
+           "MBEDTLS_TLS_MILAGRO_CS not defined.\n");
+    return( 0 );
+}
+#else
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/timing.h"
+#include "mbedtls/milagro.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DFL_CLIENTS             64
+#define DFL_WORKERS             0
+#define DFL_BATCH               1
+#define DFL_WINDOW              0
+#define DFL_CLIENT_IDENTITY     "client@miracl.com"
+
+#define PIPE_LEN                16384
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+#define USAGE_WORKERS \
+    "    workers=%%d          default: 0 (authenticate inline)\n" \
+    "    batch=%%d            default: 1 (clients per batch)\n"    \
+    "    window=%%d           default: 0 (ms to fill a batch)\n"
+#else
+#define USAGE_WORKERS ""
+#endif
+
+#define USAGE \
+    "\n usage: cs_load_test param=<>...\n"                  \
+    "\n acceptable parameters:\n"                           \
+    "    clients=%%d          default: 64\n"                \
+    USAGE_WORKERS                                           \
+    "\n"                                                    \
+    " The keys are read from CSClientKey, CSServerKey and\n"\
+    " CSTimePermit, as written by TA_cs.\n"                 \
+    "\n"
+
+/*
+ * global options
+ */
+struct options
+{
+    int clients;                /* number of handshakes in the burst        */
+    int workers;                /* threads of the worker pool, 0 if none    */
+    int batch;                  /* clients authenticated together           */
+    int window;                 /* time the workers wait to fill a batch    */
+} opt;
+
+/*
+ * One direction of an in-memory connection
+ */
+typedef struct
+{
+    unsigned char buf[PIPE_LEN];
+    size_t len;
+} mem_pipe;
+
+typedef struct
+{
+    mem_pipe *in;
+    mem_pipe *out;
+} mem_endpoint;
+
+typedef struct
+{
+    mbedtls_ssl_context cli;
+    mbedtls_ssl_context srv;
+    mbedtls_milagro_cs_context cli_cs;
+    mem_pipe c2s;
+    mem_pipe s2c;
+    mem_endpoint cli_end;
+    mem_endpoint srv_end;
+    int cli_done;
+    int srv_done;
+    int accepted;
+    unsigned long accept_ms;    /* time until the ServerHello was written   */
+} connection;
+
+static int mem_send( void *ctx, const unsigned char *buf, size_t len )
+{
+    mem_pipe *out = ((mem_endpoint *) ctx)->out;
+
+    if( out->len == PIPE_LEN )
+        return( MBEDTLS_ERR_SSL_WANT_WRITE );
+
+    if( len > PIPE_LEN - out->len )
+        len = PIPE_LEN - out->len;
+
+    memcpy( out->buf + out->len, buf, len );
+    out->len += len;
+
+    return( (int) len );
+}
+
+static int mem_recv( void *ctx, unsigned char *buf, size_t len )
+{
+    mem_pipe *in = ((mem_endpoint *) ctx)->in;
+
+    if( in->len == 0 )
+        return( MBEDTLS_ERR_SSL_WANT_READ );
+
+    if( len > in->len )
+        len = in->len;
+
+    memcpy( buf, in->buf, len );
+    memmove( in->buf, in->buf + len, in->len - len );
+    in->len -= len;
+
+    return( (int) len );
+}
+
+/*
+ * Read a hex-encoded key written by TA_cs, return its length or -1
+ */
+static int read_key( const char *path, char *key, int max_len )
+{
+    FILE *file;
+    unsigned int tmp;
+    int len = 0;
+
+    if( ( file = fopen( path, "r" ) ) == NULL )
+    {
+        mbedtls_printf( " failed\n  ! %s is missing, run TA_cs first\n\n", path );
+        return( -1 );
+    }
+
+    while( len < max_len && fscanf( file, "%02x", &tmp ) == 1 )
+        key[len++] = (char) tmp;
+
+    fclose( file );
+
+    return( len );
+}
+
+static int cmp_ulong( const void *a, const void *b )
+{
+    unsigned long x = *(const unsigned long *) a, y = *(const unsigned long *) b;
+
+    return( x < y ? -1 : x > y );
+}
+
+static int is_retry( int ret )
+{
+    return( ret == MBEDTLS_ERR_SSL_WANT_READ ||
+            ret == MBEDTLS_ERR_SSL_WANT_WRITE ||
+            ret == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS );
+}
+
+int main( int argc, char *argv[] )
+{
+    int ret = 1, i, left, cli_key_len, srv_key_len;
+    unsigned long elapsed, step, max_step = 0, *latencies = NULL;
+    const char *pers = "cs_load_test";
+    char cli_key[2*PFS+1], srv_key[4*PFS];
+#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
+    char tp[2*PFS+1];
+    int tp_len;
+#endif
+    char *p, *q;
+    int ciphersuites[2];
+    struct mbedtls_timing_hr_time timer, step_timer;
+
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_ssl_config conf_cli, conf_srv;
+    connection *conns = NULL;
+    mbedtls_milagro_cs_context srv_cs;
+    mbedtls_milagro_cs_context_pool srv_cs_pool;
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    mbedtls_milagro_cs_worker_pool pool;
+#endif
+
+    mbedtls_entropy_init( &entropy );
+    mbedtls_ctr_drbg_init( &ctr_drbg );
+    mbedtls_ssl_config_init( &conf_cli );
+    mbedtls_ssl_config_init( &conf_srv );
+    mbedtls_ssl_milagro_cs_init( &srv_cs );
+    mbedtls_milagro_cs_context_pool_init( &srv_cs_pool );
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    mbedtls_milagro_cs_worker_pool_init( &pool );
+#endif
+
+    opt.clients = DFL_CLIENTS;
+    opt.workers = DFL_WORKERS;
+    opt.batch   = DFL_BATCH;
+    opt.window  = DFL_WINDOW;
+
+    for( i = 1; i < argc; i++ )
+    {
+        p = argv[i];
+        if( ( q = strchr( p, '=' ) ) == NULL )
+            goto usage;
+        *q++ = '\0';
+
+        if( strcmp( p, "clients" ) == 0 )
+        {
+            opt.clients = atoi( q );
+            if( opt.clients < 1 )
+                goto usage;
+        }
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+        else if( strcmp( p, "workers" ) == 0 )
+        {
+            opt.workers = atoi( q );
+            if( opt.workers < 0 || opt.workers > MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_THREADS )
+                goto usage;
+        }
+        else if( strcmp( p, "batch" ) == 0 )
+        {
+            opt.batch = atoi( q );
+            if( opt.batch < 1 || opt.batch > MBEDTLS_MILAGRO_CS_WORKER_POOL_MAX_BATCH )
+                goto usage;
+        }
+        else if( strcmp( p, "window" ) == 0 )
+        {
+            opt.window = atoi( q );
+            if( opt.window < 0 )
+                goto usage;
+        }
+#endif
+        else
+            goto usage;
+    }
+
+    /*
+     * 1. Read the keys and seed the RNG
+     */
+    mbedtls_printf( "\n  . Reading the MILAGRO_CS keys..." );
+    fflush( stdout );
+
+    if( ( cli_key_len = read_key( "CSClientKey", cli_key, sizeof( cli_key ) ) ) < 0 ||
+        ( srv_key_len = read_key( "CSServerKey", srv_key, sizeof( srv_key ) ) ) < 0 )
+        goto exit;
+#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
+    if( ( tp_len = read_key( "CSTimePermit", tp, sizeof( tp ) ) ) < 0 )
+        goto exit;
+#endif
+
+    if( ( ret = mbedtls_ctr_drbg_seed( &ctr_drbg, mbedtls_entropy_func, &entropy,
+                               (const unsigned char *) pers,
+                               strlen( pers ) ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret );
+        goto exit;
+    }
+
+    mbedtls_printf( " ok\n" );
+
+    /*
+     * 2. Setup the configurations and the worker pool
+     */
+    mbedtls_printf( "  . Setting up %d connections, %d workers...", opt.clients, opt.workers );
+    fflush( stdout );
+
+    ciphersuites[0] = mbedtls_ssl_get_ciphersuite_id( "TLS-MILAGRO-CS-WITH-AES-128-GCM-SHA256" );
+    ciphersuites[1] = 0;
+
+    if( ( ret = mbedtls_ssl_config_defaults( &conf_cli, MBEDTLS_SSL_IS_CLIENT,
+                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 ||
+        ( ret = mbedtls_ssl_config_defaults( &conf_srv, MBEDTLS_SSL_IS_SERVER,
+                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_config_defaults returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+
+    mbedtls_ssl_conf_rng( &conf_cli, mbedtls_ctr_drbg_random, &ctr_drbg );
+    mbedtls_ssl_conf_rng( &conf_srv, mbedtls_ctr_drbg_random, &ctr_drbg );
+    mbedtls_ssl_conf_ciphersuites( &conf_cli, ciphersuites );
+    mbedtls_ssl_conf_ciphersuites( &conf_srv, ciphersuites );
+
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    mbedtls_milagro_cs_worker_pool_set_batch( &pool, opt.batch, opt.window );
+    if( opt.workers > 0 &&
+        ( ret = mbedtls_milagro_cs_worker_pool_setup( &pool, opt.workers ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_milagro_cs_worker_pool_setup returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+    if( opt.workers > 0 )
+        mbedtls_ssl_milagro_cs_set_worker_pool( &srv_cs, &pool );
+#endif
+
+    /* All the servers share one configuration, each handshake takes a
+     * context from its pool */
+    mbedtls_ssl_milagro_cs_set_secret( &srv_cs, srv_key, srv_key_len );
+    if( ( ret = mbedtls_milagro_cs_context_pool_setup( &srv_cs_pool, &srv_cs, &entropy ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_milagro_cs_context_pool_setup returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+    mbedtls_ssl_conf_milagro_cs( &conf_srv, &srv_cs_pool );
+
+    conns = mbedtls_calloc( opt.clients, sizeof( connection ) );
+    latencies = mbedtls_calloc( opt.clients, sizeof( unsigned long ) );
+    if( conns == NULL || latencies == NULL )
+    {
+        mbedtls_printf( " failed\n  ! memory allocation failed\n\n" );
+        goto exit;
+    }
+
+    for( i = 0; i < opt.clients; i++ )
+    {
+        connection *c = &conns[i];
+
+        mbedtls_ssl_init( &c->cli );
+        mbedtls_ssl_init( &c->srv );
+        mbedtls_ssl_milagro_cs_init( &c->cli_cs );
+
+        if( ( ret = mbedtls_ssl_setup( &c->cli, &conf_cli ) ) != 0 ||
+            ( ret = mbedtls_ssl_setup( &c->srv, &conf_srv ) ) != 0 )
+        {
+            mbedtls_printf( " failed\n  ! mbedtls_ssl_setup returned -0x%x\n\n", -ret );
+            goto exit;
+        }
+
+        c->cli_end.in = &c->s2c;
+        c->cli_end.out = &c->c2s;
+        c->srv_end.in = &c->c2s;
+        c->srv_end.out = &c->s2c;
+        mbedtls_ssl_set_bio( &c->cli, &c->cli_end, mem_send, mem_recv, NULL );
+        mbedtls_ssl_set_bio( &c->srv, &c->srv_end, mem_send, mem_recv, NULL );
+
+        mbedtls_ssl_milagro_cs_set_secret( &c->cli_cs, cli_key, cli_key_len );
+        mbedtls_ssl_milagro_cs_set_client_identity( &c->cli_cs, (char *) DFL_CLIENT_IDENTITY );
+#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
+        mbedtls_ssl_milagro_cs_set_timepermit( &c->cli_cs, tp, tp_len );
+#endif
+
+        if( ( ret = mbedtls_ssl_milagro_cs_setup_RNG( &c->cli_cs, &entropy ) ) != 0 )
+        {
+            mbedtls_printf( " failed\n  ! mbedtls_ssl_milagro_cs_setup_RNG returned -0x%x\n\n", -ret );
+            goto exit;
+        }
+
+        mbedtls_ssl_set_milagro_cs( c->cli.handshake, &c->cli_cs );
+    }
+
+    mbedtls_printf( " ok\n" );
+
+    /*
+     * 3. All the clients send their ClientHello at once
+     */
+    mbedtls_printf( "  . Sending %d ClientHello...", opt.clients );
+    fflush( stdout );
+
+    for( i = 0; i < opt.clients; i++ )
+    {
+        ret = mbedtls_ssl_handshake( &conns[i].cli );
+        if( !is_retry( ret ) )
+        {
+            mbedtls_printf( " failed\n  ! client %d: mbedtls_ssl_handshake returned -0x%x\n\n", i, -ret );
+            goto exit;
+        }
+    }
+
+    mbedtls_printf( " ok\n" );
+
+    /*
+     * 4. Event loop: one pass on the servers, one on the clients
+     */
+    mbedtls_printf( "  . Running the handshakes..." );
+    fflush( stdout );
+
+    (void) mbedtls_timing_get_timer( &timer, 1 );
+
+    for( left = opt.clients; left > 0; )
+    {
+        for( i = 0; i < opt.clients; i++ )
+        {
+            connection *c = &conns[i];
+
+            if( c->srv_done )
+                continue;
+
+            (void) mbedtls_timing_get_timer( &step_timer, 1 );
+            ret = mbedtls_ssl_handshake( &c->srv );
+            step = mbedtls_timing_get_timer( &step_timer, 0 );
+            if( step > max_step )
+                max_step = step;
+
+            if( !c->accepted && c->srv.state > MBEDTLS_SSL_SERVER_HELLO )
+            {
+                c->accept_ms = mbedtls_timing_get_timer( &timer, 0 );
+                c->accepted = 1;
+            }
+
+            if( ret == 0 )
+                c->srv_done = 1;
+            else if( !is_retry( ret ) )
+            {
+                mbedtls_printf( " failed\n  ! server %d: mbedtls_ssl_handshake returned -0x%x\n\n", i, -ret );
+                goto exit;
+            }
+        }
+
+        for( i = 0; i < opt.clients; i++ )
+        {
+            connection *c = &conns[i];
+
+            if( c->cli_done )
+                continue;
+
+            ret = mbedtls_ssl_handshake( &c->cli );
+            if( ret == 0 )
+            {
+                c->cli_done = 1;
+                left--;
+            }
+            else if( !is_retry( ret ) )
+            {
+                mbedtls_printf( " failed\n  ! client %d: mbedtls_ssl_handshake returned -0x%x\n\n", i, -ret );
+                goto exit;
+            }
+        }
+    }
+
+    elapsed = mbedtls_timing_get_timer( &timer, 0 );
+
+    mbedtls_printf( " ok\n" );
+
+    /*
+     * 5. Report
+     */
+    for( i = 0; i < opt.clients; i++ )
+        latencies[i] = conns[i].accept_ms;
+    qsort( latencies, opt.clients, sizeof( unsigned long ), cmp_ulong );
+
+    mbedtls_printf( "\n  %d handshakes in %lu ms (%lu handshakes/s)\n", opt.clients, elapsed,
+                    elapsed ? (unsigned long) opt.clients * 1000 / elapsed : 0 );
+    mbedtls_printf( "  accept latency (ms): min %lu, median %lu, p99 %lu, max %lu\n",
+                    latencies[0], latencies[opt.clients / 2],
+                    latencies[( opt.clients * 99 ) / 100], latencies[opt.clients - 1] );
+    mbedtls_printf( "  longest event loop stall: %lu ms\n", max_step );
+    mbedtls_printf( "  server milagro_cs contexts allocated: %d\n\n", srv_cs_pool.nb_contexts );
+
+    ret = 0;
+    goto exit;
+
+usage:
+    mbedtls_printf( USAGE );
+
+exit:
+    /* The contexts are taken back from the pool before it is stopped */
+    if( conns != NULL )
+    {
+        for( i = 0; i < opt.clients; i++ )
+        {
+            mbedtls_ssl_free( &conns[i].cli );
+            mbedtls_ssl_free( &conns[i].srv );
+        }
+    }
+#if defined(MBEDTLS_TLS_MILAGRO_CS_ASYNC)
+    mbedtls_milagro_cs_worker_pool_free( &pool );
+#endif
+    mbedtls_milagro_cs_context_pool_free( &srv_cs_pool );
+    mbedtls_milagro_cs_free( &srv_cs );
+    mbedtls_free( conns );
+    mbedtls_free( latencies );
+    mbedtls_ssl_config_free( &conf_cli );
+    mbedtls_ssl_config_free( &conf_srv );
+    mbedtls_ctr_drbg_free( &ctr_drbg );
+    mbedtls_entropy_free( &entropy );
+
+    if( ret < 0 )
+        ret = 1;
+
+    return( ret );
+}
+#endif /* MBEDTLS_ENTROPY_C && MBEDTLS_CTR_DRBG_C && MBEDTLS_SSL_TLS_C &&
+          MBEDTLS_SSL_SRV_C && MBEDTLS_SSL_CLI_C && MBEDTLS_TIMING_C &&
+          MBEDTLS_TLS_MILAGRO_CS */
@@ -0,0 +1,897 @@
+/*
+ Licensed to the Apache Software Foundation (ASF) under one
+ or more contributor license agreements.  See the NOTICE file
+ distributed with this work for additional information
+ regarding copyright ownership.  The ASF licenses this file
+ to you under the Apache License, Version 2.0 (the
+ "License"); you may not use this file except in compliance
+ with the License.  You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing,
+ software distributed under the License is distributed on an
+ "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ KIND, either express or implied.  See the License for the
+ specific language governing permissions and limitations
+ under the License.
+ */
+
+/*
+ *
+ * handshake_bench.c
+ *
+ * Full handshakes between a client and a server context of the same
+ * process, over in-memory transports, for each key exchange compiled in.
+ * Reports the handshakes per second and, for each state of each side,
+ * the percentiles of the time spent in mbedtls_ssl_handshake_step().
+ * With MBEDTLS_SSL_HANDSHAKE_TIMING, the time spent in the expensive
+ * crypto operations is reported too.
+ *
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#include <stdio.h>
+#define mbedtls_free       free
+#define mbedtls_calloc    calloc
+#define mbedtls_printf     printf
+
+#if !defined(MBEDTLS_ENTROPY_C) || !defined(MBEDTLS_CTR_DRBG_C) || \
+    !defined(MBEDTLS_SSL_TLS_C) || !defined(MBEDTLS_SSL_SRV_C) || \
+    !defined(MBEDTLS_SSL_CLI_C)
+int main( void )
+{
+    mbedtls_printf("MBEDTLS_ENTROPY_C and/or MBEDTLS_CTR_DRBG_C and/or "
+           "MBEDTLS_SSL_TLS_C and/or MBEDTLS_SSL_SRV_C and/or "
+           "MBEDTLS_SSL_CLI_C not defined.\n");
+    return( 0 );
+}
+#else
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/certs.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/milagro.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(MBEDTLS_CERTS_C) && defined(MBEDTLS_PEM_PARSE_C) && \
+    defined(MBEDTLS_X509_CRT_PARSE_C)
+#if defined(MBEDTLS_KEY_EXCHANGE_RSA_ENABLED) && defined(MBEDTLS_GCM_C)
+#define BENCH_RSA
+#endif
+#if defined(MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED) && defined(MBEDTLS_GCM_C)
+#define BENCH_ECDHE_ECDSA
+#endif
+#endif /* MBEDTLS_CERTS_C && MBEDTLS_PEM_PARSE_C && MBEDTLS_X509_CRT_PARSE_C */
+
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED) && defined(MBEDTLS_GCM_C)
+#define BENCH_PSK
+#endif
+#if defined(MBEDTLS_KEY_EXCHANGE_ECJPAKE_ENABLED)
+#define BENCH_ECJPAKE
+#endif
+#if defined(MBEDTLS_KEY_EXCHANGE_MILAGRO_CS_ENABLED)
+#define BENCH_MILAGRO_CS
+#endif
+#if defined(MBEDTLS_KEY_EXCHANGE_MILAGRO_P2P_ENABLED)
+#define BENCH_MILAGRO_P2P
+#endif
+
+#define DFL_HANDSHAKES          100
+#define DFL_KEX                 "all"
+#define DFL_CLIENT_IDENTITY     "client@miracl.com"
+#define DFL_SERVER_IDENTITY     "server.miracl.com"
+#define DFL_PSK                 "0102030405060708090a0b0c0d0e0f10"
+#define DFL_PSK_IDENTITY        "Client_identity"
+#define DFL_ECJPAKE_PW          "bench"
+
+#define PIPE_LEN                32768
+
+/* One past the last value of mbedtls_ssl_states */
+#define NB_STATES               ( MBEDTLS_SSL_SERVER_HELLO_VERIFY_REQUEST_SENT + 1 )
+
+/* One past the last MBEDTLS_SSL_TIMING_XXX event */
+#define NB_EVENTS               ( MBEDTLS_SSL_TIMING_X509_VERIFY + 1 )
+
+#define USAGE \
+    "\n usage: handshake_bench param=<>...\n"               \
+    "\n acceptable parameters:\n"                           \
+    "    handshakes=%%d       default: 100\n"               \
+    "    kex=<name>          default: all\n"                \
+    "                        options: rsa, ecdhe_ecdsa, psk, ecjpake,\n" \
+    "                                 milagro_cs, milagro_p2p\n" \
+    "\n"                                                    \
+    " The Milagro keys are read from the files written by\n"\
+    " TA_cs and TA_p2p.\n"                                  \
+    "\n"
+
+/*
+ * global options
+ */
+struct options
+{
+    int handshakes;             /* handshakes per key exchange              */
+    const char *kex;            /* key exchange to run, or all              */
+} opt;
+
+/*
+ * One direction of an in-memory connection
+ */
+typedef struct
+{
+    unsigned char buf[PIPE_LEN];
+    size_t len;
+} mem_pipe;
+
+typedef struct
+{
+    mem_pipe *in;
+    mem_pipe *out;
+} mem_endpoint;
+
+/*
+ * Long-lived material of both sides, for the key exchange being run
+ */
+typedef struct
+{
+#if defined(BENCH_RSA) || defined(BENCH_ECDHE_ECDSA)
+    mbedtls_x509_crt ca;
+    mbedtls_x509_crt srv_crt;
+    mbedtls_pk_context srv_key;
+#endif
+#if defined(BENCH_MILAGRO_CS)
+    mbedtls_milagro_cs_context cli_cs;
+    mbedtls_milagro_cs_context srv_cs;
+    mbedtls_milagro_cs_context_pool cli_cs_pool;
+    mbedtls_milagro_cs_context_pool srv_cs_pool;
+#endif
+#if defined(BENCH_MILAGRO_P2P)
+    mbedtls_milagro_p2p_context cli_p2p;
+    mbedtls_milagro_p2p_context srv_p2p;
+    mbedtls_milagro_p2p_context_pool cli_p2p_pool;
+    mbedtls_milagro_p2p_context_pool srv_p2p_pool;
+#endif
+    mbedtls_entropy_context *entropy;
+} bench_keys;
+
+typedef struct
+{
+    const char *name;           /* value of the kex option                  */
+    const char *ciphersuite;
+    int (*setup)( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                  mbedtls_ssl_config *conf_srv );
+} bench_kex;
+
+static const char *state_names[NB_STATES] =
+{
+    "HelloRequest",
+    "ClientHello",
+    "ServerHello",
+    "ServerCertificate",
+    "ServerKeyExchange",
+    "CertificateRequest",
+    "ServerHelloDone",
+    "ClientCertificate",
+    "ClientKeyExchange",
+    "CertificateVerify",
+    "ClientChangeCipherSpec",
+    "ClientFinished",
+    "ServerChangeCipherSpec",
+    "ServerFinished",
+    "FlushBuffers",
+    "HandshakeWrapup",
+    "HandshakeOver",
+    "NewSessionTicket",
+    "HelloVerifyRequestSent",
+};
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+static const char *event_names[NB_EVENTS] =
+{
+    "Step",
+    "Pairing",
+    "EcpMul",
+    "RsaPrivate",
+    "X509Verify",
+};
+
+/*
+ * Time spent in each operation, for each handshake of one side
+ */
+typedef struct
+{
+    unsigned long *samples;     /* [event][handshake], microseconds         */
+    int n;                      /* handshake being run                      */
+} op_timings;
+
+static void record_op( void *p_timing, const mbedtls_ssl_context *ssl,
+                       int event, int state, unsigned long start,
+                       unsigned long end )
+{
+    op_timings *t = (op_timings *) p_timing;
+
+    ((void) ssl);
+    ((void) state);
+
+    /* The steps are timed by run_kex() itself */
+    if( event != MBEDTLS_SSL_TIMING_STEP )
+        t->samples[(size_t) event * opt.handshakes + t->n] += end - start;
+}
+#endif /* MBEDTLS_SSL_HANDSHAKE_TIMING */
+
+static int mem_send( void *ctx, const unsigned char *buf, size_t len )
+{
+    mem_pipe *out = ((mem_endpoint *) ctx)->out;
+
+    if( out->len == PIPE_LEN )
+        return( MBEDTLS_ERR_SSL_WANT_WRITE );
+
+    if( len > PIPE_LEN - out->len )
+        len = PIPE_LEN - out->len;
+
+    memcpy( out->buf + out->len, buf, len );
+    out->len += len;
+
+    return( (int) len );
+}
+
+static int mem_recv( void *ctx, unsigned char *buf, size_t len )
+{
+    mem_pipe *in = ((mem_endpoint *) ctx)->in;
+
+    if( in->len == 0 )
+        return( MBEDTLS_ERR_SSL_WANT_READ );
+
+    if( len > in->len )
+        len = in->len;
+
+    memcpy( buf, in->buf, len );
+    memmove( in->buf, in->buf + len, in->len - len );
+    in->len -= len;
+
+    return( (int) len );
+}
+
+/*
+ * Monotonic clock, in microseconds
+ */
+static unsigned long now_us( void )
+{
+#if defined(_WIN32)
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter( &count );
+    QueryPerformanceFrequency( &freq );
+
+    return( (unsigned long) ( count.QuadPart * 1000000 / freq.QuadPart ) );
+#else
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return( (unsigned long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 );
+#endif
+}
+
+static int cmp_ulong( const void *a, const void *b )
+{
+    unsigned long x = *(const unsigned long *) a, y = *(const unsigned long *) b;
+
+    return( x < y ? -1 : x > y );
+}
+
+static int is_retry( int ret )
+{
+    return( ret == MBEDTLS_ERR_SSL_WANT_READ ||
+            ret == MBEDTLS_ERR_SSL_WANT_WRITE ||
+            ret == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS );
+}
+
+#if defined(BENCH_MILAGRO_CS) || defined(BENCH_MILAGRO_P2P)
+/*
+ * Read a hex-encoded key written by TA_cs or TA_p2p, return its length or -1
+ */
+static int read_key( const char *path, char *key, int max_len )
+{
+    FILE *file;
+    unsigned int tmp;
+    int len = 0;
+
+    if( ( file = fopen( path, "r" ) ) == NULL )
+    {
+        mbedtls_printf( " failed\n  ! %s is missing, run TA_cs and TA_p2p first\n\n", path );
+        return( -1 );
+    }
+
+    while( len < max_len && fscanf( file, "%02x", &tmp ) == 1 )
+        key[len++] = (char) tmp;
+
+    fclose( file );
+
+    return( len );
+}
+#endif /* BENCH_MILAGRO_CS || BENCH_MILAGRO_P2P */
+
+#if defined(BENCH_RSA) || defined(BENCH_ECDHE_ECDSA)
+static int setup_certs( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                        mbedtls_ssl_config *conf_srv,
+                        const char *ca, size_t ca_len,
+                        const char *crt, size_t crt_len,
+                        const char *key, size_t key_len )
+{
+    int ret;
+
+    if( ( ret = mbedtls_x509_crt_parse( &keys->ca, (const unsigned char *) ca, ca_len ) ) != 0 ||
+        ( ret = mbedtls_x509_crt_parse( &keys->srv_crt, (const unsigned char *) crt, crt_len ) ) != 0 ||
+        ( ret = mbedtls_pk_parse_key( &keys->srv_key, (const unsigned char *) key, key_len,
+                                      NULL, 0 ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! parsing the test certificates returned -0x%x\n\n", -ret );
+        return( ret );
+    }
+
+    /* The client verifies the chain, as it would against a real server */
+    mbedtls_ssl_conf_authmode( conf_cli, MBEDTLS_SSL_VERIFY_REQUIRED );
+    mbedtls_ssl_conf_ca_chain( conf_cli, &keys->ca, NULL );
+
+    if( ( ret = mbedtls_ssl_conf_own_cert( conf_srv, &keys->srv_crt, &keys->srv_key ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_conf_own_cert returned -0x%x\n\n", -ret );
+        return( ret );
+    }
+
+    return( 0 );
+}
+#endif /* BENCH_RSA || BENCH_ECDHE_ECDSA */
+
+#if defined(BENCH_RSA)
+static int setup_rsa( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                      mbedtls_ssl_config *conf_srv )
+{
+    return( setup_certs( keys, conf_cli, conf_srv,
+                         mbedtls_test_ca_crt_rsa, mbedtls_test_ca_crt_rsa_len,
+                         mbedtls_test_srv_crt_rsa, mbedtls_test_srv_crt_rsa_len,
+                         mbedtls_test_srv_key_rsa, mbedtls_test_srv_key_rsa_len ) );
+}
+#endif
+
+#if defined(BENCH_ECDHE_ECDSA)
+static int setup_ecdhe_ecdsa( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                              mbedtls_ssl_config *conf_srv )
+{
+    return( setup_certs( keys, conf_cli, conf_srv,
+                         mbedtls_test_ca_crt_ec, mbedtls_test_ca_crt_ec_len,
+                         mbedtls_test_srv_crt_ec, mbedtls_test_srv_crt_ec_len,
+                         mbedtls_test_srv_key_ec, mbedtls_test_srv_key_ec_len ) );
+}
+#endif
+
+#if defined(BENCH_PSK)
+static int setup_psk( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                      mbedtls_ssl_config *conf_srv )
+{
+    unsigned char psk[16];
+    unsigned int tmp;
+    size_t i;
+    int ret;
+
+    ((void) keys);
+
+    for( i = 0; i < sizeof( psk ); i++ )
+    {
+        sscanf( DFL_PSK + 2 * i, "%02x", &tmp );
+        psk[i] = (unsigned char) tmp;
+    }
+
+    if( ( ret = mbedtls_ssl_conf_psk( conf_cli, psk, sizeof( psk ),
+                    (const unsigned char *) DFL_PSK_IDENTITY, strlen( DFL_PSK_IDENTITY ) ) ) != 0 ||
+        ( ret = mbedtls_ssl_conf_psk( conf_srv, psk, sizeof( psk ),
+                    (const unsigned char *) DFL_PSK_IDENTITY, strlen( DFL_PSK_IDENTITY ) ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_conf_psk returned -0x%x\n\n", -ret );
+        return( ret );
+    }
+
+    return( 0 );
+}
+#endif
+
+#if defined(BENCH_ECJPAKE)
+static int setup_ecjpake( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                          mbedtls_ssl_config *conf_srv )
+{
+    /* The password is set on each handshake, see run_kex() */
+    ((void) keys);
+    ((void) conf_cli);
+    ((void) conf_srv);
+
+    return( 0 );
+}
+#endif
+
+#if defined(BENCH_MILAGRO_CS)
+static int setup_milagro_cs( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                             mbedtls_ssl_config *conf_srv )
+{
+    char cli_key[2*PFS+1], srv_key[4*PFS];
+#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
+    char tp[2*PFS+1];
+    int tp_len;
+#endif
+    int ret, cli_key_len, srv_key_len;
+
+    if( ( cli_key_len = read_key( "CSClientKey", cli_key, sizeof( cli_key ) ) ) < 0 ||
+        ( srv_key_len = read_key( "CSServerKey", srv_key, sizeof( srv_key ) ) ) < 0 )
+        return( -1 );
+#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
+    if( ( tp_len = read_key( "CSTimePermit", tp, sizeof( tp ) ) ) < 0 )
+        return( -1 );
+#endif
+
+    mbedtls_ssl_milagro_cs_set_secret( &keys->cli_cs, cli_key, cli_key_len );
+    mbedtls_ssl_milagro_cs_set_client_identity( &keys->cli_cs, (char *) DFL_CLIENT_IDENTITY );
+#if defined(MBEDTLS_TLS_MILAGRO_CS_TIME_PERMITS)
+    mbedtls_ssl_milagro_cs_set_timepermit( &keys->cli_cs, tp, tp_len );
+#endif
+    mbedtls_ssl_milagro_cs_set_secret( &keys->srv_cs, srv_key, srv_key_len );
+
+    /* A long-running client would precompute its pairings once */
+    if( ( ret = mbedtls_ssl_milagro_cs_precompute( &keys->cli_cs ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_milagro_cs_precompute returned -0x%x\n\n", -ret );
+        return( ret );
+    }
+
+    if( ( ret = mbedtls_milagro_cs_context_pool_setup( &keys->cli_cs_pool, &keys->cli_cs,
+                                                       keys->entropy ) ) != 0 ||
+        ( ret = mbedtls_milagro_cs_context_pool_setup( &keys->srv_cs_pool, &keys->srv_cs,
+                                                       keys->entropy ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_milagro_cs_context_pool_setup returned -0x%x\n\n", -ret );
+        return( ret );
+    }
+
+    mbedtls_ssl_conf_milagro_cs( conf_cli, &keys->cli_cs_pool );
+    mbedtls_ssl_conf_milagro_cs( conf_srv, &keys->srv_cs_pool );
+
+    return( 0 );
+}
+#endif /* BENCH_MILAGRO_CS */
+
+#if defined(BENCH_MILAGRO_P2P)
+static int setup_milagro_p2p( bench_keys *keys, mbedtls_ssl_config *conf_cli,
+                              mbedtls_ssl_config *conf_srv )
+{
+    char cli_key[4*PFS], srv_key[2*PFS+1];
+    int ret, cli_key_len, srv_key_len;
+
+    if( ( cli_key_len = read_key( "P2PClientKey", cli_key, sizeof( cli_key ) ) ) < 0 ||
+        ( srv_key_len = read_key( "P2PServerKey", srv_key, sizeof( srv_key ) ) ) < 0 )
+        return( -1 );
+
+    mbedtls_ssl_milagro_p2p_set_key( MBEDTLS_SSL_IS_CLIENT, &keys->cli_p2p, cli_key, cli_key_len );
+    mbedtls_ssl_milagro_p2p_set_key( MBEDTLS_SSL_IS_SERVER, &keys->srv_p2p, srv_key, srv_key_len );
+
+    if( ( ret = mbedtls_ssl_milagro_p2p_set_identity( MBEDTLS_SSL_IS_CLIENT, &keys->cli_p2p,
+                                                      (char *) DFL_CLIENT_IDENTITY ) ) != 0 ||
+        ( ret = mbedtls_ssl_milagro_p2p_set_identity( MBEDTLS_SSL_IS_SERVER, &keys->srv_p2p,
+                                                      (char *) DFL_SERVER_IDENTITY ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_milagro_p2p_set_identity returned -0x%x\n\n", -ret );
+        return( ret );
+    }
+
+    if( ( ret = mbedtls_milagro_p2p_context_pool_setup( &keys->cli_p2p_pool, &keys->cli_p2p,
+                                                        keys->entropy ) ) != 0 ||
+        ( ret = mbedtls_milagro_p2p_context_pool_setup( &keys->srv_p2p_pool, &keys->srv_p2p,
+                                                        keys->entropy ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_milagro_p2p_context_pool_setup returned -0x%x\n\n", -ret );
+        return( ret );
+    }
+
+    mbedtls_ssl_conf_milagro_p2p( conf_cli, &keys->cli_p2p_pool );
+    mbedtls_ssl_conf_milagro_p2p( conf_srv, &keys->srv_p2p_pool );
+
+    return( 0 );
+}
+#endif /* BENCH_MILAGRO_P2P */
+
+static const bench_kex kex_list[] =
+{
+#if defined(BENCH_RSA)
+    { "rsa", "TLS-RSA-WITH-AES-128-GCM-SHA256", setup_rsa },
+#endif
+#if defined(BENCH_ECDHE_ECDSA)
+    { "ecdhe_ecdsa", "TLS-ECDHE-ECDSA-WITH-AES-128-GCM-SHA256", setup_ecdhe_ecdsa },
+#endif
+#if defined(BENCH_PSK)
+    { "psk", "TLS-PSK-WITH-AES-128-GCM-SHA256", setup_psk },
+#endif
+#if defined(BENCH_ECJPAKE)
+    { "ecjpake", "TLS-ECJPAKE-WITH-AES-128-CCM-8", setup_ecjpake },
+#endif
+#if defined(BENCH_MILAGRO_CS)
+    { "milagro_cs", "TLS-MILAGRO-CS-WITH-AES-128-GCM-SHA256", setup_milagro_cs },
+#endif
+#if defined(BENCH_MILAGRO_P2P)
+    { "milagro_p2p", "TLS-MILAGRO-P2P-WITH-AES-128-GCM-SHA256", setup_milagro_p2p },
+#endif
+    { NULL, NULL, NULL }
+};
+
+static void keys_init( bench_keys *keys, mbedtls_entropy_context *entropy )
+{
+    memset( keys, 0, sizeof( bench_keys ) );
+    keys->entropy = entropy;
+
+#if defined(BENCH_RSA) || defined(BENCH_ECDHE_ECDSA)
+    mbedtls_x509_crt_init( &keys->ca );
+    mbedtls_x509_crt_init( &keys->srv_crt );
+    mbedtls_pk_init( &keys->srv_key );
+#endif
+#if defined(BENCH_MILAGRO_CS)
+    mbedtls_ssl_milagro_cs_init( &keys->cli_cs );
+    mbedtls_ssl_milagro_cs_init( &keys->srv_cs );
+    mbedtls_milagro_cs_context_pool_init( &keys->cli_cs_pool );
+    mbedtls_milagro_cs_context_pool_init( &keys->srv_cs_pool );
+#endif
+#if defined(BENCH_MILAGRO_P2P)
+    mbedtls_ssl_milagro_p2p_init( &keys->cli_p2p );
+    mbedtls_ssl_milagro_p2p_init( &keys->srv_p2p );
+    mbedtls_milagro_p2p_context_pool_init( &keys->cli_p2p_pool );
+    mbedtls_milagro_p2p_context_pool_init( &keys->srv_p2p_pool );
+#endif
+}
+
+static void keys_free( bench_keys *keys )
+{
+#if defined(BENCH_RSA) || defined(BENCH_ECDHE_ECDSA)
+    mbedtls_x509_crt_free( &keys->ca );
+    mbedtls_x509_crt_free( &keys->srv_crt );
+    mbedtls_pk_free( &keys->srv_key );
+#endif
+#if defined(BENCH_MILAGRO_CS)
+    mbedtls_milagro_cs_context_pool_free( &keys->cli_cs_pool );
+    mbedtls_milagro_cs_context_pool_free( &keys->srv_cs_pool );
+    mbedtls_milagro_cs_free( &keys->cli_cs );
+    mbedtls_milagro_cs_free( &keys->srv_cs );
+#endif
+#if defined(BENCH_MILAGRO_P2P)
+    mbedtls_milagro_p2p_context_pool_free( &keys->cli_p2p_pool );
+    mbedtls_milagro_p2p_context_pool_free( &keys->srv_p2p_pool );
+    mbedtls_milagro_p2p_free( &keys->cli_p2p );
+    mbedtls_milagro_p2p_free( &keys->srv_p2p );
+#endif
+}
+
+/*
+ * Print the percentiles of the time spent in each state, or operation,
+ * of one side
+ */
+static void report_samples( const char *side, const char **names, int nb_names,
+                            unsigned long *samples, int n )
+{
+    unsigned long *s;
+    int i;
+
+    for( i = 0; i < nb_names; i++ )
+    {
+        s = samples + (size_t) i * n;
+
+        qsort( s, n, sizeof( unsigned long ), cmp_ulong );
+        if( s[n - 1] == 0 )
+            continue;
+
+        mbedtls_printf( "    %s %-24s p50 %7lu  p90 %7lu  p99 %7lu  max %7lu\n",
+                        side, names[i], s[n / 2], s[( n * 9 ) / 10],
+                        s[( n * 99 ) / 100], s[n - 1] );
+    }
+}
+
+/*
+ * Run opt.handshakes handshakes of one key exchange
+ */
+static int run_kex( const bench_kex *kex, mbedtls_entropy_context *entropy,
+                    mbedtls_ctr_drbg_context *ctr_drbg )
+{
+    int ret, n, state, retries, ciphersuites[2];
+    unsigned long t0, t1, total = 0;
+    unsigned long *samples = NULL;  /* [side][state][handshake], microseconds */
+    mbedtls_ssl_config conf_cli, conf_srv;
+    mbedtls_ssl_context cli, srv;
+    mbedtls_ssl_context *ssl[2];
+    mem_pipe *c2s = NULL, *s2c = NULL;
+    mem_endpoint cli_end, srv_end;
+    bench_keys keys;
+    int side;
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    op_timings ops[2];
+
+    memset( ops, 0, sizeof( ops ) );
+#endif
+
+    mbedtls_ssl_config_init( &conf_cli );
+    mbedtls_ssl_config_init( &conf_srv );
+    mbedtls_ssl_init( &cli );
+    mbedtls_ssl_init( &srv );
+    keys_init( &keys, entropy );
+
+    mbedtls_printf( "  . %-12s setting up...", kex->name );
+    fflush( stdout );
+
+    ciphersuites[0] = mbedtls_ssl_get_ciphersuite_id( kex->ciphersuite );
+    ciphersuites[1] = 0;
+
+    if( ( ret = mbedtls_ssl_config_defaults( &conf_cli, MBEDTLS_SSL_IS_CLIENT,
+                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 ||
+        ( ret = mbedtls_ssl_config_defaults( &conf_srv, MBEDTLS_SSL_IS_SERVER,
+                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_config_defaults returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+
+    mbedtls_ssl_conf_rng( &conf_cli, mbedtls_ctr_drbg_random, ctr_drbg );
+    mbedtls_ssl_conf_rng( &conf_srv, mbedtls_ctr_drbg_random, ctr_drbg );
+    mbedtls_ssl_conf_ciphersuites( &conf_cli, ciphersuites );
+    mbedtls_ssl_conf_ciphersuites( &conf_srv, ciphersuites );
+
+    if( ( ret = kex->setup( &keys, &conf_cli, &conf_srv ) ) != 0 )
+        goto exit;
+
+    samples = mbedtls_calloc( 2 * NB_STATES * (size_t) opt.handshakes, sizeof( unsigned long ) );
+    c2s = mbedtls_calloc( 1, sizeof( mem_pipe ) );
+    s2c = mbedtls_calloc( 1, sizeof( mem_pipe ) );
+    if( samples == NULL || c2s == NULL || s2c == NULL )
+    {
+        mbedtls_printf( " failed\n  ! memory allocation failed\n\n" );
+        ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+        goto exit;
+    }
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    for( side = 0; side < 2; side++ )
+    {
+        ops[side].samples = mbedtls_calloc( NB_EVENTS * (size_t) opt.handshakes,
+                                            sizeof( unsigned long ) );
+        if( ops[side].samples == NULL )
+        {
+            mbedtls_printf( " failed\n  ! memory allocation failed\n\n" );
+            ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+            goto exit;
+        }
+    }
+
+    mbedtls_ssl_conf_timing_cb( &conf_cli, record_op, &ops[0] );
+    mbedtls_ssl_conf_timing_cb( &conf_srv, record_op, &ops[1] );
+#endif
+
+    if( ( ret = mbedtls_ssl_setup( &cli, &conf_cli ) ) != 0 ||
+        ( ret = mbedtls_ssl_setup( &srv, &conf_srv ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_setup returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+
+#if defined(BENCH_RSA) || defined(BENCH_ECDHE_ECDSA)
+    if( ( ret = mbedtls_ssl_set_hostname( &cli, "localhost" ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_set_hostname returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+#endif
+
+    cli_end.in = s2c;
+    cli_end.out = c2s;
+    srv_end.in = c2s;
+    srv_end.out = s2c;
+    mbedtls_ssl_set_bio( &cli, &cli_end, mem_send, mem_recv, NULL );
+    mbedtls_ssl_set_bio( &srv, &srv_end, mem_send, mem_recv, NULL );
+
+    ssl[0] = &cli;
+    ssl[1] = &srv;
+
+    mbedtls_printf( " ok\n" );
+
+    for( n = 0; n < opt.handshakes; n++ )
+    {
+        if( n > 0 &&
+            ( ( ret = mbedtls_ssl_session_reset( &cli ) ) != 0 ||
+              ( ret = mbedtls_ssl_session_reset( &srv ) ) != 0 ) )
+        {
+            mbedtls_printf( "  ! mbedtls_ssl_session_reset returned -0x%x\n\n", -ret );
+            goto exit;
+        }
+        c2s->len = 0;
+        s2c->len = 0;
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+        ops[0].n = n;
+        ops[1].n = n;
+#endif
+
+#if defined(BENCH_ECJPAKE)
+        if( strcmp( kex->name, "ecjpake" ) == 0 &&
+            ( ( ret = mbedtls_ssl_set_hs_ecjpake_password( &cli,
+                            (const unsigned char *) DFL_ECJPAKE_PW, strlen( DFL_ECJPAKE_PW ) ) ) != 0 ||
+              ( ret = mbedtls_ssl_set_hs_ecjpake_password( &srv,
+                            (const unsigned char *) DFL_ECJPAKE_PW, strlen( DFL_ECJPAKE_PW ) ) ) != 0 ) )
+        {
+            mbedtls_printf( "  ! mbedtls_ssl_set_hs_ecjpake_password returned -0x%x\n\n", -ret );
+            goto exit;
+        }
+#endif
+
+        /* One step on each side in turn, until both are done. Two rounds
+         * without any progress mean the peers wait for each other. */
+        for( retries = 0; cli.state != MBEDTLS_SSL_HANDSHAKE_OVER ||
+                          srv.state != MBEDTLS_SSL_HANDSHAKE_OVER; )
+        {
+            int progress = 0;
+
+            for( side = 0; side < 2; side++ )
+            {
+                if( ssl[side]->state == MBEDTLS_SSL_HANDSHAKE_OVER )
+                    continue;
+
+                state = ssl[side]->state;
+
+                t0 = now_us();
+                ret = mbedtls_ssl_handshake_step( ssl[side] );
+                t1 = now_us();
+
+                samples[( (size_t) side * NB_STATES + state ) * opt.handshakes + n] += t1 - t0;
+                total += t1 - t0;
+
+                if( ret != 0 && !is_retry( ret ) )
+                {
+                    mbedtls_printf( "  ! %s: mbedtls_ssl_handshake_step returned -0x%x\n\n",
+                                    side == 0 ? "client" : "server", -ret );
+                    goto exit;
+                }
+
+                if( ret == 0 || ssl[side]->state != state )
+                    progress = 1;
+            }
+
+            if( progress )
+                retries = 0;
+            else if( ++retries == 2 )
+            {
+                mbedtls_printf( "  ! handshake stalled\n\n" );
+                ret = -1;
+                goto exit;
+            }
+        }
+    }
+
+    mbedtls_printf( "    %d handshakes in %lu ms (%lu handshakes/s)\n",
+                    opt.handshakes, total / 1000,
+                    total ? (unsigned long) ( (double) opt.handshakes * 1000000 / total ) : 0 );
+    mbedtls_printf( "    time per state (us):\n" );
+    report_samples( "client", state_names, NB_STATES, samples, opt.handshakes );
+    report_samples( "server", state_names, NB_STATES,
+                    samples + (size_t) NB_STATES * opt.handshakes, opt.handshakes );
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    mbedtls_printf( "    time per operation (us):\n" );
+    report_samples( "client", event_names, NB_EVENTS, ops[0].samples, opt.handshakes );
+    report_samples( "server", event_names, NB_EVENTS, ops[1].samples, opt.handshakes );
+#endif
+    mbedtls_printf( "\n" );
+
+    ret = 0;
+
+exit:
+    /* The Milagro contexts go back to their pools before the pools go away */
+    mbedtls_ssl_free( &cli );
+    mbedtls_ssl_free( &srv );
+    keys_free( &keys );
+    mbedtls_ssl_config_free( &conf_cli );
+    mbedtls_ssl_config_free( &conf_srv );
+    mbedtls_free( samples );
+    mbedtls_free( c2s );
+    mbedtls_free( s2c );
+#if defined(MBEDTLS_SSL_HANDSHAKE_TIMING)
+    mbedtls_free( ops[0].samples );
+    mbedtls_free( ops[1].samples );
+#endif
+
+    return( ret );
+}
+
+int main( int argc, char *argv[] )
+{
+    int ret = 1, i, ran = 0;
+    const char *pers = "handshake_bench";
+    char *p, *q;
+    const bench_kex *kex;
+
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+
+    mbedtls_entropy_init( &entropy );
+    mbedtls_ctr_drbg_init( &ctr_drbg );
+
+    opt.handshakes = DFL_HANDSHAKES;
+    opt.kex        = DFL_KEX;
+
+    for( i = 1; i < argc; i++ )
+    {
+        p = argv[i];
+        if( ( q = strchr( p, '=' ) ) == NULL )
+            goto usage;
+        *q++ = '\0';
+
+        if( strcmp( p, "handshakes" ) == 0 )
+        {
+            opt.handshakes = atoi( q );
+            if( opt.handshakes < 1 )
+                goto usage;
+        }
+        else if( strcmp( p, "kex" ) == 0 )
+            opt.kex = q;
+        else
+            goto usage;
+    }
+
+    mbedtls_printf( "\n  . Seeding the random number generator..." );
+    fflush( stdout );
+
+    if( ( ret = mbedtls_ctr_drbg_seed( &ctr_drbg, mbedtls_entropy_func, &entropy,
+                               (const unsigned char *) pers,
+                               strlen( pers ) ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret );
+        goto exit;
+    }
+
+    mbedtls_printf( " ok\n\n" );
+
+    for( kex = kex_list; kex->name != NULL; kex++ )
+    {
+        if( strcmp( opt.kex, "all" ) != 0 && strcmp( opt.kex, kex->name ) != 0 )
+            continue;
+
+        ran++;
+        if( ( ret = run_kex( kex, &entropy, &ctr_drbg ) ) != 0 )
+            goto exit;
+    }
+
+    if( ran == 0 )
+    {
+        mbedtls_printf( "  ! key exchange %s is not available\n", opt.kex );
+        goto usage;
+    }
+
+    ret = 0;
+    goto exit;
+
+usage:
+    mbedtls_printf( USAGE );
+    ret = 1;
+
+exit:
+    mbedtls_ctr_drbg_free( &ctr_drbg );
+    mbedtls_entropy_free( &entropy );
+
+    if( ret < 0 )
+        ret = 1;
+
+    return( ret );
+}
+#endif /* MBEDTLS_ENTROPY_C && MBEDTLS_CTR_DRBG_C && MBEDTLS_SSL_TLS_C &&
+          MBEDTLS_SSL_SRV_C && MBEDTLS_SSL_CLI_C */
@@ -0,0 +1,455 @@
+/*
+ Licensed to the Apache Software Foundation (ASF) under one
+ or more contributor license agreements.  See the NOTICE file
+ distributed with this work for additional information
+ regarding copyright ownership.  The ASF licenses this file
+ to you under the Apache License, Version 2.0 (the
+ "License"); you may not use this file except in compliance
+ with the License.  You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing,
+ software distributed under the License is distributed on an
+ "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ KIND, either express or implied.  See the License for the
+ specific language governing permissions and limitations
+ under the License.
+ */
+
+/*
+ *
+ * record_io_bench.c
+ *
+ * Application data sent from a client to a server context of the same
+ * process, over in-memory transports, after a PSK handshake. Reports the
+ * calls to f_send on the client side and to f_recv on the server side per
+ * MB of application data, which stand for the send() and recv() system
+ * calls of a real connection, with and without MBEDTLS_SSL_WRITE_BATCH
+ * and MBEDTLS_SSL_READ_AHEAD.
+ *
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#include <stdio.h>
+#define mbedtls_free       free
+#define mbedtls_calloc    calloc
+#define mbedtls_printf     printf
+
+#if !defined(MBEDTLS_ENTROPY_C) || !defined(MBEDTLS_CTR_DRBG_C) || \
+    !defined(MBEDTLS_SSL_TLS_C) || !defined(MBEDTLS_SSL_SRV_C) || \
+    !defined(MBEDTLS_SSL_CLI_C) || !defined(MBEDTLS_GCM_C) || \
+    !defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+int main( void )
+{
+    mbedtls_printf("MBEDTLS_ENTROPY_C and/or MBEDTLS_CTR_DRBG_C and/or "
+           "MBEDTLS_SSL_TLS_C and/or MBEDTLS_SSL_SRV_C and/or "
+           "MBEDTLS_SSL_CLI_C and/or MBEDTLS_GCM_C and/or "
+           "MBEDTLS_KEY_EXCHANGE_PSK_ENABLED not defined.\n");
+    return( 0 );
+}
+#else
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define DFL_MB                  16
+#define DFL_WRITE_SIZE          1024
+#define DFL_PSK                 "0102030405060708090a0b0c0d0e0f10"
+#define DFL_PSK_IDENTITY        "Client_identity"
+#define DFL_CIPHERSUITE         "TLS-PSK-WITH-AES-128-GCM-SHA256"
+
+#define PIPE_LEN                65536
+
+#define USAGE \
+    "\n usage: record_io_bench param=<>...\n"               \
+    "\n acceptable parameters:\n"                           \
+    "    mb=%%d               default: 16\n"                \
+    "    write_size=%%d       default: 1024\n"              \
+    "                        bytes per mbedtls_ssl_write() call\n" \
+    "\n"
+
+/*
+ * global options
+ */
+struct options
+{
+    int mb;                     /* MB of application data per run           */
+    int write_size;             /* bytes per mbedtls_ssl_write() call       */
+} opt;
+
+/*
+ * One direction of an in-memory connection
+ */
+typedef struct
+{
+    unsigned char buf[PIPE_LEN];
+    size_t len;
+} mem_pipe;
+
+typedef struct
+{
+    mem_pipe *in;
+    mem_pipe *out;
+    unsigned long sends;        /* calls to mem_send() from this side       */
+    unsigned long recvs;        /* calls to mem_recv() from this side       */
+} mem_endpoint;
+
+/*
+ * Record I/O settings of one run
+ */
+typedef struct
+{
+    const char *name;
+    unsigned int write_batch;   /* records per write call, 0 if unsupported */
+    size_t read_ahead;          /* read-ahead bytes, 0 for none             */
+} bench_run;
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+#define NO_BATCH                1
+#else
+#define NO_BATCH                0
+#endif
+
+static const bench_run run_list[] =
+{
+    { "baseline",           NO_BATCH, 0 },
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    { "write batch",        MBEDTLS_SSL_WRITE_BATCH_RECORDS, 0 },
+#endif
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    { "read-ahead",         NO_BATCH, MBEDTLS_SSL_READ_AHEAD_LEN },
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    { "write batch + read-ahead", MBEDTLS_SSL_WRITE_BATCH_RECORDS,
+                                  MBEDTLS_SSL_READ_AHEAD_LEN },
+#endif
+#endif
+    { NULL, 0, 0 }
+};
+
+static int mem_send( void *ctx, const unsigned char *buf, size_t len )
+{
+    mem_endpoint *end = (mem_endpoint *) ctx;
+    mem_pipe *out = end->out;
+
+    end->sends++;
+
+    if( out->len == PIPE_LEN )
+        return( MBEDTLS_ERR_SSL_WANT_WRITE );
+
+    if( len > PIPE_LEN - out->len )
+        len = PIPE_LEN - out->len;
+
+    memcpy( out->buf + out->len, buf, len );
+    out->len += len;
+
+    return( (int) len );
+}
+
+static int mem_recv( void *ctx, unsigned char *buf, size_t len )
+{
+    mem_endpoint *end = (mem_endpoint *) ctx;
+    mem_pipe *in = end->in;
+
+    end->recvs++;
+
+    if( in->len == 0 )
+        return( MBEDTLS_ERR_SSL_WANT_READ );
+
+    if( len > in->len )
+        len = in->len;
+
+    memcpy( buf, in->buf, len );
+    memmove( in->buf, in->buf + len, in->len - len );
+    in->len -= len;
+
+    return( (int) len );
+}
+
+/*
+ * Monotonic clock, in microseconds
+ */
+static unsigned long now_us( void )
+{
+#if defined(_WIN32)
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter( &count );
+    QueryPerformanceFrequency( &freq );
+
+    return( (unsigned long) ( count.QuadPart * 1000000 / freq.QuadPart ) );
+#else
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return( (unsigned long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 );
+#endif
+}
+
+static int is_retry( int ret )
+{
+    return( ret == MBEDTLS_ERR_SSL_WANT_READ ||
+            ret == MBEDTLS_ERR_SSL_WANT_WRITE );
+}
+
+/*
+ * Handshake, then send opt.mb MB from the client to the server
+ */
+static int run_bench( const bench_run *run, mbedtls_ctr_drbg_context *ctr_drbg )
+{
+    int ret, ciphersuites[2];
+    unsigned char psk[16];
+    unsigned int tmp;
+    unsigned char *data = NULL;
+    size_t i, total, sent = 0, received = 0;
+    unsigned long t0, t1;
+    mbedtls_ssl_config conf_cli, conf_srv;
+    mbedtls_ssl_context cli, srv;
+    mem_pipe *c2s = NULL, *s2c = NULL;
+    mem_endpoint cli_end, srv_end;
+
+    mbedtls_ssl_config_init( &conf_cli );
+    mbedtls_ssl_config_init( &conf_srv );
+    mbedtls_ssl_init( &cli );
+    mbedtls_ssl_init( &srv );
+
+    total = (size_t) opt.mb * 1024 * 1024;
+
+    ciphersuites[0] = mbedtls_ssl_get_ciphersuite_id( DFL_CIPHERSUITE );
+    ciphersuites[1] = 0;
+
+    for( i = 0; i < sizeof( psk ); i++ )
+    {
+        sscanf( DFL_PSK + 2 * i, "%02x", &tmp );
+        psk[i] = (unsigned char) tmp;
+    }
+
+    if( ( ret = mbedtls_ssl_config_defaults( &conf_cli, MBEDTLS_SSL_IS_CLIENT,
+                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 ||
+        ( ret = mbedtls_ssl_config_defaults( &conf_srv, MBEDTLS_SSL_IS_SERVER,
+                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 )
+    {
+        mbedtls_printf( "  ! mbedtls_ssl_config_defaults returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+
+    mbedtls_ssl_conf_rng( &conf_cli, mbedtls_ctr_drbg_random, ctr_drbg );
+    mbedtls_ssl_conf_rng( &conf_srv, mbedtls_ctr_drbg_random, ctr_drbg );
+    mbedtls_ssl_conf_ciphersuites( &conf_cli, ciphersuites );
+    mbedtls_ssl_conf_ciphersuites( &conf_srv, ciphersuites );
+
+    if( ( ret = mbedtls_ssl_conf_psk( &conf_cli, psk, sizeof( psk ),
+                    (const unsigned char *) DFL_PSK_IDENTITY, strlen( DFL_PSK_IDENTITY ) ) ) != 0 ||
+        ( ret = mbedtls_ssl_conf_psk( &conf_srv, psk, sizeof( psk ),
+                    (const unsigned char *) DFL_PSK_IDENTITY, strlen( DFL_PSK_IDENTITY ) ) ) != 0 )
+    {
+        mbedtls_printf( "  ! mbedtls_ssl_conf_psk returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    if( run->write_batch != 0 )
+        mbedtls_ssl_conf_write_batch( &conf_cli, run->write_batch );
+#endif
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    mbedtls_ssl_conf_read_ahead( &conf_srv, run->read_ahead );
+#endif
+
+    data = mbedtls_calloc( 1, opt.write_size );
+    c2s = mbedtls_calloc( 1, sizeof( mem_pipe ) );
+    s2c = mbedtls_calloc( 1, sizeof( mem_pipe ) );
+    if( data == NULL || c2s == NULL || s2c == NULL )
+    {
+        mbedtls_printf( "  ! memory allocation failed\n\n" );
+        ret = MBEDTLS_ERR_SSL_ALLOC_FAILED;
+        goto exit;
+    }
+
+    if( ( ret = mbedtls_ssl_setup( &cli, &conf_cli ) ) != 0 ||
+        ( ret = mbedtls_ssl_setup( &srv, &conf_srv ) ) != 0 )
+    {
+        mbedtls_printf( "  ! mbedtls_ssl_setup returned -0x%x\n\n", -ret );
+        goto exit;
+    }
+
+    memset( &cli_end, 0, sizeof( cli_end ) );
+    memset( &srv_end, 0, sizeof( srv_end ) );
+    cli_end.in = s2c;
+    cli_end.out = c2s;
+    srv_end.in = c2s;
+    srv_end.out = s2c;
+    mbedtls_ssl_set_bio( &cli, &cli_end, mem_send, mem_recv, NULL );
+    mbedtls_ssl_set_bio( &srv, &srv_end, mem_send, mem_recv, NULL );
+
+    while( cli.state != MBEDTLS_SSL_HANDSHAKE_OVER ||
+           srv.state != MBEDTLS_SSL_HANDSHAKE_OVER )
+    {
+        if( ( ( ret = mbedtls_ssl_handshake( &cli ) ) != 0 && !is_retry( ret ) ) ||
+            ( ( ret = mbedtls_ssl_handshake( &srv ) ) != 0 && !is_retry( ret ) ) )
+        {
+            mbedtls_printf( "  ! mbedtls_ssl_handshake returned -0x%x\n\n", -ret );
+            goto exit;
+        }
+    }
+
+    /* Only the application data is counted */
+    cli_end.sends = 0;
+    srv_end.recvs = 0;
+
+    /*
+     * The client writes until the pipe is full, then the server reads
+     * until it is empty, as the two ends of a busy socket would.
+     */
+    t0 = now_us();
+
+    while( received < total )
+    {
+        while( sent < total )
+        {
+            size_t len = total - sent;
+
+            if( len > (size_t) opt.write_size )
+                len = opt.write_size;
+
+            ret = mbedtls_ssl_write( &cli, data, len );
+            if( ret == MBEDTLS_ERR_SSL_WANT_WRITE )
+                break;
+            if( ret < 0 )
+            {
+                mbedtls_printf( "  ! mbedtls_ssl_write returned -0x%x\n\n", -ret );
+                goto exit;
+            }
+
+            sent += ret;
+        }
+
+        while( received < total )
+        {
+            ret = mbedtls_ssl_read( &srv, data, opt.write_size );
+            if( ret == MBEDTLS_ERR_SSL_WANT_READ )
+                break;
+            if( ret <= 0 )
+            {
+                mbedtls_printf( "  ! mbedtls_ssl_read returned -0x%x\n\n", -ret );
+                goto exit;
+            }
+
+            received += ret;
+        }
+    }
+
+    t1 = now_us();
+
+    mbedtls_printf( "  . %-26s send/MB %9.1f  recv/MB %9.1f  %8.1f MB/s\n",
+                    run->name,
+                    (double) cli_end.sends / opt.mb,
+                    (double) srv_end.recvs / opt.mb,
+                    t1 > t0 ? (double) opt.mb * 1000000 / ( t1 - t0 ) : 0.0 );
+
+    ret = 0;
+
+exit:
+    mbedtls_ssl_free( &cli );
+    mbedtls_ssl_free( &srv );
+    mbedtls_ssl_config_free( &conf_cli );
+    mbedtls_ssl_config_free( &conf_srv );
+    mbedtls_free( data );
+    mbedtls_free( c2s );
+    mbedtls_free( s2c );
+
+    return( ret );
+}
+
+int main( int argc, char *argv[] )
+{
+    int ret = 1, i;
+    const char *pers = "record_io_bench";
+    char *p, *q;
+    const bench_run *run;
+
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+
+    mbedtls_entropy_init( &entropy );
+    mbedtls_ctr_drbg_init( &ctr_drbg );
+
+    opt.mb         = DFL_MB;
+    opt.write_size = DFL_WRITE_SIZE;
+
+    for( i = 1; i < argc; i++ )
+    {
+        p = argv[i];
+        if( ( q = strchr( p, '=' ) ) == NULL )
+            goto usage;
+        *q++ = '\0';
+
+        if( strcmp( p, "mb" ) == 0 )
+        {
+            opt.mb = atoi( q );
+            if( opt.mb < 1 || opt.mb > 1024 )
+                goto usage;
+        }
+        else if( strcmp( p, "write_size" ) == 0 )
+        {
+            opt.write_size = atoi( q );
+            if( opt.write_size < 1 || opt.write_size > 1024 * 1024 )
+                goto usage;
+        }
+        else
+            goto usage;
+    }
+
+    mbedtls_printf( "\n  . Seeding the random number generator..." );
+    fflush( stdout );
+
+    if( ( ret = mbedtls_ctr_drbg_seed( &ctr_drbg, mbedtls_entropy_func, &entropy,
+                               (const unsigned char *) pers,
+                               strlen( pers ) ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret );
+        goto exit;
+    }
+
+    mbedtls_printf( " ok\n\n" );
+    mbedtls_printf( "  %d MB in writes of %d bytes, %s\n\n",
+                    opt.mb, opt.write_size, DFL_CIPHERSUITE );
+
+    for( run = run_list; run->name != NULL; run++ )
+    {
+        if( ( ret = run_bench( run, &ctr_drbg ) ) != 0 )
+            goto exit;
+    }
+
+    ret = 0;
+    goto exit;
+
+usage:
+    mbedtls_printf( USAGE );
+    ret = 1;
+
+exit:
+    mbedtls_ctr_drbg_free( &ctr_drbg );
+    mbedtls_entropy_free( &entropy );
+
+    if( ret < 0 )
+        ret = 1;
+
+    return( ret );
+}
+#endif /* MBEDTLS_ENTROPY_C && MBEDTLS_CTR_DRBG_C && MBEDTLS_SSL_TLS_C &&
+          MBEDTLS_SSL_SRV_C && MBEDTLS_SSL_CLI_C && MBEDTLS_GCM_C &&
+          MBEDTLS_KEY_EXCHANGE_PSK_ENABLED */
@@ -273,9 +273,12 @@ int main( int argc, char *argv[] )
     int got_milagro_p2p_ciphersuite;
 #if defined(MBEDTLS_TLS_MILAGRO_CS)
     mbedtls_milagro_cs_context milagro_cs;
+    mbedtls_milagro_cs_context_pool milagro_cs_pool;
 #endif
 #if defined(MBEDTLS_TLS_MILAGRO_P2P)
     mbedtls_milagro_p2p_context milagro_p2p;
+    mbedtls_milagro_p2p_context_pool milagro_p2p_pool;
+    mbedtls_milagro_p2p_precomp_context milagro_p2p_precomp;
 #endif
 #if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
     unsigned char alloc_buf[100000];
@@ -298,9 +301,12 @@ int main( int argc, char *argv[] )
     mbedtls_ctr_drbg_init( &ctr_drbg );
 #if defined(MBEDTLS_TLS_MILAGRO_CS)
     mbedtls_ssl_milagro_cs_init(&milagro_cs );
+    mbedtls_milagro_cs_context_pool_init( &milagro_cs_pool );
 #endif
 #if defined(MBEDTLS_TLS_MILAGRO_P2P)
     mbedtls_ssl_milagro_p2p_init(&milagro_p2p);
+    mbedtls_milagro_p2p_context_pool_init( &milagro_p2p_pool );
+    mbedtls_milagro_p2p_precomp_init( &milagro_p2p_precomp );
 #endif
 #if !defined(_WIN32)
     /* Abort cleanly on SIGTERM and SIGINT */
@@ -480,34 +486,6 @@ int main( int argc, char *argv[] )
 
     mbedtls_printf( " ok\n" );
 
-reset:
-#if !defined(_WIN32)
-    if( received_sigterm )
-    {
-        mbedtls_printf( " interrupted by SIGTERM\n" );
-        ret = 0;
-        goto exit;
-    }
-#endif
-
-    if( ret == MBEDTLS_ERR_SSL_CLIENT_RECONNECT )
-    {
-        mbedtls_printf( "  ! Client initiated reconnection from same port\n" );
-        goto handshake;
-    }
-
-#ifdef MBEDTLS_ERROR_C
-    if( ret != 0 )
-    {
-        char error_buf[100];
-        mbedtls_strerror( ret, error_buf, 100 );
-        mbedtls_printf("Last error was: %d - %s\n\n", ret, error_buf );
-    }
-#endif
-
-    mbedtls_net_free( &client_fd );
-    mbedtls_ssl_session_reset( &ssl );
-
     ciphersuites = ssl.conf->ciphersuite_list[ssl.minor_ver];
     got_milagro_cs_ciphersuite = 0;
     got_milagro_p2p_ciphersuite = 0;
@@ -544,13 +522,14 @@ reset:
     
         mbedtls_ssl_milagro_cs_set_secret(&milagro_cs, cs_server_key, 4*PFS); free(cs_server_key);
     
-        if( mbedtls_ssl_milagro_cs_setup_RNG(&milagro_cs, &entropy) != 0)
+        /* Every handshake gets its own context, seeded from the entropy */
+        if( ( ret = mbedtls_milagro_cs_context_pool_setup( &milagro_cs_pool, &milagro_cs, &entropy ) ) != 0 )
         {
-            printf("\n\nFailed while setting the RNG in MILAGRO_CS\n");
-            exit(-1);
+            mbedtls_printf( " failed\n  ! mbedtls_milagro_cs_context_pool_setup returned -0x%x\n\n", -ret );
+            goto exit;
         }
     
-        mbedtls_ssl_set_milagro_cs(ssl.handshake, &milagro_cs);
+        mbedtls_ssl_conf_milagro_cs( &conf, &milagro_cs_pool );
     
         printf( " ok\n" );
     }
@@ -571,21 +550,70 @@ reset:
     
         mbedtls_ssl_milagro_p2p_set_key(MBEDTLS_SSL_IS_SERVER, &milagro_p2p, p2p_server_key, 2*PFS+1); free(p2p_server_key);
     
-        if (mbedtls_ssl_milagro_p2p_setup_RNG( &milagro_p2p, &entropy) != 0 )
+        mbedtls_ssl_milagro_p2p_set_identity(MBEDTLS_SSL_IS_SERVER, &milagro_p2p, (char *)"server.miracl.com");
+    
+        if( ( ret = mbedtls_milagro_p2p_precomp_setup( &milagro_p2p_precomp, MBEDTLS_SSL_IS_SERVER,
+                                                       "server.miracl.com", &entropy,
+                                                       MBEDTLS_MILAGRO_P2P_PRECOMP_MAX_PAIRS ) ) != 0 )
         {
-            printf("\n\nFailed while setting the RNG in MPIN\n");
-            exit(-1);
+            mbedtls_printf( " failed\n  ! mbedtls_milagro_p2p_precomp_setup returned -0x%x\n\n", -ret );
+            goto exit;
+        }
+#if defined(MBEDTLS_THREADING_PTHREAD)
+        if( ( ret = mbedtls_milagro_p2p_precomp_start( &milagro_p2p_precomp ) ) != 0 )
+        {
+            mbedtls_printf( " failed\n  ! mbedtls_milagro_p2p_precomp_start returned -0x%x\n\n", -ret );
+            goto exit;
         }
+#endif
+        mbedtls_ssl_milagro_p2p_set_precomp( &milagro_p2p, &milagro_p2p_precomp );
     
-        mbedtls_ssl_milagro_p2p_set_identity(MBEDTLS_SSL_IS_SERVER, &milagro_p2p, (char *)"server.miracl.com");
+        if( ( ret = mbedtls_milagro_p2p_context_pool_setup( &milagro_p2p_pool, &milagro_p2p, &entropy ) ) != 0 )
+        {
+            mbedtls_printf( " failed\n  ! mbedtls_milagro_p2p_context_pool_setup returned -0x%x\n\n", -ret );
+            goto exit;
+        }
     
-        mbedtls_ssl_set_milagro_p2p(ssl.handshake, &milagro_p2p);
+        mbedtls_ssl_conf_milagro_p2p( &conf, &milagro_p2p_pool );
     
         mbedtls_printf( " ok\n" );
     }
 #endif /* MBEDTLS_TLS_MILAGRO_P2P */
-    
-    
+
+reset:
+#if !defined(_WIN32)
+    if( received_sigterm )
+    {
+        mbedtls_printf( " interrupted by SIGTERM\n" );
+        ret = 0;
+        goto exit;
+    }
+#endif
+
+    if( ret == MBEDTLS_ERR_SSL_CLIENT_RECONNECT )
+    {
+        mbedtls_printf( "  ! Client initiated reconnection from same port\n" );
+        goto handshake;
+    }
+
+#ifdef MBEDTLS_ERROR_C
+    if( ret != 0 )
+    {
+        char error_buf[100];
+        mbedtls_strerror( ret, error_buf, 100 );
+        mbedtls_printf("Last error was: %d - %s\n\n", ret, error_buf );
+    }
+#endif
+
+    mbedtls_net_free( &client_fd );
+    mbedtls_ssl_session_reset( &ssl );
+
+#if defined(MBEDTLS_TLS_MILAGRO_P2P) && !defined(MBEDTLS_THREADING_PTHREAD)
+    /* No refill thread: fill the precomputed pairs while no client is connected */
+    if( got_milagro_p2p_ciphersuite > 0 )
+        mbedtls_milagro_p2p_precomp_refill( &milagro_p2p_precomp );
+#endif
+
     /*
      * 3. Wait until a client connects
      */
@@ -835,6 +863,15 @@ exit:
     mbedtls_net_free( &client_fd );
     mbedtls_net_free( &listen_fd );
     mbedtls_ssl_free( &ssl );
+#if defined(MBEDTLS_TLS_MILAGRO_CS)
+    mbedtls_milagro_cs_context_pool_free( &milagro_cs_pool );
+    mbedtls_milagro_cs_free( &milagro_cs );
+#endif
+#if defined(MBEDTLS_TLS_MILAGRO_P2P)
+    mbedtls_milagro_p2p_context_pool_free( &milagro_p2p_pool );
+    mbedtls_milagro_p2p_free( &milagro_p2p );
+    mbedtls_milagro_p2p_precomp_free( &milagro_p2p_precomp );
+#endif
     mbedtls_ssl_config_free( &conf );
     mbedtls_ctr_drbg_free( &ctr_drbg );
     mbedtls_entropy_free( &entropy );
@@ -100,6 +100,10 @@ int main( void )
 #define DFL_FALLBACK            -1
 #define DFL_EXTENDED_MS         -1
 #define DFL_ETM                 -1
+#define DFL_WRITE_BATCH         -1
+#define DFL_READ_AHEAD          -1
+#define DFL_READ_INPLACE        0
+#define DFL_WRITEV              0
 
 #define GET_REQUEST "GET %s HTTP/1.0\r\nExtra-header: "
 #define GET_REQUEST_END "\r\n\r\n"
@@ -204,6 +208,26 @@ int main( void )
 #define USAGE_ETM ""
 #endif
 
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+#define USAGE_WRITE_BATCH \
+    "    write_batch=%%d      default: (library default)\n"
+#else
+#define USAGE_WRITE_BATCH ""
+#endif /* MBEDTLS_SSL_WRITE_BATCH */
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+#define USAGE_READ_AHEAD \
+    "    read_ahead=%%d       default: (library default)\n"
+#else
+#define USAGE_READ_AHEAD ""
+#endif /* MBEDTLS_SSL_READ_AHEAD */
+
+#define USAGE_RECORD_IO                                     \
+    USAGE_WRITE_BATCH                                       \
+    USAGE_READ_AHEAD                                        \
+    "    read_inplace=0/1    default: 0 (mbedtls_ssl_read)\n" \
+    "    writev=0/1          default: 0 (mbedtls_ssl_write)\n"
+
 #if defined(MBEDTLS_SSL_RENEGOTIATION)
 #define USAGE_RENEGO \
     "    renegotiation=%%d    default: 0 (disabled)\n"      \
@@ -259,6 +283,8 @@ int main( void )
     USAGE_RECSPLIT                                          \
     USAGE_DHMLEN                                            \
     "\n"                                                    \
+    USAGE_RECORD_IO                                         \
+    "\n"                                                    \
     "    arc4=%%d             default: (library default: 0)\n" \
     "    min_version=%%s      default: (library default: tls1)\n"       \
     "    max_version=%%s      default: (library default: tls1_2)\n"     \
@@ -314,6 +340,10 @@ struct options
     int fallback;               /* is this a fallback connection?           */
     int extended_ms;            /* negotiate extended master secret?        */
     int etm;                    /* negotiate encrypt then mac?              */
+    int write_batch;            /* max records encrypted per write call     */
+    int read_ahead;             /* size of the read-ahead area              */
+    int read_inplace;           /* read with mbedtls_ssl_read_inplace()?    */
+    int writev;                 /* write with mbedtls_ssl_writev()?         */
 } opt;
 
 static void my_debug( void *ctx, int level,
@@ -369,6 +399,53 @@ static int my_send( void *ctx, const unsigned char *buf, size_t len )
     return( ret );
 }
 
+/*
+ * mbedtls_ssl_read(), or with read_inplace=1 the same through
+ * mbedtls_ssl_read_inplace(): copy out what fits and give back only that
+ */
+static int ssl_read_data( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len )
+{
+    const unsigned char *data;
+    int ret;
+
+    if( opt.read_inplace == 0 )
+        return( mbedtls_ssl_read( ssl, buf, len ) );
+
+    if( ( ret = mbedtls_ssl_read_inplace( ssl, &data ) ) <= 0 )
+        return( ret );
+
+    if( (size_t) ret > len )
+        ret = (int) len;
+
+    memcpy( buf, data, ret );
+
+    if( mbedtls_ssl_read_release( ssl, ret ) != 0 )
+        return( MBEDTLS_ERR_SSL_INTERNAL_ERROR );
+
+    return( ret );
+}
+
+/*
+ * mbedtls_ssl_write(), or with writev=1 the same data scattered over
+ * three fragments of unequal sizes for mbedtls_ssl_writev()
+ */
+static int ssl_write_data( mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len )
+{
+    mbedtls_ssl_iovec iov[3];
+
+    if( opt.writev == 0 )
+        return( mbedtls_ssl_write( ssl, buf, len ) );
+
+    iov[0].base = buf;
+    iov[0].len  = len / 7;
+    iov[1].base = iov[0].base + iov[0].len;
+    iov[1].len  = len / 2;
+    iov[2].base = iov[1].base + iov[1].len;
+    iov[2].len  = len - iov[0].len - iov[1].len;
+
+    return( mbedtls_ssl_writev( ssl, iov, 3 ) );
+}
+
 #if defined(MBEDTLS_X509_CRT_PARSE_C)
 /*
  * Enabled if debug_level > 1 in code below
@@ -504,6 +581,10 @@ int main( int argc, char *argv[] )
     opt.fallback            = DFL_FALLBACK;
     opt.extended_ms         = DFL_EXTENDED_MS;
     opt.etm                 = DFL_ETM;
+    opt.write_batch         = DFL_WRITE_BATCH;
+    opt.read_ahead          = DFL_READ_AHEAD;
+    opt.read_inplace        = DFL_READ_INPLACE;
+    opt.writev              = DFL_WRITEV;
 
     for( i = 1; i < argc; i++ )
     {
@@ -663,6 +744,30 @@ int main( int argc, char *argv[] )
                 default: goto usage;
             }
         }
+        else if( strcmp( p, "write_batch" ) == 0 )
+        {
+            opt.write_batch = atoi( q );
+            if( opt.write_batch < 0 )
+                goto usage;
+        }
+        else if( strcmp( p, "read_ahead" ) == 0 )
+        {
+            opt.read_ahead = atoi( q );
+            if( opt.read_ahead < 0 )
+                goto usage;
+        }
+        else if( strcmp( p, "read_inplace" ) == 0 )
+        {
+            opt.read_inplace = atoi( q );
+            if( opt.read_inplace < 0 || opt.read_inplace > 1 )
+                goto usage;
+        }
+        else if( strcmp( p, "writev" ) == 0 )
+        {
+            opt.writev = atoi( q );
+            if( opt.writev < 0 || opt.writev > 1 )
+                goto usage;
+        }
         else if( strcmp( p, "min_version" ) == 0 )
         {
             if( strcmp( q, "ssl3" ) == 0 )
@@ -1121,6 +1226,16 @@ int main( int argc, char *argv[] )
         mbedtls_ssl_conf_encrypt_then_mac( &conf, opt.etm );
 #endif
 
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    if( opt.write_batch != DFL_WRITE_BATCH )
+        mbedtls_ssl_conf_write_batch( &conf, opt.write_batch );
+#endif
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    if( opt.read_ahead != DFL_READ_AHEAD )
+        mbedtls_ssl_conf_read_ahead( &conf, opt.read_ahead );
+#endif
+
 #if defined(MBEDTLS_SSL_CBC_RECORD_SPLITTING)
     if( opt.recsplit != DFL_RECSPLIT )
         mbedtls_ssl_conf_cbc_record_splitting( &conf, opt.recsplit
@@ -1236,6 +1351,9 @@ int main( int argc, char *argv[] )
         mbedtls_ssl_set_bio( &ssl, &server_fd, mbedtls_net_send, mbedtls_net_recv,
                              opt.nbio == 0 ? mbedtls_net_recv_timeout : NULL );
 
+    if( opt.writev != 0 && opt.nbio != 2 )
+        mbedtls_ssl_set_bio_vec( &ssl, mbedtls_net_send_vec );
+
 #if defined(MBEDTLS_TIMING_C)
     mbedtls_ssl_set_timer_cb( &ssl, &timer, mbedtls_timing_set_delay,
                                             mbedtls_timing_get_delay );
@@ -1391,7 +1509,7 @@ send_request:
     {
         for( written = 0, frags = 0; written < len; written += ret, frags++ )
         {
-            while( ( ret = mbedtls_ssl_write( &ssl, buf + written, len - written ) )
+            while( ( ret = ssl_write_data( &ssl, buf + written, len - written ) )
                            <= 0 )
             {
                 if( ret != MBEDTLS_ERR_SSL_WANT_READ &&
@@ -1437,7 +1555,7 @@ send_request:
         {
             len = sizeof( buf ) - 1;
             memset( buf, 0, sizeof( buf ) );
-            ret = mbedtls_ssl_read( &ssl, buf, len );
+            ret = ssl_read_data( &ssl, buf, len );
 
             if( ret == MBEDTLS_ERR_SSL_WANT_READ ||
                 ret == MBEDTLS_ERR_SSL_WANT_WRITE )
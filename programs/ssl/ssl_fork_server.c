@@ -68,6 +68,10 @@ int main( void )
 #include "mbedtls/net.h"
 #include "mbedtls/timing.h"
 
+#if defined(MBEDTLS_SSL_CACHE_SHM_C)
+#include "mbedtls/ssl_cache_shm.h"
+#endif
+
 #include <string.h>
 #include <signal.h>
 
@@ -105,6 +109,9 @@ int main( void )
     mbedtls_ssl_config conf;
     mbedtls_x509_crt srvcert;
     mbedtls_pk_context pkey;
+#if defined(MBEDTLS_SSL_CACHE_SHM_C)
+    mbedtls_ssl_cache_shm_context cache;
+#endif
 
     mbedtls_net_init( &listen_fd );
     mbedtls_net_init( &client_fd );
@@ -114,6 +121,9 @@ int main( void )
     mbedtls_pk_init( &pkey );
     mbedtls_x509_crt_init( &srvcert );
     mbedtls_ctr_drbg_init( &ctr_drbg );
+#if defined(MBEDTLS_SSL_CACHE_SHM_C)
+    mbedtls_ssl_cache_shm_init( &cache );
+#endif
 
     signal( SIGCHLD, SIG_IGN );
 
@@ -195,6 +205,21 @@ int main( void )
         goto exit;
     }
 
+#if defined(MBEDTLS_SSL_CACHE_SHM_C)
+    /*
+     * The cache is mapped before forking so every child shares it
+     */
+    if( ( ret = mbedtls_ssl_cache_shm_setup( &cache, 1000, 86400 ) ) != 0 )
+    {
+        mbedtls_printf( " failed\n  ! mbedtls_ssl_cache_shm_setup returned %d\n\n", ret );
+        goto exit;
+    }
+
+    mbedtls_ssl_conf_session_cache( &conf, &cache,
+                                   mbedtls_ssl_cache_shm_get,
+                                   mbedtls_ssl_cache_shm_set );
+#endif
+
     mbedtls_printf( " ok\n" );
 
     /*
@@ -393,6 +418,9 @@ exit:
     mbedtls_ssl_config_free( &conf );
     mbedtls_ctr_drbg_free( &ctr_drbg );
     mbedtls_entropy_free( &entropy );
+#if defined(MBEDTLS_SSL_CACHE_SHM_C)
+    mbedtls_ssl_cache_shm_free( &cache );
+#endif
 
 #if defined(_WIN32)
     mbedtls_printf( "  Press Enter to exit this program.\n" );
@@ -73,6 +73,10 @@ int main( void )
 #include "mbedtls/ssl_ticket.h"
 #endif
 
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+#include "mbedtls/ssl_keyshare.h"
+#endif
+
 #if defined(MBEDTLS_SSL_COOKIE_C)
 #include "mbedtls/ssl_cookie.h"
 #endif
@@ -122,6 +126,13 @@ int main( void )
 #define DFL_TICKET_TIMEOUT      86400
 #define DFL_CACHE_MAX           -1
 #define DFL_CACHE_TIMEOUT       -1
+#define DFL_KEYSHARE            0
+#define DFL_KEYSHARE_THREADS    1
+#define DFL_BUFFER_POOL         0
+#define DFL_WRITE_BATCH         -1
+#define DFL_READ_AHEAD          -1
+#define DFL_READ_INPLACE        0
+#define DFL_WRITEV              0
 #define DFL_SNI                 NULL
 #define DFL_ALPN_STRING         NULL
 #define DFL_DHM_FILE            NULL
@@ -208,6 +219,49 @@ int main( void )
 #define USAGE_CACHE ""
 #endif /* MBEDTLS_SSL_CACHE_C */
 
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+#if defined(MBEDTLS_THREADING_PTHREAD)
+#define USAGE_KEYSHARE_THREADS                                  \
+    "    keyshare_threads=%%d default: 1\n"
+#else
+#define USAGE_KEYSHARE_THREADS ""
+#endif
+#define USAGE_KEYSHARE                                          \
+    "    keyshare=%%d         default: 0 (disabled)\n"          \
+    "                        ECDH key pairs precomputed per curve\n" \
+    USAGE_KEYSHARE_THREADS
+#else
+#define USAGE_KEYSHARE ""
+#endif /* MBEDTLS_SSL_KEYSHARE_C */
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+#define USAGE_BUFFER_POOL \
+    "    buffer_pool=0/1     default: 0 (record buffers owned by the context)\n"
+#else
+#define USAGE_BUFFER_POOL ""
+#endif /* MBEDTLS_SSL_BUFFER_POOL */
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+#define USAGE_WRITE_BATCH \
+    "    write_batch=%%d      default: (library default)\n"
+#else
+#define USAGE_WRITE_BATCH ""
+#endif /* MBEDTLS_SSL_WRITE_BATCH */
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+#define USAGE_READ_AHEAD \
+    "    read_ahead=%%d       default: (library default)\n"
+#else
+#define USAGE_READ_AHEAD ""
+#endif /* MBEDTLS_SSL_READ_AHEAD */
+
+#define USAGE_RECORD_IO                                     \
+    USAGE_BUFFER_POOL                                       \
+    USAGE_WRITE_BATCH                                       \
+    USAGE_READ_AHEAD                                        \
+    "    read_inplace=0/1    default: 0 (mbedtls_ssl_read)\n" \
+    "    writev=0/1          default: 0 (mbedtls_ssl_write)\n"
+
 #if defined(SNI_OPTION)
 #define USAGE_SNI                                                           \
     "    sni=%%s              name1,cert1,key1,ca1,crl1,auth1[,...]\n"  \
@@ -330,6 +384,10 @@ int main( void )
     "\n"                                                    \
     USAGE_TICKETS                                           \
     USAGE_CACHE                                             \
+    USAGE_KEYSHARE                                          \
+    "\n"                                                    \
+    USAGE_RECORD_IO                                         \
+    "\n"                                                    \
     USAGE_MAX_FRAG_LEN                                      \
     USAGE_TRUNC_HMAC                                        \
     USAGE_ALPN                                              \
@@ -386,6 +444,13 @@ struct options
     int ticket_timeout;         /* session ticket lifetime                  */
     int cache_max;              /* max number of session cache entries      */
     int cache_timeout;          /* expiration delay of session cache entries */
+    int keyshare;               /* precomputed ECDH key pairs per curve     */
+    int keyshare_threads;       /* threads refilling the keyshare pool      */
+    int buffer_pool;            /* take record buffers from a shared pool?  */
+    int write_batch;            /* max records encrypted per write call     */
+    int read_ahead;             /* size of the read-ahead area              */
+    int read_inplace;           /* read with mbedtls_ssl_read_inplace()?    */
+    int writev;                 /* write with mbedtls_ssl_writev()?         */
     char *sni;                  /* string describing sni information        */
     const char *alpn_string;    /* ALPN supported protocols                 */
     const char *dhm_file;       /* the file with the DH parameters          */
@@ -452,6 +517,53 @@ static int my_send( void *ctx, const unsigned char *buf, size_t len )
     return( ret );
 }
 
+/*
+ * mbedtls_ssl_read(), or with read_inplace=1 the same through
+ * mbedtls_ssl_read_inplace(): copy out what fits and give back only that
+ */
+static int ssl_read_data( mbedtls_ssl_context *ssl, unsigned char *buf, size_t len )
+{
+    const unsigned char *data;
+    int ret;
+
+    if( opt.read_inplace == 0 )
+        return( mbedtls_ssl_read( ssl, buf, len ) );
+
+    if( ( ret = mbedtls_ssl_read_inplace( ssl, &data ) ) <= 0 )
+        return( ret );
+
+    if( (size_t) ret > len )
+        ret = (int) len;
+
+    memcpy( buf, data, ret );
+
+    if( mbedtls_ssl_read_release( ssl, ret ) != 0 )
+        return( MBEDTLS_ERR_SSL_INTERNAL_ERROR );
+
+    return( ret );
+}
+
+/*
+ * mbedtls_ssl_write(), or with writev=1 the same data scattered over
+ * three fragments of unequal sizes for mbedtls_ssl_writev()
+ */
+static int ssl_write_data( mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len )
+{
+    mbedtls_ssl_iovec iov[3];
+
+    if( opt.writev == 0 )
+        return( mbedtls_ssl_write( ssl, buf, len ) );
+
+    iov[0].base = buf;
+    iov[0].len  = len / 7;
+    iov[1].base = iov[0].base + iov[0].len;
+    iov[1].len  = len / 2;
+    iov[2].base = iov[1].base + iov[1].len;
+    iov[2].len  = len - iov[0].len - iov[1].len;
+
+    return( mbedtls_ssl_writev( ssl, iov, 3 ) );
+}
+
 /*
  * Return authmode from string, or -1 on error
  */
@@ -819,6 +931,13 @@ int main( int argc, char *argv[] )
 #if defined(MBEDTLS_SSL_SESSION_TICKETS)
     mbedtls_ssl_ticket_context ticket_ctx;
 #endif
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+    mbedtls_ssl_keyshare_pool keyshare;
+    mbedtls_ecp_group_id keyshare_curves[MBEDTLS_SSL_KEYSHARE_MAX_CURVES + 1];
+#endif
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    mbedtls_ssl_buffer_pool buffer_pool;
+#endif
 #if defined(SNI_OPTION)
     sni_entry *sni_info = NULL;
 #endif
@@ -861,6 +980,13 @@ int main( int argc, char *argv[] )
 #if defined(MBEDTLS_SSL_SESSION_TICKETS)
     mbedtls_ssl_ticket_init( &ticket_ctx );
 #endif
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+    mbedtls_ssl_keyshare_init( &keyshare );
+    keyshare_curves[0] = MBEDTLS_ECP_DP_NONE;
+#endif
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    mbedtls_ssl_buffer_pool_init( &buffer_pool );
+#endif
 #if defined(MBEDTLS_SSL_ALPN)
     memset( (void *) alpn_list, 0, sizeof( alpn_list ) );
 #endif
@@ -929,6 +1055,13 @@ int main( int argc, char *argv[] )
     opt.ticket_timeout      = DFL_TICKET_TIMEOUT;
     opt.cache_max           = DFL_CACHE_MAX;
     opt.cache_timeout       = DFL_CACHE_TIMEOUT;
+    opt.keyshare            = DFL_KEYSHARE;
+    opt.keyshare_threads    = DFL_KEYSHARE_THREADS;
+    opt.buffer_pool         = DFL_BUFFER_POOL;
+    opt.write_batch         = DFL_WRITE_BATCH;
+    opt.read_ahead          = DFL_READ_AHEAD;
+    opt.read_inplace        = DFL_READ_INPLACE;
+    opt.writev              = DFL_WRITEV;
     opt.sni                 = DFL_SNI;
     opt.alpn_string         = DFL_ALPN_STRING;
     opt.dhm_file            = DFL_DHM_FILE;
@@ -1197,6 +1330,48 @@ int main( int argc, char *argv[] )
             if( opt.cache_timeout < 0 )
                 goto usage;
         }
+        else if( strcmp( p, "keyshare" ) == 0 )
+        {
+            opt.keyshare = atoi( q );
+            if( opt.keyshare < 0 )
+                goto usage;
+        }
+        else if( strcmp( p, "keyshare_threads" ) == 0 )
+        {
+            opt.keyshare_threads = atoi( q );
+            if( opt.keyshare_threads < 0 )
+                goto usage;
+        }
+        else if( strcmp( p, "buffer_pool" ) == 0 )
+        {
+            opt.buffer_pool = atoi( q );
+            if( opt.buffer_pool < 0 || opt.buffer_pool > 1 )
+                goto usage;
+        }
+        else if( strcmp( p, "write_batch" ) == 0 )
+        {
+            opt.write_batch = atoi( q );
+            if( opt.write_batch < 0 )
+                goto usage;
+        }
+        else if( strcmp( p, "read_ahead" ) == 0 )
+        {
+            opt.read_ahead = atoi( q );
+            if( opt.read_ahead < 0 )
+                goto usage;
+        }
+        else if( strcmp( p, "read_inplace" ) == 0 )
+        {
+            opt.read_inplace = atoi( q );
+            if( opt.read_inplace < 0 || opt.read_inplace > 1 )
+                goto usage;
+        }
+        else if( strcmp( p, "writev" ) == 0 )
+        {
+            opt.writev = atoi( q );
+            if( opt.writev < 0 || opt.writev > 1 )
+                goto usage;
+        }
         else if( strcmp( p, "cookies" ) == 0 )
         {
             opt.cookies = atoi( q );
@@ -1660,6 +1835,53 @@ int main( int argc, char *argv[] )
                                    mbedtls_ssl_cache_set );
 #endif
 
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+    if( opt.keyshare != 0 )
+    {
+        const mbedtls_ecp_group_id *gid = mbedtls_ecp_grp_id_list();
+
+        for( i = 0; i < MBEDTLS_SSL_KEYSHARE_MAX_CURVES && gid[i] != MBEDTLS_ECP_DP_NONE; i++ )
+            keyshare_curves[i] = gid[i];
+        keyshare_curves[i] = MBEDTLS_ECP_DP_NONE;
+
+        if( ( ret = mbedtls_ssl_keyshare_setup( &keyshare, keyshare_curves, opt.keyshare,
+                                        mbedtls_ctr_drbg_random, &ctr_drbg ) ) != 0 )
+        {
+            mbedtls_printf( " failed\n  ! mbedtls_ssl_keyshare_setup returned %d\n\n", ret );
+            goto exit;
+        }
+
+#if defined(MBEDTLS_THREADING_PTHREAD)
+        if( opt.keyshare_threads > 0 )
+            ret = mbedtls_ssl_keyshare_start( &keyshare, opt.keyshare_threads );
+        else
+#endif
+            ret = mbedtls_ssl_keyshare_refill( &keyshare );
+        if( ret != 0 )
+        {
+            mbedtls_printf( " failed\n  ! mbedtls_ssl_keyshare_refill returned %d\n\n", ret );
+            goto exit;
+        }
+
+        mbedtls_ssl_conf_keyshare_cb( &conf, mbedtls_ssl_keyshare_get, &keyshare );
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( opt.buffer_pool != 0 )
+        mbedtls_ssl_conf_buffer_pool( &conf, &buffer_pool );
+#endif
+
+#if defined(MBEDTLS_SSL_WRITE_BATCH)
+    if( opt.write_batch != DFL_WRITE_BATCH )
+        mbedtls_ssl_conf_write_batch( &conf, opt.write_batch );
+#endif
+
+#if defined(MBEDTLS_SSL_READ_AHEAD)
+    if( opt.read_ahead != DFL_READ_AHEAD )
+        mbedtls_ssl_conf_read_ahead( &conf, opt.read_ahead );
+#endif
+
 #if defined(MBEDTLS_SSL_SESSION_TICKETS)
     if( opt.tickets == MBEDTLS_SSL_SESSION_TICKETS_ENABLED )
     {
@@ -1834,6 +2056,9 @@ int main( int argc, char *argv[] )
         mbedtls_ssl_set_bio( &ssl, &client_fd, mbedtls_net_send, mbedtls_net_recv,
                              opt.nbio == 0 ? mbedtls_net_recv_timeout : NULL );
 
+    if( opt.writev != 0 && opt.nbio != 2 )
+        mbedtls_ssl_set_bio_vec( &ssl, mbedtls_net_send_vec );
+
 #if defined(MBEDTLS_TIMING_C)
     mbedtls_ssl_set_timer_cb( &ssl, &timer, mbedtls_timing_set_delay,
                                             mbedtls_timing_get_delay );
@@ -2043,7 +2268,7 @@ data_exchange:
             int terminated = 0;
             len = sizeof( buf ) - 1;
             memset( buf, 0, sizeof( buf ) );
-            ret = mbedtls_ssl_read( &ssl, buf, len );
+            ret = ssl_read_data( &ssl, buf, len );
 
             if( ret == MBEDTLS_ERR_SSL_WANT_READ ||
                 ret == MBEDTLS_ERR_SSL_WANT_WRITE )
@@ -2100,7 +2325,7 @@ data_exchange:
                 memcpy( larger_buf, buf, ori_len );
 
                 /* This read should never fail and get the whole cached data */
-                ret = mbedtls_ssl_read( &ssl, larger_buf + ori_len, extra_len );
+                ret = ssl_read_data( &ssl, larger_buf + ori_len, extra_len );
                 if( ret != extra_len ||
                     mbedtls_ssl_get_bytes_avail( &ssl ) != 0 )
                 {
@@ -2197,7 +2422,7 @@ data_exchange:
     {
         for( written = 0, frags = 0; written < len; written += ret, frags++ )
         {
-            while( ( ret = mbedtls_ssl_write( &ssl, buf + written, len - written ) )
+            while( ( ret = ssl_write_data( &ssl, buf + written, len - written ) )
                            <= 0 )
             {
                 if( ret == MBEDTLS_ERR_NET_CONN_RESET )
@@ -2235,6 +2460,17 @@ data_exchange:
     mbedtls_printf( " %d bytes written in %d fragments\n\n%s\n", written, frags, (char *) buf );
     ret = 0;
 
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    if( opt.buffer_pool != 0 )
+    {
+        size_t in_use, idle, peak;
+
+        if( mbedtls_ssl_buffer_pool_stats( &buffer_pool, &in_use, &idle, &peak ) == 0 )
+            mbedtls_printf( "  . Buffer pool: %u bytes in use, %u idle, %u peak\n",
+                            (unsigned) in_use, (unsigned) idle, (unsigned) peak );
+    }
+#endif
+
     /*
      * 7b. Continue doing data exchanges?
      */
@@ -2269,6 +2505,25 @@ exit:
     }
 #endif
 
+#if defined(MBEDTLS_SSL_KEYSHARE_C)
+    for( i = 0; opt.keyshare != 0 && keyshare_curves[i] != MBEDTLS_ECP_DP_NONE; i++ )
+    {
+        int available;
+        unsigned long hits, misses, generated;
+
+        if( mbedtls_ssl_keyshare_stats( &keyshare, keyshare_curves[i], &available,
+                                        &hits, &misses, &generated ) == 0 )
+        {
+            mbedtls_printf( "  . Keyshare %s: %d ready, %lu hits, %lu misses, %lu generated\n",
+                            mbedtls_ecp_curve_info_from_grp_id( keyshare_curves[i] )->name,
+                            available, hits, misses, generated );
+        }
+    }
+
+    /* Stop the refill threads before the RNG goes away */
+    mbedtls_ssl_keyshare_free( &keyshare );
+#endif
+
     mbedtls_printf( "  . Cleaning up..." );
     fflush( stdout );
 
@@ -2309,6 +2564,9 @@ exit:
 #if defined(MBEDTLS_SSL_COOKIE_C)
     mbedtls_ssl_cookie_free( &cookie_ctx );
 #endif
+#if defined(MBEDTLS_SSL_BUFFER_POOL)
+    mbedtls_ssl_buffer_pool_free( &buffer_pool );
+#endif
 
 #if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
 #if defined(MBEDTLS_MEMORY_DEBUG)
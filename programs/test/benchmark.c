@@ -47,6 +47,7 @@ int main( void )
 #include <stdlib.h>
 
 #include "mbedtls/timing.h"
+#include "mbedtls/cpu.h"
 
 #include "mbedtls/md4.h"
 #include "mbedtls/md5.h"
@@ -61,6 +62,9 @@ int main( void )
 #include "mbedtls/camellia.h"
 #include "mbedtls/gcm.h"
 #include "mbedtls/ccm.h"
+#include "mbedtls/chacha20.h"
+#include "mbedtls/poly1305.h"
+#include "mbedtls/chachapoly.h"
 #include "mbedtls/havege.h"
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/hmac_drbg.h"
@@ -70,6 +74,10 @@ int main( void )
 #include "mbedtls/ecdh.h"
 #include "mbedtls/error.h"
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS)
+#include "mbedtls/milagro.h"
+#endif
+
 #if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
 #include "mbedtls/memory_buffer_alloc.h"
 #endif
@@ -93,8 +101,11 @@ int main( void )
 #define OPTIONS                                                         \
     "md4, md5, ripemd160, sha1, sha256, sha512,\n"                      \
     "arc4, des3, des, aes_cbc, aes_gcm, aes_ccm, camellia, blowfish,\n" \
+    "chacha20, poly1305, chachapoly,\n"                                \
     "havege, ctr_drbg, hmac_drbg\n"                                     \
-    "rsa, dhm, ecdsa, ecdh.\n"
+    "rsa, dhm, ecdsa, ecdh, milagro_cs.\n"                             \
+    "Force an implementation with <primitive>=<implementation>,\n"     \
+    "e.g. AES=generic, using the names listed before the results.\n"
 
 #if defined(MBEDTLS_ERROR_C)
 #define PRINT_ERROR                                                     \
@@ -105,7 +116,11 @@ int main( void )
         mbedtls_printf( "FAILED: -0x%04x\n", -ret );
 #endif
 
-#define TIME_AND_TSC( TITLE, CODE )                                     \
+/*
+ * Cycles per byte are printed with two decimals, as bulk AES-GCM and the
+ * hashes with hardware support take less than a few cycles per byte
+ */
+#define TIME_AND_TSC_LEN( TITLE, LEN, CODE )                            \
 do {                                                                    \
     unsigned long ii, jj, tsc;                                          \
                                                                         \
@@ -123,12 +138,17 @@ do {                                                                    \
     {                                                                   \
         CODE;                                                           \
     }                                                                   \
+    tsc = mbedtls_timing_hardclock() - tsc;                             \
                                                                         \
-    mbedtls_printf( "%9lu Kb/s,  %9lu cycles/byte\n",                   \
-                     ii * BUFSIZE / 1024,                               \
-                     ( mbedtls_timing_hardclock() - tsc ) / ( jj * BUFSIZE ) );         \
+    mbedtls_printf( "%9lu Kb/s,  %6lu.%02lu cycles/byte\n",             \
+                     ii * ( LEN ) / 1024,                               \
+                     tsc / ( jj * ( LEN ) ),                            \
+                     tsc % ( jj * ( LEN ) ) * 100 / ( jj * ( LEN ) ) ); \
 } while( 0 )
 
+#define TIME_AND_TSC( TITLE, CODE )                                     \
+    TIME_AND_TSC_LEN( TITLE, BUFSIZE, CODE )
+
 #if defined(MBEDTLS_ERROR_C)
 #define PRINT_ERROR                                                     \
         mbedtls_strerror( ret, ( char * )tmp, sizeof( tmp ) );          \
@@ -232,16 +252,48 @@ void ecp_clear_precomputed( mbedtls_ecp_group *grp )
 
 unsigned char buf[BUFSIZE];
 
+/*
+ * Force the implementation given as <primitive>=<implementation>
+ */
+static int set_impl( const char *arg )
+{
+#if defined(MBEDTLS_CPU_C)
+    int p, i;
+    const char *name, *eq = strchr( arg, '=' );
+
+    for( p = 0; p < MBEDTLS_CPU_PRIMITIVES; p++ )
+    {
+        name = mbedtls_cpu_primitive_name( (mbedtls_cpu_primitive_t) p );
+
+        if( strlen( name ) != (size_t)( eq - arg ) ||
+            strncmp( arg, name, eq - arg ) != 0 )
+            continue;
+
+        for( i = 0; i < MBEDTLS_CPU_IMPLS; i++ )
+        {
+            if( strcmp( eq + 1, mbedtls_cpu_impl_name( (mbedtls_cpu_impl_t) i ) ) == 0 )
+                return( mbedtls_cpu_set_impl( (mbedtls_cpu_primitive_t) p,
+                                              (mbedtls_cpu_impl_t) i ) );
+        }
+    }
+#else
+    ((void) arg);
+#endif /* MBEDTLS_CPU_C */
+
+    return( MBEDTLS_ERR_CPU_FEATURE_UNAVAILABLE );
+}
+
 typedef struct {
     char md4, md5, ripemd160, sha1, sha256, sha512,
          arc4, des3, des, aes_cbc, aes_gcm, aes_ccm, camellia, blowfish,
+         chacha20, poly1305, chachapoly,
          havege, ctr_drbg, hmac_drbg,
-         rsa, dhm, ecdsa, ecdh;
+         rsa, dhm, ecdsa, ecdh, milagro_cs;
 } todo_list;
 
 int main( int argc, char *argv[] )
 {
-    int i;
+    int i, forced = 0;
     unsigned char tmp[200];
     char title[TITLE_LEN];
     todo_list todo;
@@ -259,7 +311,13 @@ int main( int argc, char *argv[] )
 
         for( i = 1; i < argc; i++ )
         {
-            if( strcmp( argv[i], "md4" ) == 0 )
+            if( strchr( argv[i], '=' ) != NULL )
+            {
+                forced++;
+                if( set_impl( argv[i] ) != 0 )
+                    mbedtls_printf( "Unavailable implementation: %s\n", argv[i] );
+            }
+            else if( strcmp( argv[i], "md4" ) == 0 )
                 todo.md4 = 1;
             else if( strcmp( argv[i], "md5" ) == 0 )
                 todo.md5 = 1;
@@ -287,6 +345,12 @@ int main( int argc, char *argv[] )
                 todo.camellia = 1;
             else if( strcmp( argv[i], "blowfish" ) == 0 )
                 todo.blowfish = 1;
+            else if( strcmp( argv[i], "chacha20" ) == 0 )
+                todo.chacha20 = 1;
+            else if( strcmp( argv[i], "poly1305" ) == 0 )
+                todo.poly1305 = 1;
+            else if( strcmp( argv[i], "chachapoly" ) == 0 )
+                todo.chachapoly = 1;
             else if( strcmp( argv[i], "havege" ) == 0 )
                 todo.havege = 1;
             else if( strcmp( argv[i], "ctr_drbg" ) == 0 )
@@ -301,6 +365,8 @@ int main( int argc, char *argv[] )
                 todo.ecdsa = 1;
             else if( strcmp( argv[i], "ecdh" ) == 0 )
                 todo.ecdh = 1;
+            else if( strcmp( argv[i], "milagro_cs" ) == 0 )
+                todo.milagro_cs = 1;
             else
             {
                 mbedtls_printf( "Unrecognized option: %s\n", argv[i] );
@@ -309,7 +375,22 @@ int main( int argc, char *argv[] )
         }
     }
 
+    /* Only implementations forced: run everything with them */
+    if( forced == argc - 1 )
+        memset( &todo, 1, sizeof( todo ) );
+
+    mbedtls_printf( "\n" );
+
+#if defined(MBEDTLS_CPU_C)
+    for( i = 0; i < MBEDTLS_CPU_PRIMITIVES; i++ )
+    {
+        mbedtls_printf( "  %-9s: %s\n",
+                mbedtls_cpu_primitive_name( (mbedtls_cpu_primitive_t) i ),
+                mbedtls_cpu_impl_name( mbedtls_cpu_impl( (mbedtls_cpu_primitive_t) i ) ) );
+    }
+
     mbedtls_printf( "\n" );
+#endif
 
 #if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
     mbedtls_memory_buffer_alloc_init( alloc_buf, sizeof( alloc_buf ) );
@@ -339,12 +420,43 @@ int main( int argc, char *argv[] )
 
 #if defined(MBEDTLS_SHA256_C)
     if( todo.sha256 )
+    {
+        const unsigned char *in[MBEDTLS_SHA256_MULTI_LANES];
+        unsigned char *out[MBEDTLS_SHA256_MULTI_LANES];
+        unsigned char sums[MBEDTLS_SHA256_MULTI_LANES][32];
+        size_t len[MBEDTLS_SHA256_MULTI_LANES];
+
         TIME_AND_TSC( "SHA-256", mbedtls_sha256( buf, BUFSIZE, tmp, 0 ) );
+        TIME_AND_TSC_LEN( "SHA-256 (64 bytes)", 64,
+                mbedtls_sha256( buf, 64, tmp, 0 ) );
+
+        for( i = 0; i < MBEDTLS_SHA256_MULTI_LANES; i++ )
+        {
+            in[i] = buf + 64 * i;
+            out[i] = sums[i];
+            len[i] = 64;
+        }
+
+        snprintf( title, sizeof( title ), "SHA-256 (%d x 64B)",
+                  MBEDTLS_SHA256_MULTI_LANES );
+        TIME_AND_TSC_LEN( title, 64 * MBEDTLS_SHA256_MULTI_LANES,
+                mbedtls_sha256_multi( MBEDTLS_SHA256_MULTI_LANES,
+                                      in, len, out, 0 ) );
+        snprintf( title, sizeof( title ), "HMAC-SHA-256 (%d x 64B)",
+                  MBEDTLS_SHA256_MULTI_LANES );
+        TIME_AND_TSC_LEN( title, 64 * MBEDTLS_SHA256_MULTI_LANES,
+                mbedtls_sha256_hmac_multi( tmp, 32, MBEDTLS_SHA256_MULTI_LANES,
+                                           in, len, out ) );
+    }
 #endif
 
 #if defined(MBEDTLS_SHA512_C)
     if( todo.sha512 )
+    {
         TIME_AND_TSC( "SHA-512", mbedtls_sha512( buf, BUFSIZE, tmp, 0 ) );
+        TIME_AND_TSC_LEN( "SHA-512 (64 bytes)", 64,
+                mbedtls_sha512( buf, 64, tmp, 0 ) );
+    }
 #endif
 
 #if defined(MBEDTLS_ARC4_C)
@@ -495,6 +607,53 @@ int main( int argc, char *argv[] )
     }
 #endif
 
+#if defined(MBEDTLS_CHACHA20_C)
+    if( todo.chacha20 )
+    {
+        mbedtls_chacha20_context chacha20;
+        mbedtls_chacha20_init( &chacha20 );
+
+        memset( buf, 0, sizeof( buf ) );
+        memset( tmp, 0, sizeof( tmp ) );
+        mbedtls_chacha20_setkey( &chacha20, tmp );
+        mbedtls_chacha20_starts( &chacha20, tmp, 0 );
+
+        TIME_AND_TSC( "ChaCha20",
+                mbedtls_chacha20_update( &chacha20, BUFSIZE, buf, buf ) );
+
+        mbedtls_chacha20_free( &chacha20 );
+    }
+#endif
+
+#if defined(MBEDTLS_POLY1305_C)
+    if( todo.poly1305 )
+    {
+        memset( buf, 0, sizeof( buf ) );
+        memset( tmp, 0, sizeof( tmp ) );
+
+        TIME_AND_TSC( "Poly1305",
+                mbedtls_poly1305_mac( tmp, buf, BUFSIZE, tmp ) );
+    }
+#endif
+
+#if defined(MBEDTLS_CHACHAPOLY_C)
+    if( todo.chachapoly )
+    {
+        mbedtls_chachapoly_context chachapoly;
+        mbedtls_chachapoly_init( &chachapoly );
+
+        memset( buf, 0, sizeof( buf ) );
+        memset( tmp, 0, sizeof( tmp ) );
+        mbedtls_chachapoly_setkey( &chachapoly, tmp );
+
+        TIME_AND_TSC( "ChaCha20-Poly1305",
+                mbedtls_chachapoly_encrypt_and_tag( &chachapoly, BUFSIZE, tmp,
+                    NULL, 0, buf, buf, tmp ) );
+
+        mbedtls_chachapoly_free( &chachapoly );
+    }
+#endif
+
 #if defined(MBEDTLS_HAVEGE_C)
     if( todo.havege )
     {
@@ -807,6 +966,58 @@ int main( int argc, char *argv[] )
     }
 #endif
 
+#if defined(MBEDTLS_TLS_MILAGRO_CS) && defined(MBEDTLS_SSL_CLI_C)
+    if( todo.milagro_cs )
+    {
+        mbedtls_milagro_cs_context milagro_cs;
+        char ms[PGS], token[2*PFS+1], seed[32];
+        char x[PGS], r[PGS], h[PGS], w_rand[PGS], w[2*PFS+1], key[PAS];
+        char g1[12*PFS], g2[12*PFS];
+        octet MS = { 0, sizeof( ms ), ms };
+        octet TOKEN = { 0, sizeof( token ), token };
+        octet SEED = { sizeof( seed ), sizeof( seed ), seed };
+        octet X = { 0, sizeof( x ), x };
+        octet R = { 0, sizeof( r ), r };
+        octet H = { sizeof( h ), sizeof( h ), h };
+        octet W_RAND = { 0, sizeof( w_rand ), w_rand };
+        octet W = { 0, sizeof( w ), w };
+        octet KEY = { 0, sizeof( key ), key };
+        octet G1 = { 0, sizeof( g1 ), g1 };
+        octet G2 = { 0, sizeof( g2 ), g2 };
+
+        mbedtls_ssl_milagro_cs_init( &milagro_cs );
+        myrand( NULL, (unsigned char *) seed, sizeof( seed ) );
+        myrand( NULL, (unsigned char *) h, sizeof( h ) );
+        MPIN_CREATE_CSPRNG( &milagro_cs.RNG, &SEED );
+        mbedtls_ssl_milagro_cs_set_client_identity( &milagro_cs, (char *) "client@miracl.com" );
+
+        /* Play the TA and the server once, only the client key is timed */
+        if( MPIN_RANDOM_GENERATE( &milagro_cs.RNG, &MS ) != 0 ||
+            MPIN_GET_CLIENT_SECRET( &MS, &milagro_cs.hash_client_id, &TOKEN ) != 0 ||
+            MPIN_RANDOM_GENERATE( &milagro_cs.RNG, &X ) != 0 ||
+            MPIN_RANDOM_GENERATE( &milagro_cs.RNG, &R ) != 0 ||
+            MPIN_GET_G1_MULTIPLE( &milagro_cs.RNG, 1, &W_RAND, &milagro_cs.hash_client_id, &W ) != 0 )
+        {
+            mbedtls_exit( 1 );
+        }
+        mbedtls_ssl_milagro_cs_set_secret( &milagro_cs, TOKEN.val, TOKEN.len );
+
+        TIME_PUBLIC( "MILAGRO_CS", "handshake",
+                ret |= MPIN_PRECOMPUTE( &milagro_cs.secret, &milagro_cs.hash_client_id,
+                                        &G1, &G2 );
+                ret |= MPIN_CLIENT_KEY( &G1, &G2, 0, &R, &X, &H, &W, &KEY ) );
+
+        if( mbedtls_ssl_milagro_cs_precompute( &milagro_cs ) != 0 )
+            mbedtls_exit( 1 );
+
+        TIME_PUBLIC( "MILAGRO_CS precomputed", "handshake",
+                ret |= MPIN_CLIENT_KEY( &milagro_cs.G1, &milagro_cs.G2, 0,
+                                        &R, &X, &H, &W, &KEY ) );
+
+        mbedtls_milagro_cs_free( &milagro_cs );
+    }
+#endif
+
     mbedtls_printf( "\n" );
 
 #if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
@@ -2901,6 +2901,366 @@ run_test    "Large packet TLS 1.2 AEAD shorter tag" \
             0 \
             -s "Read from client: 16384 bytes read"
 
+# Tests for ChaCha20-Poly1305 ciphersuites, with records around the 256 and
+# 512-byte SIMD block sizes and a full-size one
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: ECDHE-RSA" \
+            "$P_SRV" \
+            "$P_CLI force_ciphersuite=TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            0 \
+            -s "Ciphersuite is TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            -c "Ciphersuite is TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: ECDHE-ECDSA" \
+            "$P_SRV" \
+            "$P_CLI force_ciphersuite=TLS-ECDHE-ECDSA-WITH-CHACHA20-POLY1305-SHA256" \
+            0 \
+            -s "Ciphersuite is TLS-ECDHE-ECDSA-WITH-CHACHA20-POLY1305-SHA256" \
+            -c "Ciphersuite is TLS-ECDHE-ECDSA-WITH-CHACHA20-POLY1305-SHA256"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: DHE-RSA" \
+            "$P_SRV" \
+            "$P_CLI force_ciphersuite=TLS-DHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            0 \
+            -s "Ciphersuite is TLS-DHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            -c "Ciphersuite is TLS-DHE-RSA-WITH-CHACHA20-POLY1305-SHA256"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: PSK" \
+            "$P_SRV psk=abc123 psk_identity=foo" \
+            "$P_CLI force_ciphersuite=TLS-PSK-WITH-CHACHA20-POLY1305-SHA256 \
+             psk_identity=foo psk=abc123" \
+            0 \
+            -s "Ciphersuite is TLS-PSK-WITH-CHACHA20-POLY1305-SHA256" \
+            -c "Ciphersuite is TLS-PSK-WITH-CHACHA20-POLY1305-SHA256"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: ECDHE-PSK" \
+            "$P_SRV psk=abc123 psk_identity=foo" \
+            "$P_CLI force_ciphersuite=TLS-ECDHE-PSK-WITH-CHACHA20-POLY1305-SHA256 \
+             psk_identity=foo psk=abc123" \
+            0 \
+            -s "Ciphersuite is TLS-ECDHE-PSK-WITH-CHACHA20-POLY1305-SHA256" \
+            -c "Ciphersuite is TLS-ECDHE-PSK-WITH-CHACHA20-POLY1305-SHA256"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: 257-byte record" \
+            "$P_SRV" \
+            "$P_CLI request_size=257 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            0 \
+            -s "Read from client: 257 bytes read"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: 513-byte record" \
+            "$P_SRV" \
+            "$P_CLI request_size=513 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            0 \
+            -s "Read from client: 513 bytes read"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: large packet" \
+            "$P_SRV" \
+            "$P_CLI request_size=16384 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            0 \
+            -s "Read from client: 16384 bytes read"
+
+requires_config_enabled MBEDTLS_CHACHAPOLY_C
+run_test    "ChaCha20-Poly1305: DTLS" \
+            "$P_SRV dtls=1" \
+            "$P_CLI dtls=1 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            0 \
+            -s "Ciphersuite is TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256" \
+            -c "Ciphersuite is TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256"
+
+# Tests for variable-size record buffers: CBC records that fit in an idle-size
+# input buffer, up to the largest one, as the padding check reads past them
+
+requires_config_enabled MBEDTLS_SSL_VARIABLE_BUFFERS
+run_test    "Variable buffers: idle-size record TLS 1.0 BlockCipher" \
+            "$P_SRV" \
+            "$P_CLI request_size=987 force_version=tls1 recsplit=0 \
+             force_ciphersuite=TLS-RSA-WITH-AES-256-CBC-SHA" \
+            0 \
+            -s "Read from client: 987 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_VARIABLE_BUFFERS
+run_test    "Variable buffers: idle-size record TLS 1.2 BlockCipher" \
+            "$P_SRV" \
+            "$P_CLI request_size=959 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 959 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_VARIABLE_BUFFERS
+run_test    "Variable buffers: idle-size record TLS 1.2 BlockCipher larger MAC" \
+            "$P_SRV" \
+            "$P_CLI request_size=943 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-256-CBC-SHA384" \
+            0 \
+            -s "Read from client: 943 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_VARIABLE_BUFFERS
+run_test    "Variable buffers: small records TLS 1.2 BlockCipher" \
+            "$P_SRV" \
+            "$P_CLI request_size=1 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 1 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_VARIABLE_BUFFERS
+run_test    "Variable buffers: just too large record TLS 1.2 BlockCipher" \
+            "$P_SRV" \
+            "$P_CLI request_size=960 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 960 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_VARIABLE_BUFFERS
+run_test    "Variable buffers: largest record TLS 1.2 BlockCipher" \
+            "$P_SRV" \
+            "$P_CLI request_size=16384 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 16384 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_VARIABLE_BUFFERS
+requires_config_enabled MBEDTLS_SSL_BUFFER_POOL
+run_test    "Variable buffers: buffer pool, records of both sizes" \
+            "$P_SRV buffer_pool=1" \
+            "$P_CLI request_size=16384 reconnect=1 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 16384 bytes read" \
+            -s "Buffer pool: "
+
+# Tests for the record layer options: buffer pool, batched writes, read-ahead,
+# vectored writes and in-place reads, with stream and block ciphers
+
+requires_config_enabled MBEDTLS_SSL_BUFFER_POOL
+run_test    "Record layer: buffer pool AEAD" \
+            "$P_SRV buffer_pool=1" \
+            "$P_CLI request_size=16384 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256" \
+            0 \
+            -s "Read from client: 16384 bytes read" \
+            -s "Buffer pool: .* peak"
+
+requires_config_enabled MBEDTLS_SSL_BUFFER_POOL
+run_test    "Record layer: buffer pool TLS 1.2 BlockCipher" \
+            "$P_SRV buffer_pool=1" \
+            "$P_CLI request_size=16384 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 16384 bytes read" \
+            -s "Buffer pool: .* peak"
+
+requires_config_enabled MBEDTLS_SSL_BUFFER_POOL
+requires_config_enabled MBEDTLS_SSL_CBC_RECORD_SPLITTING
+run_test    "Record layer: buffer pool TLS 1.0 BlockCipher, reconnect" \
+            "$P_SRV buffer_pool=1" \
+            "$P_CLI request_size=1000 reconnect=1 force_version=tls1 \
+             force_ciphersuite=TLS-RSA-WITH-AES-256-CBC-SHA" \
+            0 \
+            -s "Read from client: 1 bytes read" \
+            -s "999 bytes read" \
+            -s "Buffer pool: .* peak" \
+            -c "Reconnecting with saved session... ok"
+
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: batched writes AEAD" \
+            "$P_SRV" \
+            "$P_CLI request_size=4000 max_frag_len=512 write_batch=8 debug_level=3 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256" \
+            0 \
+            -c "batched 8 records" \
+            -c "4000 bytes written in 1 fragments" \
+            -s "Read from client: 512 bytes read" \
+            -s "416 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: batched writes TLS 1.2 BlockCipher" \
+            "$P_SRV" \
+            "$P_CLI request_size=4000 max_frag_len=512 write_batch=8 debug_level=3 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -c "batched 8 records" \
+            -c "4000 bytes written in 1 fragments" \
+            -s "Read from client: 512 bytes read" \
+            -s "416 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+requires_config_enabled MBEDTLS_SSL_CBC_RECORD_SPLITTING
+run_test    "Record layer: batched writes TLS 1.0 BlockCipher" \
+            "$P_SRV" \
+            "$P_CLI request_size=4000 max_frag_len=512 write_batch=8 debug_level=3 \
+             force_version=tls1 force_ciphersuite=TLS-RSA-WITH-AES-256-CBC-SHA" \
+            0 \
+            -c "batched .* records" \
+            -s "Read from client: 1 bytes read" \
+            -s "415 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: batched writes disabled" \
+            "$P_SRV" \
+            "$P_CLI request_size=4000 max_frag_len=512 write_batch=1 debug_level=3 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -C "batched .* records" \
+            -c "4000 bytes written in 8 fragments" \
+            -s "416 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_READ_AHEAD
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: read-ahead AEAD" \
+            "$P_SRV read_ahead=16384 debug_level=2" \
+            "$P_CLI request_size=4000 max_frag_len=512 write_batch=8 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256" \
+            0 \
+            -s "taking .* bytes read ahead" \
+            -s "512 bytes read" \
+            -s "416 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_READ_AHEAD
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: read-ahead TLS 1.2 BlockCipher" \
+            "$P_SRV read_ahead=16384 debug_level=2" \
+            "$P_CLI request_size=4000 max_frag_len=512 write_batch=8 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "taking .* bytes read ahead" \
+            -s "512 bytes read" \
+            -s "416 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_READ_AHEAD
+run_test    "Record layer: read-ahead smaller than the records" \
+            "$P_SRV read_ahead=100 debug_level=2" \
+            "$P_CLI request_size=16384 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "16384 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_READ_AHEAD
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: read-ahead disabled" \
+            "$P_SRV read_ahead=0 debug_level=2" \
+            "$P_CLI request_size=4000 max_frag_len=512 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -S "bytes read ahead" \
+            -s "416 bytes read"
+
+run_test    "Record layer: writev AEAD" \
+            "$P_SRV writev=1 debug_level=2" \
+            "$P_CLI request_size=16384 writev=1 debug_level=2 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256" \
+            0 \
+            -c "=> writev" \
+            -s "=> writev" \
+            -s "16384 bytes read" \
+            -c "HTTP/1.0 200 OK"
+
+run_test    "Record layer: writev TLS 1.2 BlockCipher" \
+            "$P_SRV writev=1 debug_level=2" \
+            "$P_CLI request_size=16384 writev=1 debug_level=2 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -c "=> writev" \
+            -s "=> writev" \
+            -s "16384 bytes read" \
+            -c "HTTP/1.0 200 OK"
+
+requires_config_enabled MBEDTLS_SSL_CBC_RECORD_SPLITTING
+run_test    "Record layer: writev TLS 1.0 BlockCipher" \
+            "$P_SRV writev=1" \
+            "$P_CLI request_size=16384 writev=1 debug_level=2 force_version=tls1 \
+             force_ciphersuite=TLS-RSA-WITH-AES-256-CBC-SHA" \
+            0 \
+            -c "=> writev" \
+            -s "Read from client: 1 bytes read" \
+            -s "16383 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: writev non-blocking, small records" \
+            "$P_SRV writev=1 nbio=2" \
+            "$P_CLI request_size=4000 writev=1 nbio=2 max_frag_len=512 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 512 bytes read" \
+            -s "416 bytes read" \
+            -c "Read from server: .* bytes read"
+
+run_test    "Record layer: in-place read AEAD" \
+            "$P_SRV read_inplace=1 debug_level=2" \
+            "$P_CLI request_size=16384 read_inplace=1 debug_level=2 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256" \
+            0 \
+            -s "=> read inplace" \
+            -c "=> read inplace" \
+            -s "16384 bytes read" \
+            -c "HTTP/1.0 200 OK"
+
+run_test    "Record layer: in-place read TLS 1.2 BlockCipher" \
+            "$P_SRV read_inplace=1 debug_level=2" \
+            "$P_CLI request_size=16384 read_inplace=1 debug_level=2 \
+             force_version=tls1_2 force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "=> read inplace" \
+            -c "=> read inplace" \
+            -s "16384 bytes read" \
+            -c "HTTP/1.0 200 OK"
+
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+requires_config_enabled MBEDTLS_SSL_CBC_RECORD_SPLITTING
+run_test    "Record layer: in-place read TLS 1.0 BlockCipher, small records" \
+            "$P_SRV read_inplace=1" \
+            "$P_CLI request_size=4000 max_frag_len=512 force_version=tls1 \
+             force_ciphersuite=TLS-RSA-WITH-AES-256-CBC-SHA" \
+            0 \
+            -s "Read from client: 1 bytes read" \
+            -s "512 bytes read"
+
+requires_config_enabled MBEDTLS_SSL_BUFFER_POOL
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_READ_AHEAD
+requires_config_enabled MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+run_test    "Record layer: all options TLS 1.2 BlockCipher" \
+            "$P_SRV buffer_pool=1 read_ahead=4096 read_inplace=1 writev=1" \
+            "$P_CLI request_size=4000 max_frag_len=512 write_batch=3 writev=1 \
+             read_inplace=1 read_ahead=4096 reconnect=1 force_version=tls1_2 \
+             force_ciphersuite=TLS-ECDHE-RSA-WITH-AES-128-CBC-SHA256" \
+            0 \
+            -s "Read from client: 512 bytes read" \
+            -s "416 bytes read" \
+            -s "Buffer pool: .* peak" \
+            -c "Reconnecting with saved session... ok"
+
+requires_config_enabled MBEDTLS_SSL_BUFFER_POOL
+requires_config_enabled MBEDTLS_SSL_WRITE_BATCH
+requires_config_enabled MBEDTLS_SSL_READ_AHEAD
+requires_config_enabled MBEDTLS_SSL_CBC_RECORD_SPLITTING
+run_test    "Record layer: all options TLS 1.0 BlockCipher, non-blocking" \
+            "$P_SRV buffer_pool=1 read_ahead=4096 read_inplace=1 writev=1 nbio=2" \
+            "$P_CLI request_size=16384 write_batch=3 writev=1 read_inplace=1 \
+             read_ahead=4096 nbio=2 force_version=tls1 \
+             force_ciphersuite=TLS-RSA-WITH-AES-256-CBC-SHA" \
+            0 \
+            -s "Read from client: 1 bytes read" \
+            -s "16383 bytes read" \
+            -s "Buffer pool: .* peak"
+
 # Tests for DTLS HelloVerifyRequest
 
 run_test    "DTLS cookie: enabled" \